@@ -50,6 +50,7 @@ int ClayEngine::ProcessWSALastError()
 struct ClayEngine::AsyncListenServerModule::AcceptSocketData
 {
     OVERLAPPED Overlapped;
+    ListenOperation Operation = ListenOperation::Accept; // Second like in ListenOverlapped
     SOCKET Socket = INVALID_SOCKET;
     CHAR* Buffer = NULL;
     DWORD BufferLength = 0;
@@ -157,7 +158,18 @@ void ClayEngine::AsyncListenServerFunctor::operator()(FUTURE future, AsyncListen
         DWORD bytesTransferred;
         ULONG_PTR completionKey; // I expect this to be the handle to the listen queue
         LPOVERLAPPED overlapped; // Should == opData
-        if (GetQueuedCompletionStatus(context->GetListenQueue(), &bytesTransferred, &completionKey, &overlapped, INFINITE))
+        BOOL completed = FALSE;
+        while (true)
+        {
+            completed = GetQueuedCompletionStatus(context->GetListenQueue(), &bytesTransferred, &completionKey, &overlapped, INFINITE);
+            auto error = completed ? ERROR_SUCCESS : GetLastError();
+
+            // Close watches on accepted sockets complete here as well, hand them on and keep waiting for the accept
+            if (!overlapped || reinterpret_cast<ListenOverlapped*>(overlapped)->Operation != ListenOperation::Watch) break;
+            context->CompleteClientWatch(overlapped, error);
+        }
+
+        if (completed)
         {
             // Cast the overlapped structure back to AcceptSocketData to retrieve connection details
             auto completedOpData = reinterpret_cast<AsyncListenServerModule::AcceptSocketData*>(overlapped);
@@ -220,7 +232,7 @@ void ClayEngine::AsyncListenServerFunctor::operator()(FUTURE future, AsyncListen
 
             // Create ClientConnectionData to handle the newly accepted client
 			auto remoteAddrIn = reinterpret_cast<SOCKADDR_IN*>(remoteAddr);
-            context->MakeClientConnectionData(completedOpData->Socket, localAddr, remoteAddrIn);
+            context->MakeClientConnectionData(completedOpData->Socket, localAddr, remoteAddrIn, clientGuid, serverGuid);
 
             isAcceptDataReady = false;
         }
@@ -382,9 +394,14 @@ void ClayEngine::AsyncListenServerModule::FreeAcceptSocketData(AcceptSocketData*
     m_accept_sockets.erase(std::remove_if(m_accept_sockets.begin(), m_accept_sockets.end(), [acceptSocketData](const AcceptSocketDataPtr& pAcceptSocketData) { return acceptSocketData == pAcceptSocketData.get(); }), m_accept_sockets.end());
 }
 
-void ClayEngine::AsyncListenServerModule::MakeClientConnectionData(SOCKET socket, SOCKADDR* local, SOCKADDR_IN* remote)
+void ClayEngine::AsyncListenServerModule::MakeClientConnectionData(SOCKET socket, SOCKADDR* local, SOCKADDR_IN* remote, GUID clientGuid, GUID serverGuid)
+{
+    m_ans->MakeClientConnectionData(socket, local, remote, clientGuid, serverGuid);
+}
+
+void ClayEngine::AsyncListenServerModule::CompleteClientWatch(OVERLAPPED* overlapped, DWORD error)
 {
-    m_ans->MakeClientConnectionData(socket, local, remote);
+    m_ans->CompleteClientWatch(overlapped, error);
 }
 #pragma endregion
 
@@ -424,6 +441,18 @@ ClayEngine::AsyncNetworkSystem::ClientConnectionData::~ClientConnectionData()
 {
     if (Socket) closesocket(Socket);
 }
+
+/// <summary>
+/// A zero byte receive pending on a client socket. It only holds the handle, so it may complete after
+/// the connection has been freed (closing the socket aborts it) and is deleted by its completion, or by
+/// ~AsyncNetworkSystem when the listen workers stopped before it came back.
+/// </summary>
+struct ClayEngine::AsyncNetworkSystem::ClientConnectionWatch
+{
+    OVERLAPPED Overlapped = {};
+    ListenOperation Operation = ListenOperation::Watch; // Second like in ListenOverlapped
+    ConnectionHandle Connection = 0;
+};
 #pragma endregion
 
 #pragma region Async Network System Implementation
@@ -475,24 +504,110 @@ ClayEngine::AsyncNetworkSystem::AsyncNetworkSystem(AffinityData affinityData, Un
 
 ClayEngine::AsyncNetworkSystem::~AsyncNetworkSystem()
 {
-    for (auto& element : m_client_connections)
-    {
-        element.reset();
-    }
-
+    // Stop the listen workers first, they accept new connections and post and complete their watches
     if (m_connect_client) m_connect_client.reset();
     if (m_listen_server) m_listen_server.reset();
 
+    m_client_connections.Clear();
+
+    // With the workers gone nothing is pinned, so this closes the retired sockets before WSACleanup
+    for (auto i = 0; i < 3; ++i) EpochCollect();
+
+    // Their sockets are closed, so the watches no completion came back for are no longer in use
+    for (auto watch : m_client_watches) delete watch;
+    m_client_watches.clear();
+
     WSACleanup();
 }
 
-void ClayEngine::AsyncNetworkSystem::MakeClientConnectionData(SOCKET socket, SOCKADDR* local, SOCKADDR_IN* remote)
+ClayEngine::ConnectionHandle ClayEngine::AsyncNetworkSystem::MakeClientConnectionData(SOCKET socket, SOCKADDR* local, SOCKADDR_IN* remote, GUID clientGuid, GUID serverGuid)
 {
-    LockGuard lock(m_client_connections_mutex);
+    auto client = ToConnectionGuid(clientGuid);
+    auto replacing = m_client_connections.FindClient(client) != 0;
+
+    // A client reconnecting under a GUID that is still connected has given up on the old connection,
+    // which may not have been seen to close yet, so its data (and socket) goes and the new one takes over
+    auto connection = m_client_connections.Replace(client, ToConnectionGuid(serverGuid), std::make_unique<ClientConnectionData>(socket, local, remote));
+
+    if (!connection) WriteLine(L"Refused Client Socket, server GUID already in use");
+    else if (replacing) WriteLine(L"Replaced Client Socket");
+    else WriteLine(L"Added Client Socket");
+
+    if (connection) watchClientConnection(connection);
+    return connection;
+}
+
+bool ClayEngine::AsyncNetworkSystem::FreeClientConnectionData(ConnectionHandle connection)
+{
+    // The socket closes once no worker can still be reading the connection
+    return m_client_connections.Remove(connection);
+}
 
-    WriteLine(L"Added Client Socket");
+void ClayEngine::AsyncNetworkSystem::watchClientConnection(ConnectionHandle connection)
+{
+    // Deleted by CompleteClientWatch, or by the destructor if the listen workers are gone first. Tracked
+    // before posting, the completion may be handled on another worker before WSARecv returns.
+    auto watch = new ClientConnectionWatch();
+    watch->Connection = connection;
+    {
+        LockGuard lock(m_client_watches_mutex);
+        m_client_watches.insert(watch);
+    }
+
+    // Pinned only while posting, the socket is closed through the epoch so it is open for the call
+    auto posted = false;
+    m_client_connections.Read(connection, [&](ClientConnectionData& data) {
+        // Completes when data arrives or the peer goes, without taking any data
+        WSABUF buffer = {};
+        DWORD flags = 0;
+        posted = WSARecv(data.Socket, &buffer, 1, nullptr, &flags, &watch->Overlapped, nullptr) == 0 || WSAGetLastError() == WSA_IO_PENDING;
+    });
+    if (posted) return;
+
+    {
+        LockGuard lock(m_client_watches_mutex);
+        m_client_watches.erase(watch);
+    }
+    delete watch;
+
+    if (FreeClientConnectionData(connection)) WriteLine(L"Removed Client Socket");
+}
+
+void ClayEngine::AsyncNetworkSystem::CompleteClientWatch(OVERLAPPED* overlapped, DWORD error)
+{
+    std::unique_ptr<ClientConnectionWatch> watch(reinterpret_cast<ClientConnectionWatch*>(overlapped));
+    {
+        LockGuard lock(m_client_watches_mutex);
+        m_client_watches.erase(watch.get());
+    }
+
+    // Pinned only to copy the socket out, the calls below must not hold reclamation up
+    auto socket = INVALID_SOCKET;
+    if (!m_client_connections.Read(watch->Connection, [&](ClientConnectionData& data) { socket = data.Socket; })) return; // Freed meanwhile
+
+    if (error == ERROR_SUCCESS)
+    {
+        // Data or an orderly close. Nothing else reads the socket, so no bytes waiting means the peer closed.
+        u_long available = 0;
+        if (ioctlsocket(socket, FIONREAD, &available) == 0 && available > 0)
+        {
+            // No control messages follow the GUID exchange yet, so the bytes are drained and dropped. Watching
+            // a socket with unread data would complete straight away. recv doesn't block for bytes FIONREAD counted.
+            char drain[c_ans_control_drain_length];
+            while (available > 0)
+            {
+                auto received = recv(socket, drain, static_cast<int>(std::min<u_long>(available, sizeof(drain))), 0);
+                if (received <= 0) break;
+                available -= static_cast<u_long>(received);
+            }
+
+            watchClientConnection(watch->Connection);
+            return;
+        }
+    }
 
-    m_client_connections.emplace_back(std::make_unique<ClientConnectionData>(socket, local, remote));
+    // Reset, aborted or closed. A connection already freed (or replaced) makes this a no-op.
+    if (FreeClientConnectionData(watch->Connection)) WriteLine(L"Removed Client Socket");
 }
 #pragma endregion
 
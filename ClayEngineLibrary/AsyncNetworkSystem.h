@@ -3,6 +3,11 @@
 #include "Strings.h"
 #include "Storage.h"
 #include "Services.h"
+#include "BufferPool.h"
+#include "ConnectionTable.h"
+#include "ChatFraming.h"
+
+#include <unordered_set>
 
 namespace ClayEngine
 {
@@ -16,6 +21,8 @@ namespace ClayEngine
 	constexpr auto c_ans_bulk_workers = 8UL; // TCP, UNSPEC, 4096KiB, 19742/52/62/72/etc...
 	constexpr auto c_ans_vector_workers = 16UL; // UDP, UNSPEC, 64KiB, 19743/53/63/73/etc...
 
+	constexpr auto c_ans_control_drain_length = 256UL; // Stack buffer control bytes are drained through, see CompleteClientWatch
+
 	constexpr auto c_ans_socket_backlog = SOMAXCONN;
 	constexpr auto c_ans_hints_flags = AI_PASSIVE;
 	constexpr auto c_ans_hints_family = AF_UNSPEC;
@@ -31,6 +38,14 @@ namespace ClayEngine
 	constexpr DWORD c_guid_length = sizeof(GUID);
 	constexpr DWORD c_address_length = sizeof(SOCKADDR_IN) + 16;
 
+	static_assert(sizeof(GUID) == sizeof(ConnectionGuid), "ConnectionGuid must hold a GUID");
+	inline ConnectionGuid ToConnectionGuid(const GUID& guid)
+	{
+		ConnectionGuid key = {};
+		ClayMemCopy(&key, &guid, sizeof(GUID));
+		return key;
+	}
+
 
 	/// <summary>
 	/// 
@@ -74,6 +89,24 @@ namespace ClayEngine
 	constexpr DWORD c_listen_local_addr_length = sizeof(SOCKADDR_IN) + 16;
 	constexpr DWORD c_listen_remote_addr_length = sizeof(SOCKADDR_IN) + 16;
 
+	/// <summary>
+	/// Accepted sockets stay on the listen queue, so the close watches posted on them complete there too
+	/// </summary>
+	enum class ListenOperation
+	{
+		Accept,
+		Watch,
+	};
+
+	/// <summary>
+	/// Leading members of everything completing on the listen queue, Operation tells them apart
+	/// </summary>
+	struct ListenOverlapped
+	{
+		OVERLAPPED Overlapped;
+		ListenOperation Operation;
+	};
+
 	struct AsyncListenServerWorker;
 	using AsyncListenServerWorkers = std::vector<AsyncListenServerWorker>;
 	
@@ -124,7 +157,8 @@ namespace ClayEngine
 		const LPFN_ACCEPTEX GetAcceptExFunction() const { return m_fnAcceptEx; }
 		const LPFN_GETACCEPTEXSOCKADDRS GetAcceptExSockAddrsFunction() const { return m_fnGetAcceptExSockAddrs; }
 
-		void MakeClientConnectionData(SOCKET socket, SOCKADDR* local, SOCKADDR_IN* remote);
+		void MakeClientConnectionData(SOCKET socket, SOCKADDR* local, SOCKADDR_IN* remote, GUID clientGuid, GUID serverGuid);
+		void CompleteClientWatch(OVERLAPPED* overlapped, DWORD error);
 	};
 	using AsyncListenServerModulePtr = std::unique_ptr<AsyncListenServerModule>;
 	#pragma endregion
@@ -205,6 +239,11 @@ namespace ClayEngine
 		void operator()(FUTURE future, AsyncChatDataServerModule* context);
 	};
 
+	/// <summary>
+	/// Chat channel. On the wire every message is a frame: a varint (LEB128) length, then a
+	/// ChatMessageType byte and the payload, the length counting both, see ChatFraming.h. This module
+	/// doesn't receive yet; ReactorServerModule parses chat into frames, see ReactorServerHandler::OnChatFrame.
+	/// </summary>
 	class AsyncChatDataServerModule
 	{
 
@@ -223,7 +262,8 @@ namespace ClayEngine
 	public:
 		struct ClientConnectionData;
 		using ClientConnectionDataPtr = std::unique_ptr<ClientConnectionData>;
-		using ClientConnectionsData = std::vector<ClientConnectionDataPtr>;
+		using ClientConnectionsData = ConnectionTable<ClientConnectionData>;
+		struct ClientConnectionWatch;
 
 	private:
 		AffinityData m_affinity_data = {};
@@ -236,18 +276,32 @@ namespace ClayEngine
 		AsyncListenServerModulePtr m_listen_server = nullptr;
 		//AsyncDataTransferModulePtr m_data_transfer = nullptr;
 
-		// Used by Server and Headless to manage client socket lifetime
-		MUTEX m_client_connections_mutex = {};
+		// Used by Server and Headless to manage client socket lifetime, looked up by client or server GUID
 		ClientConnectionsData m_client_connections = {};
 
 		// Instantiated for Client configuration
 		ConnectClientModulePtr m_connect_client = nullptr;
 
+		// Posted close watches, the destructor deletes those whose completion was never dequeued
+		MUTEX m_client_watches_mutex = {};
+		std::unordered_set<ClientConnectionWatch*> m_client_watches = {};
+
+		void watchClientConnection(ConnectionHandle connection);
+
 	public:
 		AsyncNetworkSystem(AffinityData affinityData, Unicode className, Document document);
 		~AsyncNetworkSystem();
 
-		void MakeClientConnectionData(SOCKET socket, SOCKADDR* local, SOCKADDR_IN* remote);
+		ConnectionHandle MakeClientConnectionData(SOCKET socket, SOCKADDR* local, SOCKADDR_IN* remote, GUID clientGuid, GUID serverGuid);
+		bool FreeClientConnectionData(ConnectionHandle connection);
+		/// <summary>
+		/// Called by the listen workers when a client's close watch completes, frees the connection when
+		/// its socket closed or failed and otherwise drains the control bytes and watches it again
+		/// </summary>
+		void CompleteClientWatch(OVERLAPPED* overlapped, DWORD error);
+
+		ConnectionHandle FindClientConnection(GUID clientGuid) const { return m_client_connections.FindClient(ToConnectionGuid(clientGuid)); }
+		ConnectionHandle FindServerConnection(GUID serverGuid) const { return m_client_connections.FindServer(ToConnectionGuid(serverGuid)); }
 
 	};
 	using AsyncNetworkSystemPtr = std::unique_ptr<AsyncNetworkSystem>;
@@ -283,7 +337,7 @@ namespace Experimental
 	class AsyncBufferData;
 
 	// RAII compliant-buffer and client connection data
-	struct ClientConnectionData							// 260 + B
+	struct ClientConnectionData							// 264 + ring
 	{
 		OVERLAPPED Overlapped;							//  32 = 32
 		GUID ClientGUID = {};							//  16 = 48
@@ -313,26 +367,20 @@ namespace Experimental
 		SOCKADDR_IN LocalVectorSockAddr = {};			//  16 = 240
 		SOCKADDR_IN RemoteVectorSockAddr = {};			//  16 = 256
 
-		DWORD Length = 0;								//   4 = 260
-		CHAR* Buffer = nullptr;							//   B - Buffer
+		// Chat socket receive ring, WSARecv into GetWriteData and frames are parsed out in place. bufferLength is
+		// only where it starts, it grows to fit the frames the client sends.
+		ClayEngine::ChatFrameReaderPtr ChatReceive = nullptr;	//   8 = 264
 
-		ClientConnectionData(DWORD bufferLength, GUID clientGuid) : ClientGUID(clientGuid), Length(bufferLength)
+		ClientConnectionData(DWORD bufferLength, GUID clientGuid) : ClientGUID(clientGuid)
 		{
 			std::lock_guard lock(m_mutex);
 
 			ClayMemZero(&Overlapped, sizeof(OVERLAPPED));
 			if (FAILED(CoCreateGuid(&ServerGUID))) throw;
 
-			if (Length > 0)
-			{
-				Buffer = new CHAR[Length];
-				ClayMemZero(&Buffer, sizeof(Length));
-			}
-		}
-		~ClientConnectionData()
-		{
-			delete[] Buffer;
+			if (bufferLength > 0) ChatReceive = std::make_unique<ClayEngine::ChatFrameReader>(bufferLength);
 		}
+		~ClientConnectionData() = default;
 
 	private:
 		std::mutex m_mutex;
@@ -340,157 +388,174 @@ namespace Experimental
 	using ClientConnectionDataPtr = std::unique_ptr<ClientConnectionData>;
 	using ClientConnectionsData = std::vector<ClientConnectionDataPtr>;
 
-	// Per operation data object
+	// Per operation data object, the buffer comes from the AsyncBufferManager's pool
 	class AsyncBufferData
 	{
 		std::mutex m_mutex;
 
-		SOCKET m_socket;
-		HANDLE m_port;
+		SOCKET m_socket = INVALID_SOCKET;
+		HANDLE m_port = INVALID_HANDLE_VALUE;
 
-		DWORD m_operation;
+		DWORD m_operation = 0;
 
-		DWORD m_length = 0;
-		CHAR* m_buffer = nullptr;
+		ClayEngine::BufferHandle m_buffer = {};
 
 	public:
-		AsyncBufferData(SOCKET socket, HANDLE port, DWORD length) : m_socket(socket), m_port(port), m_length(length)
+		AsyncBufferData() = default;
+		~AsyncBufferData() = default;
+
+		void Reset(SOCKET socket, HANDLE port, ClayEngine::BufferHandle buffer)
 		{
 			std::lock_guard lock(m_mutex);
 
-			if (m_length > 0)
-			{
-				m_buffer = new CHAR[m_length];
-				ClayMemZero(&m_buffer, sizeof(m_length));
-			}
-		}
-		~AsyncBufferData()
-		{
-			delete[] m_buffer;
+			m_socket = socket;
+			m_port = port;
+			m_operation = 0;
+			m_buffer = std::move(buffer);
 		}
 
-		DWORD GetLength() { return m_length; }
-		CHAR* GetBuffer() { return m_buffer; }
+		DWORD GetLength() { return static_cast<DWORD>(m_buffer.GetLength()); }
+		CHAR* GetBuffer() { return reinterpret_cast<CHAR*>(m_buffer.GetData()); }
 
-		void SetBuffer(CHAR* buffer, DWORD length)
+		/// <summary>
+		/// Copies length bytes in, which must fit the block the buffer was taken with
+		/// </summary>
+		bool SetBuffer(CHAR* buffer, DWORD length)
 		{
 			std::lock_guard lock(m_mutex);
 
-			if (m_length != length)
-			{
-				delete[] m_buffer;
-				m_length = length;
-				m_buffer = new CHAR[m_length];
-			}
-			ClayMemCopy(m_buffer, buffer, m_length);
+			if (length > m_buffer.GetCapacity()) return false;
+			ClayMemCopy(m_buffer.GetData(), buffer, length);
+			return true;
 		}
 
+		void ReleaseBuffer()
+		{
+			std::lock_guard lock(m_mutex);
+			m_buffer.Release();
+		}
 	};
 	using AsyncBufferDataPtr = std::unique_ptr<AsyncBufferData>;
 	using AsyncBuffersData = std::vector<AsyncBufferDataPtr>;
 
+	/// <summary>
+	/// Hands out per operation data with a buffer from a size class pool. Operation objects go back on
+	/// a look-aside list when freed and buffers go back to the pool, so a warmed up server does no heap
+	/// allocation per packet.
+	/// </summary>
 	class AsyncBufferManager
 	{
-		AsyncBuffersData m_buffers = {};
+		ClayEngine::BufferPool m_pool = {};
 
-		// map ptr, free - look aside list
+		std::mutex m_mutex;
+		AsyncBuffersData m_buffers = {}; // Every operation object ever made
+		std::vector<AsyncBufferData*> m_free = {}; // Look-aside list
 
 	public:
 		AsyncBufferManager() = default;
 		~AsyncBufferManager() = default;
 
-		AsyncBufferData* MakeAsyncBufferData(DWORD bufferLength)
-		{
-			m_buffers.emplace_back(std::make_unique<AsyncBufferData>(bufferLength));
-			return m_buffers.back().get();
-		}
-
-		CHAR* GetBuffer(DWORD bufferLength)
+		AsyncBufferData* MakeAsyncBufferData(SOCKET socket, HANDLE port, DWORD bufferLength)
 		{
-			for (auto& element : m_buffers)
+			AsyncBufferData* data = nullptr;
 			{
-				if (element->GetLength() == bufferLength)
+				std::lock_guard lock(m_mutex);
+
+				if (m_free.empty())
+				{
+					m_buffers.emplace_back(std::make_unique<AsyncBufferData>());
+					m_free.reserve(m_buffers.size());
+					data = m_buffers.back().get();
+				}
+				else
 				{
-					return element->GetBuffer();
+					data = m_free.back();
+					m_free.pop_back();
 				}
 			}
-			return nullptr;
+
+			data->Reset(socket, port, m_pool.Acquire(bufferLength));
+			return data;
+		}
+
+		void FreeAsyncBufferData(AsyncBufferData* data)
+		{
+			data->ReleaseBuffer();
+
+			std::lock_guard lock(m_mutex);
+			m_free.push_back(data);
 		}
 
-		// free buffer
+		/// <summary>
+		/// Buffer of at least bufferLength bytes, back to the pool when the handle goes
+		/// </summary>
+		ClayEngine::BufferHandle GetBuffer(DWORD bufferLength)
+		{
+			return m_pool.Acquire(bufferLength);
+		}
 
+		/// <summary>
+		/// Takes the slabs for count buffers of bufferLength up front, before the first client connects
+		/// </summary>
+		void Reserve(DWORD bufferLength, size_t count)
+		{
+			m_pool.Reserve(bufferLength, count);
+		}
+
+		ClayEngine::BufferPoolStatistics GetStatistics()
+		{
+			return m_pool.GetStatistics();
+		}
 	};
 	using AsyncBufferManagerPtr = std::unique_ptr<AsyncBufferManager>;
 
 	class ConnectedClientManager
 	{
-		ClientConnectionsData m_client_connections = {};
+		ClayEngine::ConnectionTable<ClientConnectionData> m_client_connections = {};
+
+		/// <summary>
+		/// Copies a socket out of the client's connection data, INVALID_SOCKET when it is not connected
+		/// </summary>
+		template<typename Member>
+		SOCKET getSocket(GUID client, Member member)
+		{
+			auto socket = INVALID_SOCKET;
+			m_client_connections.ReadClient(ClayEngine::ToConnectionGuid(client), [&](ClientConnectionData& data) { socket = data.*member; });
+			return socket;
+		}
 
 	public:
 		ConnectedClientManager() = default;
 		~ConnectedClientManager() = default;
 
-		ClientConnectionData* MakeClientConnectionData(DWORD bufferLength, GUID clientGuid)
+		/// <summary>
+		/// Adds a client, the handle stays valid until RemoveClientConnectionData. A client GUID that is
+		/// still connected belonged to a connection the client has given up on, so that one is replaced.
+		/// </summary>
+		ClayEngine::ConnectionHandle MakeClientConnectionData(DWORD bufferLength, GUID clientGuid)
 		{
-			m_client_connections.emplace_back(std::make_unique<ClientConnectionData>(bufferLength, clientGuid));
-			return m_client_connections.back().get();
+			auto data = std::make_unique<ClientConnectionData>(bufferLength, clientGuid);
+			auto server = ClayEngine::ToConnectionGuid(data->ServerGUID);
+			return m_client_connections.Replace(ClayEngine::ToConnectionGuid(clientGuid), server, std::move(data));
 		}
 
-		std::tuple<SOCKET, SOCKET, SOCKET, SOCKET> GetSockets(GUID client)
-		{
-			for (auto& element : m_client_connections)
-			{
-				if (element->ClientGUID == client)
-				{
-					return std::make_tuple(element->ControlSocket, element->ChatSocket, element->DataSocket, element->VectorSocket);
-				}
-			}
-			return std::make_tuple(INVALID_SOCKET, INVALID_SOCKET, INVALID_SOCKET, INVALID_SOCKET);
-		}
-		SOCKET GetClientControlSocket(GUID client)
+		bool RemoveClientConnectionData(GUID client)
 		{
-			for (auto& element : m_client_connections)
-			{
-				if (element->ClientGUID == client)
-				{
-					return element->ControlSocket;
-				}
-			}
-			return 0;
-		}
-		SOCKET GetClientChatSocket(GUID client)
-		{
-			for (auto& element : m_client_connections)
-			{
-				if (element->ClientGUID == client)
-				{
-					return element->ChatSocket;
-				}
-			}
-			return 0;
-		}
-		SOCKET GetClientDataSocket(GUID client)
-		{
-			for (auto& element : m_client_connections)
-			{
-				if (element->ClientGUID == client)
-				{
-					return element->DataSocket;
-				}
-			}
-			return 0;
+			return m_client_connections.Remove(m_client_connections.FindClient(ClayEngine::ToConnectionGuid(client)));
 		}
-		SOCKET GetClientVectorSocket(GUID client)
+
+		std::tuple<SOCKET, SOCKET, SOCKET, SOCKET> GetSockets(GUID client)
 		{
-			for (auto& element : m_client_connections)
-			{
-				if (element->ClientGUID == client)
-				{
-					return element->VectorSocket;
-				}
-			}
-			return 0;
+			auto sockets = std::make_tuple(INVALID_SOCKET, INVALID_SOCKET, INVALID_SOCKET, INVALID_SOCKET);
+			m_client_connections.ReadClient(ClayEngine::ToConnectionGuid(client), [&](ClientConnectionData& data) {
+				sockets = std::make_tuple(data.ControlSocket, data.ChatSocket, data.DataSocket, data.VectorSocket);
+			});
+			return sockets;
 		}
+		SOCKET GetClientControlSocket(GUID client) { return getSocket(client, &ClientConnectionData::ControlSocket); }
+		SOCKET GetClientChatSocket(GUID client) { return getSocket(client, &ClientConnectionData::ChatSocket); }
+		SOCKET GetClientDataSocket(GUID client) { return getSocket(client, &ClientConnectionData::DataSocket); }
+		SOCKET GetClientVectorSocket(GUID client) { return getSocket(client, &ClientConnectionData::VectorSocket); }
 	};
 	using ConnectedClientManagerPtr = std::unique_ptr<ConnectedClientManager>;
 }
\ No newline at end of file
@@ -0,0 +1,23 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* Helpers shared by the Run...Benchmark functions                            */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <cstddef>
+#include <chrono>
+
+namespace ClayEngine
+{
+	/// <summary>
+	/// count over the elapsed time in seconds, 0 when no time was measured
+	/// </summary>
+	inline double PerSecond(size_t count, std::chrono::steady_clock::duration elapsed)
+	{
+		auto seconds = std::chrono::duration<double>(elapsed).count();
+		return seconds > 0. ? static_cast<double>(count) / seconds : 0.;
+	}
+}
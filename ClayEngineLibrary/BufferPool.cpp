@@ -0,0 +1,454 @@
+#include "pch.h"
+#include "BufferPool.h"
+#include "Strings.h"
+#include "Benchmark.h"
+
+using namespace ClayEngine;
+
+namespace
+{
+	constexpr uint32_t c_no_block{ 0xFFFFFFFFu };
+	constexpr size_t c_slab_alignment{ 64 };
+	constexpr auto c_bench_window{ 8 }; // Buffers each benchmark thread holds at once, like a socket's pending operations
+	constexpr auto c_bench_batch{ 1024 }; // Buffers handed to the next thread per round of the cross thread phase
+	constexpr std::array<size_t, 6> c_bench_lengths{ 16, 96, 512, 1400, 4096, 16384 };
+
+	/// <summary>
+	/// Statistics counters are only written by the thread owning them, so a plain load and store is
+	/// enough and the hot path never pays for a locked add
+	/// </summary>
+	inline void bump(std::atomic<uint64_t>& counter)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	/// <summary>
+	/// Next link of a free block, block number plus one so zero ends the list
+	/// </summary>
+	inline std::atomic<uint32_t>& link(uint8_t* block)
+	{
+		return *reinterpret_cast<std::atomic<uint32_t>*>(block);
+	}
+}
+
+#pragma region Buffer Pool Internal Declarations
+struct BufferPool::SizeClass
+{
+	alignas(c_slab_alignment) std::atomic<uint64_t> Head = 0; // Tag in the high half, top block number plus one in the low half
+
+	size_t BlockLength = 0;
+	uint32_t SlabShift = 0; // Blocks per slab as a power of two
+	uint32_t CacheCapacity = 0; // Blocks a thread cache may hold
+
+	MUTEX Mutex = {}; // Serializes carving new slabs
+	std::array<std::atomic<uint8_t*>, c_buffer_max_slabs> Slabs = {};
+	std::atomic<uint32_t> SlabCount = 0;
+
+	uint8_t* Block(uint32_t index) const
+	{
+		auto slab = Slabs[index >> SlabShift].load(std::memory_order_acquire);
+		return slab + (static_cast<size_t>(index & ((1u << SlabShift) - 1)) * BlockLength);
+	}
+
+	uint32_t Pop()
+	{
+		auto head = Head.load(std::memory_order_acquire);
+		while (true)
+		{
+			auto top = static_cast<uint32_t>(head);
+			if (top == 0) return c_no_block;
+
+			// Another thread may take the block first and scribble on it, the tag makes the exchange fail then
+			auto next = link(Block(top - 1)).load(std::memory_order_relaxed);
+			auto replacement = (((head >> 32) + 1) << 32) | next;
+			if (Head.compare_exchange_weak(head, replacement, std::memory_order_acq_rel, std::memory_order_acquire)) return top - 1;
+		}
+	}
+
+	/// <summary>
+	/// Pushes a chain of blocks already linked from first to last
+	/// </summary>
+	void Push(uint32_t first, uint32_t last)
+	{
+		auto head = Head.load(std::memory_order_relaxed);
+		uint64_t replacement = 0;
+		do
+		{
+			link(Block(last)).store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+			replacement = (((head >> 32) + 1) << 32) | (first + 1);
+		} while (!Head.compare_exchange_weak(head, replacement, std::memory_order_release, std::memory_order_relaxed));
+	}
+};
+
+/// <summary>
+/// Free blocks and counters of one thread, shared with the pool so the counters outlive the thread
+/// and the blocks are flushed to the shared lists when it exits. Pool is cleared under Mutex by
+/// whichever of the two goes first.
+/// </summary>
+struct BufferPool::ThreadCache
+{
+	struct Class
+	{
+		std::array<uint32_t, c_buffer_thread_cache> Blocks = {};
+		uint32_t Count = 0;
+
+		std::atomic<uint64_t> Hits = 0;
+		std::atomic<uint64_t> Misses = 0;
+		std::atomic<uint64_t> Acquired = 0;
+		std::atomic<uint64_t> Released = 0;
+	};
+
+	MUTEX Mutex = {};
+	std::atomic<BufferPool*> Pool = nullptr;
+	std::array<Class, c_buffer_classes> Classes = {};
+};
+#pragma endregion
+
+#pragma region Buffer Handle Implementation
+void BufferHandle::Release()
+{
+	if (!m_data) return;
+
+	m_pool->release(m_class, m_index);
+	m_pool = nullptr;
+	m_data = nullptr;
+}
+#pragma endregion
+
+#pragma region Buffer Pool Implementation
+BufferPool::BufferPool()
+{
+	m_classes = std::make_unique<SizeClass[]>(c_buffer_classes);
+
+	for (auto c = 0; c < c_buffer_classes; ++c)
+	{
+		auto& sizeClass = m_classes[c];
+		sizeClass.BlockLength = size_t(1) << (c + c_buffer_min_shift);
+
+		auto blocks = std::max<size_t>(1, c_buffer_slab_length / sizeClass.BlockLength);
+		while ((size_t(1) << sizeClass.SlabShift) < blocks) ++sizeClass.SlabShift;
+
+		sizeClass.CacheCapacity = static_cast<uint32_t>(std::clamp<size_t>(c_buffer_thread_cache_length / sizeClass.BlockLength, 1, c_buffer_thread_cache));
+	}
+}
+
+BufferPool::~BufferPool()
+{
+	{
+		LockGuard lock(m_caches_mutex);
+		for (auto& cache : m_caches)
+		{
+			LockGuard cacheLock(cache->Mutex);
+			cache->Pool.store(nullptr);
+		}
+	}
+
+	for (auto c = 0; c < c_buffer_classes; ++c)
+	{
+		auto& sizeClass = m_classes[c];
+		for (uint32_t s = 0; s < sizeClass.SlabCount.load(); ++s)
+			::operator delete(sizeClass.Slabs[s].load(), std::align_val_t{ c_slab_alignment });
+	}
+}
+
+BufferHandle BufferPool::Acquire(size_t length)
+{
+	if (length > c_buffer_max_length)
+	{
+		m_oversized.fetch_add(1, std::memory_order_relaxed);
+		return {};
+	}
+
+	auto sizeClass = GetSizeClass(length);
+	auto& cache = threadCache();
+	auto& local = cache.Classes[sizeClass];
+
+	uint32_t index = c_no_block;
+	if (local.Count > 0)
+	{
+		index = local.Blocks[--local.Count];
+		bump(local.Hits);
+	}
+	else index = refill(sizeClass, cache);
+
+	bump(local.Acquired);
+	return BufferHandle(this, m_classes[sizeClass].Block(index), index, static_cast<uint32_t>(length), sizeClass);
+}
+
+void BufferPool::Reserve(size_t length, size_t count)
+{
+	if (length > c_buffer_max_length) return;
+
+	auto sizeClass = GetSizeClass(length);
+	auto& element = m_classes[sizeClass];
+	while ((static_cast<size_t>(element.SlabCount.load()) << element.SlabShift) < count) carve(sizeClass, nullptr);
+}
+
+BufferPoolStatistics BufferPool::GetStatistics()
+{
+	BufferPoolStatistics statistics = {};
+	statistics.Oversized = m_oversized.load(std::memory_order_relaxed);
+
+	LockGuard lock(m_caches_mutex);
+	for (auto c = 0; c < c_buffer_classes; ++c)
+	{
+		auto& element = statistics.Classes[c];
+		element.BlockLength = m_classes[c].BlockLength;
+		element.HighWater = static_cast<size_t>(m_classes[c].SlabCount.load()) << m_classes[c].SlabShift;
+
+		for (auto& cache : m_caches)
+		{
+			auto& local = cache->Classes[c];
+			element.Hits += local.Hits.load(std::memory_order_relaxed);
+			element.Misses += local.Misses.load(std::memory_order_relaxed);
+			element.InUse += static_cast<int64_t>(local.Acquired.load(std::memory_order_relaxed) - local.Released.load(std::memory_order_relaxed));
+		}
+
+		statistics.Hits += element.Hits;
+		statistics.Misses += element.Misses;
+		statistics.InUseBytes += static_cast<size_t>(std::max<int64_t>(0, element.InUse)) * element.BlockLength;
+		statistics.HighWaterBytes += element.HighWater * element.BlockLength;
+	}
+
+	return statistics;
+}
+
+uint8_t BufferPool::GetSizeClass(size_t length)
+{
+	uint8_t sizeClass = 0;
+	while ((size_t(1) << (sizeClass + c_buffer_min_shift)) < length) ++sizeClass;
+	return sizeClass;
+}
+
+BufferPool::ThreadCache& BufferPool::threadCache()
+{
+	// Flushes the thread's caches into pools that are still alive when the thread exits
+	struct Owned
+	{
+		std::vector<ThreadCachePtr> Caches = {};
+
+		~Owned()
+		{
+			for (auto& cache : Caches)
+			{
+				LockGuard lock(cache->Mutex);
+				auto pool = cache->Pool.load();
+				if (pool) pool->flush(*cache);
+				cache->Pool.store(nullptr);
+			}
+		}
+	};
+
+	static thread_local ThreadCache* t_last = nullptr;
+	if (t_last && t_last->Pool.load(std::memory_order_relaxed) == this) return *t_last;
+
+	static thread_local Owned t_owned = {};
+	for (auto& cache : t_owned.Caches)
+	{
+		if (cache->Pool.load(std::memory_order_relaxed) == this)
+		{
+			t_last = cache.get();
+			return *t_last;
+		}
+	}
+
+	// First use of this pool on this thread, drop caches of pools destroyed since
+	t_owned.Caches.erase(std::remove_if(t_owned.Caches.begin(), t_owned.Caches.end(), [](const ThreadCachePtr& cache) { return cache->Pool.load() == nullptr; }), t_owned.Caches.end());
+
+	auto cache = std::make_shared<ThreadCache>();
+	cache->Pool.store(this);
+	{
+		LockGuard lock(m_caches_mutex);
+		m_caches.push_back(cache);
+	}
+
+	t_owned.Caches.push_back(cache);
+	t_last = cache.get();
+	return *t_last;
+}
+
+uint32_t BufferPool::refill(uint8_t sizeClass, ThreadCache& cache)
+{
+	auto& element = m_classes[sizeClass];
+	auto& local = cache.Classes[sizeClass];
+
+	// The first block goes to the caller, the cache fills to half so a run of releases doesn't spill at once
+	auto index = element.Pop();
+	if (index == c_no_block)
+	{
+		bump(local.Misses);
+		return carve(sizeClass, &cache);
+	}
+
+	bump(local.Hits);
+	auto target = std::max(1u, element.CacheCapacity / 2);
+	while (local.Count + 1 < target)
+	{
+		auto next = element.Pop();
+		if (next == c_no_block) break;
+		local.Blocks[local.Count++] = next;
+	}
+
+	return index;
+}
+
+uint32_t BufferPool::carve(uint8_t sizeClass, ThreadCache* cache)
+{
+	auto& element = m_classes[sizeClass];
+
+	uint32_t first = 0;
+	{
+		LockGuard lock(element.Mutex);
+
+		auto slab = element.SlabCount.load();
+		if (slab == c_buffer_max_slabs) throw std::runtime_error("ClayEngine::BufferPool slab limit reached");
+
+		auto data = static_cast<uint8_t*>(::operator new(element.BlockLength << element.SlabShift, std::align_val_t{ c_slab_alignment }));
+		element.Slabs[slab].store(data, std::memory_order_release);
+		element.SlabCount.store(slab + 1, std::memory_order_release);
+		first = slab << element.SlabShift;
+	}
+
+	auto end = first + (1u << element.SlabShift);
+	auto next = first;
+
+	// Reserve puts the whole slab on the shared list, Acquire keeps one block and fills its cache first
+	uint32_t index = c_no_block;
+	if (cache)
+	{
+		auto& local = cache->Classes[sizeClass];
+		index = next++;
+
+		auto target = std::max(1u, element.CacheCapacity / 2);
+		while (next < end && local.Count + 1 < target) local.Blocks[local.Count++] = next++;
+	}
+
+	if (next < end)
+	{
+		for (auto i = next; i + 1 < end; ++i) link(element.Block(i)).store(i + 2, std::memory_order_relaxed);
+		element.Push(next, end - 1);
+	}
+
+	return index;
+}
+
+void BufferPool::spill(uint8_t sizeClass, ThreadCache& cache, uint32_t count)
+{
+	auto& element = m_classes[sizeClass];
+	auto& local = cache.Classes[sizeClass];
+
+	// The oldest blocks go, the most recently released ones are the likeliest to still be in cache
+	for (uint32_t i = 0; i + 1 < count; ++i) link(element.Block(local.Blocks[i])).store(local.Blocks[i + 1] + 1, std::memory_order_relaxed);
+	element.Push(local.Blocks[0], local.Blocks[count - 1]);
+
+	std::copy(local.Blocks.begin() + count, local.Blocks.begin() + local.Count, local.Blocks.begin());
+	local.Count -= count;
+}
+
+void BufferPool::release(uint8_t sizeClass, uint32_t index)
+{
+	auto& cache = threadCache();
+	auto& local = cache.Classes[sizeClass];
+
+	auto capacity = m_classes[sizeClass].CacheCapacity;
+	if (local.Count == capacity) spill(sizeClass, cache, std::max(1u, capacity / 2));
+
+	local.Blocks[local.Count++] = index;
+	bump(local.Released);
+}
+
+void BufferPool::flush(ThreadCache& cache)
+{
+	for (uint8_t c = 0; c < c_buffer_classes; ++c)
+		if (cache.Classes[c].Count > 0) spill(c, cache, cache.Classes[c].Count);
+}
+#pragma endregion
+
+ClayEngine::BufferPoolBenchmark ClayEngine::RunBufferPoolBenchmark(size_t threadCount, size_t operationCount)
+{
+	BufferPoolBenchmark result = {};
+	result.ThreadCount = std::max<size_t>(1, threadCount);
+	result.OperationCount = operationCount;
+
+	auto runThreads = [&](const std::function<void(size_t thread)>& body) {
+		auto start = std::chrono::steady_clock::now();
+		std::vector<THREAD> threads;
+		for (size_t t = 0; t < result.ThreadCount; ++t) threads.emplace_back(body, t);
+		for (auto& element : threads) element.join();
+		return std::chrono::steady_clock::now() - start;
+	};
+	auto pairs = result.ThreadCount * operationCount;
+
+	// Heap, every packet gets a fresh array like AsyncBufferData does today
+	auto elapsed = runThreads([&](size_t thread) {
+		std::array<uint8_t*, c_bench_window> window = {};
+		for (size_t i = 0; i < operationCount; ++i)
+		{
+			auto& slot = window[i % c_bench_window];
+			delete[] slot;
+			slot = new uint8_t[c_bench_lengths[(i + thread) % c_bench_lengths.size()]];
+			slot[0] = static_cast<uint8_t>(i);
+		}
+		for (auto element : window) delete[] element;
+	});
+	result.HeapPairsPerSecond = PerSecond(pairs, elapsed);
+
+	auto pool = std::make_unique<BufferPool>();
+
+	elapsed = runThreads([&](size_t thread) {
+		std::array<BufferHandle, c_bench_window> window = {};
+		for (size_t i = 0; i < operationCount; ++i)
+		{
+			auto& slot = window[i % c_bench_window];
+			slot = pool->Acquire(c_bench_lengths[(i + thread) % c_bench_lengths.size()]);
+			slot.GetData()[0] = static_cast<uint8_t>(i);
+		}
+	});
+	result.PoolPairsPerSecond = PerSecond(pairs, elapsed);
+
+	// Cross thread, each round every thread fills a batch and then releases its neighbour's
+	std::vector<std::vector<BufferHandle>> batches(result.ThreadCount);
+	for (auto& batch : batches) batch.resize(c_bench_batch);
+
+	std::atomic<size_t> arrived = 0;
+	auto barrier = [&](size_t& generation) {
+		arrived.fetch_add(1);
+		++generation;
+		while (arrived.load() < generation * result.ThreadCount) std::this_thread::yield();
+	};
+
+	auto rounds = std::max<size_t>(1, operationCount / c_bench_batch);
+	elapsed = runThreads([&](size_t thread) {
+		size_t generation = 0;
+		auto& neighbour = batches[(thread + 1) % result.ThreadCount];
+		for (size_t r = 0; r < rounds; ++r)
+		{
+			for (size_t i = 0; i < c_bench_batch; ++i)
+				batches[thread][i] = pool->Acquire(c_bench_lengths[(i + r) % c_bench_lengths.size()]);
+			barrier(generation);
+
+			for (auto& element : neighbour) element.Release();
+			barrier(generation);
+		}
+	});
+	result.CrossThreadPairsPerSecond = PerSecond(result.ThreadCount * rounds * c_bench_batch, elapsed);
+
+	auto statistics = pool->GetStatistics();
+	result.HitRate = statistics.Hits + statistics.Misses > 0 ? static_cast<double>(statistics.Hits) / static_cast<double>(statistics.Hits + statistics.Misses) : 0.;
+	result.HighWaterBytes = statistics.HighWaterBytes;
+	for (auto& element : statistics.Classes)
+		if (element.InUse != 0) result.Leaks += static_cast<size_t>(std::abs(element.InUse));
+
+	std::wstringstream wss;
+	wss << std::fixed << std::setprecision(2)
+		<< L"BufferPool " << result.ThreadCount << L" threads"
+		<< L" | Heap " << result.HeapPairsPerSecond / 1e6 << L" M/sec"
+		<< L" | Pool " << result.PoolPairsPerSecond / 1e6 << L" M/sec"
+		<< L" | Cross thread " << result.CrossThreadPairsPerSecond / 1e6 << L" M/sec"
+		<< L" | Hit rate " << result.HitRate * 100. << L"%"
+		<< L" | High water " << result.HighWaterBytes / 1024 << L" KiB"
+		<< L" | Leaks " << result.Leaks;
+	WriteLine(wss.str());
+
+	return result;
+}
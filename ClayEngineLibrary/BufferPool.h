@@ -0,0 +1,188 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* Size class slab pool with per thread caches for network buffers            */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Services.h"
+
+namespace ClayEngine
+{
+	constexpr auto c_buffer_min_shift{ 6 }; // Smallest block is 64 bytes, one cache line
+	constexpr auto c_buffer_max_shift{ 22 }; // Largest block is 4 MiB, the bulk module's buffer
+	constexpr auto c_buffer_classes{ c_buffer_max_shift - c_buffer_min_shift + 1 };
+	constexpr size_t c_buffer_max_length{ size_t(1) << c_buffer_max_shift };
+	constexpr size_t c_buffer_slab_length{ 1024 * 1024 }; // Carved at once, or one block when blocks are larger
+	constexpr auto c_buffer_max_slabs{ 1024 }; // Per size class
+	constexpr auto c_buffer_thread_cache{ 32 }; // Most blocks a thread keeps per size class
+	constexpr size_t c_buffer_thread_cache_length{ 256 * 1024 }; // Most bytes a thread keeps per size class
+
+	class BufferPool;
+
+	/// <summary>
+	/// Block taken from a BufferPool, given back when the handle is destroyed or released. Move only,
+	/// and it must not outlive the pool.
+	/// </summary>
+	class BufferHandle
+	{
+		friend class BufferPool;
+
+		BufferPool* m_pool = nullptr;
+		uint8_t* m_data = nullptr;
+		uint32_t m_index = 0;
+		uint32_t m_length = 0;
+		uint8_t m_class = 0;
+
+		BufferHandle(BufferPool* pool, uint8_t* data, uint32_t index, uint32_t length, uint8_t sizeClass)
+			: m_pool(pool), m_data(data), m_index(index), m_length(length), m_class(sizeClass) {}
+
+	public:
+		BufferHandle() = default;
+		~BufferHandle() { Release(); }
+
+		BufferHandle(const BufferHandle&) = delete;
+		BufferHandle& operator=(const BufferHandle&) = delete;
+
+		BufferHandle(BufferHandle&& other) noexcept
+			: m_pool(other.m_pool), m_data(other.m_data), m_index(other.m_index), m_length(other.m_length), m_class(other.m_class)
+		{
+			other.m_pool = nullptr;
+			other.m_data = nullptr;
+		}
+		BufferHandle& operator=(BufferHandle&& other) noexcept
+		{
+			if (this != &other)
+			{
+				Release();
+				m_pool = other.m_pool;
+				m_data = other.m_data;
+				m_index = other.m_index;
+				m_length = other.m_length;
+				m_class = other.m_class;
+				other.m_pool = nullptr;
+				other.m_data = nullptr;
+			}
+			return *this;
+		}
+
+		/// <summary>
+		/// Gives the block back to its pool, on the calling thread's cache
+		/// </summary>
+		void Release();
+
+		uint8_t* GetData() const { return m_data; }
+		/// <summary>
+		/// Bytes asked for, the block itself is GetCapacity() bytes
+		/// </summary>
+		size_t GetLength() const { return m_length; }
+		size_t GetCapacity() const { return m_data ? size_t(1) << (m_class + c_buffer_min_shift) : 0; }
+
+		bool IsEmpty() const { return m_data == nullptr; }
+		explicit operator bool() const { return m_data != nullptr; }
+	};
+
+	struct BufferClassStatistics
+	{
+		size_t BlockLength = 0;
+		uint64_t Hits = 0; // Taken from a thread cache or the shared free list
+		uint64_t Misses = 0; // Needed a new slab
+		int64_t InUse = 0; // Blocks held by handles right now
+		size_t HighWater = 0; // Blocks carved, slabs are never given back so this only grows
+	};
+
+	struct BufferPoolStatistics
+	{
+		std::array<BufferClassStatistics, c_buffer_classes> Classes = {};
+		uint64_t Hits = 0;
+		uint64_t Misses = 0;
+		uint64_t Oversized = 0; // Requests over c_buffer_max_length, answered with an empty handle
+		size_t InUseBytes = 0;
+		size_t HighWaterBytes = 0;
+	};
+
+	/// <summary>
+	/// Power of two size classes from 64 bytes to 4 MiB, each carved out of 1 MiB slabs. A free block
+	/// holds the number of the next one in its first bytes, so the shared free list of a class is a
+	/// lock free stack of block numbers with a tag against ABA and costs no memory of its own. Every
+	/// thread keeps a small stack of free blocks per class in front of it: Acquire and Release only
+	/// touch the shared list when that stack runs empty or full, and then move half a stack at once.
+	/// Nothing is heap allocated once a thread has its cache and the classes it uses have slabs, so
+	/// Reserve ahead of time keeps the per packet path free of allocations. Blocks released on another
+	/// thread than the one that took them end up in that thread's cache, which is how they flow back.
+	/// </summary>
+	class BufferPool
+	{
+		friend class BufferHandle;
+
+		struct SizeClass;
+		struct ThreadCache;
+		using ThreadCachePtr = std::shared_ptr<ThreadCache>;
+
+		std::unique_ptr<SizeClass[]> m_classes; // No initializer, SizeClass is only complete in BufferPool.cpp
+
+		MUTEX m_caches_mutex = {};
+		std::vector<ThreadCachePtr> m_caches = {}; // Shared with the threads, which flush them when they exit
+		std::atomic<uint64_t> m_oversized = 0;
+
+		ThreadCache& threadCache();
+		uint32_t refill(uint8_t sizeClass, ThreadCache& cache);
+		uint32_t carve(uint8_t sizeClass, ThreadCache* cache);
+		void spill(uint8_t sizeClass, ThreadCache& cache, uint32_t count);
+		void release(uint8_t sizeClass, uint32_t index);
+		void flush(ThreadCache& cache);
+
+	public:
+		BufferPool();
+		~BufferPool();
+
+		BufferPool(const BufferPool&) = delete;
+		BufferPool& operator=(const BufferPool&) = delete;
+
+		/// <summary>
+		/// Block of at least length bytes, contents undefined. Empty when length is over c_buffer_max_length.
+		/// </summary>
+		BufferHandle Acquire(size_t length);
+
+		/// <summary>
+		/// Carves slabs until the class for length has count blocks, so the first count Acquires don't allocate
+		/// </summary>
+		void Reserve(size_t length, size_t count);
+
+		BufferPoolStatistics GetStatistics();
+
+		/// <summary>
+		/// Size class index for length, which must not be over c_buffer_max_length
+		/// </summary>
+		static uint8_t GetSizeClass(size_t length);
+	};
+	using BufferPoolPtr = std::unique_ptr<BufferPool>;
+	using BufferPoolRaw = BufferPool*;
+
+	struct BufferPoolBenchmark
+	{
+		size_t ThreadCount = 0;
+		size_t OperationCount = 0; // Acquire and release pairs per thread
+		double HeapPairsPerSecond = 0.; // new[] and delete[], what AsyncBufferData does
+		double PoolPairsPerSecond = 0.;
+		double CrossThreadPairsPerSecond = 0.; // Acquired on one thread, released on another
+		double HitRate = 0.;
+		size_t HighWaterBytes = 0;
+		size_t Leaks = 0; // Blocks still in use after every handle is gone, should be 0
+	};
+
+	/// <summary>
+	/// Runs threadCount threads each taking and releasing operationCount packet sized buffers from
+	/// the heap and from a BufferPool, then hands buffers between threads, and writes the pairs per
+	/// second and the pool's hit rate to the console
+	/// </summary>
+	BufferPoolBenchmark RunBufferPoolBenchmark(size_t threadCount = 4, size_t operationCount = 1u << 20);
+}
@@ -0,0 +1,344 @@
+#include "pch.h"
+#include "CellTable.h"
+#include "Strings.h"
+#include "Benchmark.h"
+
+#include <random>
+#include <unordered_map>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define CLAY_CELL_SSE2 1
+#else
+#define CLAY_CELL_SSE2 0
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+using namespace ClayEngine;
+
+namespace
+{
+	constexpr int8_t c_control_empty{ -128 };
+	constexpr int8_t c_control_deleted{ -2 }; // Full slots hold 0 to 127, so both marks have the sign bit set
+	constexpr auto c_no_slot{ std::numeric_limits<size_t>::max() };
+
+	/// <summary>
+	/// Bit i set when control byte i of the group equals value
+	/// </summary>
+	inline uint32_t matchGroup(const int8_t* group, int8_t value)
+	{
+#if CLAY_CELL_SSE2
+		auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+		return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(value))));
+#else
+		uint32_t mask = 0;
+		for (auto i = 0; i < c_cell_group_width; ++i)
+			if (group[i] == value) mask |= 1u << i;
+		return mask;
+#endif
+	}
+
+	/// <summary>
+	/// Bit i set when slot i of the group is empty or deleted
+	/// </summary>
+	inline uint32_t matchFree(const int8_t* group)
+	{
+#if CLAY_CELL_SSE2
+		return static_cast<uint32_t>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(group))));
+#else
+		uint32_t mask = 0;
+		for (auto i = 0; i < c_cell_group_width; ++i)
+			if (group[i] < 0) mask |= 1u << i;
+		return mask;
+#endif
+	}
+
+	inline int lowestBit(uint32_t mask)
+	{
+#if defined(_MSC_VER)
+		unsigned long index = 0;
+		_BitScanForward(&index, mask);
+		return static_cast<int>(index);
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+
+	inline int8_t controlByte(uint64_t hash) { return static_cast<int8_t>(hash & 0x7F); }
+	inline size_t firstGroup(uint64_t hash, size_t mask) { return static_cast<size_t>(hash >> 7) & mask; }
+
+	/// <summary>
+	/// Smallest power of two capacity, in whole groups, that keeps count slots at most 7/8 full
+	/// </summary>
+	size_t capacityFor(size_t count)
+	{
+		size_t capacity = c_cell_group_width;
+		while (capacity * 7 < count * 8) capacity *= 2;
+		return capacity;
+	}
+}
+
+#pragma region Cell Index Implementation
+uint64_t ClayEngine::CellIndex::Hash(uint64_t key)
+{
+	// Packed cell ids differ mostly in a few low bits of each coordinate, mix them all into the top and bottom
+	key ^= key >> 30;
+	key *= 0xBF58476D1CE4E5B9ull;
+	key ^= key >> 27;
+	key *= 0x94D049BB133111EBull;
+	key ^= key >> 31;
+	return key;
+}
+
+size_t ClayEngine::CellIndex::findSlot(uint64_t key, uint64_t hash) const
+{
+	if (m_control.empty()) return c_no_slot;
+
+	auto control = controlByte(hash);
+	auto group = firstGroup(hash, m_group_mask);
+	for (size_t step = 1;; ++step)
+	{
+		auto base = group * c_cell_group_width;
+		for (auto mask = matchGroup(&m_control[base], control); mask; mask &= mask - 1)
+		{
+			auto slot = base + lowestBit(mask);
+			if (m_keys[slot] == key) return slot;
+		}
+		if (matchGroup(&m_control[base], c_control_empty)) return c_no_slot;
+
+		// Triangular steps visit every group of a power of two table
+		group = (group + step) & m_group_mask;
+	}
+}
+
+void ClayEngine::CellIndex::rehash(size_t capacity)
+{
+	auto control = std::move(m_control);
+	auto keys = std::move(m_keys);
+	auto entries = std::move(m_entries);
+
+	m_control.assign(capacity, c_control_empty);
+	m_keys.assign(capacity, 0);
+	m_entries.assign(capacity, c_cell_none);
+	m_group_mask = capacity / c_cell_group_width - 1;
+	m_deleted = 0;
+
+	for (size_t i = 0; i < control.size(); ++i)
+	{
+		if (control[i] < 0) continue;
+
+		auto hash = Hash(keys[i]);
+		auto group = firstGroup(hash, m_group_mask);
+		for (size_t step = 1;; ++step)
+		{
+			auto base = group * c_cell_group_width;
+			auto free = matchFree(&m_control[base]);
+			if (free)
+			{
+				auto slot = base + lowestBit(free);
+				m_control[slot] = control[i];
+				m_keys[slot] = keys[i];
+				m_entries[slot] = entries[i];
+				break;
+			}
+			group = (group + step) & m_group_mask;
+		}
+	}
+}
+
+uint32_t ClayEngine::CellIndex::Find(uint64_t key) const
+{
+	auto slot = findSlot(key, Hash(key));
+	return slot == c_no_slot ? c_cell_none : m_entries[slot];
+}
+
+void ClayEngine::CellIndex::Insert(uint64_t key, uint32_t entry)
+{
+	// Tombstones count against the load, so a table that churns rehashes in place instead of growing
+	if ((m_size + m_deleted + 1) * 8 > m_control.size() * 7) rehash(capacityFor(std::max<size_t>(m_size * 2, 1)));
+
+	auto hash = Hash(key);
+	auto group = firstGroup(hash, m_group_mask);
+	for (size_t step = 1;; ++step)
+	{
+		auto base = group * c_cell_group_width;
+		auto free = matchFree(&m_control[base]);
+		if (free)
+		{
+			auto slot = base + lowestBit(free);
+			if (m_control[slot] == c_control_deleted) --m_deleted;
+			m_control[slot] = controlByte(hash);
+			m_keys[slot] = key;
+			m_entries[slot] = entry;
+			++m_size;
+			return;
+		}
+		group = (group + step) & m_group_mask;
+	}
+}
+
+uint32_t ClayEngine::CellIndex::Erase(uint64_t key)
+{
+	auto slot = findSlot(key, Hash(key));
+	if (slot == c_no_slot) return c_cell_none;
+
+	// Lookups already stop at a group that has an empty slot, so freeing a slot there needs no tombstone
+	auto base = slot - slot % c_cell_group_width;
+	if (matchGroup(&m_control[base], c_control_empty)) m_control[slot] = c_control_empty;
+	else
+	{
+		m_control[slot] = c_control_deleted;
+		++m_deleted;
+	}
+	--m_size;
+
+	auto entry = m_entries[slot];
+	m_entries[slot] = c_cell_none;
+	return entry;
+}
+
+void ClayEngine::CellIndex::Reserve(size_t count)
+{
+	auto capacity = capacityFor(count);
+	if (capacity > m_control.size()) rehash(capacity);
+}
+
+void ClayEngine::CellIndex::Clear()
+{
+	std::fill(m_control.begin(), m_control.end(), c_control_empty);
+	std::fill(m_entries.begin(), m_entries.end(), c_cell_none);
+	m_size = 0;
+	m_deleted = 0;
+}
+#pragma endregion
+
+#pragma region Concurrent Cell Set Implementation
+bool ClayEngine::ConcurrentCellSet::Contains(uint64_t key) const
+{
+	auto& s = shard(key);
+	std::shared_lock<std::shared_mutex> lock(s.Mutex);
+	return s.Set.Contains(key);
+}
+
+bool ClayEngine::ConcurrentCellSet::Insert(uint64_t key)
+{
+	auto& s = shard(key);
+	std::unique_lock<std::shared_mutex> lock(s.Mutex);
+	return s.Set.Insert(key);
+}
+
+bool ClayEngine::ConcurrentCellSet::Erase(uint64_t key)
+{
+	auto& s = shard(key);
+	std::unique_lock<std::shared_mutex> lock(s.Mutex);
+	return s.Set.Erase(key);
+}
+
+void ClayEngine::ConcurrentCellSet::Clear()
+{
+	for (auto& s : m_shards)
+	{
+		std::unique_lock<std::shared_mutex> lock(s.Mutex);
+		s.Set.Clear();
+	}
+}
+
+size_t ClayEngine::ConcurrentCellSet::GetSize() const
+{
+	size_t size = 0;
+	for (auto& s : m_shards)
+	{
+		std::shared_lock<std::shared_mutex> lock(s.Mutex);
+		size += s.Set.GetSize();
+	}
+	return size;
+}
+#pragma endregion
+
+ClayEngine::CellTableBenchmark ClayEngine::RunCellTableBenchmark(size_t keyCount)
+{
+	CellTableBenchmark result = {};
+	result.KeyCount = keyCount;
+
+	// Level in the top bits and 20 bits per coordinate, laid out like a packed CellId around a viewer
+	auto pack = [](uint64_t level, int64_t x, int64_t y, int64_t z) {
+		return (level << 60) | ((static_cast<uint64_t>(x) & 0xFFFFF) << 40) | ((static_cast<uint64_t>(y) & 0xFFFFF) << 20) | (static_cast<uint64_t>(z) & 0xFFFFF);
+	};
+
+	std::vector<uint64_t> keys;
+	keys.reserve(keyCount);
+	auto edge = static_cast<int64_t>(std::ceil(std::cbrt(static_cast<double>(keyCount))));
+	for (int64_t z = -edge / 2; keys.size() < keyCount; ++z)
+		for (int64_t y = -edge / 2; y < edge / 2 + 1 && keys.size() < keyCount; ++y)
+			for (int64_t x = -edge / 2; x < edge / 2 + 1 && keys.size() < keyCount; ++x) keys.push_back(pack(0, x, y, z));
+
+	std::mt19937_64 rng(3);
+	std::shuffle(keys.begin(), keys.end(), rng);
+
+	// Half the lookups hit, half ask for the same cells one level up, which were never inserted
+	std::vector<uint64_t> probes(keyCount * 4);
+	std::uniform_int_distribution<size_t> pick(0, keyCount - 1);
+	for (auto& probe : probes) probe = keys[pick(rng)] | ((rng() & 1) << 60);
+
+	std::map<uint64_t, uint32_t> ordered;
+	std::unordered_map<uint64_t, uint32_t> unordered;
+	CellMap<uint32_t> flat;
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < keyCount; ++i) ordered[keys[i]] = i;
+	result.OrderedInsertsPerSecond = PerSecond(keyCount, std::chrono::steady_clock::now() - start);
+
+	start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < keyCount; ++i) unordered[keys[i]] = i;
+	result.UnorderedInsertsPerSecond = PerSecond(keyCount, std::chrono::steady_clock::now() - start);
+
+	start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < keyCount; ++i) flat[keys[i]] = i;
+	result.FlatInsertsPerSecond = PerSecond(keyCount, std::chrono::steady_clock::now() - start);
+
+	std::vector<uint32_t> expected(probes.size()), found(probes.size());
+
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < probes.size(); ++i)
+	{
+		auto it = ordered.find(probes[i]);
+		expected[i] = it == ordered.end() ? c_cell_none : it->second;
+	}
+	result.OrderedLookupsPerSecond = PerSecond(probes.size(), std::chrono::steady_clock::now() - start);
+
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < probes.size(); ++i)
+	{
+		auto it = unordered.find(probes[i]);
+		found[i] = it == unordered.end() ? c_cell_none : it->second;
+	}
+	result.UnorderedLookupsPerSecond = PerSecond(probes.size(), std::chrono::steady_clock::now() - start);
+
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < probes.size(); ++i)
+	{
+		auto value = flat.Find(probes[i]);
+		found[i] = value ? *value : c_cell_none;
+	}
+	result.FlatLookupsPerSecond = PerSecond(probes.size(), std::chrono::steady_clock::now() - start);
+
+	for (size_t i = 0; i < probes.size(); ++i)
+		if (found[i] != expected[i]) ++result.Mismatches;
+
+	std::wstringstream wss;
+	wss << std::fixed << std::setprecision(2)
+		<< L"CellTable " << result.KeyCount << L" keys"
+		<< L" | Lookups std::map " << result.OrderedLookupsPerSecond / 1e6 << L" M/sec"
+		<< L", std::unordered_map " << result.UnorderedLookupsPerSecond / 1e6 << L" M/sec"
+		<< L", CellMap " << result.FlatLookupsPerSecond / 1e6 << L" M/sec"
+		<< L" | Inserts std::map " << result.OrderedInsertsPerSecond / 1e6 << L" M/sec"
+		<< L", std::unordered_map " << result.UnorderedInsertsPerSecond / 1e6 << L" M/sec"
+		<< L", CellMap " << result.FlatInsertsPerSecond / 1e6 << L" M/sec"
+		<< L" | Mismatches " << result.Mismatches;
+	WriteLine(wss.str());
+
+	return result;
+}
@@ -0,0 +1,398 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* Flat open addressing map and set for packed CellId keys                    */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <vector>
+
+namespace ClayEngine
+{
+	constexpr uint32_t c_cell_none{ 0xFFFFFFFFu }; // No entry
+	constexpr auto c_cell_group_width{ 16 }; // Control bytes matched by one SSE2 compare
+	constexpr auto c_cell_compact_minimum{ 32 }; // Dead entries tolerated before a CellTable compacts
+	constexpr auto c_cell_shard_bits{ 4 };
+	constexpr auto c_cell_shards{ 1 << c_cell_shard_bits }; // Independently locked tables in the concurrent variants
+
+	/// <summary>
+	/// Swiss table style index from a 64 bit key to a 32 bit entry number. Slots are split into groups
+	/// of 16 with one control byte each, holding 7 bits of the key's hash or an empty or deleted mark,
+	/// and a lookup compares a whole group's control bytes at once, so only keys whose hash bits match
+	/// are ever compared. Groups are probed quadratically and a lookup stops at the first group with
+	/// an empty slot. Keys sit next to their entry numbers, a hit touches one cache line past the
+	/// control bytes and nothing else.
+	/// </summary>
+	class CellIndex
+	{
+		std::vector<int8_t> m_control = {};
+		std::vector<uint64_t> m_keys = {};
+		std::vector<uint32_t> m_entries = {};
+		size_t m_size = 0;
+		size_t m_deleted = 0;
+		size_t m_group_mask = 0;
+
+		size_t findSlot(uint64_t key, uint64_t hash) const;
+		void rehash(size_t capacity);
+
+	public:
+		static uint64_t Hash(uint64_t key);
+
+		/// <summary>
+		/// Entry number stored for key, c_cell_none when it is absent
+		/// </summary>
+		uint32_t Find(uint64_t key) const;
+		/// <summary>
+		/// Adds key, which must not be present yet
+		/// </summary>
+		void Insert(uint64_t key, uint32_t entry);
+		/// <summary>
+		/// Removes key and returns its entry number, c_cell_none when it was absent
+		/// </summary>
+		uint32_t Erase(uint64_t key);
+
+		void Reserve(size_t count);
+		void Clear();
+
+		size_t GetSize() const { return m_size; }
+		size_t GetCapacity() const { return m_control.size(); }
+	};
+
+	template<typename T>
+	struct CellMapEntry
+	{
+		uint64_t Key = 0;
+		T Value = {};
+		bool Live = false;
+	};
+
+	struct CellSetEntry
+	{
+		uint64_t Key = 0;
+		bool Live = false;
+	};
+
+	/// <summary>
+	/// Entries in insertion order on top of a CellIndex. Iteration walks the entry array and skips
+	/// erased ones, so the order is stable for debugging and never changes when the index grows.
+	/// Erased entries are compacted away once they outnumber the live ones, which (like growing)
+	/// moves the remaining entries, so pointers into the table only last until the next insert or erase.
+	/// </summary>
+	template<typename Entry>
+	class CellTable
+	{
+	protected:
+		CellIndex m_index = {};
+		std::vector<Entry> m_entries = {};
+		size_t m_dead = 0;
+
+		Entry* find(uint64_t key)
+		{
+			auto entry = m_index.Find(key);
+			return entry == c_cell_none ? nullptr : &m_entries[entry];
+		}
+		const Entry* find(uint64_t key) const
+		{
+			auto entry = m_index.Find(key);
+			return entry == c_cell_none ? nullptr : &m_entries[entry];
+		}
+		Entry& findOrAdd(uint64_t key, bool& added)
+		{
+			auto entry = m_index.Find(key);
+			added = entry == c_cell_none;
+			if (added)
+			{
+				entry = static_cast<uint32_t>(m_entries.size());
+				m_entries.emplace_back();
+				m_entries.back().Key = key;
+				m_entries.back().Live = true;
+				m_index.Insert(key, entry);
+			}
+			return m_entries[entry];
+		}
+		void compact()
+		{
+			if (m_dead < c_cell_compact_minimum || m_dead < m_index.GetSize()) return;
+
+			std::vector<Entry> entries;
+			entries.reserve(m_index.GetSize());
+			for (auto& entry : m_entries)
+				if (entry.Live) entries.push_back(std::move(entry));
+
+			m_index.Clear();
+			m_index.Reserve(entries.size());
+			for (uint32_t i = 0; i < entries.size(); ++i) m_index.Insert(entries[i].Key, i);
+
+			m_entries = std::move(entries);
+			m_dead = 0;
+		}
+
+	public:
+		/// <summary>
+		/// Walks live entries in insertion order
+		/// </summary>
+		template<typename Base>
+		class Iterator
+		{
+			Base* m_at = nullptr;
+			Base* m_end = nullptr;
+
+			void skip() { while (m_at != m_end && !m_at->Live) ++m_at; }
+
+		public:
+			Iterator(Base* at, Base* end) : m_at(at), m_end(end) { skip(); }
+
+			Base& operator*() const { return *m_at; }
+			Base* operator->() const { return m_at; }
+			Iterator& operator++() { ++m_at; skip(); return *this; }
+			bool operator==(const Iterator& rhs) const { return m_at == rhs.m_at; }
+			bool operator!=(const Iterator& rhs) const { return m_at != rhs.m_at; }
+		};
+
+		Iterator<Entry> begin() { return { m_entries.data(), m_entries.data() + m_entries.size() }; }
+		Iterator<Entry> end() { return { m_entries.data() + m_entries.size(), m_entries.data() + m_entries.size() }; }
+		Iterator<const Entry> begin() const { return { m_entries.data(), m_entries.data() + m_entries.size() }; }
+		Iterator<const Entry> end() const { return { m_entries.data() + m_entries.size(), m_entries.data() + m_entries.size() }; }
+
+		bool Contains(uint64_t key) const { return m_index.Find(key) != c_cell_none; }
+
+		bool Erase(uint64_t key)
+		{
+			auto entry = m_index.Erase(key);
+			if (entry == c_cell_none) return false;
+
+			m_entries[entry] = {};
+			++m_dead;
+			compact();
+			return true;
+		}
+
+		/// <summary>
+		/// Erases every entry predicate(entry) returns true for, returns how many went
+		/// </summary>
+		template<typename Predicate>
+		size_t EraseIf(Predicate predicate)
+		{
+			size_t erased = 0;
+			for (auto& entry : m_entries)
+			{
+				if (!entry.Live || !predicate(static_cast<const Entry&>(entry))) continue;
+
+				m_index.Erase(entry.Key);
+				entry = {};
+				++m_dead;
+				++erased;
+			}
+			compact();
+			return erased;
+		}
+
+		void Reserve(size_t count)
+		{
+			m_index.Reserve(count);
+			m_entries.reserve(count);
+		}
+
+		void Clear()
+		{
+			m_index.Clear();
+			m_entries.clear();
+			m_dead = 0;
+		}
+
+		size_t GetSize() const { return m_index.GetSize(); }
+		bool IsEmpty() const { return m_index.GetSize() == 0; }
+	};
+
+	/// <summary>
+	/// Flat hash map from a packed CellId to T, a drop in for std::map<CellId, T> cell tables
+	/// </summary>
+	template<typename T>
+	class CellMap : public CellTable<CellMapEntry<T>>
+	{
+		using Base = CellTable<CellMapEntry<T>>;
+
+	public:
+		/// <summary>
+		/// Value stored for key or nullptr, valid until the next insert or erase
+		/// </summary>
+		T* Find(uint64_t key)
+		{
+			auto entry = Base::find(key);
+			return entry ? &entry->Value : nullptr;
+		}
+		const T* Find(uint64_t key) const
+		{
+			auto entry = Base::find(key);
+			return entry ? &entry->Value : nullptr;
+		}
+
+		/// <summary>
+		/// Value for key, added as T{} when it is absent
+		/// </summary>
+		T& operator[](uint64_t key)
+		{
+			auto added = false;
+			return Base::findOrAdd(key, added).Value;
+		}
+
+		/// <summary>
+		/// Sets key to value, returns true when key was new
+		/// </summary>
+		bool Insert(uint64_t key, T value)
+		{
+			auto added = false;
+			Base::findOrAdd(key, added).Value = std::move(value);
+			return added;
+		}
+	};
+
+	/// <summary>
+	/// Flat hash set of packed CellIds, a drop in for TSet<CellId> and std::unordered_set cell sets
+	/// </summary>
+	class CellSet : public CellTable<CellSetEntry>
+	{
+	public:
+		/// <summary>
+		/// Adds key, returns true when it was new
+		/// </summary>
+		bool Insert(uint64_t key)
+		{
+			auto added = false;
+			findOrAdd(key, added);
+			return added;
+		}
+	};
+
+	/// <summary>
+	/// CellMap split into c_cell_shards tables by hash, each behind its own shared_mutex. Any number of
+	/// generator threads can read at once, and a writer only blocks readers of its own shard. Values
+	/// are copied out since a pointer could be invalidated by another thread's insert.
+	/// </summary>
+	template<typename T>
+	class ConcurrentCellMap
+	{
+		struct Shard
+		{
+			mutable std::shared_mutex Mutex = {};
+			CellMap<T> Map = {};
+		};
+
+		std::array<Shard, c_cell_shards> m_shards = {};
+
+		Shard& shard(uint64_t key) { return m_shards[CellIndex::Hash(key) >> (64 - c_cell_shard_bits)]; }
+		const Shard& shard(uint64_t key) const { return m_shards[CellIndex::Hash(key) >> (64 - c_cell_shard_bits)]; }
+
+	public:
+		bool TryGet(uint64_t key, T& value) const
+		{
+			auto& s = shard(key);
+			std::shared_lock<std::shared_mutex> lock(s.Mutex);
+			auto found = s.Map.Find(key);
+			if (found) value = *found;
+			return found != nullptr;
+		}
+
+		bool Contains(uint64_t key) const
+		{
+			auto& s = shard(key);
+			std::shared_lock<std::shared_mutex> lock(s.Mutex);
+			return s.Map.Contains(key);
+		}
+
+		bool Insert(uint64_t key, T value)
+		{
+			auto& s = shard(key);
+			std::unique_lock<std::shared_mutex> lock(s.Mutex);
+			return s.Map.Insert(key, std::move(value));
+		}
+
+		bool Erase(uint64_t key)
+		{
+			auto& s = shard(key);
+			std::unique_lock<std::shared_mutex> lock(s.Mutex);
+			return s.Map.Erase(key);
+		}
+
+		void Clear()
+		{
+			for (auto& s : m_shards)
+			{
+				std::unique_lock<std::shared_mutex> lock(s.Mutex);
+				s.Map.Clear();
+			}
+		}
+
+		/// <summary>
+		/// Visits every entry, shard by shard in insertion order, holding each shard's read lock in turn
+		/// </summary>
+		template<typename Visitor>
+		void ForEach(Visitor visitor) const
+		{
+			for (auto& s : m_shards)
+			{
+				std::shared_lock<std::shared_mutex> lock(s.Mutex);
+				for (auto& entry : s.Map) visitor(entry.Key, entry.Value);
+			}
+		}
+
+		size_t GetSize() const
+		{
+			size_t size = 0;
+			for (auto& s : m_shards)
+			{
+				std::shared_lock<std::shared_mutex> lock(s.Mutex);
+				size += s.Map.GetSize();
+			}
+			return size;
+		}
+	};
+
+	/// <summary>
+	/// CellSet sharded the same way as ConcurrentCellMap
+	/// </summary>
+	class ConcurrentCellSet
+	{
+		struct Shard
+		{
+			mutable std::shared_mutex Mutex = {};
+			CellSet Set = {};
+		};
+
+		std::array<Shard, c_cell_shards> m_shards = {};
+
+		Shard& shard(uint64_t key) { return m_shards[CellIndex::Hash(key) >> (64 - c_cell_shard_bits)]; }
+		const Shard& shard(uint64_t key) const { return m_shards[CellIndex::Hash(key) >> (64 - c_cell_shard_bits)]; }
+
+	public:
+		bool Contains(uint64_t key) const;
+		bool Insert(uint64_t key);
+		bool Erase(uint64_t key);
+		void Clear();
+		size_t GetSize() const;
+	};
+
+	struct CellTableBenchmark
+	{
+		size_t KeyCount = 0;
+		double OrderedLookupsPerSecond = 0.; // std::map
+		double UnorderedLookupsPerSecond = 0.; // std::unordered_map
+		double FlatLookupsPerSecond = 0.; // CellMap
+		double OrderedInsertsPerSecond = 0.;
+		double UnorderedInsertsPerSecond = 0.;
+		double FlatInsertsPerSecond = 0.;
+		size_t Mismatches = 0; // Lookups where CellMap disagrees with std::map, should be 0
+	};
+
+	/// <summary>
+	/// Inserts keyCount packed cell ids around a viewer into each table, looks up a mix of present and
+	/// absent ids and writes the operations per second to the console
+	/// </summary>
+	CellTableBenchmark RunCellTableBenchmark(size_t keyCount = 1u << 16);
+}
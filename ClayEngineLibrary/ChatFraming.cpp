@@ -0,0 +1,331 @@
+#include "pch.h"
+#include "ChatFraming.h"
+#include "Strings.h"
+#include "Benchmark.h"
+
+#include <cstring>
+#include <random>
+
+using namespace ClayEngine;
+
+namespace
+{
+	constexpr size_t c_chat_min_capacity{ 64 }; // Room for a varint and a short frame, Next grows it from there
+	constexpr size_t c_bench_pattern_frames{ 1 << 16 }; // Distinct frames, the stream repeats them up to frameCount
+	constexpr size_t c_bench_max_receive{ 8192 }; // Largest piece the stream is fed in
+
+	size_t roundUpPowerOfTwo(size_t value)
+	{
+		size_t result = 1;
+		while (result < value) result <<= 1;
+		return result;
+	}
+
+	size_t varintLength(size_t value)
+	{
+		size_t length = 1;
+		while (value >= 0x80)
+		{
+			value >>= 7;
+			++length;
+		}
+		return length;
+	}
+}
+
+#pragma region Chat Frame Reader Implementation
+ClayEngine::ChatFrameReader::ChatFrameReader(size_t capacity)
+	: m_capacity(roundUpPowerOfTwo(std::max(capacity, c_chat_min_capacity)))
+{
+	m_ring = std::make_unique<uint8_t[]>(m_capacity);
+}
+
+size_t ClayEngine::ChatFrameReader::GetWriteLength() const
+{
+	auto free = m_capacity - static_cast<size_t>(m_write - m_read);
+	auto contiguous = m_capacity - static_cast<size_t>(m_write & (m_capacity - 1));
+	return std::min(free, contiguous);
+}
+
+void ClayEngine::ChatFrameReader::Commit(size_t length)
+{
+	if (length > GetWriteLength()) throw std::runtime_error("ClayEngine::ChatFrameReader::Commit past the free space");
+	m_write += length;
+}
+
+size_t ClayEngine::ChatFrameReader::Write(const uint8_t* data, size_t length)
+{
+	size_t written = 0;
+	while (written < length)
+	{
+		auto count = std::min(length - written, GetWriteLength());
+		if (count == 0) break;
+
+		memcpy(GetWriteData(), data + written, count);
+		m_write += count;
+		written += count;
+	}
+	return written;
+}
+
+ChatFrameStatus ClayEngine::ChatFrameReader::Next(ChatFrame& frame)
+{
+	m_read = m_parse;
+	frame = {};
+	if (m_malformed) return ChatFrameStatus::Malformed;
+
+	// Varint length, its bytes are read one at a time so it doesn't care where the ring wraps
+	auto available = static_cast<size_t>(m_write - m_parse);
+	size_t length = 0;
+	size_t header = 0;
+	while (true)
+	{
+		if (header == available) return ChatFrameStatus::Incomplete;
+
+		auto byte = at(m_parse + header);
+		length |= static_cast<size_t>(byte & 0x7F) << (7 * header);
+		++header;
+
+		if ((byte & 0x80) == 0) break;
+		if (header == c_chat_varint_max_length)
+		{
+			m_malformed = true;
+			return ChatFrameStatus::Malformed;
+		}
+	}
+
+	// Every frame has at least its type byte
+	if (length == 0 || length > c_chat_max_frame_length)
+	{
+		m_malformed = true;
+		return ChatFrameStatus::Malformed;
+	}
+	if (available - header < length)
+	{
+		// The previous frame was released above, so the ring only has to hold this one
+		if (header + length > m_capacity) grow(header + length);
+		return ChatFrameStatus::Incomplete;
+	}
+
+	auto type = m_parse + header;
+	auto payload = static_cast<size_t>((type + 1) & (m_capacity - 1));
+	auto count = length - 1;
+
+	frame.Type = static_cast<ChatMessageType>(at(type));
+	if (payload + count <= m_capacity)
+	{
+		frame.Payload = ByteView(m_ring.get() + payload, count);
+	}
+	else
+	{
+		// Splice the two halves, the only copy a frame ever gets
+		if (!m_splice) m_splice = std::make_unique<uint8_t[]>(m_capacity);
+
+		auto first = m_capacity - payload;
+		memcpy(m_splice.get(), m_ring.get() + payload, first);
+		memcpy(m_splice.get() + first, m_ring.get(), count - first);
+
+		frame.Payload = ByteView(m_splice.get(), count);
+		frame.Spliced = true;
+		++m_spliced;
+	}
+
+	m_parse += header + length;
+	++m_frames;
+	return ChatFrameStatus::Ready;
+}
+
+void ClayEngine::ChatFrameReader::grow(size_t length)
+{
+	auto capacity = m_capacity;
+	while (capacity < length) capacity <<= 1;
+
+	// Only the unparsed bytes are live, they keep their running positions in the bigger ring
+	auto ring = std::make_unique<uint8_t[]>(capacity);
+	for (auto position = m_parse; position < m_write;)
+	{
+		auto from = static_cast<size_t>(position & (m_capacity - 1));
+		auto to = static_cast<size_t>(position & (capacity - 1));
+		auto count = std::min({ static_cast<size_t>(m_write - position), m_capacity - from, capacity - to });
+		memcpy(ring.get() + to, m_ring.get() + from, count);
+		position += count;
+	}
+
+	m_ring = std::move(ring);
+	m_capacity = capacity;
+	m_splice = nullptr;
+}
+
+void ClayEngine::ChatFrameReader::Reset()
+{
+	m_read = m_parse = m_write = 0;
+	m_malformed = false;
+}
+#pragma endregion
+
+#pragma region Chat Frame Writer Implementation
+size_t ClayEngine::GetChatFrameLength(size_t payloadLength)
+{
+	if (payloadLength > c_chat_max_payload_length) return 0;
+	return varintLength(payloadLength + 1) + 1 + payloadLength;
+}
+
+size_t ClayEngine::WriteChatFrame(uint8_t* destination, size_t capacity, ChatMessageType type, ByteView payload)
+{
+	auto total = GetChatFrameLength(payload.GetSize());
+	if (total == 0 || total > capacity) return 0;
+
+	size_t offset = 0;
+	auto length = payload.GetSize() + 1;
+	while (length >= 0x80)
+	{
+		destination[offset++] = static_cast<uint8_t>(length | 0x80);
+		length >>= 7;
+	}
+	destination[offset++] = static_cast<uint8_t>(length);
+	destination[offset++] = static_cast<uint8_t>(type);
+
+	if (!payload.IsEmpty()) memcpy(destination + offset, payload.GetData(), payload.GetSize());
+	return total;
+}
+#pragma endregion
+
+ClayEngine::ChatFramingBenchmark ClayEngine::RunChatFramingBenchmark(size_t frameCount)
+{
+	ChatFramingBenchmark result = {};
+	result.FrameCount = frameCount;
+
+	struct Expected
+	{
+		ChatMessageType Type = ChatMessageType::None;
+		size_t Length = 0;
+		uint8_t First = 0;
+		uint8_t Last = 0;
+	};
+
+	// Mostly chat lines with the odd pasted block, every frame's payload is random bytes
+	std::mt19937_64 rng(19742);
+	auto patternCount = std::max<size_t>(1, std::min(frameCount, c_bench_pattern_frames));
+	std::vector<Expected> expected(patternCount);
+	std::vector<uint8_t> pattern = {};
+	std::vector<uint8_t> payload(c_chat_max_payload_length);
+	for (auto& element : expected)
+	{
+		element.Type = static_cast<ChatMessageType>(1 + rng() % 6);
+		element.Length = rng() % 64 == 0 ? 1024 + rng() % 8192 : rng() % 256;
+		for (size_t i = 0; i < element.Length; ++i) payload[i] = static_cast<uint8_t>(rng());
+		if (element.Length > 0)
+		{
+			element.First = payload[0];
+			element.Last = payload[element.Length - 1];
+		}
+
+		auto offset = pattern.size();
+		pattern.resize(offset + GetChatFrameLength(element.Length));
+		WriteChatFrame(pattern.data() + offset, pattern.size() - offset, element.Type, ByteView(payload.data(), element.Length));
+	}
+
+	auto repeats = (frameCount + patternCount - 1) / patternCount;
+	result.ByteCount = repeats * pattern.size();
+
+	std::vector<size_t> receives(4096);
+	for (auto& element : receives) element = 1 + rng() % c_bench_max_receive;
+
+	auto check = [&](size_t frame, ChatMessageType type, const uint8_t* data, size_t length) {
+		auto& wanted = expected[frame % patternCount];
+		if (type != wanted.Type || length != wanted.Length) return false;
+		return length == 0 || (data[0] == wanted.First && data[length - 1] == wanted.Last);
+	};
+
+	// Copying parser: append each receive to a vector, copy every payload out, erase what was parsed
+	{
+		std::vector<uint8_t> buffer = {};
+		size_t frame = 0;
+		size_t mismatches = 0;
+		size_t receive = 0;
+
+		auto start = std::chrono::steady_clock::now();
+		for (size_t r = 0; r < repeats; ++r)
+		{
+			size_t offset = 0;
+			while (offset < pattern.size())
+			{
+				auto count = std::min(receives[receive++ % receives.size()], pattern.size() - offset);
+				buffer.insert(buffer.end(), pattern.begin() + offset, pattern.begin() + offset + count);
+				offset += count;
+
+				size_t parsed = 0;
+				while (true)
+				{
+					size_t length = 0;
+					size_t header = 0;
+					bool complete = false;
+					while (parsed + header < buffer.size() && header < c_chat_varint_max_length)
+					{
+						auto byte = buffer[parsed + header];
+						length |= static_cast<size_t>(byte & 0x7F) << (7 * header);
+						++header;
+						if ((byte & 0x80) == 0)
+						{
+							complete = true;
+							break;
+						}
+					}
+					if (!complete || buffer.size() - parsed - header < length) break;
+
+					auto type = static_cast<ChatMessageType>(buffer[parsed + header]);
+					std::vector<uint8_t> copy(buffer.begin() + parsed + header + 1, buffer.begin() + parsed + header + length);
+					if (!check(frame++, type, copy.data(), copy.size())) ++mismatches;
+					parsed += header + length;
+				}
+				buffer.erase(buffer.begin(), buffer.begin() + parsed);
+			}
+		}
+		result.CopyFramesPerSecond = PerSecond(frame, std::chrono::steady_clock::now() - start);
+		result.Mismatches += mismatches + (frame != repeats * patternCount ? 1 : 0);
+	}
+
+	// ChatFrameReader: receive straight into the ring, parse views in place
+	{
+		ChatFrameReader reader(c_chat_receive_length);
+		ChatFrame frame = {};
+		size_t frames = 0;
+		size_t mismatches = 0;
+		size_t receive = 0;
+
+		auto start = std::chrono::steady_clock::now();
+		for (size_t r = 0; r < repeats; ++r)
+		{
+			size_t offset = 0;
+			while (offset < pattern.size())
+			{
+				// Stands in for the WSARecv into GetWriteData
+				auto count = std::min({ receives[receive++ % receives.size()], pattern.size() - offset, reader.GetWriteLength() });
+				memcpy(reader.GetWriteData(), pattern.data() + offset, count);
+				reader.Commit(count);
+				offset += count;
+
+				ChatFrameStatus status;
+				while ((status = reader.Next(frame)) == ChatFrameStatus::Ready)
+				{
+					if (!check(frames++, frame.Type, frame.Payload.GetData(), frame.Payload.GetSize())) ++mismatches;
+				}
+				if (status == ChatFrameStatus::Malformed) break;
+			}
+		}
+		result.ViewFramesPerSecond = PerSecond(frames, std::chrono::steady_clock::now() - start);
+		result.SplicedRate = frames > 0 ? static_cast<double>(reader.GetSplicedCount()) / static_cast<double>(frames) : 0.;
+		result.Mismatches += mismatches + (frames != repeats * patternCount ? 1 : 0);
+	}
+
+	std::wstringstream wss;
+	wss << std::fixed << std::setprecision(2)
+		<< L"ChatFraming " << repeats * patternCount << L" frames, " << result.ByteCount / (1024. * 1024.) << L" MiB"
+		<< L" | Copying " << result.CopyFramesPerSecond / 1e6 << L" M/sec"
+		<< L" | Views " << result.ViewFramesPerSecond / 1e6 << L" M/sec"
+		<< L" | Spliced " << result.SplicedRate * 100. << L"%"
+		<< L" | Mismatches " << result.Mismatches;
+	WriteLine(wss.str());
+
+	return result;
+}
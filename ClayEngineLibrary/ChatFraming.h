@@ -0,0 +1,176 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* Varint length prefixed chat frames parsed in place from a ring buffer      */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+
+namespace ClayEngine
+{
+	constexpr size_t c_chat_max_frame_length{ 64 * 1024 }; // Type byte and payload, the varint is not counted
+	constexpr size_t c_chat_max_payload_length{ c_chat_max_frame_length - 1 };
+	constexpr size_t c_chat_varint_max_length{ 3 }; // 21 bits, enough for c_chat_max_frame_length
+	constexpr size_t c_chat_receive_length{ 4 * 1024 }; // Per connection ring to start with, it grows to fit the largest frame it's sent
+
+	/// <summary>
+	/// The byte after a frame's length. Readers pass unknown values through, so new types don't break old peers.
+	/// </summary>
+	enum class ChatMessageType : uint8_t
+	{
+		None = 0,
+		Say = 1,
+		Whisper = 2,
+		Channel = 3,
+		System = 4,
+		Ping = 5,
+		Pong = 6,
+	};
+
+	/// <summary>
+	/// Read only pointer and length into bytes owned by someone else, what std::span<const uint8_t> is in C++20
+	/// </summary>
+	class ByteView
+	{
+		const uint8_t* m_data = nullptr;
+		size_t m_size = 0;
+
+	public:
+		constexpr ByteView() = default;
+		constexpr ByteView(const uint8_t* data, size_t size) : m_data(data), m_size(size) {}
+
+		constexpr const uint8_t* GetData() const { return m_data; }
+		constexpr size_t GetSize() const { return m_size; }
+		constexpr bool IsEmpty() const { return m_size == 0; }
+
+		constexpr const uint8_t& operator[](size_t index) const { return m_data[index]; }
+		constexpr const uint8_t* begin() const { return m_data; }
+		constexpr const uint8_t* end() const { return m_data + m_size; }
+
+		/// <summary>
+		/// count bytes from offset, clamped to the end of the view
+		/// </summary>
+		constexpr ByteView Subview(size_t offset, size_t count = SIZE_MAX) const
+		{
+			if (offset > m_size) offset = m_size;
+			if (count > m_size - offset) count = m_size - offset;
+			return ByteView(m_data + offset, count);
+		}
+	};
+
+	struct ChatFrame
+	{
+		ChatMessageType Type = ChatMessageType::None;
+		ByteView Payload = {}; // Valid until the next call to Next on the reader it came from
+		bool Spliced = false; // The frame wrapped around the ring and Payload points at the splice buffer
+	};
+
+	enum class ChatFrameStatus
+	{
+		Ready, // A frame was returned
+		Incomplete, // Needs more bytes
+		Malformed, // Bad length, the stream can't be resynchronized and the connection should be dropped
+	};
+
+	/// <summary>
+	/// Per connection receive ring that frames are parsed out of in place. Receives go straight into
+	/// GetWriteData and are published with Commit, and Next hands out each frame's payload as a view
+	/// into the ring with no copy. Only a frame whose payload wraps past the end of the ring is
+	/// copied, into a splice buffer made the first time one does. A frame's bytes stay reserved until
+	/// the next call to Next, so a view survives receives posted in between. The ring starts small and
+	/// Next doubles it when the frame it's waiting on can't fit, so an idle connection holds kilobytes
+	/// and only one sending large frames grows toward twice c_chat_max_frame_length. Not thread safe,
+	/// a connection's receives complete one at a time.
+	/// </summary>
+	class ChatFrameReader
+	{
+		std::unique_ptr<uint8_t[]> m_ring; // No initializer, sized in the constructor
+		size_t m_capacity = 0; // Power of two
+		std::unique_ptr<uint8_t[]> m_splice = nullptr; // m_capacity bytes, made on demand and dropped when the ring grows
+
+		// Running positions, masked to index the ring
+		uint64_t m_read = 0; // Start of the frame the caller may still be looking at
+		uint64_t m_parse = 0; // Start of the next frame
+		uint64_t m_write = 0; // End of the received bytes
+
+		bool m_malformed = false;
+		uint64_t m_frames = 0;
+		uint64_t m_spliced = 0;
+
+		uint8_t at(uint64_t position) const { return m_ring[position & (m_capacity - 1)]; }
+		void grow(size_t length);
+
+	public:
+		/// <summary>
+		/// capacity is where the ring starts, rounded up to a power of two
+		/// </summary>
+		explicit ChatFrameReader(size_t capacity = c_chat_receive_length);
+		~ChatFrameReader() = default;
+
+		ChatFrameReader(const ChatFrameReader&) = delete;
+		ChatFrameReader& operator=(const ChatFrameReader&) = delete;
+
+		/// <summary>
+		/// Contiguous free space to receive into, GetWriteLength bytes. It stops at the end of the ring,
+		/// so a receive may take two calls to fill all the free space.
+		/// </summary>
+		uint8_t* GetWriteData() { return m_ring.get() + (m_write & (m_capacity - 1)); }
+		size_t GetWriteLength() const;
+		/// <summary>
+		/// Publishes length bytes received into GetWriteData, which must not exceed GetWriteLength
+		/// </summary>
+		void Commit(size_t length);
+		/// <summary>
+		/// Copies in as much of data as fits, for callers that didn't receive into the ring, and returns how much
+		/// </summary>
+		size_t Write(const uint8_t* data, size_t length);
+
+		/// <summary>
+		/// Parses the next frame. Releases the previous frame's bytes, so its payload view is dead after this call.
+		/// Incomplete means write more, there is always free space for it afterwards.
+		/// </summary>
+		ChatFrameStatus Next(ChatFrame& frame);
+
+		/// <summary>
+		/// Drops everything buffered and clears a malformed stream, for a reused connection. The ring keeps its size.
+		/// </summary>
+		void Reset();
+
+		size_t GetCapacity() const { return m_capacity; }
+		size_t GetBufferedLength() const { return static_cast<size_t>(m_write - m_parse); }
+		uint64_t GetFrameCount() const { return m_frames; }
+		uint64_t GetSplicedCount() const { return m_spliced; }
+	};
+	using ChatFrameReaderPtr = std::unique_ptr<ChatFrameReader>;
+
+	/// <summary>
+	/// Bytes WriteChatFrame needs for a payloadLength payload, 0 when the payload is too long for a frame
+	/// </summary>
+	size_t GetChatFrameLength(size_t payloadLength);
+	/// <summary>
+	/// Writes the varint length, type and payload to destination and returns the bytes written, 0 when
+	/// they don't fit in capacity or the payload is too long for a frame
+	/// </summary>
+	size_t WriteChatFrame(uint8_t* destination, size_t capacity, ChatMessageType type, ByteView payload);
+
+	struct ChatFramingBenchmark
+	{
+		size_t FrameCount = 0;
+		size_t ByteCount = 0;
+		double CopyFramesPerSecond = 0.; // Growing vector, every payload copied out and the parsed prefix erased
+		double ViewFramesPerSecond = 0.; // ChatFrameReader
+		double SplicedRate = 0.; // Frames that wrapped the ring and had to be copied
+		size_t Mismatches = 0; // Frames that differ from what was written, should be 0
+	};
+
+	/// <summary>
+	/// Writes frameCount frames of random type and length, feeds them in receive sized pieces to a
+	/// copying parser and to a ChatFrameReader, and writes the frames per second to the console
+	/// </summary>
+	ChatFramingBenchmark RunChatFramingBenchmark(size_t frameCount = 1u << 20);
+}
@@ -0,0 +1,446 @@
+#include "pch.h"
+#include "ConnectionTable.h"
+#include "Strings.h"
+#include "Benchmark.h"
+
+#include <random>
+
+using namespace ClayEngine;
+
+namespace
+{
+	constexpr ConnectionHandle c_index_erased{ ~0ULL }; // Handle of an erased index entry, its key stays for probing
+	constexpr auto c_bench_scan_divisor{ 256 }; // The linear scan gets this much fewer lookups to finish in time
+
+	inline uint64_t mix(uint64_t x)
+	{
+		x ^= x >> 30; x *= 0xBF58476D1CE4E5B9ULL;
+		x ^= x >> 27; x *= 0x94D049BB133111EBULL;
+		return x ^ (x >> 31);
+	}
+
+	struct EpochState
+	{
+		std::atomic<uint64_t> Global = 1; // 0 in a record means not pinned
+
+		MUTEX RecordsMutex = {};
+		std::vector<std::unique_ptr<EpochRecord>> Records = {}; // Reused after their thread exits, never freed
+
+		MUTEX LimboMutex = {};
+		std::vector<std::pair<uint64_t, std::function<void()>>> Limbo = {}; // Epoch retired in and the reclaim
+		std::atomic<size_t> Reclaimed = 0;
+	};
+
+	EpochState& epochState()
+	{
+		static EpochState state = {};
+		return state;
+	}
+}
+
+#pragma region Epoch Reclamation Implementation
+struct ClayEngine::EpochRecord
+{
+	std::atomic<uint64_t> Pinned = 0;
+	std::atomic<bool> Claimed = false;
+	uint32_t Depth = 0; // Nested guards on the owning thread
+};
+
+namespace
+{
+	/// <summary>
+	/// Claims a record on a thread's first guard and hands it back when the thread exits
+	/// </summary>
+	struct EpochThread
+	{
+		EpochRecord* Record = nullptr;
+
+		~EpochThread()
+		{
+			if (Record) Record->Claimed.store(false, std::memory_order_release);
+		}
+
+		EpochRecord& Get()
+		{
+			if (Record) return *Record;
+
+			auto& state = epochState();
+			LockGuard lock(state.RecordsMutex);
+			for (auto& element : state.Records)
+			{
+				auto claimed = false;
+				if (element->Claimed.compare_exchange_strong(claimed, true))
+				{
+					Record = element.get();
+					return *Record;
+				}
+			}
+
+			state.Records.emplace_back(std::make_unique<EpochRecord>());
+			Record = state.Records.back().get();
+			Record->Claimed.store(true);
+			return *Record;
+		}
+	};
+
+	thread_local EpochThread t_epoch_thread = {};
+}
+
+ClayEngine::EpochGuard::EpochGuard()
+{
+	m_record = &t_epoch_thread.Get();
+	if (m_record->Depth++ > 0) return;
+
+	// The fence keeps the reads the guard protects from moving ahead of the announcement
+	m_record->Pinned.store(epochState().Global.load(std::memory_order_acquire), std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+ClayEngine::EpochGuard::~EpochGuard()
+{
+	if (--m_record->Depth == 0) m_record->Pinned.store(0, std::memory_order_release);
+}
+
+void ClayEngine::EpochRetire(std::function<void()> reclaim)
+{
+	auto& state = epochState();
+
+	size_t pending = 0;
+	{
+		LockGuard lock(state.LimboMutex);
+		state.Limbo.emplace_back(state.Global.load(std::memory_order_acquire), std::move(reclaim));
+		pending = state.Limbo.size();
+	}
+
+	if (pending >= c_epoch_retire_batch) EpochCollect();
+}
+
+size_t ClayEngine::EpochCollect()
+{
+	auto& state = epochState();
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	// The epoch moves on once every pinned thread has seen the current one
+	auto epoch = state.Global.load(std::memory_order_acquire);
+	auto advance = true;
+	{
+		LockGuard lock(state.RecordsMutex);
+		for (auto& element : state.Records)
+		{
+			auto pinned = element->Pinned.load(std::memory_order_seq_cst);
+			if (pinned != 0 && pinned != epoch)
+			{
+				advance = false;
+				break;
+			}
+		}
+	}
+	if (advance) state.Global.compare_exchange_strong(epoch, epoch + 1);
+
+	// Retired two epochs back means every thread has unpinned at least once since
+	auto global = state.Global.load(std::memory_order_acquire);
+	std::vector<std::function<void()>> ready = {};
+	{
+		LockGuard lock(state.LimboMutex);
+		auto keep = std::partition(state.Limbo.begin(), state.Limbo.end(), [global](const auto& element) { return element.first + 2 > global; });
+		for (auto it = keep; it != state.Limbo.end(); ++it) ready.emplace_back(std::move(it->second));
+		state.Limbo.erase(keep, state.Limbo.end());
+	}
+
+	for (auto& reclaim : ready) reclaim();
+	state.Reclaimed.fetch_add(ready.size(), std::memory_order_relaxed);
+	return ready.size();
+}
+
+size_t ClayEngine::GetEpochPendingCount()
+{
+	auto& state = epochState();
+	LockGuard lock(state.LimboMutex);
+	return state.Limbo.size();
+}
+
+size_t ClayEngine::GetEpochReclaimedCount()
+{
+	return epochState().Reclaimed.load(std::memory_order_relaxed);
+}
+#pragma endregion
+
+#pragma region Connection Index Implementation
+namespace
+{
+	struct IndexEntry
+	{
+		std::atomic<uint64_t> Low = 0;
+		std::atomic<uint64_t> High = 0;
+		std::atomic<ConnectionHandle> Handle = 0; // 0 while empty, published last
+	};
+
+	struct IndexTable
+	{
+		size_t Mask = 0;
+		std::unique_ptr<IndexEntry[]> Entries = nullptr;
+
+		IndexTable(size_t capacity) : Mask(capacity - 1), Entries(std::make_unique<IndexEntry[]>(capacity)) {}
+	};
+}
+
+struct ConnectionIndex::Shard
+{
+	alignas(64) MUTEX Mutex = {};
+	std::atomic<IndexTable*> Table = nullptr;
+	size_t Live = 0;
+	size_t Used = 0; // Live and erased entries, only a rehash gets erased ones back
+};
+
+ConnectionIndex::ConnectionIndex()
+{
+	m_shards = std::make_unique<Shard[]>(c_connection_shards);
+}
+
+ConnectionIndex::~ConnectionIndex()
+{
+	for (auto s = 0; s < c_connection_shards; ++s) delete m_shards[s].Table.load();
+}
+
+uint64_t ConnectionIndex::Hash(const ConnectionGuid& guid)
+{
+	return mix(guid.Low ^ mix(guid.High + 0x9E3779B97F4A7C15ULL));
+}
+
+ConnectionHandle ConnectionIndex::Find(const ConnectionGuid& guid) const
+{
+	auto hash = Hash(guid);
+	auto table = m_shards[hash >> (64 - c_connection_shard_bits)].Table.load(std::memory_order_acquire);
+	if (!table) return 0;
+
+	// Tables never fill past three quarters, so the probe always reaches an empty entry
+	for (auto position = hash & table->Mask;; position = (position + 1) & table->Mask)
+	{
+		auto& entry = table->Entries[position];
+		auto handle = entry.Handle.load(std::memory_order_acquire);
+		if (handle == 0) return 0;
+		if (handle != c_index_erased && entry.Low.load(std::memory_order_relaxed) == guid.Low && entry.High.load(std::memory_order_relaxed) == guid.High) return handle;
+	}
+}
+
+bool ConnectionIndex::Insert(const ConnectionGuid& guid, ConnectionHandle handle)
+{
+	auto hash = Hash(guid);
+	auto& shard = m_shards[hash >> (64 - c_connection_shard_bits)];
+	LockGuard lock(shard.Mutex);
+
+	auto table = shard.Table.load(std::memory_order_relaxed);
+	if (!table || (shard.Used + 1) * 4 > (table->Mask + 1) * 3)
+	{
+		// Sized for twice the live entries, so a shard full of erased entries is rebuilt at the same size
+		auto capacity = c_connection_index_minimum;
+		while (capacity < (shard.Live + 1) * 2) capacity <<= 1;
+
+		auto rebuilt = new IndexTable(capacity);
+		if (table)
+		{
+			for (size_t i = 0; i <= table->Mask; ++i)
+			{
+				auto& entry = table->Entries[i];
+				auto live = entry.Handle.load(std::memory_order_relaxed);
+				if (live == 0 || live == c_index_erased) continue;
+
+				ConnectionGuid key = { entry.Low.load(std::memory_order_relaxed), entry.High.load(std::memory_order_relaxed) };
+				auto position = Hash(key) & rebuilt->Mask;
+				while (rebuilt->Entries[position].Handle.load(std::memory_order_relaxed) != 0) position = (position + 1) & rebuilt->Mask;
+
+				rebuilt->Entries[position].Low.store(key.Low, std::memory_order_relaxed);
+				rebuilt->Entries[position].High.store(key.High, std::memory_order_relaxed);
+				rebuilt->Entries[position].Handle.store(live, std::memory_order_relaxed);
+			}
+		}
+
+		shard.Table.store(rebuilt, std::memory_order_release);
+		shard.Used = shard.Live;
+		if (table) EpochRetire([table] { delete table; });
+		table = rebuilt;
+	}
+
+	auto position = hash & table->Mask;
+	for (;; position = (position + 1) & table->Mask)
+	{
+		auto& entry = table->Entries[position];
+		auto existing = entry.Handle.load(std::memory_order_relaxed);
+		if (existing == 0) break;
+		if (existing != c_index_erased && entry.Low.load(std::memory_order_relaxed) == guid.Low && entry.High.load(std::memory_order_relaxed) == guid.High) return false;
+	}
+
+	auto& entry = table->Entries[position];
+	entry.Low.store(guid.Low, std::memory_order_relaxed);
+	entry.High.store(guid.High, std::memory_order_relaxed);
+	entry.Handle.store(handle, std::memory_order_release);
+
+	++shard.Live;
+	++shard.Used;
+	return true;
+}
+
+bool ConnectionIndex::Erase(const ConnectionGuid& guid, ConnectionHandle handle)
+{
+	auto hash = Hash(guid);
+	auto& shard = m_shards[hash >> (64 - c_connection_shard_bits)];
+	LockGuard lock(shard.Mutex);
+
+	auto table = shard.Table.load(std::memory_order_relaxed);
+	if (!table) return false;
+
+	for (auto position = hash & table->Mask;; position = (position + 1) & table->Mask)
+	{
+		auto& entry = table->Entries[position];
+		auto existing = entry.Handle.load(std::memory_order_relaxed);
+		if (existing == 0) return false;
+		if (existing == handle && entry.Low.load(std::memory_order_relaxed) == guid.Low && entry.High.load(std::memory_order_relaxed) == guid.High)
+		{
+			entry.Handle.store(c_index_erased, std::memory_order_release);
+			--shard.Live;
+			return true;
+		}
+	}
+}
+
+void ConnectionIndex::Clear()
+{
+	for (auto s = 0; s < c_connection_shards; ++s)
+	{
+		auto& shard = m_shards[s];
+		LockGuard lock(shard.Mutex);
+
+		auto table = shard.Table.exchange(nullptr, std::memory_order_acq_rel);
+		if (table) EpochRetire([table] { delete table; });
+		shard.Live = 0;
+		shard.Used = 0;
+	}
+}
+
+size_t ConnectionIndex::GetSize() const
+{
+	size_t size = 0;
+	for (auto s = 0; s < c_connection_shards; ++s)
+	{
+		LockGuard lock(m_shards[s].Mutex);
+		size += m_shards[s].Live;
+	}
+	return size;
+}
+#pragma endregion
+
+ClayEngine::ConnectionTableBenchmark ClayEngine::RunConnectionTableBenchmark(size_t connectionCount, size_t readerCount, size_t lookupsPerReader)
+{
+	ConnectionTableBenchmark result = {};
+	result.ConnectionCount = connectionCount;
+	result.ReaderCount = std::max<size_t>(1, readerCount);
+
+	struct Connection
+	{
+		ConnectionGuid Client = {};
+		uint64_t Socket = 0;
+	};
+
+	std::mt19937_64 rng(7);
+	auto makeGuid = [&rng] { return ConnectionGuid{ rng(), rng() }; };
+
+	std::vector<ConnectionGuid> clients(connectionCount);
+	for (auto& element : clients) element = makeGuid();
+
+	auto runReaders = [&](const std::function<void(size_t reader)>& body) {
+		auto start = std::chrono::steady_clock::now();
+		std::vector<THREAD> threads;
+		for (size_t r = 0; r < result.ReaderCount; ++r) threads.emplace_back(body, r);
+		for (auto& element : threads) element.join();
+		return std::chrono::steady_clock::now() - start;
+	};
+
+	// Linear scan under one lock, ConnectedClientManager::GetSockets
+	{
+		MUTEX mutex = {};
+		std::vector<std::unique_ptr<Connection>> scanned = {};
+		for (size_t i = 0; i < connectionCount; ++i) scanned.emplace_back(std::make_unique<Connection>(Connection{ clients[i], i + 1 }));
+
+		auto lookups = std::max<size_t>(1, lookupsPerReader / c_bench_scan_divisor);
+		std::atomic<size_t> mismatches = 0;
+		auto elapsed = runReaders([&](size_t reader) {
+			for (size_t i = 0; i < lookups; ++i)
+			{
+				auto wanted = (i * 7919 + reader) % connectionCount;
+
+				uint64_t socket = 0;
+				LockGuard lock(mutex);
+				for (auto& element : scanned)
+				{
+					if (element->Client == clients[wanted])
+					{
+						socket = element->Socket;
+						break;
+					}
+				}
+				if (socket != wanted + 1) mismatches.fetch_add(1);
+			}
+		});
+		result.ScanLookupsPerSecond = PerSecond(result.ReaderCount * lookups, elapsed);
+		result.Mismatches += mismatches.load();
+	}
+
+	// Table, one thread keeps disconnecting and reconnecting while the readers look up
+	ConnectionTable<Connection> table = {};
+	std::vector<ConnectionHandle> handles(connectionCount);
+	for (size_t i = 0; i < connectionCount; ++i) handles[i] = table.Insert(clients[i], makeGuid(), std::make_unique<Connection>(Connection{ clients[i], i + 1 }));
+
+	auto reclaimed = GetEpochReclaimedCount();
+	std::atomic<bool> reading = true;
+	std::atomic<size_t> churned = 0;
+	auto churnStart = std::chrono::steady_clock::now();
+	THREAD churn([&] {
+		std::mt19937_64 churnRng(11);
+		while (reading.load(std::memory_order_relaxed))
+		{
+			auto i = churnRng() % std::max<size_t>(1, connectionCount);
+			if (connectionCount == 0) break;
+
+			table.Remove(handles[i]);
+			handles[i] = table.Insert(clients[i], ConnectionGuid{ churnRng(), churnRng() }, std::make_unique<Connection>(Connection{ clients[i], i + 1 }));
+			churned.fetch_add(1, std::memory_order_relaxed);
+		}
+	});
+
+	std::atomic<size_t> mismatches = 0;
+	auto elapsed = runReaders([&](size_t reader) {
+		if (connectionCount == 0) return;
+		for (size_t i = 0; i < lookupsPerReader; ++i)
+		{
+			auto wanted = (i * 7919 + reader) % connectionCount;
+
+			// A lookup may miss a connection that is mid reconnect, but must never return another one
+			table.ReadClient(clients[wanted], [&](const Connection& connection) {
+				if (connection.Client != clients[wanted] || connection.Socket != wanted + 1) mismatches.fetch_add(1);
+			});
+		}
+	});
+	reading.store(false);
+	churn.join();
+
+	result.TableLookupsPerSecond = PerSecond(result.ReaderCount * lookupsPerReader, elapsed);
+	result.ChurnPerSecond = PerSecond(churned.load(), std::chrono::steady_clock::now() - churnStart);
+	result.Mismatches += mismatches.load();
+
+	// Nothing is pinned any more, so three collections drain everything the churn retired
+	table.Clear();
+	for (auto i = 0; i < 3; ++i) EpochCollect();
+	result.Reclaimed = GetEpochReclaimedCount() - reclaimed;
+
+	std::wstringstream wss;
+	wss << std::fixed << std::setprecision(2)
+		<< L"ConnectionTable " << result.ConnectionCount << L" connections, " << result.ReaderCount << L" readers"
+		<< L" | Linear scan " << result.ScanLookupsPerSecond / 1e6 << L" M/sec"
+		<< L" | Table " << result.TableLookupsPerSecond / 1e6 << L" M/sec"
+		<< L" | Churn " << result.ChurnPerSecond / 1e3 << L" K/sec"
+		<< L" | Reclaimed " << result.Reclaimed
+		<< L" | Mismatches " << result.Mismatches;
+	WriteLine(wss.str());
+
+	return result;
+}
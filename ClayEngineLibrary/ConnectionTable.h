@@ -0,0 +1,367 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* Sharded GUID indexed connection table with epoch based reclamation         */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "Services.h"
+
+namespace ClayEngine
+{
+	constexpr auto c_connection_shard_bits{ 4 };
+	constexpr auto c_connection_shards{ 1 << c_connection_shard_bits }; // Independently locked index tables
+	constexpr size_t c_connection_index_minimum{ 64 }; // Entries in a shard's first table
+	constexpr auto c_connection_segment_bits{ 10 };
+	constexpr uint32_t c_connection_segment_length{ 1u << c_connection_segment_bits }; // Slots allocated at once
+	constexpr auto c_connection_max_segments{ 256 }; // 262144 connections per table
+	constexpr size_t c_epoch_retire_batch{ 64 }; // Retired objects gathered before trying to advance the epoch
+
+	using ConnectionHandle = uint64_t; // Generation in the high half, slot in the low half, 0 is no connection
+
+	/// <summary>
+	/// 128 bit connection key, the bytes of a client or server GUID
+	/// </summary>
+	struct ConnectionGuid
+	{
+		uint64_t Low = 0;
+		uint64_t High = 0;
+
+		bool operator==(const ConnectionGuid& rhs) const { return Low == rhs.Low && High == rhs.High; }
+		bool operator!=(const ConnectionGuid& rhs) const { return !(*this == rhs); }
+	};
+
+	#pragma region Epoch Reclamation
+	struct EpochRecord;
+
+	/// <summary>
+	/// Pins the calling thread to the current epoch while it lives, nothing retired from now on is
+	/// reclaimed until it goes. Pinning is two stores to the thread's own record, guards nest.
+	/// </summary>
+	class EpochGuard
+	{
+		EpochRecord* m_record = nullptr;
+
+	public:
+		EpochGuard();
+		~EpochGuard();
+
+		EpochGuard(const EpochGuard&) = delete;
+		EpochGuard& operator=(const EpochGuard&) = delete;
+	};
+
+	/// <summary>
+	/// Runs reclaim once every thread pinned now has let go. The object must already be unreachable
+	/// for readers that pin after this call.
+	/// </summary>
+	void EpochRetire(std::function<void()> reclaim);
+	/// <summary>
+	/// Advances the epoch when no thread is pinned to an older one and runs what has become safe,
+	/// returns how many. EpochRetire calls it every c_epoch_retire_batch objects.
+	/// </summary>
+	size_t EpochCollect();
+	size_t GetEpochPendingCount();
+	size_t GetEpochReclaimedCount();
+	#pragma endregion
+
+	/// <summary>
+	/// GUID to handle index split into c_connection_shards open addressing tables by hash. Writers
+	/// take their shard's lock, readers take none and must hold an EpochGuard: an entry's key is
+	/// written before its handle is published and never changes afterwards, erasing only marks the
+	/// handle, and a table that fills up is copied to a new one and the old one retired.
+	/// </summary>
+	class ConnectionIndex
+	{
+		struct Shard;
+
+		std::unique_ptr<Shard[]> m_shards; // No initializer, Shard is only complete in ConnectionTable.cpp
+
+	public:
+		ConnectionIndex();
+		~ConnectionIndex();
+
+		ConnectionIndex(const ConnectionIndex&) = delete;
+		ConnectionIndex& operator=(const ConnectionIndex&) = delete;
+
+		static uint64_t Hash(const ConnectionGuid& guid);
+
+		/// <summary>
+		/// Handle stored for guid, 0 when it is absent
+		/// </summary>
+		ConnectionHandle Find(const ConnectionGuid& guid) const;
+		/// <summary>
+		/// Adds guid, returns false when it is already present
+		/// </summary>
+		bool Insert(const ConnectionGuid& guid, ConnectionHandle handle);
+		/// <summary>
+		/// Removes guid when it maps to handle
+		/// </summary>
+		bool Erase(const ConnectionGuid& guid, ConnectionHandle handle);
+		void Clear();
+
+		size_t GetSize() const;
+	};
+
+	/// <summary>
+	/// Connections in slots that never move, reachable by handle or by either GUID. A handle carries
+	/// its slot's generation, so a handle kept past a disconnect stops resolving instead of reaching
+	/// the connection that reused the slot. Lookups from worker threads take no lock; Insert and
+	/// Remove serialize on one mutex, and a removed connection is deleted through EpochRetire once no
+	/// reader can still be looking at it.
+	/// </summary>
+	template<typename T>
+	class ConnectionTable
+	{
+		struct Slot
+		{
+			std::atomic<uint32_t> Generation = 0;
+			std::atomic<T*> Value = nullptr;
+			ConnectionGuid Client = {};
+			ConnectionGuid Server = {};
+		};
+		using Segment = std::array<Slot, c_connection_segment_length>;
+
+		std::array<std::atomic<Segment*>, c_connection_max_segments> m_segments = {};
+		std::atomic<uint32_t> m_slot_count = 0; // Slots handed out so far, the rest of the last segment is unused
+
+		MUTEX m_mutex = {};
+		std::vector<uint32_t> m_free = {};
+		std::atomic<size_t> m_size = 0;
+
+		ConnectionIndex m_clients = {};
+		ConnectionIndex m_servers = {};
+
+		Slot* slot(ConnectionHandle handle) const
+		{
+			auto index = static_cast<uint32_t>(handle);
+			if (index >= m_slot_count.load(std::memory_order_acquire)) return nullptr;
+			return &(*m_segments[index >> c_connection_segment_bits].load(std::memory_order_acquire))[index & (c_connection_segment_length - 1)];
+		}
+
+		T* remove(ConnectionHandle handle)
+		{
+			auto target = slot(handle);
+			auto generation = static_cast<uint32_t>(handle >> 32);
+			if (!target || target->Generation.load(std::memory_order_relaxed) != generation) return nullptr;
+
+			// The generation moves first, a reader that still gets the value sees it changed and backs off
+			auto next = generation + 1;
+			target->Generation.store(next == 0 ? 1 : next, std::memory_order_release);
+			auto value = target->Value.exchange(nullptr, std::memory_order_acq_rel);
+
+			m_clients.Erase(target->Client, handle);
+			m_servers.Erase(target->Server, handle);
+			m_free.push_back(static_cast<uint32_t>(handle));
+			m_size.fetch_sub(1, std::memory_order_relaxed);
+			return value;
+		}
+
+		// Both insert and remove expect m_mutex held
+		ConnectionHandle insert(const ConnectionGuid& client, const ConnectionGuid& server, std::unique_ptr<T>& value)
+		{
+			uint32_t index = 0;
+			if (m_free.empty())
+			{
+				index = m_slot_count.load(std::memory_order_relaxed);
+				auto segment = index >> c_connection_segment_bits;
+				if (segment == c_connection_max_segments) throw std::runtime_error("ClayEngine::ConnectionTable connection limit reached");
+				if (!m_segments[segment].load(std::memory_order_relaxed)) m_segments[segment].store(new Segment(), std::memory_order_release);
+				m_slot_count.store(index + 1, std::memory_order_release);
+			}
+			else
+			{
+				index = m_free.back();
+				m_free.pop_back();
+			}
+
+			auto& target = *slot(index);
+			auto generation = target.Generation.load(std::memory_order_relaxed);
+			if (generation == 0) target.Generation.store(generation = 1, std::memory_order_release);
+			auto handle = (static_cast<uint64_t>(generation) << 32) | index;
+
+			target.Client = client;
+			target.Server = server;
+			target.Value.store(value.release(), std::memory_order_release);
+
+			m_clients.Insert(client, handle);
+			m_servers.Insert(server, handle);
+			m_size.fetch_add(1, std::memory_order_relaxed);
+			return handle;
+		}
+
+	public:
+		ConnectionTable() = default;
+		~ConnectionTable()
+		{
+			// Nobody may read a table being destroyed, so values go now rather than through the epoch
+			for (uint32_t i = 0; i < m_slot_count.load(); ++i) delete (*m_segments[i >> c_connection_segment_bits].load())[i & (c_connection_segment_length - 1)].Value.load();
+			for (auto& segment : m_segments) delete segment.load();
+		}
+
+		ConnectionTable(const ConnectionTable&) = delete;
+		ConnectionTable& operator=(const ConnectionTable&) = delete;
+
+		/// <summary>
+		/// Adds value under both GUIDs and returns its handle, 0 when either GUID is already in use
+		/// </summary>
+		ConnectionHandle Insert(const ConnectionGuid& client, const ConnectionGuid& server, std::unique_ptr<T> value)
+		{
+			LockGuard lock(m_mutex);
+			{
+				EpochGuard guard;
+				if (m_clients.Find(client) != 0 || m_servers.Find(server) != 0) return 0;
+			}
+
+			return insert(client, server, value);
+		}
+
+		/// <summary>
+		/// Adds value like Insert, first removing the connection already holding client, which is deleted
+		/// like a removed one. For a client that reconnects before its old connection was seen to close.
+		/// Returns 0 when server belongs to another client.
+		/// </summary>
+		ConnectionHandle Replace(const ConnectionGuid& client, const ConnectionGuid& server, std::unique_ptr<T> value)
+		{
+			T* stale = nullptr;
+			ConnectionHandle handle = 0;
+			{
+				LockGuard lock(m_mutex);
+				ConnectionHandle existing = 0, owner = 0;
+				{
+					EpochGuard guard;
+					existing = m_clients.Find(client);
+					owner = m_servers.Find(server);
+				}
+				if (owner != 0 && owner != existing) return 0;
+
+				if (existing != 0) stale = remove(existing);
+				handle = insert(client, server, value);
+			}
+			if (stale) EpochRetire([stale] { delete stale; });
+			return handle;
+		}
+
+		/// <summary>
+		/// Removes the connection, it is deleted once every reader that could see it is done
+		/// </summary>
+		bool Remove(ConnectionHandle handle)
+		{
+			T* value = nullptr;
+			{
+				LockGuard lock(m_mutex);
+				value = remove(handle);
+			}
+			if (!value) return false;
+
+			EpochRetire([value] { delete value; });
+			return true;
+		}
+
+		void Clear()
+		{
+			std::vector<T*> values = {};
+			{
+				LockGuard lock(m_mutex);
+				for (uint32_t i = 0; i < m_slot_count.load(std::memory_order_relaxed); ++i)
+				{
+					auto& target = *slot(i);
+					auto handle = (static_cast<uint64_t>(target.Generation.load(std::memory_order_relaxed)) << 32) | i;
+					if (target.Value.load(std::memory_order_relaxed)) values.push_back(remove(handle));
+				}
+			}
+
+			for (auto value : values) EpochRetire([value] { delete value; });
+		}
+
+		ConnectionHandle FindClient(const ConnectionGuid& client) const
+		{
+			EpochGuard guard;
+			return m_clients.Find(client);
+		}
+		ConnectionHandle FindServer(const ConnectionGuid& server) const
+		{
+			EpochGuard guard;
+			return m_servers.Find(server);
+		}
+
+		/// <summary>
+		/// Calls visitor(T&) when handle still names a connection, the reference is only valid during the call
+		/// </summary>
+		template<typename Visitor>
+		bool Read(ConnectionHandle handle, Visitor visitor) const
+		{
+			EpochGuard guard;
+
+			auto target = slot(handle);
+			auto generation = static_cast<uint32_t>(handle >> 32);
+			if (!target || target->Generation.load(std::memory_order_acquire) != generation) return false;
+
+			auto value = target->Value.load(std::memory_order_acquire);
+			if (!value || target->Generation.load(std::memory_order_acquire) != generation) return false;
+
+			visitor(*value);
+			return true;
+		}
+
+		template<typename Visitor>
+		bool ReadClient(const ConnectionGuid& client, Visitor visitor) const
+		{
+			EpochGuard guard;
+			return Read(m_clients.Find(client), visitor);
+		}
+
+		template<typename Visitor>
+		bool ReadServer(const ConnectionGuid& server, Visitor visitor) const
+		{
+			EpochGuard guard;
+			return Read(m_servers.Find(server), visitor);
+		}
+
+		/// <summary>
+		/// Calls visitor(handle, T&) for every connection, without blocking writers
+		/// </summary>
+		template<typename Visitor>
+		void ForEach(Visitor visitor) const
+		{
+			EpochGuard guard;
+
+			auto count = m_slot_count.load(std::memory_order_acquire);
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				auto& target = *slot(i);
+				auto generation = target.Generation.load(std::memory_order_acquire);
+				auto value = target.Value.load(std::memory_order_acquire);
+				if (value && target.Generation.load(std::memory_order_acquire) == generation) visitor((static_cast<uint64_t>(generation) << 32) | i, *value);
+			}
+		}
+
+		size_t GetSize() const { return m_size.load(std::memory_order_relaxed); }
+	};
+
+	struct ConnectionTableBenchmark
+	{
+		size_t ConnectionCount = 0;
+		size_t ReaderCount = 0;
+		double ScanLookupsPerSecond = 0.; // Linear search under one mutex, what ConnectedClientManager did
+		double TableLookupsPerSecond = 0.; // ConnectionTable by client GUID while connections churn
+		double ChurnPerSecond = 0.; // Disconnect and reconnect pairs during the table lookups
+		size_t Reclaimed = 0; // Objects the epoch collector deleted
+		size_t Mismatches = 0; // Lookups that returned another connection, should be 0
+	};
+
+	/// <summary>
+	/// Fills a table with connectionCount connections, looks them up by client GUID from readerCount
+	/// threads while another thread disconnects and reconnects, compares with a locked linear scan and
+	/// writes the lookups per second to the console
+	/// </summary>
+	ConnectionTableBenchmark RunConnectionTableBenchmark(size_t connectionCount = 10000, size_t readerCount = 4, size_t lookupsPerReader = 1u << 20);
+}
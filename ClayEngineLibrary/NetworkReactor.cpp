@@ -0,0 +1,2002 @@
+#include "pch.h"
+#include "NetworkReactor.h"
+#include "Benchmark.h"
+#include "BufferPool.h"
+
+#if defined(__linux__)
+#include <atomic>
+#include <cstring>
+#include <queue>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace ClayEngine;
+
+#if defined(__linux__)
+namespace
+{
+	constexpr auto c_bench_client_threads{ 4 };
+	constexpr auto c_bench_message_length{ 32 };
+	constexpr auto c_bench_window{ 16 }; // Messages each client connection keeps in flight
+	constexpr auto c_bench_latency_samples{ 4096 };
+	constexpr auto c_bench_wakeups{ 1 << 16 };
+	constexpr auto c_bench_datagrams{ 1 << 15 }; // Round trips per datagram client thread
+	constexpr auto c_bench_timeout{ std::chrono::seconds(10) };
+
+	/// <summary>
+	/// Host names, addresses and port numbers are ASCII, anything else is refused rather than mangled
+	/// </summary>
+	String toAscii(const Unicode& text)
+	{
+		String result = {};
+		result.reserve(text.size());
+		for (auto c : text)
+		{
+			if (c <= 0 || c > 0x7F) throw std::runtime_error("ClayEngine::NetworkReactor address is not ASCII");
+			result += static_cast<char>(c);
+		}
+		return result;
+	}
+
+	/// <summary>
+	/// Resolves a passive bind address for the given socket type
+	/// </summary>
+	void resolveBind(const Unicode& address, const Unicode& port, int socktype, sockaddr_storage& bind_address, socklen_t& bind_length)
+	{
+		auto host = toAscii(address);
+		auto service = toAscii(port);
+
+		addrinfo hints = {};
+		hints.ai_flags = AI_PASSIVE;
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = socktype;
+		hints.ai_protocol = socktype == SOCK_DGRAM ? IPPROTO_UDP : IPPROTO_TCP;
+
+		addrinfo* info = nullptr;
+		if (getaddrinfo(host.empty() ? nullptr : host.c_str(), service.c_str(), &hints, &info) != 0)
+			throw std::runtime_error("ClayEngine::NetworkReactor getaddrinfo() FAILED");
+
+		bind_address = {};
+		memcpy(&bind_address, info->ai_addr, info->ai_addrlen);
+		bind_length = info->ai_addrlen;
+		freeaddrinfo(info);
+	}
+
+	/// <summary>
+	/// Opens a non-blocking SO_REUSEPORT socket bound to bind_address, on port bound once an earlier
+	/// socket of the same Listen has picked it. Returns -1 on failure, bound is set by the first socket.
+	/// </summary>
+	int openBound(sockaddr_storage& bind_address, socklen_t bind_length, int socktype, uint16_t& bound)
+	{
+		auto family = bind_address.ss_family;
+		auto socket = ::socket(family, socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, socktype == SOCK_DGRAM ? IPPROTO_UDP : IPPROTO_TCP);
+		if (socket < 0) return -1;
+
+		// Once the first socket has picked a port the others have to share it
+		if (bound != 0 && family == AF_INET) reinterpret_cast<sockaddr_in*>(&bind_address)->sin_port = htons(bound);
+		if (bound != 0 && family == AF_INET6) reinterpret_cast<sockaddr_in6*>(&bind_address)->sin6_port = htons(bound);
+
+		int enable = 1;
+		setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+		setsockopt(socket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable));
+		if (socktype == SOCK_STREAM) setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+		auto failed = bind(socket, reinterpret_cast<sockaddr*>(&bind_address), bind_length) < 0
+			|| (socktype == SOCK_STREAM && listen(socket, SOMAXCONN) < 0);
+		if (!failed && bound == 0)
+		{
+			sockaddr_storage local = {};
+			socklen_t length = sizeof(local);
+			failed = getsockname(socket, reinterpret_cast<sockaddr*>(&local), &length) < 0;
+			bound = ntohs(local.ss_family == AF_INET6 ? reinterpret_cast<sockaddr_in6*>(&local)->sin6_port : reinterpret_cast<sockaddr_in*>(&local)->sin_port);
+		}
+
+		if (failed)
+		{
+			close(socket);
+			return -1;
+		}
+		return socket;
+	}
+
+	enum class WatchKind : uint8_t
+	{
+		Listener,
+		Connection,
+		Datagram,
+		Wakeup,
+	};
+
+	/// <summary>
+	/// Leading member of everything registered with an epoll set, the event's data pointer points at it
+	/// </summary>
+	struct Watch
+	{
+		WatchKind Kind = WatchKind::Wakeup;
+	};
+
+	struct Listener : Watch
+	{
+		int Socket = -1;
+		const ReactorHandler* Handler = nullptr;
+	};
+	using ListenerPtr = std::unique_ptr<Listener>;
+
+	struct DatagramSocket : Watch
+	{
+		int Socket = -1;
+		ReactorDatagramPort Port = 0;
+		const ReactorDatagramHandler* Handler = nullptr;
+	};
+	using DatagramSocketPtr = std::unique_ptr<DatagramSocket>;
+
+	struct Timer
+	{
+		ReactorMilliseconds Period = {};
+		ReactorTask Task = {};
+	};
+	using TimerDue = std::pair<std::chrono::steady_clock::time_point, ReactorTimer>;
+
+	/// <summary>
+	/// Timers of one worker in a heap by due time, the caller holds the worker's mutex. Cancelled
+	/// timers leave their heap entry behind and it is dropped when it reaches the top.
+	/// </summary>
+	struct TimerQueue
+	{
+		std::priority_queue<TimerDue, std::vector<TimerDue>, std::greater<TimerDue>> Due = {};
+		std::unordered_map<ReactorTimer, Timer> Timers = {};
+
+		void Add(ReactorTimer timer, ReactorMilliseconds delay, ReactorMilliseconds period, ReactorTask task)
+		{
+			Timers.emplace(timer, Timer{ period, std::move(task) });
+			Due.emplace(std::chrono::steady_clock::now() + delay, timer);
+		}
+
+		bool Cancel(ReactorTimer timer)
+		{
+			return Timers.erase(timer) > 0;
+		}
+
+		/// <summary>
+		/// Milliseconds until the next timer is due, -1 when there is none
+		/// </summary>
+		int Timeout()
+		{
+			while (!Due.empty() && Timers.count(Due.top().second) == 0) Due.pop();
+			if (Due.empty()) return -1;
+
+			auto remaining = Due.top().first - std::chrono::steady_clock::now();
+			if (remaining <= std::chrono::steady_clock::duration::zero()) return 0;
+
+			// Round up so a wait never ends just before the timer is due
+			return static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(remaining).count());
+		}
+
+		void TakeDue(std::vector<ReactorTask>& due)
+		{
+			auto now = std::chrono::steady_clock::now();
+			while (!Due.empty() && Due.top().first <= now)
+			{
+				auto entry = Due.top();
+				Due.pop();
+
+				auto it = Timers.find(entry.second);
+				if (it == Timers.end()) continue;
+
+				// Periodic timers are rescheduled before running, so a task may cancel its own timer
+				if (it->second.Period.count() > 0)
+				{
+					due.push_back(it->second.Task);
+					Due.emplace(entry.first + it->second.Period, entry.second);
+				}
+				else
+				{
+					due.emplace_back(std::move(it->second.Task));
+					Timers.erase(it);
+				}
+			}
+		}
+	};
+
+	/// <summary>
+	/// Opens count non-blocking listen sockets on one address and port, sharing it through SO_REUSEPORT
+	/// so the kernel spreads incoming connections across them. Port "0" lets the first one pick, the
+	/// port is returned in bound. TCP_NODELAY is set here since accepted sockets inherit it.
+	/// </summary>
+	std::vector<int> openListenSockets(const Unicode& address, const Unicode& port, size_t count, uint16_t& bound)
+	{
+		sockaddr_storage bind_address = {};
+		socklen_t bind_length = 0;
+		resolveBind(address, port, SOCK_STREAM, bind_address, bind_length);
+
+		std::vector<int> sockets = {};
+		bound = 0;
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			auto listener = openBound(bind_address, bind_length, SOCK_STREAM, bound);
+			if (listener < 0)
+			{
+				for (auto element : sockets) close(element);
+				throw std::runtime_error("ClayEngine::NetworkReactor bind() FAILED");
+			}
+
+			sockets.push_back(listener);
+		}
+
+		return sockets;
+	}
+
+	/// <summary>
+	/// Opens count non-blocking UDP sockets on one address and port the same way, so each worker reads
+	/// its own and the kernel keeps a peer on one of them
+	/// </summary>
+	std::vector<int> openDatagramSockets(const Unicode& address, const Unicode& port, size_t count, uint16_t& bound)
+	{
+		sockaddr_storage bind_address = {};
+		socklen_t bind_length = 0;
+		resolveBind(address, port, SOCK_DGRAM, bind_address, bind_length);
+
+		std::vector<int> sockets = {};
+		bound = 0;
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			auto datagram = openBound(bind_address, bind_length, SOCK_DGRAM, bound);
+			if (datagram < 0)
+			{
+				for (auto element : sockets) close(element);
+				throw std::runtime_error("ClayEngine::NetworkReactor bind() FAILED");
+			}
+
+			sockets.push_back(datagram);
+		}
+
+		return sockets;
+	}
+
+	/// <summary>
+	/// Reads every datagram queued on the socket into buffer and hands each to the handler
+	/// </summary>
+	void drainDatagrams(const DatagramSocket& datagram, uint8_t* buffer, size_t length, std::atomic<uint64_t>& syscalls)
+	{
+		ReactorEndpoint from = {};
+		from.Port = datagram.Port;
+
+		while (true)
+		{
+			socklen_t address_length = static_cast<socklen_t>(from.Address.size());
+			syscalls.fetch_add(1, std::memory_order_relaxed);
+			auto received = recvfrom(datagram.Socket, buffer, length, 0, reinterpret_cast<sockaddr*>(from.Address.data()), &address_length);
+			if (received >= 0)
+			{
+				from.AddressLength = static_cast<uint32_t>(address_length);
+				if (datagram.Handler->OnReceive) datagram.Handler->OnReceive(from, buffer, static_cast<size_t>(received));
+			}
+			else if (errno == EINTR) continue;
+			else return;
+		}
+	}
+
+	/// <summary>
+	/// One sendto, UDP sockets take concurrent senders so any thread may call it
+	/// </summary>
+	bool sendDatagram(int socket, const ReactorEndpoint& endpoint, const void* data, size_t length, std::atomic<uint64_t>& syscalls)
+	{
+		while (true)
+		{
+			syscalls.fetch_add(1, std::memory_order_relaxed);
+			auto written = sendto(socket, data, length, MSG_NOSIGNAL | MSG_DONTWAIT, reinterpret_cast<const sockaddr*>(endpoint.Address.data()), endpoint.AddressLength);
+			if (written >= 0) return true;
+			if (errno != EINTR) return false;
+		}
+	}
+}
+
+#pragma region Epoll Reactor Declarations
+namespace
+{
+	/// <summary>
+	/// Connections are owned by the worker that accepted them, only it reads and tears them down.
+	/// Other threads reach them through the connection table to send or shut them down, which is why
+	/// they are shared and why the socket is only touched under Mutex while Closed is false.
+	/// </summary>
+	struct Connection : Watch
+	{
+		int Socket = -1;
+		ReactorConnection Id = 0;
+		const ReactorHandler* Handler = nullptr;
+		std::atomic<uint64_t>* Syscalls = nullptr; // Owning worker's count
+
+		MUTEX Mutex = {};
+		std::vector<uint8_t> Outbound = {}; // Bytes the socket would not take yet
+		size_t Sent = 0; // Bytes of Outbound already written
+		bool Closed = false;
+	};
+	using ConnectionPtr = std::shared_ptr<Connection>;
+
+	class EpollReactor;
+
+	struct EpollReactorFunctor
+	{
+		void operator()(FUTURE future, EpollReactor* reactor, size_t worker);
+	};
+
+	/// <summary>
+	/// One epoll set per worker. Every Listen and ListenDatagram opens a SO_REUSEPORT socket per worker
+	/// so the kernel spreads incoming connections and datagram peers across them and an accepted socket
+	/// never changes threads. All
+	/// sockets are edge triggered: reads drain until the socket is empty, writes go straight out from
+	/// Send and only what the socket refuses waits for the next EPOLLOUT edge. Timers sit in a heap
+	/// per worker that bounds the epoll_wait timeout, and an eventfd wakes a worker for posted tasks.
+	/// </summary>
+	class EpollReactor : public NetworkReactor
+	{
+		friend struct EpollReactorFunctor;
+
+		struct Worker
+		{
+			THREAD Thread;
+			PROMISE Promise = {};
+			std::atomic<uint64_t> Syscalls = 0;
+
+			int Queue = -1; // epoll set
+			int Wakeup = -1; // eventfd
+			Watch WakeupWatch = {};
+			std::vector<uint8_t> Buffer = {};
+
+			MUTEX Mutex = {};
+			std::vector<ReactorTask> Tasks = {};
+			TimerQueue Timers = {};
+		};
+		using WorkerPtr = std::unique_ptr<Worker>;
+
+		std::vector<WorkerPtr> m_workers = {};
+
+		MUTEX m_listeners_mutex = {};
+		std::vector<ListenerPtr> m_listeners = {};
+		std::vector<std::unique_ptr<ReactorHandler>> m_handlers = {};
+		std::vector<std::unique_ptr<ReactorDatagramHandler>> m_datagram_handlers = {};
+
+		mutable std::shared_mutex m_datagrams_mutex = {};
+		std::vector<DatagramSocketPtr> m_datagrams = {}; // Indexed by ReactorDatagramPort
+
+		mutable std::shared_mutex m_connections_mutex = {};
+		std::unordered_map<ReactorConnection, ConnectionPtr> m_connections = {};
+
+		std::atomic<uint64_t> m_generation = 0;
+		std::atomic<uint64_t> m_timer_sequence = 0;
+		std::atomic<size_t> m_next_worker = 0;
+
+		void wake(Worker& worker);
+		int waitTimeout(Worker& worker);
+		void dispatch(Worker& worker, const epoll_event& event);
+		void accept(Worker& worker, Listener& listener);
+		void receive(Worker& worker, Connection& connection, uint32_t events);
+		void receiveDatagrams(Worker& worker, DatagramSocket& datagram);
+		void flush(Connection& connection);
+		void teardown(Worker& worker, Connection& connection);
+		void runTimers(Worker& worker);
+		void runTasks(Worker& worker);
+		ConnectionPtr findConnection(ReactorConnection connection) const;
+
+	public:
+		EpollReactor(size_t workers);
+		~EpollReactor();
+
+		EpollReactor(const EpollReactor&) = delete;
+		EpollReactor& operator=(const EpollReactor&) = delete;
+
+		uint16_t Listen(Unicode address, Unicode port, ReactorHandler handler) override;
+		uint16_t ListenDatagram(Unicode address, Unicode port, ReactorDatagramHandler handler) override;
+		bool Send(ReactorConnection connection, const void* data, size_t length) override;
+		void Close(ReactorConnection connection) override;
+		bool SendDatagram(const ReactorEndpoint& endpoint, const void* data, size_t length) override;
+		ReactorTimer AddTimer(ReactorMilliseconds delay, ReactorMilliseconds period, ReactorTask task) override;
+		bool CancelTimer(ReactorTimer timer) override;
+		void Post(ReactorTask task) override;
+
+		size_t GetWorkerCount() const override { return m_workers.size(); }
+		Unicode GetBackendName() const override { return L"epoll"; }
+		uint64_t GetSyscallCount() const override;
+	};
+}
+#pragma endregion
+
+#pragma region Epoll Reactor Functor Implementation
+void EpollReactorFunctor::operator()(FUTURE future, EpollReactor* reactor, size_t worker)
+{
+	auto& element = *reactor->m_workers[worker];
+	std::array<epoll_event, c_reactor_events> events = {};
+
+	while (future.wait_for(std::chrono::milliseconds(0)) == std::future_status::timeout)
+	{
+		auto timeout = reactor->waitTimeout(element);
+
+		element.Syscalls.fetch_add(1, std::memory_order_relaxed);
+		auto count = epoll_wait(element.Queue, events.data(), c_reactor_events, timeout);
+		if (count < 0 && errno != EINTR) break;
+
+		for (auto i = 0; i < count; ++i) reactor->dispatch(element, events[i]);
+
+		reactor->runTimers(element);
+		reactor->runTasks(element);
+	}
+}
+#pragma endregion
+
+#pragma region Epoll Reactor Implementation
+EpollReactor::EpollReactor(size_t workers)
+{
+	if (workers == 0) workers = std::max(1u, std::thread::hardware_concurrency());
+
+	for (size_t i = 0; i < workers; ++i)
+	{
+		auto worker = std::make_unique<Worker>();
+		worker->Buffer.resize(c_reactor_recv_length);
+
+		worker->Queue = epoll_create1(EPOLL_CLOEXEC);
+		worker->Wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+		epoll_event event = {};
+		event.events = EPOLLIN | EPOLLET;
+		event.data.ptr = &worker->WakeupWatch;
+		auto failed = worker->Queue < 0 || worker->Wakeup < 0 || epoll_ctl(worker->Queue, EPOLL_CTL_ADD, worker->Wakeup, &event) < 0;
+
+		m_workers.emplace_back(std::move(worker));
+		if (failed)
+		{
+			for (auto& element : m_workers)
+			{
+				if (element->Queue >= 0) close(element->Queue);
+				if (element->Wakeup >= 0) close(element->Wakeup);
+			}
+			throw std::runtime_error("ClayEngine::EpollReactor epoll_create1() FAILED");
+		}
+	}
+
+	for (size_t i = 0; i < m_workers.size(); ++i)
+	{
+		auto& element = *m_workers[i];
+		element.Thread = THREAD{ EpollReactorFunctor(), std::move(element.Promise.get_future()), this, i };
+	}
+}
+
+EpollReactor::~EpollReactor()
+{
+	for (auto& element : m_workers)
+	{
+		element->Promise.set_value();
+		wake(*element);
+	}
+
+	for (auto& element : m_workers)
+	{
+		if (element->Thread.joinable()) element->Thread.join();
+	}
+
+	for (auto& element : m_connections) close(element.second->Socket);
+	for (auto& element : m_listeners) close(element->Socket);
+	for (auto& element : m_datagrams) close(element->Socket);
+	for (auto& element : m_workers)
+	{
+		close(element->Queue);
+		close(element->Wakeup);
+	}
+}
+
+uint16_t EpollReactor::Listen(Unicode address, Unicode port, ReactorHandler handler)
+{
+	uint16_t bound = 0;
+	auto sockets = openListenSockets(address, port, m_workers.size(), bound);
+
+	LockGuard lock(m_listeners_mutex);
+
+	m_handlers.emplace_back(std::make_unique<ReactorHandler>(std::move(handler)));
+	for (size_t i = 0; i < sockets.size(); ++i)
+	{
+		auto listener = std::make_unique<Listener>();
+		listener->Kind = WatchKind::Listener;
+		listener->Socket = sockets[i];
+		listener->Handler = m_handlers.back().get();
+
+		epoll_event event = {};
+		event.events = EPOLLIN | EPOLLET;
+		event.data.ptr = listener.get();
+		if (epoll_ctl(m_workers[i]->Queue, EPOLL_CTL_ADD, listener->Socket, &event) < 0)
+		{
+			// The ones already registered stay owned by m_listeners, they just stop accepting
+			for (auto j = i; j < sockets.size(); ++j) close(sockets[j]);
+			for (auto j = m_listeners.size() - i; j < m_listeners.size(); ++j) shutdown(m_listeners[j]->Socket, SHUT_RDWR);
+			throw std::runtime_error("ClayEngine::EpollReactor epoll_ctl() FAILED");
+		}
+
+		m_listeners.emplace_back(std::move(listener));
+	}
+
+	return bound;
+}
+
+uint16_t EpollReactor::ListenDatagram(Unicode address, Unicode port, ReactorDatagramHandler handler)
+{
+	uint16_t bound = 0;
+	auto sockets = openDatagramSockets(address, port, m_workers.size(), bound);
+
+	LockGuard lock(m_listeners_mutex);
+	std::unique_lock<std::shared_mutex> datagrams_lock(m_datagrams_mutex);
+
+	m_datagram_handlers.emplace_back(std::make_unique<ReactorDatagramHandler>(std::move(handler)));
+	for (size_t i = 0; i < sockets.size(); ++i)
+	{
+		auto datagram = std::make_unique<DatagramSocket>();
+		datagram->Kind = WatchKind::Datagram;
+		datagram->Socket = sockets[i];
+		datagram->Port = static_cast<ReactorDatagramPort>(m_datagrams.size());
+		datagram->Handler = m_datagram_handlers.back().get();
+
+		// Owned by m_datagrams either way, a socket that could not be registered just never reads
+		epoll_event event = {};
+		event.events = EPOLLIN | EPOLLET;
+		event.data.ptr = datagram.get();
+		if (epoll_ctl(m_workers[i]->Queue, EPOLL_CTL_ADD, datagram->Socket, &event) < 0) shutdown(datagram->Socket, SHUT_RDWR);
+
+		m_datagrams.emplace_back(std::move(datagram));
+	}
+
+	return bound;
+}
+
+bool EpollReactor::Send(ReactorConnection connection, const void* data, size_t length)
+{
+	auto target = findConnection(connection);
+	if (!target) return false;
+
+	LockGuard lock(target->Mutex);
+	if (target->Closed) return false;
+
+	auto bytes = static_cast<const uint8_t*>(data);
+	if (target->Sent == target->Outbound.size())
+	{
+		target->Outbound.clear();
+		target->Sent = 0;
+
+		while (length > 0)
+		{
+			target->Syscalls->fetch_add(1, std::memory_order_relaxed);
+			auto written = send(target->Socket, bytes, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+			if (written > 0)
+			{
+				bytes += written;
+				length -= static_cast<size_t>(written);
+			}
+			else if (written < 0 && errno == EINTR) continue;
+			else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+			else
+			{
+				shutdown(target->Socket, SHUT_RDWR);
+				return false;
+			}
+		}
+	}
+
+	target->Outbound.insert(target->Outbound.end(), bytes, bytes + length);
+	return true;
+}
+
+bool EpollReactor::SendDatagram(const ReactorEndpoint& endpoint, const void* data, size_t length)
+{
+	int socket = -1;
+	{
+		std::shared_lock<std::shared_mutex> lock(m_datagrams_mutex);
+		if (endpoint.Port >= m_datagrams.size()) return false;
+		socket = m_datagrams[endpoint.Port]->Socket;
+	}
+
+	// Ports are handed out a worker's worth at a time, so the port picks the socket's worker
+	return sendDatagram(socket, endpoint, data, length, m_workers[endpoint.Port % m_workers.size()]->Syscalls);
+}
+
+void EpollReactor::Close(ReactorConnection connection)
+{
+	auto target = findConnection(connection);
+	if (!target) return;
+
+	// The worker sees the hang up and tears the connection down on its own thread
+	LockGuard lock(target->Mutex);
+	if (!target->Closed)
+	{
+		target->Syscalls->fetch_add(1, std::memory_order_relaxed);
+		shutdown(target->Socket, SHUT_RDWR);
+	}
+}
+
+ReactorTimer EpollReactor::AddTimer(ReactorMilliseconds delay, ReactorMilliseconds period, ReactorTask task)
+{
+	// The owning worker is recoverable from the id, so CancelTimer only locks that worker
+	auto worker = m_next_worker.fetch_add(1) % m_workers.size();
+	auto timer = (m_timer_sequence.fetch_add(1) + 1) * m_workers.size() + worker;
+
+	auto& element = *m_workers[worker];
+	{
+		LockGuard lock(element.Mutex);
+		element.Timers.Add(timer, delay, period, std::move(task));
+	}
+	wake(element);
+
+	return timer;
+}
+
+bool EpollReactor::CancelTimer(ReactorTimer timer)
+{
+	auto& element = *m_workers[timer % m_workers.size()];
+
+	LockGuard lock(element.Mutex);
+	return element.Timers.Cancel(timer);
+}
+
+void EpollReactor::Post(ReactorTask task)
+{
+	auto& element = *m_workers[m_next_worker.fetch_add(1) % m_workers.size()];
+
+	auto empty = false;
+	{
+		LockGuard lock(element.Mutex);
+		empty = element.Tasks.empty();
+		element.Tasks.emplace_back(std::move(task));
+	}
+
+	// A task already waiting means its poster has woken the worker and it will take this one too
+	if (empty) wake(element);
+}
+
+uint64_t EpollReactor::GetSyscallCount() const
+{
+	uint64_t count = 0;
+	for (auto& element : m_workers) count += element->Syscalls.load(std::memory_order_relaxed);
+	return count;
+}
+
+void EpollReactor::wake(Worker& worker)
+{
+	uint64_t one = 1;
+	worker.Syscalls.fetch_add(1, std::memory_order_relaxed);
+	while (write(worker.Wakeup, &one, sizeof(one)) < 0 && errno == EINTR) {}
+}
+
+int EpollReactor::waitTimeout(Worker& worker)
+{
+	LockGuard lock(worker.Mutex);
+	if (!worker.Tasks.empty()) return 0;
+
+	return worker.Timers.Timeout();
+}
+
+void EpollReactor::dispatch(Worker& worker, const epoll_event& event)
+{
+	auto watch = static_cast<Watch*>(event.data.ptr);
+	switch (watch->Kind)
+	{
+	case WatchKind::Wakeup:
+	{
+		uint64_t value = 0;
+		worker.Syscalls.fetch_add(1, std::memory_order_relaxed);
+		while (read(worker.Wakeup, &value, sizeof(value)) < 0 && errno == EINTR) {}
+		break;
+	}
+	case WatchKind::Listener:
+		accept(worker, *static_cast<Listener*>(watch));
+		break;
+	case WatchKind::Datagram:
+		receiveDatagrams(worker, *static_cast<DatagramSocket*>(watch));
+		break;
+	case WatchKind::Connection:
+	{
+		auto& connection = *static_cast<Connection*>(watch);
+		if (event.events & EPOLLERR)
+		{
+			teardown(worker, connection);
+			break;
+		}
+		if (event.events & EPOLLOUT) flush(connection);
+		if (event.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) receive(worker, connection, event.events);
+		break;
+	}
+	}
+}
+
+void EpollReactor::accept(Worker& worker, Listener& listener)
+{
+	// Edge triggered, so take everything queued. On EMFILE the rest wait for the next connection.
+	while (true)
+	{
+		worker.Syscalls.fetch_add(1, std::memory_order_relaxed);
+		auto socket = accept4(listener.Socket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (socket < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			break;
+		}
+
+		auto connection = std::make_shared<Connection>();
+		connection->Kind = WatchKind::Connection;
+		connection->Socket = socket;
+		connection->Id = ((m_generation.fetch_add(1) + 1) << 32) | static_cast<uint32_t>(socket);
+		connection->Handler = listener.Handler;
+		connection->Syscalls = &worker.Syscalls;
+
+		{
+			std::unique_lock<std::shared_mutex> lock(m_connections_mutex);
+			m_connections.emplace(connection->Id, connection);
+		}
+
+		epoll_event event = {};
+		event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		event.data.ptr = connection.get();
+		worker.Syscalls.fetch_add(1, std::memory_order_relaxed);
+		if (epoll_ctl(worker.Queue, EPOLL_CTL_ADD, socket, &event) < 0)
+		{
+			std::unique_lock<std::shared_mutex> lock(m_connections_mutex);
+			m_connections.erase(connection->Id);
+			close(socket);
+			continue;
+		}
+
+		if (connection->Handler->OnAccept) connection->Handler->OnAccept(connection->Id);
+	}
+}
+
+void EpollReactor::receive(Worker& worker, Connection& connection, uint32_t events)
+{
+	auto hangup = (events & (EPOLLRDHUP | EPOLLHUP)) != 0;
+
+	while (true)
+	{
+		worker.Syscalls.fetch_add(1, std::memory_order_relaxed);
+		auto length = recv(connection.Socket, worker.Buffer.data(), worker.Buffer.size(), 0);
+		if (length > 0)
+		{
+			if (connection.Handler->OnReceive) connection.Handler->OnReceive(connection.Id, worker.Buffer.data(), static_cast<size_t>(length));
+
+			// A short read emptied the socket, anything later brings a new edge. After a hang up
+			// keep reading until recv reports the end.
+			if (static_cast<size_t>(length) < worker.Buffer.size() && !hangup) return;
+		}
+		else if (length < 0 && errno == EINTR) continue;
+		else if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+		else
+		{
+			teardown(worker, connection);
+			return;
+		}
+	}
+}
+
+void EpollReactor::receiveDatagrams(Worker& worker, DatagramSocket& datagram)
+{
+	// Edge triggered, drain every queued datagram
+	drainDatagrams(datagram, worker.Buffer.data(), worker.Buffer.size(), worker.Syscalls);
+}
+
+void EpollReactor::flush(Connection& connection)
+{
+	LockGuard lock(connection.Mutex);
+	if (connection.Closed) return;
+
+	while (connection.Sent < connection.Outbound.size())
+	{
+		connection.Syscalls->fetch_add(1, std::memory_order_relaxed);
+		auto written = send(connection.Socket, connection.Outbound.data() + connection.Sent, connection.Outbound.size() - connection.Sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (written > 0) connection.Sent += static_cast<size_t>(written);
+		else if (written < 0 && errno == EINTR) continue;
+		else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+		else
+		{
+			shutdown(connection.Socket, SHUT_RDWR);
+			return;
+		}
+	}
+
+	connection.Outbound.clear();
+	connection.Sent = 0;
+}
+
+void EpollReactor::teardown(Worker& worker, Connection& connection)
+{
+	{
+		LockGuard lock(connection.Mutex);
+		if (connection.Closed) return;
+		connection.Closed = true;
+	}
+
+	// Senders on other threads see Closed before the socket number can be reused
+	worker.Syscalls.fetch_add(2, std::memory_order_relaxed);
+	epoll_ctl(worker.Queue, EPOLL_CTL_DEL, connection.Socket, nullptr);
+	close(connection.Socket);
+
+	ConnectionPtr owned = nullptr;
+	{
+		std::unique_lock<std::shared_mutex> lock(m_connections_mutex);
+		auto it = m_connections.find(connection.Id);
+		if (it != m_connections.end())
+		{
+			owned = std::move(it->second);
+			m_connections.erase(it);
+		}
+	}
+
+	if (connection.Handler->OnClose) connection.Handler->OnClose(connection.Id);
+}
+
+void EpollReactor::runTimers(Worker& worker)
+{
+	std::vector<ReactorTask> due = {};
+	{
+		LockGuard lock(worker.Mutex);
+		worker.Timers.TakeDue(due);
+	}
+
+	for (auto& task : due) task();
+}
+
+void EpollReactor::runTasks(Worker& worker)
+{
+	std::vector<ReactorTask> tasks = {};
+	{
+		LockGuard lock(worker.Mutex);
+		tasks.swap(worker.Tasks);
+	}
+
+	for (auto& task : tasks) task();
+}
+
+ConnectionPtr EpollReactor::findConnection(ReactorConnection connection) const
+{
+	std::shared_lock<std::shared_mutex> lock(m_connections_mutex);
+	auto it = m_connections.find(connection);
+	return it == m_connections.end() ? nullptr : it->second;
+}
+#pragma endregion
+
+#pragma region Uring Reactor Declarations
+namespace
+{
+	enum class UringOp : uint8_t
+	{
+		Wakeup = 1,
+		Accept,
+		Recv,
+		Send,
+		Datagram, // Multishot poll on a datagram socket
+		Other, // Shutdown and close, which only complete when they fail
+	};
+
+	/// <summary>
+	/// Completion tag: operation in the top byte, the low 24 bits of the slot generation, then the
+	/// connection slot, listener index or datagram socket index
+	/// </summary>
+	uint64_t uringData(UringOp op, uint32_t generation, uint32_t index)
+	{
+		return (static_cast<uint64_t>(op) << 56) | (static_cast<uint64_t>(generation & 0xFFFFFF) << 32) | index;
+	}
+
+	/// <summary>
+	/// One registered file slot. A slot is only handed back to the kernel once its multishot recv has
+	/// ended and no send is in flight, so no completion can arrive for a previous connection and the
+	/// kernel is done with InFlight before it is reused.
+	/// </summary>
+	struct UringConnection
+	{
+		std::atomic<ReactorConnection> Id = 0; // 0 while the slot is free, read by Send on other threads
+		uint32_t Generation = 0;
+		const ReactorHandler* Handler = nullptr;
+
+		std::vector<uint8_t> Outbound = {}; // Queued since the last send was submitted
+		std::vector<uint8_t> InFlight = {}; // Read by the kernel while Sending
+		size_t Sent = 0; // Bytes of InFlight already sent
+
+		bool Open = false;
+		bool Receiving = false; // Multishot recv armed
+		bool Sending = false;
+		bool Closing = false;
+		bool Dirty = false; // Listed for the next send submission
+	};
+
+	enum class UringCommandKind : uint8_t
+	{
+		Send,
+		Close,
+		Listen,
+		ListenDatagram,
+		Task,
+	};
+
+	/// <summary>
+	/// Work handed to a worker by other threads, only the worker may touch its rings
+	/// </summary>
+	struct UringCommand
+	{
+		UringCommandKind Kind = UringCommandKind::Task;
+		ReactorConnection Connection = 0;
+		std::vector<uint8_t> Data = {};
+		Listener* Target = nullptr;
+		DatagramSocket* Datagram = nullptr;
+		ReactorTask Task = {};
+	};
+
+	class UringReactor;
+
+	struct UringReactorFunctor
+	{
+		void operator()(FUTURE future, UringReactor* reactor, size_t worker);
+	};
+
+	/// <summary>
+	/// Rings, registered files, provided buffers and connection slots of one worker
+	/// </summary>
+	struct UringWorker
+	{
+		uint32_t Index = 0;
+		THREAD Thread;
+		PROMISE Promise = {};
+		std::atomic<uint64_t> Syscalls = 0;
+
+		int Ring = -1;
+		void* RingMap = MAP_FAILED; // Submission and completion rings share one mapping
+		size_t RingMapLength = 0;
+		io_uring_sqe* Sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+		size_t SqesLength = 0;
+		uint32_t* SqHead = nullptr;
+		uint32_t* SqTail = nullptr;
+		uint32_t SqMask = 0;
+		uint32_t SqEntries = 0;
+		uint32_t SqLocalTail = 0; // Prepared entries, published to SqTail on the next enter
+		uint32_t* CqHead = nullptr;
+		uint32_t* CqTail = nullptr;
+		uint32_t CqMask = 0;
+		io_uring_cqe* Cqes = nullptr;
+
+		int Wakeup = -1; // eventfd with a read always queued on the ring
+		uint64_t WakeupValue = 0;
+
+		io_uring_buf_ring* Buffers = static_cast<io_uring_buf_ring*>(MAP_FAILED);
+		size_t BuffersLength = 0;
+		std::vector<BufferHandle> BufferBlocks = {}; // Indexed by buffer id, released after the ring is closed
+		uint16_t BufferTail = 0;
+		BufferHandle DatagramBuffer = {};
+
+		std::unique_ptr<UringConnection[]> Connections = nullptr;
+		std::vector<uint32_t> Dirty = {}; // Slots with Outbound waiting for a send
+		std::vector<Listener*> Listeners = {};
+		std::vector<DatagramSocket*> Datagrams = {};
+		std::vector<uint32_t> PausedAccepts = {}; // Listeners waiting for a free file slot
+
+		MUTEX Mutex = {};
+		std::vector<UringCommand> Commands = {};
+		std::vector<UringCommand> Running = {}; // Commands taken by the worker, kept for the capacity
+		TimerQueue Timers = {};
+
+		~UringWorker();
+	};
+	using UringWorkerPtr = std::unique_ptr<UringWorker>;
+
+	thread_local UringWorker* t_uring_worker = nullptr; // Worker running on this thread, if any
+
+	/// <summary>
+	/// One io_uring per worker, set up for the fewest system calls per message. Every Listen opens a
+	/// SO_REUSEPORT socket per worker with a multishot accept that installs each connection straight
+	/// into the worker's registered file table, so connections never get a normal descriptor. Each
+	/// connection has one multishot recv that picks buffers from the worker's provided buffer ring,
+	/// which are handed back as soon as OnReceive returns; the buffers are blocks of the reactor's
+	/// BufferPool. Sends made during a loop are gathered per connection into a single send, and the
+	/// whole loop's submissions go in with the same io_uring_enter that waits for the next completions,
+	/// bounded by the timer heap. Datagram sockets keep a normal descriptor with a multishot poll on
+	/// the ring, the worker drains them with recvfrom and SendDatagram is a plain sendto.
+	/// </summary>
+	class UringReactor : public NetworkReactor
+	{
+		friend struct UringReactorFunctor;
+
+		BufferPool m_pool = {}; // Outlives the workers, which hold its blocks
+		std::vector<UringWorkerPtr> m_workers = {};
+
+		MUTEX m_listeners_mutex = {};
+		std::vector<ListenerPtr> m_listeners = {};
+		std::vector<std::unique_ptr<ReactorHandler>> m_handlers = {};
+		std::vector<std::unique_ptr<ReactorDatagramHandler>> m_datagram_handlers = {};
+
+		mutable std::shared_mutex m_datagrams_mutex = {};
+		std::vector<DatagramSocketPtr> m_datagrams = {}; // Indexed by ReactorDatagramPort
+
+		std::atomic<uint64_t> m_timer_sequence = 0;
+		std::atomic<size_t> m_next_worker = 0;
+
+		void setup(UringWorker& worker);
+		io_uring_sqe* prepare(UringWorker& worker, uint8_t opcode, int fd, uint64_t data);
+		/// <summary>
+		/// Submits the entries the kernel hasn't consumed and, with wait, waits for a completion. True
+		/// when every prepared entry has been consumed.
+		/// </summary>
+		bool enter(UringWorker& worker, bool wait);
+		void reap(UringWorker& worker);
+		void complete(UringWorker& worker, uint64_t data, int result, uint32_t flags);
+
+		void armWakeup(UringWorker& worker);
+		void armAccept(UringWorker& worker, uint32_t listener);
+		void pauseAccept(UringWorker& worker, uint32_t listener);
+		void resumeAccepts(UringWorker& worker);
+		void armRecv(UringWorker& worker, uint32_t slot);
+		void armDatagram(UringWorker& worker, uint32_t datagram);
+		void submitSend(UringWorker& worker, uint32_t slot);
+		void submitSends(UringWorker& worker);
+		void recycle(UringWorker& worker, uint16_t buffer);
+
+		void open(UringWorker& worker, uint32_t slot, const ReactorHandler* handler);
+		void queue(UringWorker& worker, uint32_t slot, const void* data, size_t length);
+		void startClose(UringWorker& worker, uint32_t slot);
+		void finish(UringWorker& worker, uint32_t slot);
+
+		void push(UringWorker& worker, UringCommand command);
+		void wake(UringWorker& worker);
+		void runCommands(UringWorker& worker);
+		void runTimers(UringWorker& worker);
+
+		UringWorker& owner(ReactorConnection connection) const;
+		uint32_t slotOf(ReactorConnection connection) const;
+
+	public:
+		UringReactor(size_t workers);
+		~UringReactor();
+
+		UringReactor(const UringReactor&) = delete;
+		UringReactor& operator=(const UringReactor&) = delete;
+
+		uint16_t Listen(Unicode address, Unicode port, ReactorHandler handler) override;
+		uint16_t ListenDatagram(Unicode address, Unicode port, ReactorDatagramHandler handler) override;
+		bool Send(ReactorConnection connection, const void* data, size_t length) override;
+		void Close(ReactorConnection connection) override;
+		bool SendDatagram(const ReactorEndpoint& endpoint, const void* data, size_t length) override;
+		ReactorTimer AddTimer(ReactorMilliseconds delay, ReactorMilliseconds period, ReactorTask task) override;
+		bool CancelTimer(ReactorTimer timer) override;
+		void Post(ReactorTask task) override;
+
+		size_t GetWorkerCount() const override { return m_workers.size(); }
+		Unicode GetBackendName() const override { return L"io_uring"; }
+		uint64_t GetSyscallCount() const override;
+	};
+}
+#pragma endregion
+
+#pragma region Uring Reactor Functor Implementation
+void UringReactorFunctor::operator()(FUTURE future, UringReactor* reactor, size_t worker)
+{
+	auto& element = *reactor->m_workers[worker];
+	t_uring_worker = &element;
+
+	reactor->armWakeup(element);
+
+	while (future.wait_for(std::chrono::milliseconds(0)) == std::future_status::timeout)
+	{
+		reactor->runCommands(element);
+		reactor->submitSends(element);
+		reactor->enter(element, true);
+		reactor->reap(element);
+		reactor->runTimers(element);
+	}
+
+	t_uring_worker = nullptr;
+}
+#pragma endregion
+
+#pragma region Uring Reactor Implementation
+UringWorker::~UringWorker()
+{
+	// Closing the ring cancels everything queued on it and drops the registered files
+	if (Ring >= 0) close(Ring);
+	if (Wakeup >= 0) close(Wakeup);
+	if (Buffers != MAP_FAILED) munmap(Buffers, BuffersLength);
+	if (Sqes != MAP_FAILED) munmap(Sqes, SqesLength);
+	if (RingMap != MAP_FAILED) munmap(RingMap, RingMapLength);
+}
+
+UringReactor::UringReactor(size_t workers)
+{
+	if (workers == 0) workers = std::max(1u, std::thread::hardware_concurrency());
+
+	for (size_t i = 0; i < workers; ++i)
+	{
+		auto worker = std::make_unique<UringWorker>();
+		worker->Index = static_cast<uint32_t>(i);
+		setup(*worker);
+
+		m_workers.emplace_back(std::move(worker));
+	}
+
+	for (size_t i = 0; i < m_workers.size(); ++i)
+	{
+		auto& element = *m_workers[i];
+		element.Thread = THREAD{ UringReactorFunctor(), std::move(element.Promise.get_future()), this, i };
+	}
+}
+
+UringReactor::~UringReactor()
+{
+	for (auto& element : m_workers)
+	{
+		element->Promise.set_value();
+		wake(*element);
+	}
+
+	for (auto& element : m_workers)
+	{
+		if (element->Thread.joinable()) element->Thread.join();
+	}
+
+	m_workers.clear();
+	for (auto& element : m_listeners) close(element->Socket);
+	for (auto& element : m_datagrams) close(element->Socket);
+}
+
+void UringReactor::setup(UringWorker& worker)
+{
+	io_uring_params params = {};
+	params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+	params.cq_entries = c_uring_entries * 8;
+
+	worker.Ring = static_cast<int>(syscall(__NR_io_uring_setup, c_uring_entries, &params));
+	if (worker.Ring < 0) throw std::runtime_error("ClayEngine::UringReactor io_uring_setup() FAILED");
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG))
+		throw std::runtime_error("ClayEngine::UringReactor kernel too old for io_uring backend");
+
+	worker.RingMapLength = std::max(params.sq_off.array + params.sq_entries * sizeof(uint32_t), params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+	worker.RingMap = mmap(nullptr, worker.RingMapLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, worker.Ring, IORING_OFF_SQ_RING);
+	worker.SqesLength = params.sq_entries * sizeof(io_uring_sqe);
+	worker.Sqes = static_cast<io_uring_sqe*>(mmap(nullptr, worker.SqesLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, worker.Ring, IORING_OFF_SQES));
+	if (worker.RingMap == MAP_FAILED || worker.Sqes == MAP_FAILED) throw std::runtime_error("ClayEngine::UringReactor mmap() FAILED");
+
+	auto ring = static_cast<uint8_t*>(worker.RingMap);
+	worker.SqHead = reinterpret_cast<uint32_t*>(ring + params.sq_off.head);
+	worker.SqTail = reinterpret_cast<uint32_t*>(ring + params.sq_off.tail);
+	worker.SqMask = *reinterpret_cast<uint32_t*>(ring + params.sq_off.ring_mask);
+	worker.SqEntries = params.sq_entries;
+	worker.SqLocalTail = *worker.SqTail;
+	worker.CqHead = reinterpret_cast<uint32_t*>(ring + params.cq_off.head);
+	worker.CqTail = reinterpret_cast<uint32_t*>(ring + params.cq_off.tail);
+	worker.CqMask = *reinterpret_cast<uint32_t*>(ring + params.cq_off.ring_mask);
+	worker.Cqes = reinterpret_cast<io_uring_cqe*>(ring + params.cq_off.cqes);
+
+	// Submission slots map one to one onto entries, the array is never touched again
+	auto array = reinterpret_cast<uint32_t*>(ring + params.sq_off.array);
+	for (uint32_t i = 0; i < worker.SqEntries; ++i) array[i] = i;
+
+	// Sparse table for the connections accepted straight into it
+	io_uring_rsrc_register files = {};
+	files.nr = c_uring_files;
+	files.flags = IORING_RSRC_REGISTER_SPARSE;
+	if (syscall(__NR_io_uring_register, worker.Ring, IORING_REGISTER_FILES2, &files, sizeof(files)) < 0)
+		throw std::runtime_error("ClayEngine::UringReactor IORING_REGISTER_FILES2 FAILED");
+
+	// Provided buffer ring, the kernel picks a buffer per completion so idle connections hold none
+	worker.BuffersLength = c_uring_buffer_count * sizeof(io_uring_buf);
+	worker.Buffers = static_cast<io_uring_buf_ring*>(mmap(nullptr, worker.BuffersLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+	if (worker.Buffers == MAP_FAILED) throw std::runtime_error("ClayEngine::UringReactor mmap() FAILED");
+	m_pool.Reserve(c_uring_buffer_length, c_uring_buffer_count);
+	worker.BufferBlocks.reserve(c_uring_buffer_count);
+	for (uint32_t i = 0; i < c_uring_buffer_count; ++i) worker.BufferBlocks.emplace_back(m_pool.Acquire(c_uring_buffer_length));
+	worker.DatagramBuffer = m_pool.Acquire(c_reactor_recv_length);
+
+	io_uring_buf_reg buffers = {};
+	buffers.ring_addr = reinterpret_cast<uint64_t>(worker.Buffers);
+	buffers.ring_entries = c_uring_buffer_count;
+	buffers.bgid = 0;
+	if (syscall(__NR_io_uring_register, worker.Ring, IORING_REGISTER_PBUF_RING, &buffers, 1) < 0)
+		throw std::runtime_error("ClayEngine::UringReactor IORING_REGISTER_PBUF_RING FAILED");
+	for (uint32_t i = 0; i < c_uring_buffer_count; ++i) recycle(worker, static_cast<uint16_t>(i));
+
+	worker.Wakeup = eventfd(0, EFD_CLOEXEC);
+	if (worker.Wakeup < 0) throw std::runtime_error("ClayEngine::UringReactor eventfd() FAILED");
+
+	worker.Connections = std::make_unique<UringConnection[]>(c_uring_files);
+}
+
+uint16_t UringReactor::Listen(Unicode address, Unicode port, ReactorHandler handler)
+{
+	uint16_t bound = 0;
+	auto sockets = openListenSockets(address, port, m_workers.size(), bound);
+
+	LockGuard lock(m_listeners_mutex);
+
+	m_handlers.emplace_back(std::make_unique<ReactorHandler>(std::move(handler)));
+	for (size_t i = 0; i < sockets.size(); ++i)
+	{
+		auto listener = std::make_unique<Listener>();
+		listener->Kind = WatchKind::Listener;
+		listener->Socket = sockets[i];
+		listener->Handler = m_handlers.back().get();
+
+		// Each worker arms the multishot accept on its own ring
+		UringCommand command = {};
+		command.Kind = UringCommandKind::Listen;
+		command.Target = listener.get();
+		push(*m_workers[i], std::move(command));
+
+		m_listeners.emplace_back(std::move(listener));
+	}
+
+	return bound;
+}
+
+uint16_t UringReactor::ListenDatagram(Unicode address, Unicode port, ReactorDatagramHandler handler)
+{
+	uint16_t bound = 0;
+	auto sockets = openDatagramSockets(address, port, m_workers.size(), bound);
+
+	LockGuard lock(m_listeners_mutex);
+	std::unique_lock<std::shared_mutex> datagrams_lock(m_datagrams_mutex);
+
+	m_datagram_handlers.emplace_back(std::make_unique<ReactorDatagramHandler>(std::move(handler)));
+	for (size_t i = 0; i < sockets.size(); ++i)
+	{
+		auto datagram = std::make_unique<DatagramSocket>();
+		datagram->Kind = WatchKind::Datagram;
+		datagram->Socket = sockets[i];
+		datagram->Port = static_cast<ReactorDatagramPort>(m_datagrams.size());
+		datagram->Handler = m_datagram_handlers.back().get();
+
+		UringCommand command = {};
+		command.Kind = UringCommandKind::ListenDatagram;
+		command.Datagram = datagram.get();
+		push(*m_workers[i], std::move(command));
+
+		m_datagrams.emplace_back(std::move(datagram));
+	}
+
+	return bound;
+}
+
+bool UringReactor::Send(ReactorConnection connection, const void* data, size_t length)
+{
+	auto& worker = owner(connection);
+	auto slot = slotOf(connection);
+	if (slot >= c_uring_files || worker.Connections[slot].Id.load(std::memory_order_acquire) != connection) return false;
+
+	// Callbacks on the owning worker append directly, the loop submits them after the completions
+	if (t_uring_worker == &worker)
+	{
+		auto& target = worker.Connections[slot];
+		if (!target.Open || target.Closing) return false;
+
+		queue(worker, slot, data, length);
+		return true;
+	}
+
+	UringCommand command = {};
+	command.Kind = UringCommandKind::Send;
+	command.Connection = connection;
+	command.Data.assign(static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + length);
+	push(worker, std::move(command));
+	return true;
+}
+
+void UringReactor::Close(ReactorConnection connection)
+{
+	auto& worker = owner(connection);
+	auto slot = slotOf(connection);
+	if (slot >= c_uring_files || worker.Connections[slot].Id.load(std::memory_order_acquire) != connection) return;
+
+	if (t_uring_worker == &worker)
+	{
+		if (worker.Connections[slot].Open) startClose(worker, slot);
+		return;
+	}
+
+	UringCommand command = {};
+	command.Kind = UringCommandKind::Close;
+	command.Connection = connection;
+	push(worker, std::move(command));
+}
+
+bool UringReactor::SendDatagram(const ReactorEndpoint& endpoint, const void* data, size_t length)
+{
+	int socket = -1;
+	{
+		std::shared_lock<std::shared_mutex> lock(m_datagrams_mutex);
+		if (endpoint.Port >= m_datagrams.size()) return false;
+		socket = m_datagrams[endpoint.Port]->Socket;
+	}
+
+	return sendDatagram(socket, endpoint, data, length, m_workers[endpoint.Port % m_workers.size()]->Syscalls);
+}
+
+ReactorTimer UringReactor::AddTimer(ReactorMilliseconds delay, ReactorMilliseconds period, ReactorTask task)
+{
+	auto worker = m_next_worker.fetch_add(1) % m_workers.size();
+	auto timer = (m_timer_sequence.fetch_add(1) + 1) * m_workers.size() + worker;
+
+	auto& element = *m_workers[worker];
+	{
+		LockGuard lock(element.Mutex);
+		element.Timers.Add(timer, delay, period, std::move(task));
+	}
+	wake(element);
+
+	return timer;
+}
+
+bool UringReactor::CancelTimer(ReactorTimer timer)
+{
+	auto& element = *m_workers[timer % m_workers.size()];
+
+	LockGuard lock(element.Mutex);
+	return element.Timers.Cancel(timer);
+}
+
+void UringReactor::Post(ReactorTask task)
+{
+	UringCommand command = {};
+	command.Kind = UringCommandKind::Task;
+	command.Task = std::move(task);
+	push(*m_workers[m_next_worker.fetch_add(1) % m_workers.size()], std::move(command));
+}
+
+uint64_t UringReactor::GetSyscallCount() const
+{
+	uint64_t count = 0;
+	for (auto& element : m_workers) count += element->Syscalls.load(std::memory_order_relaxed);
+	return count;
+}
+
+io_uring_sqe* UringReactor::prepare(UringWorker& worker, uint8_t opcode, int fd, uint64_t data)
+{
+	// Queue full, hand what is prepared to the kernel. An entry is only reused once SqHead has moved
+	// past it, the kernel may still be reading one it was published but hasn't consumed yet.
+	while (worker.SqLocalTail - __atomic_load_n(worker.SqHead, __ATOMIC_ACQUIRE) >= worker.SqEntries)
+	{
+		if (!enter(worker, false)) std::this_thread::yield(); // -EAGAIN or -EBUSY, try again
+	}
+
+	auto sqe = &worker.Sqes[worker.SqLocalTail & worker.SqMask];
+	memset(sqe, 0, sizeof(io_uring_sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->user_data = data;
+
+	++worker.SqLocalTail;
+	return sqe;
+}
+
+bool UringReactor::enter(UringWorker& worker, bool wait)
+{
+	// Everything the kernel hasn't consumed yet, entries a failed enter left behind included
+	auto submit = worker.SqLocalTail - __atomic_load_n(worker.SqHead, __ATOMIC_ACQUIRE);
+	__atomic_store_n(worker.SqTail, worker.SqLocalTail, __ATOMIC_RELEASE);
+
+	// Completions already waiting are reaped first, the wait only happens on an empty queue
+	if (wait) wait = __atomic_load_n(worker.CqTail, __ATOMIC_ACQUIRE) == *worker.CqHead;
+	if (submit == 0 && !wait) return true;
+
+	unsigned flags = 0;
+	io_uring_getevents_arg arg = {};
+	__kernel_timespec timeout = {};
+	if (wait)
+	{
+		flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+
+		int milliseconds = -1;
+		{
+			LockGuard lock(worker.Mutex);
+			milliseconds = worker.Commands.empty() ? worker.Timers.Timeout() : 0;
+		}
+		if (milliseconds >= 0)
+		{
+			timeout.tv_sec = milliseconds / 1000;
+			timeout.tv_nsec = static_cast<long long>(milliseconds % 1000) * 1000000;
+			arg.ts = reinterpret_cast<uint64_t>(&timeout);
+		}
+	}
+
+	worker.Syscalls.fetch_add(1, std::memory_order_relaxed);
+	auto result = syscall(__NR_io_uring_enter, worker.Ring, submit, wait ? 1 : 0, flags, wait ? &arg : nullptr, wait ? sizeof(arg) : 0);
+
+	// -ETIME and -EINTR only end the wait. -EAGAIN and -EBUSY leave entries unconsumed, they go out
+	// with the next enter once the loop has reaped the completions the kernel is holding back.
+	if (result < 0 && errno != ETIME && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+		throw std::runtime_error("ClayEngine::UringReactor io_uring_enter() FAILED");
+
+	return worker.SqLocalTail == __atomic_load_n(worker.SqHead, __ATOMIC_ACQUIRE);
+}
+
+void UringReactor::reap(UringWorker& worker)
+{
+	auto head = *worker.CqHead;
+	auto tail = __atomic_load_n(worker.CqTail, __ATOMIC_ACQUIRE);
+
+	while (head != tail)
+	{
+		auto& cqe = worker.Cqes[head & worker.CqMask];
+		auto data = cqe.user_data;
+		auto result = cqe.res;
+		auto flags = cqe.flags;
+
+		// Hand the entry back before running callbacks so the kernel can keep posting
+		__atomic_store_n(worker.CqHead, ++head, __ATOMIC_RELEASE);
+		complete(worker, data, result, flags);
+	}
+}
+
+void UringReactor::complete(UringWorker& worker, uint64_t data, int result, uint32_t flags)
+{
+	auto op = static_cast<UringOp>(data >> 56);
+	auto generation = static_cast<uint32_t>(data >> 32) & 0xFFFFFF;
+	auto index = static_cast<uint32_t>(data);
+
+	switch (op)
+	{
+	case UringOp::Wakeup:
+		armWakeup(worker);
+		break;
+	case UringOp::Accept:
+		if (result >= 0) open(worker, static_cast<uint32_t>(result), worker.Listeners[index]->Handler);
+		if (flags & IORING_CQE_F_MORE) break;
+
+		// A full file table fails every accept and the kernel drops that connection, so wait for a
+		// close to free a slot rather than rearming into the same error
+		if (result == -ENFILE || result == -EMFILE) pauseAccept(worker, index);
+		// A transient failure ends the multishot, a listener that is gone ends it for good
+		else if (result != -EBADF && result != -EINVAL && result != -ECANCELED) armAccept(worker, index);
+		break;
+	case UringOp::Recv:
+	{
+		auto& connection = worker.Connections[index];
+		auto current = (connection.Generation & 0xFFFFFF) == generation && connection.Open;
+
+		if (flags & IORING_CQE_F_BUFFER)
+		{
+			auto buffer = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+			if (result > 0 && current && connection.Handler->OnReceive)
+				connection.Handler->OnReceive(connection.Id.load(std::memory_order_relaxed), worker.BufferBlocks[buffer].GetData(), static_cast<size_t>(result));
+			recycle(worker, buffer);
+		}
+		if (!current || (flags & IORING_CQE_F_MORE)) break;
+
+		// The multishot ended, after running out of buffers it is simply armed again
+		connection.Receiving = false;
+		if ((result > 0 || result == -ENOBUFS) && !connection.Closing) armRecv(worker, index);
+		else
+		{
+			startClose(worker, index);
+			finish(worker, index);
+		}
+		break;
+	}
+	case UringOp::Send:
+	{
+		auto& connection = worker.Connections[index];
+		if ((connection.Generation & 0xFFFFFF) != generation || !connection.Open) break;
+
+		connection.Sending = false;
+		if (result < 0)
+		{
+			startClose(worker, index);
+			finish(worker, index);
+			break;
+		}
+
+		connection.Sent += static_cast<size_t>(result);
+		if (connection.Sent < connection.InFlight.size() && !connection.Closing)
+		{
+			submitSend(worker, index);
+			break;
+		}
+
+		connection.InFlight.clear();
+		connection.Sent = 0;
+		if (!connection.Outbound.empty() && !connection.Dirty)
+		{
+			connection.Dirty = true;
+			worker.Dirty.push_back(index);
+		}
+		finish(worker, index);
+		break;
+	}
+	case UringOp::Datagram:
+	{
+		auto& datagram = *worker.Datagrams[index];
+		if (result > 0 && (result & POLLIN)) drainDatagrams(datagram, worker.DatagramBuffer.GetData(), worker.DatagramBuffer.GetCapacity(), worker.Syscalls);
+		if (!(flags & IORING_CQE_F_MORE) && result != -EBADF && result != -ECANCELED) armDatagram(worker, index);
+		break;
+	}
+	case UringOp::Other:
+		break;
+	}
+}
+
+void UringReactor::armWakeup(UringWorker& worker)
+{
+	auto sqe = prepare(worker, IORING_OP_READ, worker.Wakeup, uringData(UringOp::Wakeup, 0, 0));
+	sqe->addr = reinterpret_cast<uint64_t>(&worker.WakeupValue);
+	sqe->len = sizeof(worker.WakeupValue);
+	sqe->off = static_cast<uint64_t>(-1);
+}
+
+void UringReactor::armAccept(UringWorker& worker, uint32_t listener)
+{
+	auto sqe = prepare(worker, IORING_OP_ACCEPT, worker.Listeners[listener]->Socket, uringData(UringOp::Accept, 0, listener));
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->file_index = IORING_FILE_INDEX_ALLOC; // No SOCK_CLOEXEC, direct descriptors have no file table entry for it
+}
+
+void UringReactor::pauseAccept(UringWorker& worker, uint32_t listener)
+{
+	// Only closes free slots in the worker's own table, so nothing else could make a retry succeed
+	worker.PausedAccepts.push_back(listener);
+}
+
+void UringReactor::resumeAccepts(UringWorker& worker)
+{
+	auto paused = std::move(worker.PausedAccepts);
+	worker.PausedAccepts.clear();
+	for (auto listener : paused) armAccept(worker, listener);
+}
+
+void UringReactor::armRecv(UringWorker& worker, uint32_t slot)
+{
+	auto& connection = worker.Connections[slot];
+
+	auto sqe = prepare(worker, IORING_OP_RECV, static_cast<int>(slot), uringData(UringOp::Recv, connection.Generation, slot));
+	sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->buf_group = 0;
+
+	connection.Receiving = true;
+}
+
+void UringReactor::armDatagram(UringWorker& worker, uint32_t datagram)
+{
+	auto sqe = prepare(worker, IORING_OP_POLL_ADD, worker.Datagrams[datagram]->Socket, uringData(UringOp::Datagram, 0, datagram));
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->poll32_events = POLLIN;
+}
+
+void UringReactor::submitSend(UringWorker& worker, uint32_t slot)
+{
+	auto& connection = worker.Connections[slot];
+
+	auto sqe = prepare(worker, IORING_OP_SEND, static_cast<int>(slot), uringData(UringOp::Send, connection.Generation, slot));
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->addr = reinterpret_cast<uint64_t>(connection.InFlight.data() + connection.Sent);
+	sqe->len = static_cast<uint32_t>(connection.InFlight.size() - connection.Sent);
+	sqe->msg_flags = MSG_NOSIGNAL;
+
+	connection.Sending = true;
+}
+
+void UringReactor::submitSends(UringWorker& worker)
+{
+	for (auto slot : worker.Dirty)
+	{
+		auto& connection = worker.Connections[slot];
+		connection.Dirty = false;
+		if (!connection.Open || connection.Closing || connection.Sending || connection.Outbound.empty()) continue;
+
+		// InFlight is empty whenever no send is out, the two vectors trade places and keep their capacity
+		std::swap(connection.Outbound, connection.InFlight);
+		connection.Sent = 0;
+		submitSend(worker, slot);
+	}
+	worker.Dirty.clear();
+}
+
+void UringReactor::recycle(UringWorker& worker, uint16_t buffer)
+{
+	// Only addr, len and bid, the first entry's resv field doubles as the ring tail. Entries are
+	// indexed from the ring itself, in C++ the header's bufs member sits behind an empty struct.
+	auto& entry = reinterpret_cast<io_uring_buf*>(worker.Buffers)[worker.BufferTail & (c_uring_buffer_count - 1)];
+	entry.addr = reinterpret_cast<uint64_t>(worker.BufferBlocks[buffer].GetData());
+	entry.len = c_uring_buffer_length;
+	entry.bid = buffer;
+
+	__atomic_store_n(&worker.Buffers->tail, ++worker.BufferTail, __ATOMIC_RELEASE);
+}
+
+void UringReactor::open(UringWorker& worker, uint32_t slot, const ReactorHandler* handler)
+{
+	if (slot >= c_uring_files) return;
+
+	auto& connection = worker.Connections[slot];
+	if ((++connection.Generation & 0xFFFFFF) == 0) ++connection.Generation;
+
+	auto id = (static_cast<uint64_t>(connection.Generation) << 32) | (slot * static_cast<uint32_t>(m_workers.size()) + worker.Index);
+	connection.Handler = handler;
+	connection.Outbound.clear();
+	connection.InFlight.clear();
+	connection.Sent = 0;
+	connection.Open = true;
+	connection.Sending = false;
+	connection.Closing = false;
+	connection.Id.store(id, std::memory_order_release);
+
+	armRecv(worker, slot);
+
+	if (handler->OnAccept) handler->OnAccept(id);
+}
+
+void UringReactor::queue(UringWorker& worker, uint32_t slot, const void* data, size_t length)
+{
+	auto& connection = worker.Connections[slot];
+	connection.Outbound.insert(connection.Outbound.end(), static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + length);
+
+	if (!connection.Dirty)
+	{
+		connection.Dirty = true;
+		worker.Dirty.push_back(slot);
+	}
+}
+
+void UringReactor::startClose(UringWorker& worker, uint32_t slot)
+{
+	auto& connection = worker.Connections[slot];
+	if (connection.Closing) return;
+	connection.Closing = true;
+
+	// Ends the multishot recv and fails a send stuck on a full socket, finish follows their completions
+	auto sqe = prepare(worker, IORING_OP_SHUTDOWN, static_cast<int>(slot), uringData(UringOp::Other, connection.Generation, slot));
+	sqe->flags = IOSQE_FIXED_FILE | IOSQE_CQE_SKIP_SUCCESS;
+	sqe->len = SHUT_RDWR;
+}
+
+void UringReactor::finish(UringWorker& worker, uint32_t slot)
+{
+	auto& connection = worker.Connections[slot];
+	if (!connection.Open || !connection.Closing || connection.Receiving || connection.Sending) return;
+
+	auto id = connection.Id.exchange(0, std::memory_order_acq_rel);
+	connection.Open = false;
+	connection.Outbound.clear();
+	connection.InFlight.clear();
+
+	auto sqe = prepare(worker, IORING_OP_CLOSE, 0, uringData(UringOp::Other, connection.Generation, slot));
+	sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+	sqe->file_index = slot + 1;
+
+	// The close goes in ahead of the accepts, so the slot is free by the time they run
+	if (!worker.PausedAccepts.empty()) resumeAccepts(worker);
+
+	if (connection.Handler->OnClose) connection.Handler->OnClose(id);
+}
+
+void UringReactor::push(UringWorker& worker, UringCommand command)
+{
+	auto empty = false;
+	{
+		LockGuard lock(worker.Mutex);
+		empty = worker.Commands.empty();
+		worker.Commands.emplace_back(std::move(command));
+	}
+
+	// A command already waiting means its sender has woken the worker and it will take this one too
+	if (empty) wake(worker);
+}
+
+void UringReactor::wake(UringWorker& worker)
+{
+	uint64_t one = 1;
+	worker.Syscalls.fetch_add(1, std::memory_order_relaxed);
+	while (write(worker.Wakeup, &one, sizeof(one)) < 0 && errno == EINTR) {}
+}
+
+void UringReactor::runCommands(UringWorker& worker)
+{
+	{
+		LockGuard lock(worker.Mutex);
+		worker.Running.swap(worker.Commands);
+	}
+
+	for (auto& command : worker.Running)
+	{
+		switch (command.Kind)
+		{
+		case UringCommandKind::Send:
+		{
+			auto slot = slotOf(command.Connection);
+			auto& connection = worker.Connections[slot];
+			if (connection.Id.load(std::memory_order_relaxed) == command.Connection && connection.Open && !connection.Closing)
+				queue(worker, slot, command.Data.data(), command.Data.size());
+			break;
+		}
+		case UringCommandKind::Close:
+		{
+			auto slot = slotOf(command.Connection);
+			if (worker.Connections[slot].Id.load(std::memory_order_relaxed) == command.Connection) startClose(worker, slot);
+			break;
+		}
+		case UringCommandKind::Listen:
+			worker.Listeners.push_back(command.Target);
+			armAccept(worker, static_cast<uint32_t>(worker.Listeners.size() - 1));
+			break;
+		case UringCommandKind::ListenDatagram:
+			worker.Datagrams.push_back(command.Datagram);
+			armDatagram(worker, static_cast<uint32_t>(worker.Datagrams.size() - 1));
+			break;
+		case UringCommandKind::Task:
+			command.Task();
+			break;
+		}
+	}
+	worker.Running.clear();
+}
+
+void UringReactor::runTimers(UringWorker& worker)
+{
+	std::vector<ReactorTask> due = {};
+	{
+		LockGuard lock(worker.Mutex);
+		worker.Timers.TakeDue(due);
+	}
+
+	for (auto& task : due) task();
+}
+
+UringWorker& UringReactor::owner(ReactorConnection connection) const
+{
+	return *m_workers[static_cast<uint32_t>(connection) % m_workers.size()];
+}
+
+uint32_t UringReactor::slotOf(ReactorConnection connection) const
+{
+	return static_cast<uint32_t>(connection) / static_cast<uint32_t>(m_workers.size());
+}
+#pragma endregion
+#endif
+
+#pragma region Network Reactor Factory and Benchmark Implementation
+ClayEngine::NetworkReactorPtr ClayEngine::MakeNetworkReactor(size_t workers, ReactorBackend backend)
+{
+#if defined(__linux__)
+	if (backend == ReactorBackend::Uring) return std::make_unique<UringReactor>(workers);
+	return std::make_unique<EpollReactor>(workers);
+#else
+	(void)workers;
+	(void)backend;
+	throw std::runtime_error("ClayEngine::MakeNetworkReactor no reactor backend for this platform");
+#endif
+}
+
+ClayEngine::NetworkReactorBenchmark ClayEngine::RunNetworkReactorBenchmark(ReactorBackend backend, size_t workers, size_t connectionCount, size_t messagesPerConnection)
+{
+	NetworkReactorBenchmark result = {};
+	result.Backend = backend;
+	result.ConnectionCount = connectionCount;
+
+#if defined(__linux__)
+	std::atomic<size_t> accepted = 0;
+	std::atomic<size_t> ticks = 0;
+	std::atomic<size_t> wakeups = 0;
+
+	auto reactor = MakeNetworkReactor(workers, backend);
+	result.WorkerCount = reactor->GetWorkerCount();
+
+	// Echo every byte straight back, the reply goes out from the worker that read it
+	auto raw = reactor.get();
+	ReactorHandler echo = {};
+	echo.OnAccept = [&accepted](ReactorConnection) { accepted.fetch_add(1); };
+	echo.OnReceive = [raw](ReactorConnection connection, const uint8_t* data, size_t length) { raw->Send(connection, data, length); };
+	auto port = reactor->Listen(L"127.0.0.1", L"0", std::move(echo));
+
+	ReactorDatagramHandler datagramEcho = {};
+	datagramEcho.OnReceive = [raw](const ReactorEndpoint& from, const uint8_t* data, size_t length) { raw->SendDatagram(from, data, length); };
+	auto datagramPort = reactor->ListenDatagram(L"127.0.0.1", L"0", std::move(datagramEcho));
+
+	sockaddr_in server = {};
+	server.sin_family = AF_INET;
+	server.sin_port = htons(port);
+	inet_pton(AF_INET, "127.0.0.1", &server.sin_addr);
+
+	std::vector<int> clients(connectionCount, -1);
+	auto threads = std::max<size_t>(1, std::min<size_t>(c_bench_client_threads, connectionCount));
+	auto runClients = [&](const std::function<void(size_t first, size_t last)>& body) {
+		std::vector<THREAD> running;
+		for (size_t t = 0; t < threads; ++t)
+			running.emplace_back(body, connectionCount * t / threads, connectionCount * (t + 1) / threads);
+		for (auto& element : running) element.join();
+	};
+	auto waitFor = [](const std::function<bool()>& done) {
+		auto limit = std::chrono::steady_clock::now() + c_bench_timeout;
+		while (!done() && std::chrono::steady_clock::now() < limit) std::this_thread::yield();
+	};
+
+	// Accepts, connections come in from a few client threads at once
+	auto start = std::chrono::steady_clock::now();
+	runClients([&](size_t first, size_t last) {
+		for (auto i = first; i < last; ++i)
+		{
+			clients[i] = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+			int enable = 1;
+			setsockopt(clients[i], IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+			if (connect(clients[i], reinterpret_cast<sockaddr*>(&server), sizeof(server)) < 0)
+			{
+				close(clients[i]);
+				clients[i] = -1;
+			}
+		}
+	});
+	waitFor([&] { return accepted.load() >= connectionCount; });
+	result.AcceptsPerSecond = PerSecond(accepted.load(), std::chrono::steady_clock::now() - start);
+
+	// Messages, every client connection keeps a window in flight and checks each echo
+	auto timer = reactor->AddTimer(ReactorMilliseconds(1), ReactorMilliseconds(1), [&ticks] { ticks.fetch_add(1); });
+	std::atomic<size_t> echoed = 0;
+	std::atomic<size_t> mismatches = 0;
+
+	auto syscalls = reactor->GetSyscallCount();
+	start = std::chrono::steady_clock::now();
+	runClients([&](size_t first, size_t last) {
+		std::vector<uint8_t> outbound(c_bench_message_length * c_bench_window);
+		std::vector<uint8_t> inbound(outbound.size());
+
+		for (size_t sent = 0; sent < messagesPerConnection; sent += c_bench_window)
+		{
+			auto window = std::min<size_t>(c_bench_window, messagesPerConnection - sent);
+			auto bytes = window * c_bench_message_length;
+
+			for (auto i = first; i < last; ++i)
+			{
+				if (clients[i] < 0) continue;
+				for (size_t b = 0; b < bytes; ++b) outbound[b] = static_cast<uint8_t>(i * 31 + sent * 7 + b);
+				if (send(clients[i], outbound.data(), bytes, MSG_NOSIGNAL) != static_cast<ssize_t>(bytes)) ++mismatches;
+			}
+
+			for (auto i = first; i < last; ++i)
+			{
+				if (clients[i] < 0) continue;
+
+				size_t received = 0;
+				while (received < bytes)
+				{
+					auto length = recv(clients[i], inbound.data() + received, bytes - received, 0);
+					if (length <= 0) break;
+					received += static_cast<size_t>(length);
+				}
+
+				auto matched = received == bytes;
+				for (size_t b = 0; b < received && matched; ++b) matched = inbound[b] == static_cast<uint8_t>(i * 31 + sent * 7 + b);
+				if (matched) echoed.fetch_add(window);
+				else mismatches.fetch_add(1);
+			}
+		}
+	});
+	result.MessagesPerSecond = PerSecond(echoed.load(), std::chrono::steady_clock::now() - start);
+	result.MessageCount = echoed.load();
+	result.Mismatches = mismatches.load();
+
+	reactor->CancelTimer(timer);
+	result.TimerTicks = ticks.load();
+
+	// The timer's own wakeups are left in, an idle server pays them too
+	if (result.MessageCount > 0) result.SyscallsPerMessage = static_cast<double>(reactor->GetSyscallCount() - syscalls) / static_cast<double>(result.MessageCount);
+
+	// Latency, one message at a time on a single connection
+	if (connectionCount > 0 && clients[0] >= 0)
+	{
+		std::vector<uint8_t> message(c_bench_message_length, 0x5A);
+		std::vector<double> samples;
+		samples.reserve(c_bench_latency_samples);
+
+		for (auto i = 0; i < c_bench_latency_samples; ++i)
+		{
+			auto sent = std::chrono::steady_clock::now();
+			if (send(clients[0], message.data(), message.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(message.size())) break;
+
+			size_t received = 0;
+			while (received < message.size())
+			{
+				auto length = recv(clients[0], message.data() + received, message.size() - received, 0);
+				if (length <= 0) break;
+				received += static_cast<size_t>(length);
+			}
+			if (received < message.size()) break;
+
+			samples.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - sent).count());
+		}
+
+		if (!samples.empty())
+		{
+			std::sort(samples.begin(), samples.end());
+			result.LatencyP50Microseconds = samples[samples.size() / 2];
+			result.LatencyP99Microseconds = samples[std::min(samples.size() - 1, samples.size() * 99 / 100)];
+		}
+	}
+
+	// Wakeups, tasks posted from outside the workers
+	start = std::chrono::steady_clock::now();
+	for (auto i = 0; i < c_bench_wakeups; ++i) reactor->Post([&wakeups] { wakeups.fetch_add(1); });
+	waitFor([&] { return wakeups.load() >= static_cast<size_t>(c_bench_wakeups); });
+	result.WakeupsPerSecond = PerSecond(wakeups.load(), std::chrono::steady_clock::now() - start);
+
+	// Datagrams, a UDP socket per client thread keeps a window in flight. Loopback rarely drops one,
+	// a lost window times out and is left out of the count.
+	std::atomic<size_t> datagrams = 0;
+	sockaddr_in datagramServer = server;
+	datagramServer.sin_port = htons(datagramPort);
+
+	start = std::chrono::steady_clock::now();
+	{
+		std::vector<THREAD> running;
+		for (auto t = 0; t < c_bench_client_threads; ++t)
+		{
+			running.emplace_back([&, t] {
+				auto socket = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+				timeval timeout = { 0, 100000 };
+				setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+				if (connect(socket, reinterpret_cast<sockaddr*>(&datagramServer), sizeof(datagramServer)) < 0)
+				{
+					close(socket);
+					return;
+				}
+
+				std::array<uint8_t, c_bench_message_length> outbound = {};
+				std::array<uint8_t, c_bench_message_length> inbound = {};
+				for (auto sent = 0; sent < c_bench_datagrams; sent += c_bench_window)
+				{
+					for (auto w = 0; w < c_bench_window; ++w)
+					{
+						outbound[0] = static_cast<uint8_t>(t);
+						outbound[1] = static_cast<uint8_t>(w);
+						send(socket, outbound.data(), outbound.size(), 0);
+					}
+					for (auto w = 0; w < c_bench_window; ++w)
+					{
+						auto length = recv(socket, inbound.data(), inbound.size(), 0);
+						if (length < 0) break;
+						if (length != static_cast<ssize_t>(inbound.size()) || inbound[0] != static_cast<uint8_t>(t)) mismatches.fetch_add(1);
+						else datagrams.fetch_add(1);
+					}
+				}
+				close(socket);
+			});
+		}
+		for (auto& element : running) element.join();
+	}
+	result.DatagramsPerSecond = PerSecond(datagrams.load(), std::chrono::steady_clock::now() - start);
+	result.Mismatches = mismatches.load();
+
+	for (auto element : clients)
+		if (element >= 0) close(element);
+
+	std::wstringstream wss;
+	wss << std::fixed << std::setprecision(2)
+		<< L"NetworkReactor " << reactor->GetBackendName() << L" " << result.WorkerCount << L" workers"
+		<< L" | Accepts " << result.AcceptsPerSecond / 1e3 << L" K/sec (" << result.ConnectionCount << L")"
+		<< L" | Messages " << result.MessagesPerSecond / 1e6 << L" M/sec (" << result.MessageCount << L")"
+		<< L", " << std::setprecision(4) << result.SyscallsPerMessage << std::setprecision(2) << L" syscalls/message"
+		<< L" | Latency p50 " << result.LatencyP50Microseconds << L" us, p99 " << result.LatencyP99Microseconds << L" us"
+		<< L" | Wakeups " << result.WakeupsPerSecond / 1e6 << L" M/sec"
+		<< L" | Datagrams " << result.DatagramsPerSecond / 1e6 << L" M/sec"
+		<< L" | Timer ticks " << result.TimerTicks
+		<< L" | Mismatches " << result.Mismatches;
+	WriteLine(wss.str());
+
+	reactor.reset();
+#else
+	(void)workers;
+	(void)messagesPerConnection;
+	WriteLine(L"NetworkReactor benchmark skipped, no reactor backend for this platform");
+#endif
+
+	return result;
+}
+#pragma endregion
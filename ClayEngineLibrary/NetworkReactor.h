@@ -0,0 +1,160 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* Platform neutral socket reactor with epoll and io_uring Linux backends     */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include "Strings.h"
+#include "Services.h"
+
+namespace ClayEngine
+{
+	constexpr auto c_reactor_workers{ 4UL }; // Event loop threads, same default as c_listen_workers
+	constexpr auto c_reactor_events{ 128 }; // Events taken per wait
+	constexpr auto c_reactor_recv_length{ 64 * 1024 }; // Bytes read per recv, each epoll worker has one buffer
+	constexpr auto c_uring_entries{ 256U }; // Submission queue entries per io_uring worker, the completion queue is 8x
+	constexpr auto c_uring_files{ 4096U }; // Registered file slots per io_uring worker, the most connections it can hold
+	constexpr auto c_uring_buffer_count{ 256U }; // Provided receive buffers per io_uring worker from the reactor's BufferPool, a power of two
+	constexpr auto c_uring_buffer_length{ 16 * 1024U };
+
+	using ReactorConnection = uint64_t; // Generation in the high half, 0 is no connection
+	using ReactorDatagramPort = uint32_t; // Index of a datagram socket, picks the socket a reply goes out on
+	using ReactorTimer = uint64_t;
+	using ReactorTask = std::function<void()>;
+	using ReactorMilliseconds = std::chrono::milliseconds;
+
+	enum class ReactorBackend
+	{
+		Epoll, // Readiness, one epoll set per worker
+		Uring, // Completions, one io_uring per worker, needs Linux 6.0 for multishot recv
+	};
+
+	/// <summary>
+	/// Callbacks for the connections accepted on one listen port. All callbacks of a connection run on
+	/// the worker that accepted it, one at a time, so a handler needs no locking for per-connection state.
+	/// The data passed to OnReceive lives in a worker's receive buffer and is only valid during the call.
+	/// </summary>
+	struct ReactorHandler
+	{
+		std::function<void(ReactorConnection connection)> OnAccept = {};
+		std::function<void(ReactorConnection connection, const uint8_t* data, size_t length)> OnReceive = {};
+		std::function<void(ReactorConnection connection)> OnClose = {};
+	};
+
+	/// <summary>
+	/// Where a datagram came from. Pass it back to SendDatagram to reply, it stays valid for as long as
+	/// the reactor does, so a module may keep it as the peer's address.
+	/// </summary>
+	struct ReactorEndpoint
+	{
+		std::array<uint8_t, 28> Address = {}; // sockaddr_in or sockaddr_in6
+		uint32_t AddressLength = 0;
+		ReactorDatagramPort Port = 0;
+	};
+
+	/// <summary>
+	/// Callback for the datagrams arriving on one datagram port. A peer's datagrams always arrive on the
+	/// same worker, the data is only valid during the call.
+	/// </summary>
+	struct ReactorDatagramHandler
+	{
+		std::function<void(const ReactorEndpoint& from, const uint8_t* data, size_t length)> OnReceive = {};
+	};
+
+	/// <summary>
+	/// Event loop shared by the server modules. Control, chat and bulk each call Listen
+	/// on their own port and vector calls ListenDatagram, all on the same workers; ReactorServerModule
+	/// lays the AsyncNetworkSystem channels out this way. Send, SendDatagram, Close, AddTimer,
+	/// CancelTimer and Post may be called from any thread, including from inside a callback.
+	/// </summary>
+	class NetworkReactor
+	{
+	public:
+		virtual ~NetworkReactor() = default;
+
+		/// <summary>
+		/// Starts accepting on address and port, port "0" picks a free one. Returns the bound port.
+		/// </summary>
+		virtual uint16_t Listen(Unicode address, Unicode port, ReactorHandler handler) = 0;
+		/// <summary>
+		/// Binds a UDP port on address the same way, each worker reads its own socket. Returns the bound port.
+		/// </summary>
+		virtual uint16_t ListenDatagram(Unicode address, Unicode port, ReactorDatagramHandler handler) = 0;
+
+		/// <summary>
+		/// Queues a copy of length bytes on connection. Epoll writes straight to the socket when nothing
+		/// is queued yet, io_uring gathers a worker loop's sends into one submission per connection.
+		/// Returns false when the connection is already closed.
+		/// </summary>
+		virtual bool Send(ReactorConnection connection, const void* data, size_t length) = 0;
+		/// <summary>
+		/// Shuts the connection down, OnClose follows on its worker
+		/// </summary>
+		virtual void Close(ReactorConnection connection) = 0;
+		/// <summary>
+		/// Sends one datagram to endpoint from the port it was received on. Datagrams the socket has no
+		/// room for are dropped and return false, as they would be on the wire.
+		/// </summary>
+		virtual bool SendDatagram(const ReactorEndpoint& endpoint, const void* data, size_t length) = 0;
+
+		/// <summary>
+		/// Runs task on a worker after delay, then every period unless period is zero
+		/// </summary>
+		virtual ReactorTimer AddTimer(ReactorMilliseconds delay, ReactorMilliseconds period, ReactorTask task) = 0;
+		virtual bool CancelTimer(ReactorTimer timer) = 0;
+
+		/// <summary>
+		/// Wakes a worker and runs task on it
+		/// </summary>
+		virtual void Post(ReactorTask task) = 0;
+
+		virtual size_t GetWorkerCount() const = 0;
+		virtual Unicode GetBackendName() const = 0;
+		/// <summary>
+		/// System calls made by the reactor so far, for comparing backends
+		/// </summary>
+		virtual uint64_t GetSyscallCount() const = 0;
+	};
+	using NetworkReactorPtr = std::unique_ptr<NetworkReactor>;
+	using NetworkReactorRaw = NetworkReactor*;
+
+	/// <summary>
+	/// Reactor on the given backend with the given number of worker threads. Throws when the platform
+	/// or kernel lacks the backend, so callers preferring io_uring can fall back to epoll; on Windows
+	/// the IOCP path in AsyncListenServerModule is still the one to use.
+	/// </summary>
+	NetworkReactorPtr MakeNetworkReactor(size_t workers = c_reactor_workers, ReactorBackend backend = ReactorBackend::Epoll);
+
+	struct NetworkReactorBenchmark
+	{
+		ReactorBackend Backend = ReactorBackend::Epoll;
+		size_t WorkerCount = 0;
+		size_t ConnectionCount = 0;
+		size_t MessageCount = 0; // Echoed messages across all connections
+		double AcceptsPerSecond = 0.;
+		double MessagesPerSecond = 0.; // Round trips through the echo handler
+		double SyscallsPerMessage = 0.; // Reactor system calls over echoed messages
+		double LatencyP50Microseconds = 0.; // Single connection ping pong
+		double LatencyP99Microseconds = 0.;
+		double WakeupsPerSecond = 0.; // Posted tasks run
+		double DatagramsPerSecond = 0.; // Round trips through a datagram echo handler
+		size_t TimerTicks = 0; // Ticks of a 1 ms timer while the message phase ran
+		size_t Mismatches = 0; // Echoes that differ from what was sent, should be 0
+	};
+
+	/// <summary>
+	/// Opens connectionCount loopback connections to an echo handler, sends messagesPerConnection
+	/// small messages on each, times single message round trips, echoes datagrams over a few UDP sockets
+	/// and writes accepts, messages and datagrams per second, system calls per message and latency to the console
+	/// </summary>
+	NetworkReactorBenchmark RunNetworkReactorBenchmark(ReactorBackend backend = ReactorBackend::Epoll, size_t workers = c_reactor_workers, size_t connectionCount = 256, size_t messagesPerConnection = 1024);
+}
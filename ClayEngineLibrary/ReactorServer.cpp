@@ -0,0 +1,378 @@
+#include "pch.h"
+#include "ReactorServer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+using namespace ClayEngine;
+
+namespace
+{
+	ReactorGuid makeGuid()
+	{
+		thread_local std::mt19937_64 t_rng(std::random_device{}());
+
+		ReactorGuid guid = {};
+		for (size_t i = 0; i < guid.size(); i += sizeof(uint64_t))
+		{
+			auto value = t_rng();
+			std::memcpy(guid.data() + i, &value, sizeof(value));
+		}
+		return guid;
+	}
+
+	Unicode offsetPort(const Unicode& port, uint16_t offset)
+	{
+		auto base = std::stoul(port);
+		if (base == 0) return port;
+		if (base + offset > 65535) throw std::runtime_error("ClayEngine::ReactorServerModule channel port out of range");
+		return std::to_wstring(base + offset);
+	}
+}
+
+#pragma region Reactor Server Module
+size_t ReactorServerModule::GuidHash::operator()(const ReactorGuid& guid) const
+{
+	// Server GUIDs are random and client GUIDs are UUIDs, either half is already well mixed
+	uint64_t low = 0, high = 0;
+	std::memcpy(&low, guid.data(), sizeof(low));
+	std::memcpy(&high, guid.data() + sizeof(low), sizeof(high));
+	return static_cast<size_t>(low ^ (high * 0x9E3779B97F4A7C15ull));
+}
+
+ReactorServerModule::ReactorServerModule(NetworkReactorRaw reactor, Unicode address, Unicode port, ReactorServerHandler handler)
+	: m_reactor(reactor)
+	, m_handler(std::move(handler))
+{
+	if (!m_reactor) throw std::runtime_error("ClayEngine::ReactorServerModule needs a reactor");
+
+	m_ports[static_cast<size_t>(ReactorChannel::Control)] = m_reactor->Listen(address, port, makeHandler(ReactorChannel::Control));
+	m_ports[static_cast<size_t>(ReactorChannel::Chat)] = m_reactor->Listen(address, offsetPort(port, c_reactor_chat_port_offset), makeHandler(ReactorChannel::Chat));
+	m_ports[static_cast<size_t>(ReactorChannel::Bulk)] = m_reactor->Listen(address, offsetPort(port, c_reactor_bulk_port_offset), makeHandler(ReactorChannel::Bulk));
+
+	ReactorDatagramHandler vector = {};
+	vector.OnReceive = [this](const ReactorEndpoint& from, const uint8_t* data, size_t length) { receiveDatagram(from, data, length); };
+	m_ports[static_cast<size_t>(ReactorChannel::Vector)] = m_reactor->ListenDatagram(address, offsetPort(port, c_reactor_vector_port_offset), std::move(vector));
+}
+
+ReactorHandler ReactorServerModule::makeHandler(ReactorChannel channel)
+{
+	ReactorHandler handler = {};
+	handler.OnAccept = [this, channel](ReactorConnection connection) { accept(connection, channel); };
+	handler.OnReceive = [this](ReactorConnection connection, const uint8_t* data, size_t length) { receive(connection, data, length); };
+	handler.OnClose = [this](ReactorConnection connection) { close(connection); };
+	return handler;
+}
+
+void ReactorServerModule::accept(ReactorConnection connection, ReactorChannel channel)
+{
+	std::unique_lock<std::shared_mutex> lock(m_mutex);
+	m_sessions[connection].Channel = channel;
+}
+
+void ReactorServerModule::receive(ReactorConnection connection, const uint8_t* data, size_t length)
+{
+	ClientPtr client = nullptr;
+	auto channel = ReactorChannel::Control;
+	ChatFrameReader* reader = nullptr;
+	{
+		// A session is only touched by the worker its connection is on, and the map only changes under
+		// the exclusive lock, so the shared lock is enough to read it and to collect the opening GUID
+		std::shared_lock<std::shared_mutex> lock(m_mutex);
+		auto it = m_sessions.find(connection);
+		if (it == m_sessions.end()) return;
+		auto& session = it->second;
+		channel = session.Channel;
+		client = session.Client;
+		reader = session.ChatReceive.get();
+
+		if (!client)
+		{
+			// The opening GUID may be split over several reads
+			auto take = std::min(length, c_reactor_guid_length - session.OpeningLength);
+			std::memcpy(session.Opening.data() + session.OpeningLength, data, take);
+			session.OpeningLength += take;
+			data += take;
+			length -= take;
+			if (session.OpeningLength < c_reactor_guid_length) return;
+		}
+	}
+
+	if (!client)
+	{
+		client = open(connection);
+		if (!client) return;
+
+		// Made by open, and like the session itself only this worker touches it
+		std::shared_lock<std::shared_mutex> lock(m_mutex);
+		auto it = m_sessions.find(connection);
+		if (it != m_sessions.end()) reader = it->second.ChatReceive.get();
+	}
+
+	if (reader)
+	{
+		// Erased only by close and open, which run on this worker, so the reader outlives the call
+		receiveChat(connection, client->ClientGuid, *reader, data, length);
+		return;
+	}
+
+	if (length && m_handler.OnReceive) m_handler.OnReceive(client->ClientGuid, channel, data, length);
+}
+
+ReactorServerModule::ClientPtr ReactorServerModule::open(ReactorConnection connection)
+{
+	ClientPtr client = nullptr;
+	auto opened = false;
+	std::vector<ReactorConnection> replaced = {};
+	ClientPtr stale = nullptr;
+	{
+		std::unique_lock<std::shared_mutex> lock(m_mutex);
+		auto it = m_sessions.find(connection);
+		if (it == m_sessions.end()) return nullptr;
+		auto& session = it->second;
+
+		if (session.Channel == ReactorChannel::Control)
+		{
+			// A client reconnecting with the same GUID replaces the connection it left behind
+			auto existing = m_clients.find(session.Opening);
+			if (existing != m_clients.end())
+			{
+				stale = existing->second;
+				m_servers.erase(stale->ServerGuid);
+				m_clients.erase(existing);
+				replaced = { stale->Control, stale->Chat, stale->Bulk };
+			}
+
+			session.Client = std::make_shared<Client>();
+			session.Client->ClientGuid = session.Opening;
+			do session.Client->ServerGuid = makeGuid(); while (m_servers.count(session.Client->ServerGuid));
+			session.Client->Control = connection;
+			m_clients.emplace(session.Client->ClientGuid, session.Client);
+			m_servers.emplace(session.Client->ServerGuid, session.Client);
+			opened = true;
+		}
+		else
+		{
+			auto owner = m_servers.find(session.Opening);
+			if (owner == m_servers.end())
+			{
+				m_sessions.erase(it);
+				lock.unlock();
+				m_reactor->Close(connection);
+				return nullptr;
+			}
+
+			session.Client = owner->second;
+			auto& slot = session.Channel == ReactorChannel::Chat ? session.Client->Chat : session.Client->Bulk;
+			if (slot) replaced = { slot };
+			slot = connection;
+
+			if (session.Channel == ReactorChannel::Chat && m_handler.OnChatFrame) session.ChatReceive = std::make_unique<ChatFrameReader>();
+		}
+		client = session.Client;
+	}
+
+	for (auto stale_connection : replaced) if (stale_connection) m_reactor->Close(stale_connection);
+	if (stale && m_handler.OnDisconnect) m_handler.OnDisconnect(stale->ClientGuid);
+
+	if (opened)
+	{
+		m_reactor->Send(connection, client->ServerGuid.data(), client->ServerGuid.size());
+		if (m_handler.OnConnect) m_handler.OnConnect(client->ClientGuid);
+	}
+	return client;
+}
+
+void ReactorServerModule::receiveChat(ReactorConnection connection, const ReactorGuid& client, ChatFrameReader& reader, const uint8_t* data, size_t length)
+{
+	// The data is only valid during the call, so whatever the ring can't take yet waits for Next to free or grow it
+	ChatFrame frame = {};
+	do
+	{
+		auto written = reader.Write(data, length);
+		data += written;
+		length -= written;
+
+		ChatFrameStatus status;
+		while ((status = reader.Next(frame)) == ChatFrameStatus::Ready) m_handler.OnChatFrame(client, frame);
+		if (status == ChatFrameStatus::Malformed)
+		{
+			m_reactor->Close(connection);
+			return;
+		}
+	} while (length);
+}
+
+void ReactorServerModule::receiveDatagram(const ReactorEndpoint& from, const uint8_t* data, size_t length)
+{
+	if (length < c_reactor_guid_length) return;
+
+	ReactorGuid server = {};
+	std::memcpy(server.data(), data, server.size());
+
+	ClientPtr client = nullptr;
+	auto moved = false;
+	{
+		std::shared_lock<std::shared_mutex> lock(m_mutex);
+		auto it = m_servers.find(server);
+		if (it == m_servers.end()) return;
+		client = it->second;
+		moved = !client->HasVector || client->Vector.AddressLength != from.AddressLength || client->Vector.Port != from.Port
+			|| std::memcmp(client->Vector.Address.data(), from.Address.data(), from.AddressLength) != 0;
+	}
+
+	if (moved)
+	{
+		// The client's latest source address is where vector replies go, NAT may have changed it
+		std::unique_lock<std::shared_mutex> lock(m_mutex);
+		client->Vector = from;
+		client->HasVector = true;
+	}
+
+	if (length > c_reactor_guid_length && m_handler.OnReceive)
+		m_handler.OnReceive(client->ClientGuid, ReactorChannel::Vector, data + c_reactor_guid_length, length - c_reactor_guid_length);
+}
+
+void ReactorServerModule::close(ReactorConnection connection)
+{
+	ClientPtr client = nullptr;
+	{
+		std::unique_lock<std::shared_mutex> lock(m_mutex);
+		auto it = m_sessions.find(connection);
+		if (it == m_sessions.end()) return;
+		auto session = std::move(it->second);
+		m_sessions.erase(it);
+		if (!session.Client) return;
+
+		if (session.Channel == ReactorChannel::Chat && session.Client->Chat == connection) session.Client->Chat = 0;
+		if (session.Channel == ReactorChannel::Bulk && session.Client->Bulk == connection) session.Client->Bulk = 0;
+		if (session.Channel == ReactorChannel::Control && session.Client->Control == connection) client = std::move(session.Client);
+	}
+
+	if (client) disconnect(client);
+}
+
+void ReactorServerModule::disconnect(const ClientPtr& client)
+{
+	std::vector<ReactorConnection> connections = {};
+	{
+		std::unique_lock<std::shared_mutex> lock(m_mutex);
+
+		// A client replaced by a reconnect has already been reported and unmapped
+		auto it = m_clients.find(client->ClientGuid);
+		if (it == m_clients.end() || it->second != client) return;
+		m_clients.erase(it);
+		m_servers.erase(client->ServerGuid);
+
+		connections = { client->Control, client->Chat, client->Bulk };
+		client->Control = client->Chat = client->Bulk = 0;
+		client->HasVector = false;
+	}
+
+	for (auto connection : connections) if (connection) m_reactor->Close(connection);
+	if (m_handler.OnDisconnect) m_handler.OnDisconnect(client->ClientGuid);
+}
+
+bool ReactorServerModule::Send(const ReactorGuid& client, ReactorChannel channel, const void* data, size_t length)
+{
+	ReactorConnection connection = 0;
+	ReactorEndpoint endpoint = {};
+	{
+		std::shared_lock<std::shared_mutex> lock(m_mutex);
+		auto it = m_clients.find(client);
+		if (it == m_clients.end()) return false;
+
+		auto& target = *it->second;
+		switch (channel)
+		{
+		case ReactorChannel::Control: connection = target.Control; break;
+		case ReactorChannel::Chat: connection = target.Chat; break;
+		case ReactorChannel::Bulk: connection = target.Bulk; break;
+		case ReactorChannel::Vector:
+			if (!target.HasVector) return false;
+			endpoint = target.Vector;
+			break;
+		}
+	}
+
+	if (channel == ReactorChannel::Vector) return m_reactor->SendDatagram(endpoint, data, length);
+	return connection && m_reactor->Send(connection, data, length);
+}
+
+void ReactorServerModule::Disconnect(const ReactorGuid& client)
+{
+	ClientPtr target = nullptr;
+	{
+		std::shared_lock<std::shared_mutex> lock(m_mutex);
+		auto it = m_clients.find(client);
+		if (it == m_clients.end()) return;
+		target = it->second;
+	}
+
+	disconnect(target);
+}
+
+size_t ReactorServerModule::GetClientCount() const
+{
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
+	return m_clients.size();
+}
+#pragma endregion
+
+#pragma region Reactor Server Host
+ReactorServerHost::ReactorServerHost(const Document& document, Unicode className, ReactorServerHandler handler)
+{
+	for (const auto& element : document["startup"])
+	{
+		if (ToUnicode(element["class"].get<std::string>()) != className) continue;
+
+		auto type = element["type"].get<std::string>();
+		if (type != "server" && type != "headless") continue;
+
+		auto address = ToUnicode(element["address"].get<std::string>());
+		auto port = ToUnicode(element["port"].get<std::string>());
+
+		// "reactor_backend" picks "epoll" (the default) or "io_uring"
+		auto backend = element.value("reactor_backend", std::string("epoll"));
+		if (backend != "epoll" && backend != "io_uring") throw std::runtime_error("ClayEngine::ReactorServerHost unknown reactor_backend, expected epoll or io_uring");
+
+		if (backend == "io_uring")
+		{
+			try
+			{
+				m_reactor = MakeNetworkReactor(c_reactor_workers, ReactorBackend::Uring);
+			}
+			catch (const std::exception& exception)
+			{
+				// Older kernels, or io_uring disabled by policy, still get the epoll reactor
+				WriteLine(L"io_uring reactor unavailable, falling back to epoll: " + ToUnicode(exception.what()));
+			}
+		}
+
+		if (!m_reactor) m_reactor = MakeNetworkReactor(c_reactor_workers, ReactorBackend::Epoll);
+		m_server = std::make_unique<ReactorServerModule>(m_reactor.get(), address, port, std::move(handler));
+		return;
+	}
+
+	throw std::runtime_error("ClayEngine::ReactorServerHost no server or headless startup entry for the class");
+}
+
+ReactorServerHost::~ReactorServerHost()
+{
+	// Stop the workers before the module their callbacks point into
+	m_reactor.reset();
+	m_server.reset();
+}
+
+int ReactorServerEntryPoint::operator()(Document document, Unicode className, FUTURE future)
+{
+	ReactorServerHost host(document, className);
+	WriteLine(L"Reactor Server listening on control port " + std::to_wstring(host.GetServer()->GetPort(ReactorChannel::Control)));
+
+	future.wait();
+	return 0;
+}
+#pragma endregion
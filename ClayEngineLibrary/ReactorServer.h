@@ -0,0 +1,176 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* Control, chat, bulk and vector server channels on a NetworkReactor         */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "NetworkReactor.h"
+#include "ChatFraming.h"
+#include "Storage.h"
+
+namespace ClayEngine
+{
+	constexpr uint16_t c_reactor_chat_port_offset{ 1 }; // Channels sit on consecutive ports after control, 19740 to 19743
+	constexpr uint16_t c_reactor_bulk_port_offset{ 2 };
+	constexpr uint16_t c_reactor_vector_port_offset{ 3 };
+	constexpr size_t c_reactor_guid_length{ 16 }; // A GUID, the same 16 bytes AcceptEx reads on the IOCP path
+
+	using ReactorGuid = std::array<uint8_t, c_reactor_guid_length>;
+
+	/// <summary>
+	/// The four sockets a client holds, the same layout as AsyncNetworkSystem
+	/// </summary>
+	enum class ReactorChannel
+	{
+		Control, // TCP, the client's GUID in and the server's GUID back
+		Chat, // TCP, small messages
+		Bulk, // TCP, large binary objects
+		Vector, // UDP, position data
+	};
+
+	/// <summary>
+	/// Application callbacks, keyed by the GUID the client sent on control. They run on reactor workers,
+	/// the channels of one client may be on different workers.
+	/// </summary>
+	struct ReactorServerHandler
+	{
+		std::function<void(const ReactorGuid& client)> OnConnect = {};
+		std::function<void(const ReactorGuid& client)> OnDisconnect = {};
+		std::function<void(const ReactorGuid& client, ReactorChannel channel, const uint8_t* data, size_t length)> OnReceive = {};
+		/// <summary>
+		/// When set, chat is parsed into frames and delivered here instead of to OnReceive. The payload is a
+		/// view into the session's ChatFrameReader, valid during the call. A malformed stream closes chat.
+		/// </summary>
+		std::function<void(const ReactorGuid& client, const ChatFrame& frame)> OnChatFrame = {};
+	};
+
+	/// <summary>
+	/// The AsyncNetworkSystem server channels on a NetworkReactor, for platforms without IOCP. A client
+	/// connects control first and sends its 16 byte GUID, the server answers with a 16 byte server GUID.
+	/// Chat and bulk connections open by sending that server GUID, and every vector datagram starts with
+	/// it; the datagram's sender becomes the client's vector address. Anything that doesn't open with a
+	/// known server GUID is dropped. Closing control disconnects the client and its other channels, and
+	/// a client connecting again with the same GUID replaces its previous connection.
+	/// </summary>
+	class ReactorServerModule
+	{
+		struct GuidHash
+		{
+			size_t operator()(const ReactorGuid& guid) const;
+		};
+
+		struct Client
+		{
+			ReactorGuid ClientGuid = {};
+			ReactorGuid ServerGuid = {};
+			ReactorConnection Control = 0;
+			ReactorConnection Chat = 0;
+			ReactorConnection Bulk = 0;
+			ReactorEndpoint Vector = {};
+			bool HasVector = false;
+		};
+		using ClientPtr = std::shared_ptr<Client>;
+
+		/// <summary>
+		/// A TCP connection until its opening GUID has arrived, then the client it belongs to
+		/// </summary>
+		struct Session
+		{
+			ReactorChannel Channel = ReactorChannel::Control;
+			ReactorGuid Opening = {};
+			size_t OpeningLength = 0;
+			ClientPtr Client = nullptr;
+			ChatFrameReaderPtr ChatReceive = nullptr; // Chat with OnChatFrame set, made when the session opens
+		};
+
+		NetworkReactorRaw m_reactor = nullptr;
+		ReactorServerHandler m_handler = {};
+		std::array<uint16_t, 4> m_ports = {};
+
+		mutable std::shared_mutex m_mutex = {};
+		std::unordered_map<ReactorGuid, ClientPtr, GuidHash> m_clients = {}; // By client GUID
+		std::unordered_map<ReactorGuid, ClientPtr, GuidHash> m_servers = {}; // By server GUID
+		std::unordered_map<ReactorConnection, Session> m_sessions = {};
+
+		ReactorHandler makeHandler(ReactorChannel channel);
+		void accept(ReactorConnection connection, ReactorChannel channel);
+		void receive(ReactorConnection connection, const uint8_t* data, size_t length);
+		void receiveDatagram(const ReactorEndpoint& from, const uint8_t* data, size_t length);
+		void close(ReactorConnection connection);
+		/// <summary>
+		/// Binds a session whose opening GUID is complete to its client, under the exclusive lock.
+		/// Null when the GUID names no client, the connection is closed then.
+		/// </summary>
+		ClientPtr open(ReactorConnection connection);
+		void receiveChat(ReactorConnection connection, const ReactorGuid& client, ChatFrameReader& reader, const uint8_t* data, size_t length);
+		void disconnect(const ClientPtr& client);
+
+	public:
+		/// <summary>
+		/// Listens for control on port and for chat, bulk and vector on the ports after it. Port "0"
+		/// picks a free port for each channel, see GetPort. The reactor must outlive the module's use,
+		/// destroy it first so no callback is still running.
+		/// </summary>
+		ReactorServerModule(NetworkReactorRaw reactor, Unicode address, Unicode port, ReactorServerHandler handler = {});
+		~ReactorServerModule() = default;
+
+		ReactorServerModule(const ReactorServerModule&) = delete;
+		ReactorServerModule& operator=(const ReactorServerModule&) = delete;
+
+		/// <summary>
+		/// Sends on one of a client's channels. False when the client or that channel isn't connected, or
+		/// for vector before the client's first datagram has told the server where to send.
+		/// </summary>
+		bool Send(const ReactorGuid& client, ReactorChannel channel, const void* data, size_t length);
+		/// <summary>
+		/// Closes every channel of the client, OnDisconnect follows
+		/// </summary>
+		void Disconnect(const ReactorGuid& client);
+
+		uint16_t GetPort(ReactorChannel channel) const { return m_ports[static_cast<size_t>(channel)]; }
+		size_t GetClientCount() const;
+	};
+	using ReactorServerModulePtr = std::unique_ptr<ReactorServerModule>;
+
+	/// <summary>
+	/// A NetworkReactor and the ReactorServerModule on it, set up from the "server" or "headless" startup
+	/// entry whose class is className. What runs a server on platforms without IOCP, where
+	/// AsyncNetworkSystem doesn't build. The entry's "reactor_backend" is "epoll" (the default) or
+	/// "io_uring", which falls back to epoll when the kernel can't run it.
+	/// </summary>
+	class ReactorServerHost
+	{
+		NetworkReactorPtr m_reactor = nullptr;
+		ReactorServerModulePtr m_server = nullptr;
+
+	public:
+		ReactorServerHost(const Document& document, Unicode className, ReactorServerHandler handler = {});
+		~ReactorServerHost();
+
+		ReactorServerHost(const ReactorServerHost&) = delete;
+		ReactorServerHost& operator=(const ReactorServerHost&) = delete;
+
+		ReactorServerModule* GetServer() { return m_server.get(); }
+		NetworkReactorRaw GetReactor() { return m_reactor.get(); }
+	};
+	using ReactorServerHostPtr = std::unique_ptr<ReactorServerHost>;
+
+	/// <summary>
+	/// Server and headless entry point for platforms without IOCP, the counterpart of
+	/// ClayEngineHeadlessEntryPoint. Serves className's startup entry until future is set.
+	/// </summary>
+	struct ReactorServerEntryPoint
+	{
+		int operator()(Document document, Unicode className, FUTURE future);
+	};
+}
@@ -8,6 +8,7 @@
 #include "CellData.h"
 #include "ClipmapView.h"
 #include "gl\glew.h"
+#include "CellTable.h"
 
 #include <string>
 #include <sstream>
@@ -72,7 +73,7 @@ namespace VoxelFarm
 			GLuint uniform_instanceProgram_ambBase;
 		};
 
-		using BakedCellInstances = std::map<CellId, BakedInstanceMesh*>;
+		using BakedCellInstances = ClayEngine::CellMap<BakedInstanceMesh*>;
 		BakedCellInstances m_bakedcellinstances = {};
 
 		Shader m_shader = {};
@@ -86,11 +87,9 @@ namespace VoxelFarm
 		}
 		~InstanceMeshManager()
 		{
-			//std::for_each(m_bakedcellinstances.begin(), m_bakedcellinstances.end(), [](auto& element) { VF_DELETE element.second; });
-			BakedCellInstances::iterator iter;
-			for (iter = m_bakedcellinstances.begin(); iter != m_bakedcellinstances.end(); ++iter)
-				VF_DELETE iter->second;
-			m_bakedcellinstances.clear();
+			for (auto& element : m_bakedcellinstances)
+				VF_DELETE element.Value;
+			m_bakedcellinstances.Clear();
 		};
 
 		void init()
@@ -246,8 +245,9 @@ namespace VoxelFarm
 
 			double scale = CELL_SIZE * (1 << level);
 
-			if (m_bakedcellinstances.find(cell) != m_bakedcellinstances.end())
-				VF_DELETE m_bakedcellinstances[cell];
+			auto baked = m_bakedcellinstances.Find(cell);
+			if (baked)
+				VF_DELETE *baked;
 
 			BakedInstanceMesh* mesh_out_ptr = VF_NEW BakedInstanceMesh();
 			m_bakedcellinstances[cell] = mesh_out_ptr;
@@ -380,10 +380,11 @@ namespace VoxelFarm
 
 		void removeCellVBO(CellId cell)
 		{
-			if (m_bakedcellinstances.find(cell) != m_bakedcellinstances.end())
+			auto baked = m_bakedcellinstances.Find(cell);
+			if (baked)
 			{
-				VF_DELETE m_bakedcellinstances[cell];
-				m_bakedcellinstances.erase(cell);
+				VF_DELETE *baked;
+				m_bakedcellinstances.Erase(cell);
 			}
 		}
 
@@ -1,6 +1,9 @@
 #include "pch.h"
 #include "VoxelFarmThread.h"
 #include "VoxelFarmCellRender.h"
+#include "VoxelNoise.h"
+#include "VoxelColumnCache.h"
+#include "VoxelRegionFile.h"
 
 using namespace ClayEngine;
 
@@ -12,15 +15,103 @@ using namespace ClayEngine;
 #include "ClipmapView.h"
 #include "InstanceMesh.h"
 
-class SimplePerlinVoxelLayer : public VoxelFarm::IVoxelLayer
+/// <summary>
+/// A voxel layer whose field (solid where positive) can be bounded over a whole cell block, so cells
+/// that are all air or all rock are settled before any voxel is evaluated
+/// </summary>
+class BoundedVoxelLayer : public VoxelFarm::IVoxelLayer
 {
-	using Index = VoxelFarm::ContourVoxelData::Index;
+	struct Classified
+	{
+		const BoundedVoxelLayer* Layer = nullptr;
+		VoxelFarm::CellId Cell = 0;
+		VoxelFarmCellClass Class = VoxelFarmCellClass::Mixed;
+	};
+
+	// The last cell each layer classified on this thread, a worker handles one cell at a time
+	static std::vector<Classified>& classified()
+	{
+		thread_local std::vector<Classified> t_classified;
+		return t_classified;
+	}
 
 public:
-	void getContourData(VoxelFarm::CellId cell, VoxelFarm::ContourVoxelData* data, bool& empty, void* threadContext)
+	virtual ~BoundedVoxelLayer() = default;
+
+	/// <summary>
+	/// Conservative min/max of the field over the cell's block, margins included
+	/// </summary>
+	virtual void getFieldBounds(VoxelFarm::CellId cell, double& low, double& high) = 0;
+
+	VoxelFarmCellClass classify(VoxelFarm::CellId cell)
 	{
-		empty = true;
+		double low, high;
+		getFieldBounds(cell, low, high);
+
+		auto kind = VoxelFarmCellClass::Mixed;
+		if (high <= 0.0) kind = VoxelFarmCellClass::Empty;
+		else if (low > 0.0) kind = VoxelFarmCellClass::Solid;
+
+		auto& entries = classified();
+		auto it = std::find_if(entries.begin(), entries.end(), [this](const Classified& entry) { return entry.Layer == this; });
+		if (it == entries.end()) it = entries.insert(entries.end(), Classified{ this });
+		it->Cell = cell;
+		it->Class = kind;
+		return kind;
+	}
+
+	/// <summary>
+	/// The class ClassifyCell just found for cell on this thread, so the generator doesn't bound it a
+	/// second time. Classifies when it hasn't been, for generators driven without ClassifyCell.
+	/// </summary>
+	VoxelFarmCellClass classifyOnce(VoxelFarm::CellId cell)
+	{
+		for (auto& entry : classified())
+		{
+			if (entry.Layer == this && entry.Cell == cell) return entry.Class;
+		}
+		return classify(cell);
+	}
+
+	static void fillSolid(VoxelFarm::ContourVoxelData* data)
+	{
+		for (int z = 0; z < VoxelFarm::BLOCK_SIZE; ++z)
+		for (int y = 0; y < VoxelFarm::BLOCK_SIZE; ++y)
+		for (int x = 0; x < VoxelFarm::BLOCK_SIZE; ++x)
+		{
+			data->setMaterial(VoxelFarm::ContourVoxelData::Index(x, y, z), 1);
+		}
+	}
+};
 
+/// <summary>
+/// The SDK's PerlinNoise3D sampled per voxel, as the layer always was. With blockNoise it fills the
+/// block from VoxelNoise instead, which is batched and can be bounded but is a different function,
+/// so every seed grows different terrain; that mode is off unless a caller asks for it.
+/// </summary>
+class SimplePerlinVoxelLayer : public BoundedVoxelLayer
+{
+	using Index = VoxelFarm::ContourVoxelData::Index;
+
+	bool m_block_noise = false;
+	ClayEngine::VoxelNoise m_noise = {};
+	ClayEngine::VoxelNoiseSettings m_settings = { 2, 1., .5, 2., 0 };
+
+	static void getBlock(VoxelFarm::CellId cell, double (&origin)[3], double& step)
+	{
+		int level, cx, cy, cz;
+		VoxelFarm::unpackCellId(cell, level, cx, cy, cz);
+		auto scale = VoxelFarm::CELL_SIZE * (1ll << level);
+
+		step = 0.00001 * scale / static_cast<double>(VoxelFarm::BLOCK_DIMENSION);
+		auto margin = static_cast<double>(VoxelFarm::BLOCK_MARGIN) / static_cast<double>(VoxelFarm::BLOCK_DIMENSION);
+		origin[0] = 0.00001 * (cx - margin) * scale;
+		origin[1] = 0.00001 * (cy - margin) * scale;
+		origin[2] = 0.00001 * (cz - margin) * scale;
+	}
+
+	void fillSdkNoise(VoxelFarm::CellId cell, VoxelFarm::ContourVoxelData* data, bool& empty)
+	{
 		int level, cx, cy, cz;
 		VoxelFarm::unpackCellId(cell, level, cx, cy, cz);
 		auto scale = VoxelFarm::CELL_SIZE * (1ll << level);
@@ -29,8 +120,6 @@ public:
 		for (int x = 0; x < VoxelFarm::BLOCK_SIZE; ++x)
 		for (int y = 0; y < VoxelFarm::BLOCK_SIZE; ++y)
 		{
-			Index index(x, y, z);
-
 			auto dx = static_cast<double>(x - VoxelFarm::BLOCK_MARGIN) / static_cast<double>(VoxelFarm::BLOCK_DIMENSION);
 			auto dy = static_cast<double>(y - VoxelFarm::BLOCK_MARGIN) / static_cast<double>(VoxelFarm::BLOCK_DIMENSION);
 			auto dz = static_cast<double>(z - VoxelFarm::BLOCK_MARGIN) / static_cast<double>(VoxelFarm::BLOCK_DIMENSION);
@@ -39,101 +128,597 @@ public:
 			auto wy = 0.00001 * (cy + dy) * scale;
 			auto wz = 0.00001 * (cz + dz) * scale;
 
-			double field = VoxelFarm::PerlinNoise3D(wx, wy, wz, 0.5, 2.0, 2);
-
 			// If field is positive, the voxel is solid
-			if (field > 0.0)
+			if (VoxelFarm::PerlinNoise3D(wx, wy, wz, 0.5, 2.0, 2) > 0.0)
 			{
 				// Set material 1 to indicate solid
-				data->setMaterial(index, 1);
+				data->setMaterial(Index(x, y, z), 1);
 				empty = false;
 			}
 		}
 	}
+
+	void fillBlockNoise(VoxelFarm::CellId cell, VoxelFarm::ContourVoxelData* data, bool& empty)
+	{
+		// The whole block in one call, the field is x-fastest and reused by each generating thread
+		thread_local std::vector<double> field(static_cast<size_t>(VoxelFarm::BLOCK_SIZE) * VoxelFarm::BLOCK_SIZE * VoxelFarm::BLOCK_SIZE);
+
+		double origin[3], step;
+		getBlock(cell, origin, step);
+		m_noise.FillBlock(origin, step, VoxelFarm::BLOCK_SIZE, m_settings, field.data());
+
+		auto sample = field.data();
+		for (int z = 0; z < VoxelFarm::BLOCK_SIZE; ++z)
+		for (int y = 0; y < VoxelFarm::BLOCK_SIZE; ++y)
+		for (int x = 0; x < VoxelFarm::BLOCK_SIZE; ++x, ++sample)
+		{
+			if (*sample > 0.0)
+			{
+				data->setMaterial(Index(x, y, z), 1);
+				empty = false;
+			}
+		}
+	}
+
+public:
+	SimplePerlinVoxelLayer(bool blockNoise = false)
+		: m_block_noise(blockNoise)
+	{
+	}
+
+	/// <summary>
+	/// Only VoxelNoise has interval bounds, the SDK noise leaves every cell Mixed
+	/// </summary>
+	void getFieldBounds(VoxelFarm::CellId cell, double& low, double& high) override
+	{
+		if (!m_block_noise)
+		{
+			low = -std::numeric_limits<double>::infinity();
+			high = std::numeric_limits<double>::infinity();
+			return;
+		}
+
+		double origin[3], step;
+		getBlock(cell, origin, step);
+
+		auto extent = step * (VoxelFarm::BLOCK_SIZE - 1);
+		const double corner[3] = { origin[0] + extent, origin[1] + extent, origin[2] + extent };
+		ClayEngine::VoxelNoise::GetBounds(origin, corner, m_settings, low, high);
+	}
+
+	void getContourData(VoxelFarm::CellId cell, VoxelFarm::ContourVoxelData* data, bool& empty, void* threadContext)
+	{
+		empty = true;
+
+		switch (classifyOnce(cell))
+		{
+		case VoxelFarmCellClass::Empty:
+			return;
+		case VoxelFarmCellClass::Solid:
+			fillSolid(data);
+			empty = false;
+			return;
+		default:
+			break;
+		}
+
+		if (m_block_noise) fillBlockNoise(cell, data, empty);
+		else fillSdkNoise(cell, data, empty);
+	}
 };
 using SimplePerlinVoxelLayerPtr = std::unique_ptr<SimplePerlinVoxelLayer>;
 
+/// <summary>
+/// 2.5D ground layer following the v1_getVoxels pattern below: a heightmap per cell column, then
+/// everything under it is solid. The heightmap only depends on (level, x, z), so it comes from a
+/// column cache shared by every cell in the vertical stack and by every generator thread.
+/// </summary>
+class HeightmapVoxelLayer : public BoundedVoxelLayer
+{
+	using Index = VoxelFarm::ContourVoxelData::Index;
+
+	ClayEngine::VoxelNoise m_noise = {};
+	ClayEngine::VoxelNoiseSettings m_settings = {};
+	ClayEngine::VoxelColumnCachePtr m_columns = nullptr;
+	double m_ground = 0.;
+	double m_amplitude = 0.;
+
+	static double cellOrigin(int cell, double scale)
+	{
+		return (cell - static_cast<double>(VoxelFarm::BLOCK_MARGIN) / static_cast<double>(VoxelFarm::BLOCK_DIMENSION)) * scale;
+	}
+
+	void fillColumn(ClayEngine::VoxelColumn& column)
+	{
+		auto scale = static_cast<double>(VoxelFarm::CELL_SIZE * (1ll << column.Level));
+		auto step = scale / static_cast<double>(VoxelFarm::BLOCK_DIMENSION);
+
+		thread_local std::vector<double> field;
+		field.resize(column.Heights.size());
+
+		const double origin[2] = { cellOrigin(column.X, scale), cellOrigin(column.Z, scale) };
+		m_noise.FillPlane(origin, step, column.Size, m_settings, field.data());
+		for (size_t i = 0; i < field.size(); ++i) column.Heights[i] = static_cast<float>(m_ground + m_amplitude * field[i]);
+
+		column.UpdateBounds();
+	}
+
+public:
+	HeightmapVoxelLayer()
+	{
+		m_settings.Octaves = 4;
+		m_settings.Frequency = 1. / (64. * VoxelFarm::CELL_SIZE);
+		m_settings.Seed = 1;
+		m_amplitude = 8. * VoxelFarm::CELL_SIZE;
+
+		m_columns = std::make_unique<ClayEngine::VoxelColumnCache>([this](ClayEngine::VoxelColumn& column) { fillColumn(column); }, VoxelFarm::BLOCK_SIZE);
+	}
+
+	/// <summary>
+	/// The field is height - y, exact over the column samples since the voxels sit on them
+	/// </summary>
+	void getFieldBounds(VoxelFarm::CellId cell, double& low, double& high) override
+	{
+		int level, cx, cy, cz;
+		VoxelFarm::unpackCellId(cell, level, cx, cy, cz);
+		auto scale = static_cast<double>(VoxelFarm::CELL_SIZE * (1ll << level));
+		auto step = scale / static_cast<double>(VoxelFarm::BLOCK_DIMENSION);
+		auto bottom = cellOrigin(cy, scale);
+		auto top = bottom + step * (VoxelFarm::BLOCK_SIZE - 1);
+
+		auto column = m_columns->Get(level, cx, cz);
+		low = column->MinHeight - top;
+		high = column->MaxHeight - bottom;
+	}
+
+	void getContourData(VoxelFarm::CellId cell, VoxelFarm::ContourVoxelData* data, bool& empty, void* threadContext)
+	{
+		empty = true;
+
+		switch (classifyOnce(cell))
+		{
+		case VoxelFarmCellClass::Empty:
+			return; // Cell is entirely above the ground
+		case VoxelFarmCellClass::Solid:
+			fillSolid(data);
+			empty = false;
+			return;
+		default:
+			break;
+		}
+
+		int level, cx, cy, cz;
+		VoxelFarm::unpackCellId(cell, level, cx, cy, cz);
+		auto scale = static_cast<double>(VoxelFarm::CELL_SIZE * (1ll << level));
+		auto step = scale / static_cast<double>(VoxelFarm::BLOCK_DIMENSION);
+		auto bottom = cellOrigin(cy, scale);
+
+		auto column = m_columns->Get(level, cx, cz);
+
+		for (int z = 0; z < VoxelFarm::BLOCK_SIZE; ++z)
+		for (int x = 0; x < VoxelFarm::BLOCK_SIZE; ++x)
+		{
+			auto height = column->GetHeight(x, z);
+			for (int y = 0; y < VoxelFarm::BLOCK_SIZE && bottom + y * step < height; ++y)
+			{
+				data->setMaterial(Index(x, y, z), 1);
+				empty = false;
+			}
+		}
+	}
+};
+
 using MaterialLibrary = VoxelFarm::CMaterialLibrary;
 using Material = VoxelFarm::CMaterial;
 using Generator = VoxelFarm::CGenerator;
 using CellData = VoxelFarm::CCellData;
 using ThreadContext = VoxelFarm::CCellData::ThreadContext;
 
-void VoxelFarmThreadFunctor::operator()(Future future)
+#pragma region Cell Scheduler
+VoxelFarmCellScheduler::VoxelFarmCellScheduler(std::vector<int> clipmapRadius)
+	: m_radius(std::move(clipmapRadius))
 {
-	using namespace VoxelFarm;
+	m_radius.resize(VoxelFarm::LEVELS, c_voxelfarm_clipmap_radius);
+	m_view_cells.resize(VoxelFarm::LEVELS * 3);
 
-	initPerlin();
-	LODStats stats;
+	std::lock_guard<Mutex> lock(m_mutex);
+	rebuild();
+}
+
+bool VoxelFarmCellScheduler::isWanted(int level, int64_t x, int64_t y, int64_t z) const
+{
+	auto radius = m_radius[level];
+	auto view = &m_view_cells[level * 3];
+	if (std::abs(x - view[0]) > radius || std::abs(y - view[1]) > radius || std::abs(z - view[2]) > radius) return false;
+	if (level == 0) return true;
+
+	// Leave the cell to the finer LOD when all eight of its children are in the finer clipmap
+	auto finer_radius = m_radius[level - 1];
+	auto finer = &m_view_cells[(level - 1) * 3];
+	auto covered = [finer_radius](int64_t c, int64_t v) { return c * 2 >= v - finer_radius && c * 2 + 1 <= v + finer_radius; };
+	return !(covered(x, finer[0]) && covered(y, finer[1]) && covered(z, finer[2]));
+}
+
+bool VoxelFarmCellScheduler::isWanted(uint64_t cell) const
+{
+	int level, x, y, z;
+	VoxelFarm::unpackCellId(cell, level, x, y, z);
+	return isWanted(level, x, y, z);
+}
+
+void VoxelFarmCellScheduler::rebuild()
+{
+	Requests queue = {};
+	CellSet queued = {};
+
+	for (auto level = 0; level < VoxelFarm::LEVELS; ++level)
+	{
+		auto size = static_cast<double>(VoxelFarm::CELL_SIZE * (1ll << level));
+		auto radius = m_radius[level];
+		auto view = &m_view_cells[level * 3];
+
+		for (auto z = view[2] - radius; z <= view[2] + radius; ++z)
+		for (auto y = view[1] - radius; y <= view[1] + radius; ++y)
+		for (auto x = view[0] - radius; x <= view[0] + radius; ++x)
+		{
+			if (!isWanted(level, x, y, z)) continue;
+
+			auto cell = static_cast<uint64_t>(VoxelFarm::packCellId(level, static_cast<int>(x), static_cast<int>(y), static_cast<int>(z)));
+			if (m_resident.Contains(cell) || m_in_flight.Contains(cell)) continue;
+
+			auto dx = (x + .5) * size - m_viewer[0];
+			auto dy = (y + .5) * size - m_viewer[1];
+			auto dz = (z + .5) * size - m_viewer[2];
+			auto distance = std::max(std::sqrt(dx * dx + dy * dy + dz * dz), size * .5);
+
+			// Projected voxel size, the error this LOD shows on screen until the cell exists
+			auto error = size / VoxelFarm::BLOCK_DIMENSION / distance;
+
+			queue.push({ cell, error, distance });
+			queued.Insert(cell);
+		}
+	}
+
+	for (auto& entry : m_queued)
+	{
+		if (!queued.Contains(entry.Key)) ++m_cancelled;
+	}
+	m_resident.EraseIf([this](const CellSetEntry& entry) { return !isWanted(entry.Key); });
+
+	std::swap(m_queue, queue);
+	std::swap(m_queued, queued);
+	m_wake.notify_all();
+}
+
+void VoxelFarmCellScheduler::SetViewer(double x, double y, double z)
+{
+	std::lock_guard<Mutex> lock(m_mutex);
+
+	m_viewer[0] = x;
+	m_viewer[1] = y;
+	m_viewer[2] = z;
+
+	std::vector<int64_t> cells(m_view_cells.size());
+	for (auto level = 0; level < VoxelFarm::LEVELS; ++level)
+	{
+		auto size = static_cast<double>(VoxelFarm::CELL_SIZE * (1ll << level));
+		for (auto axis = 0; axis < 3; ++axis) cells[level * 3 + axis] = static_cast<int64_t>(std::floor(m_viewer[axis] / size));
+	}
+
+	// Coarser LODs can only change cell when LOD 0 does
+	if (std::equal(cells.begin(), cells.begin() + 3, m_view_cells.begin())) return;
+
+	std::swap(m_view_cells, cells);
+	rebuild();
+}
+
+bool VoxelFarmCellScheduler::Pop(uint64_t& cell, std::chrono::milliseconds timeout)
+{
+	std::unique_lock<Mutex> lock(m_mutex);
+	if (!m_wake.wait_for(lock, timeout, [this]() { return !m_queue.empty(); })) return false;
+
+	cell = m_queue.top().Cell;
+	m_queue.pop();
+	m_queued.Erase(cell);
+	m_in_flight.Insert(cell);
+	return true;
+}
+
+bool VoxelFarmCellScheduler::IsWanted(uint64_t cell) const
+{
+	std::lock_guard<Mutex> lock(m_mutex);
+	return isWanted(cell);
+}
+
+bool VoxelFarmCellScheduler::Complete(uint64_t cell)
+{
+	std::lock_guard<Mutex> lock(m_mutex);
+
+	m_in_flight.Erase(cell);
+	if (!isWanted(cell))
+	{
+		++m_cancelled;
+		return false;
+	}
+
+	m_resident.Insert(cell);
+	++m_generated;
+	return true;
+}
+
+VoxelFarmSchedulerStats VoxelFarmCellScheduler::GetStats() const
+{
+	std::lock_guard<Mutex> lock(m_mutex);
+	return { m_queued.GetSize(), m_in_flight.GetSize(), m_resident.GetSize(), m_generated, m_cancelled };
+}
+#pragma endregion
+
+/// <summary>
+/// LODStats plus the cells the interval bounds settled without running the generator
+/// </summary>
+struct BoundedLODStats : public VoxelFarm::LODStats
+{
+	uint64_t SkippedEmpty = 0;
+	uint64_t SkippedSolid = 0;
+	uint64_t Generated = 0;
+	uint64_t Loaded = 0;
+};
+
+namespace
+{
+	constexpr uint8_t c_stored_cell_version{ 1 };
+	constexpr uint8_t c_stored_cell_empty{ 0x01 };
+
+	ClayEngine::VoxelCellId storedCellId(VoxelFarm::CellId cell)
+	{
+		int level, x, y, z;
+		VoxelFarm::unpackCellId(cell, level, x, y, z);
+		return ClayEngine::PackVoxelCellId(level, x, y, z);
+	}
+
+	void putVarint(std::vector<uint8_t>& out, uint32_t value)
+	{
+		while (value >= 0x80)
+		{
+			out.push_back(static_cast<uint8_t>(value | 0x80));
+			value >>= 7;
+		}
+		out.push_back(static_cast<uint8_t>(value));
+	}
+
+	bool getVarint(const uint8_t*& cursor, const uint8_t* end, uint32_t& value)
+	{
+		value = 0;
+		for (auto shift = 0; shift < 35 && cursor < end; shift += 7)
+		{
+			auto byte = *cursor++;
+			value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+			if (!(byte & 0x80)) return true;
+		}
+		return false;
+	}
+
+	/// <summary>
+	/// A generated block as stored in the region files: version, flags, then varint (run, material)
+	/// pairs over the block in z, x, y order, the order the layers write it in
+	/// </summary>
+	void encodeCell(VoxelFarm::ContourVoxelData* data, bool empty, std::vector<uint8_t>& out)
+	{
+		using Index = VoxelFarm::ContourVoxelData::Index;
+
+		out.clear();
+		out.push_back(c_stored_cell_version);
+		out.push_back(empty ? c_stored_cell_empty : 0);
+		if (empty) return;
+
+		uint32_t material = 0, run = 0;
+		for (int z = 0; z < VoxelFarm::BLOCK_SIZE; ++z)
+		for (int x = 0; x < VoxelFarm::BLOCK_SIZE; ++x)
+		for (int y = 0; y < VoxelFarm::BLOCK_SIZE; ++y)
+		{
+			auto value = static_cast<uint32_t>(data->getMaterial(Index(x, y, z)));
+			if (run > 0 && value != material)
+			{
+				putVarint(out, run);
+				putVarint(out, material);
+				run = 0;
+			}
+			material = value;
+			++run;
+		}
+		putVarint(out, run);
+		putVarint(out, material);
+	}
+
+	/// <summary>
+	/// Fills data from a stored block, false if the record is from another version or doesn't cover the block
+	/// </summary>
+	bool decodeCell(const ClayEngine::VoxelRegionCellView& view, VoxelFarm::ContourVoxelData* data, bool& empty)
+	{
+		using Index = VoxelFarm::ContourVoxelData::Index;
+
+		if (view.Size < 2 || view.Data[0] != c_stored_cell_version) return false;
+		empty = (view.Data[1] & c_stored_cell_empty) != 0;
+		if (empty) return true;
+
+		constexpr auto volume = static_cast<uint32_t>(VoxelFarm::BLOCK_SIZE) * VoxelFarm::BLOCK_SIZE * VoxelFarm::BLOCK_SIZE;
+		auto cursor = view.Data + 2, end = view.Data + view.Size;
+		uint32_t voxel = 0, run = 0, material = 0;
+		while (voxel < volume)
+		{
+			if (!getVarint(cursor, end, run) || !getVarint(cursor, end, material) || run == 0 || run > volume - voxel) return false;
+			for (; run > 0; --run, ++voxel)
+			{
+				if (material == 0) continue; // The block was cleared before decoding
+				auto y = static_cast<int>(voxel % VoxelFarm::BLOCK_SIZE);
+				auto x = static_cast<int>(voxel / VoxelFarm::BLOCK_SIZE % VoxelFarm::BLOCK_SIZE);
+				auto z = static_cast<int>(voxel / (VoxelFarm::BLOCK_SIZE * VoxelFarm::BLOCK_SIZE));
+				data->setMaterial(Index(x, y, z), material);
+			}
+		}
+		return cursor == end;
+	}
+}
 
-	MaterialLibrary* materials = VF_NEW MaterialLibrary(); // Instance specific contains Materials
-	materials->materialCount = 2;
-	materials->materialIndex = VF_ALLOC(Material, materials->materialCount);
-	memset(materials->materialIndex, 0, materials->materialCount * sizeof(Material));
-	memset(&materials->billboardPack, 0, sizeof(materials->billboardPack));
-	materials->materialIndex[0].billboard = -1;
-	materials->materialIndex[1].billboard = 1;
-	materials->materialIndex[1].billboardType = 1;
+void VoxelFarmThreadFunctor::operator()(Future future, VoxelFarmThread* farm)
+{
+	using namespace VoxelFarm;
 
-	SimplePerlinVoxelLayer* layer = VF_NEW SimplePerlinVoxelLayer(); // Simple perlin noise layer implementation
+	BoundedLODStats stats;
 
-	Generator* generator = VF_NEW Generator(); // Voxel generator, composes voxels from layers
-	generator->addVoxelLayer(layer);
+	auto scheduler = farm->GetScheduler();
+	auto generator = farm->GetGenerator();
+	auto materials = farm->GetMaterials();
+	auto store = farm->GetStore();
+	std::vector<uint8_t> stored = {}; // Encoding buffer, reused for every cell this worker saves
 
-	ContourThreadContext* contour_context = VF_NEW ContourThreadContext(); // A thread for generating voxel contour data
-	ThreadContext* context_cell_data = VF_NEW ThreadContext(); // A thread for generating contour mesh data
+	ContourThreadContext* contour_context = VF_NEW ContourThreadContext(); // This worker's voxel contour data
+	ThreadContext* context_cell_data = VF_NEW ThreadContext(); // This worker's contour mesh data
 
 	while (future.wait_for(std::chrono::nanoseconds(1)) == std::future_status::timeout)
 	{
+		uint64_t id;
+		if (!scheduler->Pop(id, c_voxelfarm_worker_wait)) continue;
+
+		CellId cell = id;
 		contour_context->data->clear();
 
-		// To generate cell mesh data you need a CellId, here we're just generating a random CellId
-		int level = rand() % VoxelFarm::LEVELS;
-		int xc = rand();
-		int yc = rand();
-		int zc = rand();
-		CellId* cell = VF_NEW CellId(packCellId(level, xc, yc, zc));
-		
-		// First we generate a cell's voxel data and store it in the thread contour_context->data
-		bool empty;
-		generator->generate(*cell, contour_context->data, empty, stats);
-		if (empty) continue;
+		// A block saved by an earlier run is read back instead of running the layers again
+		bool empty = true, loaded = false;
+		if (store)
+		{
+			auto view = store->Read(storedCellId(cell));
+			if (view)
+			{
+				loaded = decodeCell(view, contour_context->data, empty);
+				if (loaded) ++stats.Loaded;
+				else contour_context->data->clear();
+			}
+		}
 
-		// Create a CellData object to hold the cell mesh data
-		CellData* cell_data = VF_NEW CellData(*cell);
-		if (!contourCellDataMCA(contour_context, NULL, materials, cell_data, NULL, context_cell_data, true, stats))
-			continue;
+		if (!loaded)
+		{
+			// All air or all rock has no surface to contour, settle it from the bounds alone
+			auto kind = farm->ClassifyCell(cell);
+			if (kind != VoxelFarmCellClass::Mixed)
+			{
+				if (kind == VoxelFarmCellClass::Empty) ++stats.SkippedEmpty;
+				else ++stats.SkippedSolid;
+				scheduler->Complete(cell);
+				continue;
+			}
 
-		//Services::GetService<ClayEngine::Game::VoxelFarmCellRender>()->SetCellData(cell_data);
+			++stats.Generated;
 
-		// Print details of the cell data that gets generated
-		int faces = cell_data->faceCount[CellData::MEDIUM_SOLID];
-		std::wstringstream wss;
-		wss << "LOD_" << level << " [" << xc << "," << yc << "," << zc << "] " << faces << " faces";
-		WriteLine(wss.str());
+			// First we generate a cell's voxel data and store it in the thread contour_context->data
+			generator->generate(cell, contour_context->data, empty, stats);
 
+			// Then save it for the next run, the store makes it durable on its next Flush. An empty block
+			// has no surface to keep and the next run regenerates it, so it isn't saved.
+			if (store && !empty)
+			{
+				encodeCell(contour_context->data, empty, stored);
+				store->Write(storedCellId(cell), stored);
+			}
+		}
+
+		if (empty || !scheduler->IsWanted(cell))
+		{
+			scheduler->Complete(cell);
+			continue;
+		}
+
+		// Create a CellData object to hold the cell mesh data
+		CellData* cell_data = VF_NEW CellData(cell);
+		if (contourCellDataMCA(contour_context, NULL, materials, cell_data, NULL, context_cell_data, true, stats) && scheduler->Complete(cell))
+		{
+			//Services::GetService<ClayEngine::Game::VoxelFarmCellRender>()->SetCellData(cell_data);
+
+			// Print details of the cell data that gets generated
+			int level, xc, yc, zc;
+			unpackCellId(cell, level, xc, yc, zc);
+			int faces = cell_data->faceCount[CellData::MEDIUM_SOLID];
+			std::wstringstream wss;
+			wss << "LOD_" << level << " [" << xc << "," << yc << "," << zc << "] " << faces << " faces";
+			WriteLine(wss.str());
+		}
+		else
+		{
+			scheduler->Complete(cell);
+		}
 
 		VF_DELETE cell_data;
-		VF_DELETE cell;
 	}
 
+	std::wstringstream wss;
+	wss << "VoxelFarm worker generated " << stats.Generated << " cells, loaded " << stats.Loaded << ", skipped " << stats.SkippedEmpty << " empty and " << stats.SkippedSolid << " solid";
+	WriteLine(wss.str());
+
 	VF_DELETE context_cell_data;
 	VF_DELETE contour_context;
+}
+
+VoxelFarmThread::VoxelFarmThread(size_t workers, std::vector<int> clipmapRadius, bool heightmapGround, bool blockNoise, std::filesystem::path regionDirectory)
+{
+	using namespace VoxelFarm;
 
-	VF_DELETE generator;
-	VF_DELETE layer;
-	VF_DELETE materials;
+	if (!regionDirectory.empty()) m_store = std::make_unique<VoxelRegionStore>(std::move(regionDirectory));
+
+	initPerlin();
+
+	m_materials = VF_NEW MaterialLibrary(); // Instance specific contains Materials
+	m_materials->materialCount = 2;
+	m_materials->materialIndex = VF_ALLOC(Material, m_materials->materialCount);
+	memset(m_materials->materialIndex, 0, m_materials->materialCount * sizeof(Material));
+	memset(&m_materials->billboardPack, 0, sizeof(m_materials->billboardPack));
+	m_materials->materialIndex[0].billboard = -1;
+	m_materials->materialIndex[1].billboard = 1;
+	m_materials->materialIndex[1].billboardType = 1;
+
+	if (heightmapGround) m_layers.push_back(VF_NEW HeightmapVoxelLayer()); // Ground from a cached heightmap per column
+	m_layers.push_back(VF_NEW SimplePerlinVoxelLayer(blockNoise)); // Simple perlin noise layer implementation
+
+	m_generator = VF_NEW Generator(); // Voxel generator, composes voxels from layers, shared by the workers
+	for (auto layer : m_layers) m_generator->addVoxelLayer(layer);
+
+	m_scheduler = std::make_unique<VoxelFarmCellScheduler>(std::move(clipmapRadius));
+
+	if (workers == 0) workers = std::max(1u, std::thread::hardware_concurrency());
+	m_workers.resize(workers);
+	for (auto& worker : m_workers)
+	{
+		worker.WorkerThread = std::thread{ VoxelFarmThreadFunctor(), std::move(worker.WorkerPromise.get_future()), this };
+	}
 }
 
-VoxelFarmThread::VoxelFarmThread()
+VoxelFarmCellClass VoxelFarmThread::ClassifyCell(uint64_t cell)
 {
-	m_thread = std::thread{ VoxelFarmThreadFunctor(), std::move(m_promise.get_future()) };
+	auto result = VoxelFarmCellClass::Empty;
+	for (auto layer : m_layers)
+	{
+		auto kind = static_cast<BoundedVoxelLayer*>(layer)->classify(cell);
+		if (kind == VoxelFarmCellClass::Solid) return kind;
+		if (kind == VoxelFarmCellClass::Mixed) result = kind;
+	}
+	return result;
 }
 
 VoxelFarmThread::~VoxelFarmThread()
 {
-	m_promise.set_value();
-	if (m_thread.joinable()) m_thread.join();
+	for (auto& worker : m_workers)
+	{
+		worker.WorkerPromise.set_value();
+	}
+	for (auto& worker : m_workers)
+	{
+		if (worker.WorkerThread.joinable()) worker.WorkerThread.join();
+	}
+
+	if (m_store) m_store->Flush();
+
+	VF_DELETE m_generator;
+	for (auto layer : m_layers) VF_DELETE static_cast<BoundedVoxelLayer*>(layer);
+	VF_DELETE m_materials;
 }
 
 
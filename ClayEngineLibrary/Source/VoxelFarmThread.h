@@ -1,23 +1,180 @@
 #pragma once
 
 #include "ClayEngine.h"
+#include "CellTable.h"
 
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
 #include <memory>
+#include <queue>
+#include <vector>
+
+namespace VoxelFarm
+{
+	class CGenerator;
+	class CMaterialLibrary;
+	class IVoxelLayer;
+}
 
 namespace ClayEngine
 {
+	constexpr auto c_voxelfarm_clipmap_radius{ 4 }; // Default radius in cells around the viewer at every LOD
+	constexpr auto c_voxelfarm_worker_wait{ std::chrono::milliseconds(10) }; // How long an idle worker sleeps before checking for shutdown
+
+	/// <summary>
+	/// What the layers' interval bounds say about a cell before any voxel is evaluated
+	/// </summary>
+	enum class VoxelFarmCellClass
+	{
+		Empty,
+		Solid,
+		Mixed,
+	};
+
+	/// <summary>
+	/// A cell waiting to be generated. Cell is a packed VoxelFarm::CellId, Error is the projected size
+	/// of the cell's voxels from the viewer, so coarse cells close by go before fine cells far away.
+	/// </summary>
+	struct VoxelFarmCellRequest
+	{
+		uint64_t Cell = 0;
+		double Error = 0.;
+		double Distance = 0.;
+
+		bool operator<(const VoxelFarmCellRequest& rhs) const
+		{
+			if (Error != rhs.Error) return Error < rhs.Error;
+			return Distance > rhs.Distance;
+		}
+	};
+
+	struct VoxelFarmSchedulerStats
+	{
+		size_t Queued = 0;
+		size_t InFlight = 0;
+		size_t Resident = 0;
+		uint64_t Generated = 0;
+		uint64_t Cancelled = 0;
+	};
+
+	/// <summary>
+	/// Decides which cells the viewer needs and in what order. Each LOD covers a cube of clipmap radius
+	/// cells around the viewer, minus the cells whose eight children the next finer LOD already covers.
+	/// Moving the viewer into a new cell rebuilds the queue, queued cells that fell out of range are
+	/// dropped there and cells in flight are dropped when their worker reports back.
+	/// </summary>
+	class VoxelFarmCellScheduler
+	{
+		using Requests = std::priority_queue<VoxelFarmCellRequest>;
+
+		mutable Mutex m_mutex = {};
+		std::condition_variable m_wake = {};
+
+		std::vector<int> m_radius = {};
+		std::vector<int64_t> m_view_cells = {}; // Viewer cell x,y,z per LOD
+		double m_viewer[3] = {};
+
+		Requests m_queue = {};
+		CellSet m_queued = {};
+		CellSet m_in_flight = {};
+		CellSet m_resident = {};
+		uint64_t m_generated = 0;
+		uint64_t m_cancelled = 0;
+
+		bool isWanted(int level, int64_t x, int64_t y, int64_t z) const;
+		bool isWanted(uint64_t cell) const;
+		void rebuild();
+
+	public:
+		/// <summary>
+		/// clipmapRadius holds the radius in cells for each LOD, missing entries use c_voxelfarm_clipmap_radius
+		/// </summary>
+		VoxelFarmCellScheduler(std::vector<int> clipmapRadius = {});
+		~VoxelFarmCellScheduler() = default;
+
+		/// <summary>
+		/// Moves the viewer, only rebuilds the queue when the viewer crossed into another LOD 0 cell
+		/// </summary>
+		void SetViewer(double x, double y, double z);
+
+		/// <summary>
+		/// Takes the most urgent cell, waiting up to timeout for one, returns false if there was none
+		/// </summary>
+		bool Pop(uint64_t& cell, std::chrono::milliseconds timeout);
+		/// <summary>
+		/// True while the viewer still needs cell, workers check this between the expensive stages
+		/// </summary>
+		bool IsWanted(uint64_t cell) const;
+		/// <summary>
+		/// Reports cell as finished, returns false and counts a cancellation if it went out of range meanwhile
+		/// </summary>
+		bool Complete(uint64_t cell);
+
+		VoxelFarmSchedulerStats GetStats() const;
+	};
+	using VoxelFarmCellSchedulerPtr = std::unique_ptr<VoxelFarmCellScheduler>;
+
+	class VoxelFarmThread;
+	class VoxelRegionStore;
+
+	/// <summary>
+	/// Entry point for a generation worker, each worker owns its own contour thread contexts
+	/// </summary>
 	struct VoxelFarmThreadFunctor
 	{
-		void operator()(Future future);
+		void operator()(Future future, VoxelFarmThread* farm);
 	};
 
+	/// <summary>
+	/// Owns the shared generator and material library and runs workers that generate and contour the
+	/// cells the scheduler hands out
+	/// </summary>
 	class VoxelFarmThread
 	{
-		Thread m_thread;
-		Promise m_promise = {};
+		struct Worker
+		{
+			Thread WorkerThread;
+			Promise WorkerPromise = {};
+		};
+		using Workers = std::vector<Worker>;
+
+		VoxelFarmCellSchedulerPtr m_scheduler = nullptr;
+		VoxelFarm::CMaterialLibrary* m_materials = nullptr;
+		std::vector<VoxelFarm::IVoxelLayer*> m_layers = {}; // All of them bounded, see ClassifyCell
+		VoxelFarm::CGenerator* m_generator = nullptr;
+		std::unique_ptr<VoxelRegionStore> m_store = nullptr; // Only with a region directory
+		Workers m_workers = {};
+
 	public:
-		VoxelFarmThread();
+		/// <summary>
+		/// workers = 0 uses one worker per hardware thread. heightmapGround adds HeightmapVoxelLayer under
+		/// the perlin layer, which fills in ground the perlin layer leaves open and so changes the world
+		/// every existing seed generates; it is off unless a caller asks for it. blockNoise moves the perlin
+		/// layer from the SDK's PerlinNoise3D to the batched VoxelNoise, whose bounds let ClassifyCell skip
+		/// empty and solid cells, at the price of different terrain for every seed; it is off by default too.
+		/// With a regionDirectory, workers read each cell from the region files there before generating
+		/// it and save every block they generate, so a restarted server serves the same terrain again.
+		/// </summary>
+		VoxelFarmThread(size_t workers = 0, std::vector<int> clipmapRadius = {}, bool heightmapGround = false, bool blockNoise = false, std::filesystem::path regionDirectory = {});
 		~VoxelFarmThread();
+
+		void SetViewer(double x, double y, double z) { m_scheduler->SetViewer(x, y, z); }
+
+		VoxelFarmCellScheduler* GetScheduler() { return m_scheduler.get(); }
+		VoxelFarm::CGenerator* GetGenerator() { return m_generator; }
+		VoxelFarm::CMaterialLibrary* GetMaterials() { return m_materials; }
+		/// <summary>
+		/// The region files cells are loaded from and saved to, null without a region directory
+		/// </summary>
+		VoxelRegionStore* GetStore() { return m_store.get(); }
+
+		/// <summary>
+		/// Bounds every layer over the cell's block, Solid if any layer is solid throughout, Empty if all are empty.
+		/// Each layer keeps its class for the calling thread, the generator run that follows reuses it.
+		/// </summary>
+		VoxelFarmCellClass ClassifyCell(uint64_t cell);
 	};
 	using VoxelFarmThreadPtr = std::unique_ptr<VoxelFarmThread>;
 }
@@ -13,7 +13,7 @@ uint8_t ClayEngine::Voxel::EncodeVoxelVector(float vector)
 float ClayEngine::Voxel::DecodeVoxelVector(uint8_t vector)
 {
 	// (char * (2.5 / 256)) - .5
-	return float((vector * c_vector_pack_ratio) - std::abs(c_voxel_vector_min));
+	return c_voxel_decode_table[vector];
 }
 
 void ClayEngine::Voxel::SetVoxel(float& z, float& y, float& x, unsigned int& lod)
@@ -7,6 +7,7 @@
 /*                                                                            */
 /******************************************************************************/
 
+#include <array>
 #include <tuple>
 
 namespace ClayEngine
@@ -27,6 +28,27 @@ namespace ClayEngine
 	constexpr auto c_voxel_vector_abs{ c_voxel_vector_max - c_voxel_vector_min }; // Absolute value (hacky)
 	constexpr auto c_vector_pack_ratio{ c_voxel_vector_abs / c_voxel_vector_pack };
 
+	// Bit positions of the fields when a Voxel is handled as a packed uint32_t
+	constexpr auto c_voxel_vector_code_max{ (1u << c_packed_vector_bits) - 1u };
+	constexpr auto c_voxel_lod_shift{ c_packed_vector_bits * 3 };
+	constexpr auto c_voxel_lod_max{ (1u << c_packed_lod_bits) - 1u };
+	constexpr auto c_voxel_lod_mask{ c_voxel_lod_max << c_voxel_lod_shift };
+
+	/// <summary>
+	/// Builds the 256 entry table that reverses EncodeVoxelVector, (code * (2.5 / 256)) - .5
+	/// evaluated once per code at compile time.
+	/// </summary>
+	constexpr std::array<float, c_voxel_vector_pack> MakeVoxelDecodeTable()
+	{
+		std::array<float, c_voxel_vector_pack> table = {};
+		for (auto i = 0; i < c_voxel_vector_pack; ++i)
+		{
+			table[i] = static_cast<float>(i) * c_vector_pack_ratio + c_voxel_vector_min;
+		}
+		return table;
+	}
+	constexpr auto c_voxel_decode_table = MakeVoxelDecodeTable();
+
 	/// <summary>
 	/// Voxel class compresses a 3D vector of floats (128bits) into 32bits (4:1 lossy compression)
 	/// </summary>
@@ -50,14 +72,15 @@ namespace ClayEngine
 
 		/// <summary>
 		/// This function is effectively a normalization comparable to converting F to C as far as the algorithm is concerned.
-		/// I've considered just making this a lookup table as there are only 256 possible conversions from char to float.
+		/// There are only 256 possible conversions from char to float, so decoding is a lookup into c_voxel_decode_table.
 		/// We're dealing with fast precision 32 bit floats here, that range in value from 2.0 to -0.5, and then we pack them.
 		/// Since EncodeVoxelVector returns a uchar the compiler does the bit shift for us to store in the uint32_t.
-		/// The LOD and flags part aren't really implemented.
+		/// The LOD nibble holds the octree height a voxel represents (see VoxelOctree), flags aren't really implemented.
 		/// </summary>
 		uint8_t EncodeVoxelVector(float vector);
 		/// <summary>
 		/// Reverse the above algorithm, there are only 256 possible return values for this float, thus the "lossy" compression.
+		/// For spans of voxels use VoxelBatchCodec instead.
 		/// </summary>
 		float DecodeVoxelVector(uint8_t vector);
 
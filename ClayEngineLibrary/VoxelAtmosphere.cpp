@@ -0,0 +1,678 @@
+#include "pch.h"
+#include "VoxelAtmosphere.h"
+#include "VoxelOctree.h"
+#include "Strings.h"
+#include "Benchmark.h"
+
+using namespace ClayEngine;
+
+namespace
+{
+	size_t levelIndex(int X, int Y, int x, int y, int z)
+	{
+		return (static_cast<size_t>(z) * Y + y) * X + x;
+	}
+
+	float trilinear(const std::vector<float>& field, int X, int Y, int Z, float x, float y, float z)
+	{
+		x = std::clamp(x, 0.f, static_cast<float>(X - 1));
+		y = std::clamp(y, 0.f, static_cast<float>(Y - 1));
+		z = std::clamp(z, 0.f, static_cast<float>(Z - 1));
+
+		auto x0 = static_cast<int>(x), y0 = static_cast<int>(y), z0 = static_cast<int>(z);
+		auto x1 = std::min(x0 + 1, X - 1), y1 = std::min(y0 + 1, Y - 1), z1 = std::min(z0 + 1, Z - 1);
+		auto fx = x - x0, fy = y - y0, fz = z - z0;
+
+		auto lerp = [](float a, float b, float t) { return a + (b - a) * t; };
+		auto c00 = lerp(field[levelIndex(X, Y, x0, y0, z0)], field[levelIndex(X, Y, x1, y0, z0)], fx);
+		auto c10 = lerp(field[levelIndex(X, Y, x0, y1, z0)], field[levelIndex(X, Y, x1, y1, z0)], fx);
+		auto c01 = lerp(field[levelIndex(X, Y, x0, y0, z1)], field[levelIndex(X, Y, x1, y0, z1)], fx);
+		auto c11 = lerp(field[levelIndex(X, Y, x0, y1, z1)], field[levelIndex(X, Y, x1, y1, z1)], fx);
+		return lerp(lerp(c00, c10, fy), lerp(c01, c11, fy), fz);
+	}
+}
+
+float ClayEngine::AtmosphereSaturation(float temperature)
+{
+	return 3.8e-3f * std::exp(17.27f * temperature / (temperature + 237.3f));
+}
+
+void ClayEngine::AtmosphereFields::Resize(int x, int y, int z)
+{
+	auto count = static_cast<size_t>(x) * y * z;
+	Temperature.assign(count, 0.f);
+	Pressure.assign(count, 0.f);
+	Humidity.assign(count, 0.f);
+	Cloud.assign(count, 0.f);
+	VelocityX.assign(static_cast<size_t>(x + 1) * y * z, 0.f);
+	VelocityY.assign(static_cast<size_t>(x) * (y + 1) * z, 0.f);
+	VelocityZ.assign(static_cast<size_t>(x) * y * (z + 1), 0.f);
+}
+
+void ClayEngine::AtmosphereTickFunctor::operator()(FUTURE future, AtmosphereSolver* solver)
+{
+	auto next = std::chrono::steady_clock::now();
+
+	while (future.wait_until(next) == std::future_status::timeout)
+	{
+		solver->Step();
+
+		// Ticks stay fixed size, a server that falls behind runs weather slower rather than in bursts
+		next += c_atmosphere_tick_interval;
+		next = std::max(next, std::chrono::steady_clock::now());
+	}
+}
+
+#pragma region Atmosphere Solver Implementation
+ClayEngine::AtmosphereSolver::AtmosphereSolver(WorkerPoolRaw pool, const VoxelBox& region, int cellBits)
+	: m_pool(pool)
+	, m_region(region)
+	, m_cell_bits(cellBits)
+{
+	if (!m_pool) throw std::runtime_error("ClayEngine::AtmosphereSolver requires a WorkerPool");
+	if (m_region.IsEmpty()) throw std::runtime_error("ClayEngine::AtmosphereSolver region is empty");
+
+	auto cell = 1 << m_cell_bits;
+	m_cell_metres = static_cast<float>(cell) * c_atmosphere_voxel_metres;
+	m_x = (m_region.SizeX() + cell - 1) >> m_cell_bits;
+	m_y = (m_region.SizeY() + cell - 1) >> m_cell_bits;
+	m_z = (m_region.SizeZ() + cell - 1) >> m_cell_bits;
+
+	auto count = GetCellCount();
+	m_fields.Resize(m_x, m_y, m_z);
+	m_scratch.Resize(m_x, m_y, m_z);
+	m_solid.assign(count, 0);
+	m_precipitation.assign(static_cast<size_t>(m_x) * m_z, 0.f);
+	m_slab_sums.assign(static_cast<size_t>(m_z) * 2, 0.);
+
+	// Halve each axis until the coarsest level is a handful of cells
+	MultigridLevel level = {};
+	level.X = m_x;
+	level.Y = m_y;
+	level.Z = m_z;
+	level.H2 = m_cell_metres * m_cell_metres;
+	level.Solid = m_solid.data();
+	for (;;)
+	{
+		auto cells = static_cast<size_t>(level.X) * level.Y * level.Z;
+		level.Solution.assign(cells, 0.f);
+		level.Rhs.assign(cells, 0.f);
+		level.Residual.assign(cells, 0.f);
+		m_levels.push_back(level);
+
+		if (cells <= 8) break;
+
+		level.X = (level.X + 1) / 2;
+		level.Y = (level.Y + 1) / 2;
+		level.Z = (level.Z + 1) / 2;
+		level.H2 *= 4.f;
+		level.Solid = nullptr;
+	}
+
+	Load(VoxelGrid());
+}
+
+ClayEngine::AtmosphereSolver::~AtmosphereSolver()
+{
+	Stop();
+}
+
+float ClayEngine::AtmosphereSolver::environment(int y) const
+{
+	auto altitude = (static_cast<float>(m_region.Min.Y) + (static_cast<float>(y) + .5f) * static_cast<float>(1 << m_cell_bits)) * c_atmosphere_voxel_metres;
+	return c_atmosphere_ground_temperature - c_atmosphere_lapse_rate * altitude;
+}
+
+float ClayEngine::AtmosphereSolver::sample(const std::vector<float>& field, float x, float y, float z) const
+{
+	return trilinear(field, m_x, m_y, m_z, x, y, z);
+}
+
+// Face x sits half a cell before cell x's centre, so positions shift by half a cell along the face normal
+float ClayEngine::AtmosphereSolver::sampleX(float x, float y, float z) const
+{
+	return trilinear(m_fields.VelocityX, m_x + 1, m_y, m_z, x + .5f, y, z);
+}
+
+float ClayEngine::AtmosphereSolver::sampleY(float x, float y, float z) const
+{
+	return trilinear(m_fields.VelocityY, m_x, m_y + 1, m_z, x, y + .5f, z);
+}
+
+float ClayEngine::AtmosphereSolver::sampleZ(float x, float y, float z) const
+{
+	return trilinear(m_fields.VelocityZ, m_x, m_y, m_z + 1, x, y, z + .5f);
+}
+
+float ClayEngine::AtmosphereSolver::divergence(int x, int y, int z) const
+{
+	// Closed faces hold zero, so walls and obstacles need no special case
+	return (m_fields.VelocityX[faceX(x + 1, y, z)] - m_fields.VelocityX[faceX(x, y, z)]
+		+ m_fields.VelocityY[faceY(x, y + 1, z)] - m_fields.VelocityY[faceY(x, y, z)]
+		+ m_fields.VelocityZ[faceZ(x, y, z + 1)] - m_fields.VelocityZ[faceZ(x, y, z)]) / m_cell_metres;
+}
+
+void ClayEngine::AtmosphereSolver::Load(const VoxelGrid& voxels)
+{
+	LockGuard lock(m_mutex);
+
+	// Count solid voxels per coarse cell, only chunks that overlap the region are visited
+	std::vector<uint32_t> counts(GetCellCount(), 0);
+	for (const auto& [key, chunk] : voxels.GetChunks())
+	{
+		auto c = VoxelGrid::GetChunkCoord(key);
+		VoxelCoord base = { c.X * c_voxel_chunk_size, c.Y * c_voxel_chunk_size, c.Z * c_voxel_chunk_size };
+		if (base.X >= m_region.Max.X || base.Y >= m_region.Max.Y || base.Z >= m_region.Max.Z) continue;
+		if (base.X + c_voxel_chunk_size <= m_region.Min.X || base.Y + c_voxel_chunk_size <= m_region.Min.Y || base.Z + c_voxel_chunk_size <= m_region.Min.Z) continue;
+
+		for (uint32_t m = 0; m < static_cast<uint32_t>(c_voxel_chunk_volume); ++m)
+		{
+			if (IsVoxelEmpty(chunk->Voxels[m])) continue;
+
+			auto x = base.X + static_cast<int>(MortonCompact(m));
+			auto y = base.Y + static_cast<int>(MortonCompact(m >> 1));
+			auto z = base.Z + static_cast<int>(MortonCompact(m >> 2));
+			if (!m_region.Contains(x, y, z)) continue;
+
+			++counts[index((x - m_region.Min.X) >> m_cell_bits, (y - m_region.Min.Y) >> m_cell_bits, (z - m_region.Min.Z) >> m_cell_bits)];
+		}
+	}
+
+	auto half = (1u << (m_cell_bits * 3)) / 2;
+	for (auto z = 0; z < m_z; ++z)
+	{
+		for (auto y = 0; y < m_y; ++y)
+		{
+			auto t = environment(y);
+			for (auto x = 0; x < m_x; ++x)
+			{
+				auto i = index(x, y, z);
+				m_solid[i] = counts[i] > half ? 1 : 0;
+				m_fields.Temperature[i] = t;
+				m_fields.Humidity[i] = .5f * AtmosphereSaturation(t);
+				m_fields.Pressure[i] = 0.f;
+				m_fields.Cloud[i] = 0.f;
+			}
+		}
+	}
+	std::fill(m_fields.VelocityX.begin(), m_fields.VelocityX.end(), 0.f);
+	std::fill(m_fields.VelocityY.begin(), m_fields.VelocityY.end(), 0.f);
+	std::fill(m_fields.VelocityZ.begin(), m_fields.VelocityZ.end(), 0.f);
+	std::fill(m_precipitation.begin(), m_precipitation.end(), 0.f);
+}
+
+void ClayEngine::AtmosphereSolver::applyForces(float dt)
+{
+	m_pool->ParallelFor(static_cast<size_t>(m_z), [&](size_t slab, size_t) {
+		auto z = static_cast<int>(slab);
+
+		// Buoyancy pushes on the horizontal faces, from the air either side of them
+		for (auto y = 1; y < m_y; ++y)
+		{
+			auto env = .5f * (environment(y - 1) + environment(y));
+			for (auto x = 0; x < m_x; ++x)
+			{
+				if (!openY(x, y, z)) continue;
+
+				auto below = index(x, y - 1, z), above = index(x, y, z);
+				auto t = .5f * (m_fields.Temperature[below] + m_fields.Temperature[above]);
+				auto cloud = .5f * (m_fields.Cloud[below] + m_fields.Cloud[above]);
+				m_fields.VelocityY[faceY(x, y, z)] += dt * (c_atmosphere_buoyancy * (t - env) - c_atmosphere_condensate_weight * cloud);
+			}
+		}
+
+		for (auto y = 0; y < m_y; ++y)
+		{
+			auto env = environment(y);
+			for (auto x = 0; x < m_x; ++x)
+			{
+				auto i = index(x, y, z);
+				if (m_solid[i]) continue;
+
+				auto& t = m_fields.Temperature[i];
+				t += dt * c_atmosphere_relaxation * (env - t);
+
+				// Sunlit ground warms and moistens the air resting on it
+				if (y > 0 && m_solid[index(x, y - 1, z)])
+				{
+					t += dt * c_atmosphere_surface_heating;
+					auto& q = m_fields.Humidity[i];
+					q = std::min(q + dt * c_atmosphere_surface_evaporation, std::max(q, AtmosphereSaturation(t)));
+				}
+			}
+		}
+	});
+}
+
+void ClayEngine::AtmosphereSolver::advect(float dt)
+{
+	auto scale = dt / m_cell_metres;
+
+	m_pool->ParallelFor(static_cast<size_t>(m_z), [&](size_t slab, size_t) {
+		auto z = static_cast<int>(slab);
+		for (auto y = 0; y < m_y; ++y)
+		{
+			for (auto x = 0; x < m_x; ++x)
+			{
+				auto i = index(x, y, z);
+				auto fx = static_cast<float>(x), fy = static_cast<float>(y), fz = static_cast<float>(z);
+
+				// Each cell owns the faces on its low side, the faces on the far walls stay closed
+				auto backtrack = [&](std::vector<float>& target, size_t face, bool open, float px, float py, float pz, float (AtmosphereSolver::* lookup)(float, float, float) const) {
+					if (!open)
+					{
+						target[face] = 0.f;
+						return;
+					}
+					auto u = sampleX(px, py, pz), v = sampleY(px, py, pz), w = sampleZ(px, py, pz);
+					target[face] = (this->*lookup)(px - u * scale, py - v * scale, pz - w * scale);
+				};
+				backtrack(m_scratch.VelocityX, faceX(x, y, z), openX(x, y, z), fx - .5f, fy, fz, &AtmosphereSolver::sampleX);
+				backtrack(m_scratch.VelocityY, faceY(x, y, z), openY(x, y, z), fx, fy - .5f, fz, &AtmosphereSolver::sampleY);
+				backtrack(m_scratch.VelocityZ, faceZ(x, y, z), openZ(x, y, z), fx, fy, fz - .5f, &AtmosphereSolver::sampleZ);
+
+				if (m_solid[i])
+				{
+					m_scratch.Temperature[i] = m_fields.Temperature[i];
+					m_scratch.Humidity[i] = m_fields.Humidity[i];
+					m_scratch.Cloud[i] = m_fields.Cloud[i];
+					continue;
+				}
+
+				// Trace back along the velocity and pick up whatever was there a step ago
+				auto px = fx - .5f * (m_fields.VelocityX[faceX(x, y, z)] + m_fields.VelocityX[faceX(x + 1, y, z)]) * scale;
+				auto py = fy - .5f * (m_fields.VelocityY[faceY(x, y, z)] + m_fields.VelocityY[faceY(x, y + 1, z)]) * scale;
+				auto pz = fz - .5f * (m_fields.VelocityZ[faceZ(x, y, z)] + m_fields.VelocityZ[faceZ(x, y, z + 1)]) * scale;
+
+				m_scratch.Temperature[i] = sample(m_fields.Temperature, px, py, pz);
+				m_scratch.Humidity[i] = sample(m_fields.Humidity, px, py, pz);
+				m_scratch.Cloud[i] = sample(m_fields.Cloud, px, py, pz);
+			}
+		}
+	});
+
+	// Pressure isn't advected, it is warm start for the next projection
+	std::swap(m_fields.Temperature, m_scratch.Temperature);
+	std::swap(m_fields.Humidity, m_scratch.Humidity);
+	std::swap(m_fields.Cloud, m_scratch.Cloud);
+	std::swap(m_fields.VelocityX, m_scratch.VelocityX);
+	std::swap(m_fields.VelocityY, m_scratch.VelocityY);
+	std::swap(m_fields.VelocityZ, m_scratch.VelocityZ);
+}
+
+void ClayEngine::AtmosphereSolver::forEachSlab(const MultigridLevel& level, const WorkerJob& job)
+{
+	// Coarse levels have fewer slabs than threads and less work than a batch handoff, sweep them here
+	if (static_cast<size_t>(level.X) * level.Y * level.Z < c_multigrid_parallel_cells)
+	{
+		for (size_t slab = 0; slab < static_cast<size_t>(level.Z); ++slab) job(slab, 0);
+		return;
+	}
+
+	m_pool->ParallelFor(static_cast<size_t>(level.Z), job);
+}
+
+void ClayEngine::AtmosphereSolver::smooth(MultigridLevel& level, int sweeps)
+{
+	// Red cells only read black neighbours and vice versa, so each colour can be split across threads
+	for (auto sweep = 0; sweep < sweeps * 2; ++sweep)
+	{
+		auto colour = sweep & 1;
+		forEachSlab(level, [&](size_t slab, size_t) {
+			auto z = static_cast<int>(slab);
+			auto& p = level.Solution;
+			for (auto y = 0; y < level.Y; ++y)
+			{
+				for (auto x = (y + z + colour) & 1; x < level.X; x += 2)
+				{
+					auto i = levelIndex(level.X, level.Y, x, y, z);
+					if (level.Solid && level.Solid[i]) continue;
+
+					// Neumann boundaries, walls and obstacles simply drop out of the stencil
+					auto sum = 0.f;
+					auto neighbours = 0;
+					auto add = [&](int nx, int ny, int nz) {
+						auto n = levelIndex(level.X, level.Y, nx, ny, nz);
+						if (level.Solid && level.Solid[n]) return;
+						sum += p[n];
+						++neighbours;
+					};
+					if (x > 0) add(x - 1, y, z);
+					if (x + 1 < level.X) add(x + 1, y, z);
+					if (y > 0) add(x, y - 1, z);
+					if (y + 1 < level.Y) add(x, y + 1, z);
+					if (z > 0) add(x, y, z - 1);
+					if (z + 1 < level.Z) add(x, y, z + 1);
+
+					if (neighbours) p[i] = (sum - level.H2 * level.Rhs[i]) / static_cast<float>(neighbours);
+				}
+			}
+		});
+	}
+}
+
+void ClayEngine::AtmosphereSolver::computeResidual(MultigridLevel& level)
+{
+	forEachSlab(level, [&](size_t slab, size_t) {
+		auto z = static_cast<int>(slab);
+		const auto& p = level.Solution;
+		for (auto y = 0; y < level.Y; ++y)
+		{
+			for (auto x = 0; x < level.X; ++x)
+			{
+				auto i = levelIndex(level.X, level.Y, x, y, z);
+				if (level.Solid && level.Solid[i])
+				{
+					level.Residual[i] = 0.f;
+					continue;
+				}
+
+				auto laplacian = 0.f;
+				auto add = [&](int nx, int ny, int nz) {
+					auto n = levelIndex(level.X, level.Y, nx, ny, nz);
+					if (level.Solid && level.Solid[n]) return;
+					laplacian += p[n] - p[i];
+				};
+				if (x > 0) add(x - 1, y, z);
+				if (x + 1 < level.X) add(x + 1, y, z);
+				if (y > 0) add(x, y - 1, z);
+				if (y + 1 < level.Y) add(x, y + 1, z);
+				if (z > 0) add(x, y, z - 1);
+				if (z + 1 < level.Z) add(x, y, z + 1);
+
+				level.Residual[i] = level.Rhs[i] - laplacian / level.H2;
+			}
+		}
+	});
+}
+
+void ClayEngine::AtmosphereSolver::restrictResidual(const MultigridLevel& fine, MultigridLevel& coarse)
+{
+	forEachSlab(coarse, [&](size_t slab, size_t) {
+		auto z = static_cast<int>(slab);
+		for (auto y = 0; y < coarse.Y; ++y)
+		{
+			for (auto x = 0; x < coarse.X; ++x)
+			{
+				auto sum = 0.f;
+				auto children = 0;
+				for (auto cz = z * 2; cz < std::min(z * 2 + 2, fine.Z); ++cz)
+					for (auto cy = y * 2; cy < std::min(y * 2 + 2, fine.Y); ++cy)
+						for (auto cx = x * 2; cx < std::min(x * 2 + 2, fine.X); ++cx)
+						{
+							sum += fine.Residual[levelIndex(fine.X, fine.Y, cx, cy, cz)];
+							++children;
+						}
+
+				auto i = levelIndex(coarse.X, coarse.Y, x, y, z);
+				coarse.Rhs[i] = sum / static_cast<float>(children);
+				coarse.Solution[i] = 0.f;
+			}
+		}
+	});
+}
+
+void ClayEngine::AtmosphereSolver::prolong(const MultigridLevel& coarse, MultigridLevel& fine)
+{
+	forEachSlab(fine, [&](size_t slab, size_t) {
+		auto z = static_cast<int>(slab);
+		for (auto y = 0; y < fine.Y; ++y)
+		{
+			for (auto x = 0; x < fine.X; ++x)
+			{
+				auto i = levelIndex(fine.X, fine.Y, x, y, z);
+				if (fine.Solid && fine.Solid[i]) continue;
+				fine.Solution[i] += coarse.Solution[levelIndex(coarse.X, coarse.Y, x / 2, y / 2, z / 2)];
+			}
+		}
+	});
+}
+
+void ClayEngine::AtmosphereSolver::vcycle(size_t depth)
+{
+	auto& level = m_levels[depth];
+	if (depth + 1 == m_levels.size())
+	{
+		smooth(level, c_multigrid_coarse_steps);
+		return;
+	}
+
+	smooth(level, c_multigrid_smooth_steps);
+	computeResidual(level);
+
+	auto& coarse = m_levels[depth + 1];
+	restrictResidual(level, coarse);
+	vcycle(depth + 1);
+	prolong(coarse, level);
+
+	smooth(level, c_multigrid_smooth_steps);
+}
+
+void ClayEngine::AtmosphereSolver::project(float dt)
+{
+	auto& finest = m_levels.front();
+	auto inverse = 1.f / m_cell_metres;
+
+	// Right hand side is div(u) / dt, per slab sums keep the mean (and so the result) independent of threading
+	m_pool->ParallelFor(static_cast<size_t>(m_z), [&](size_t slab, size_t) {
+		auto z = static_cast<int>(slab);
+		auto sum = 0., cells = 0.;
+		for (auto y = 0; y < m_y; ++y)
+		{
+			for (auto x = 0; x < m_x; ++x)
+			{
+				auto i = index(x, y, z);
+				if (m_solid[i])
+				{
+					finest.Rhs[i] = 0.f;
+					continue;
+				}
+
+				finest.Rhs[i] = divergence(x, y, z) / dt;
+				sum += finest.Rhs[i];
+				cells += 1.;
+			}
+		}
+		m_slab_sums[slab * 2] = sum;
+		m_slab_sums[slab * 2 + 1] = cells;
+	});
+
+	// A closed box only has a solution when the sources balance, remove the mean
+	auto sum = 0., cells = 0.;
+	for (auto z = 0; z < m_z; ++z)
+	{
+		sum += m_slab_sums[z * 2];
+		cells += m_slab_sums[z * 2 + 1];
+	}
+	auto mean = cells > 0. ? static_cast<float>(sum / cells) : 0.f;
+	for (size_t i = 0; i < finest.Rhs.size(); ++i)
+	{
+		if (!m_solid[i]) finest.Rhs[i] -= mean;
+	}
+
+	std::swap(finest.Solution, m_fields.Pressure);
+	for (auto cycle = 0; cycle < c_multigrid_cycles; ++cycle) vcycle(0);
+	std::swap(finest.Solution, m_fields.Pressure);
+
+	// Subtract the pressure gradient across every open face, the same faces the Laplacian couples
+	m_pool->ParallelFor(static_cast<size_t>(m_z), [&](size_t slab, size_t) {
+		auto z = static_cast<int>(slab);
+		const auto& p = m_fields.Pressure;
+		for (auto y = 0; y < m_y; ++y)
+		{
+			for (auto x = 0; x < m_x; ++x)
+			{
+				auto i = index(x, y, z);
+				if (openX(x, y, z)) m_fields.VelocityX[faceX(x, y, z)] -= dt * (p[i] - p[index(x - 1, y, z)]) * inverse;
+				if (openY(x, y, z)) m_fields.VelocityY[faceY(x, y, z)] -= dt * (p[i] - p[index(x, y - 1, z)]) * inverse;
+				if (openZ(x, y, z)) m_fields.VelocityZ[faceZ(x, y, z)] -= dt * (p[i] - p[index(x, y, z - 1)]) * inverse;
+			}
+		}
+	});
+}
+
+void ClayEngine::AtmosphereSolver::condense(float dt)
+{
+	auto rain = std::min(1.f, c_atmosphere_rain_rate * dt);
+
+	m_pool->ParallelFor(static_cast<size_t>(m_z), [&](size_t slab, size_t) {
+		auto z = static_cast<int>(slab);
+		for (auto y = 0; y < m_y; ++y)
+		{
+			for (auto x = 0; x < m_x; ++x)
+			{
+				auto i = index(x, y, z);
+				if (m_solid[i]) continue;
+
+				auto& t = m_fields.Temperature[i];
+				auto& q = m_fields.Humidity[i];
+				auto& c = m_fields.Cloud[i];
+
+				// Vapour over saturation condenses and warms the air, cloud in dry air evaporates and cools it
+				auto saturation = AtmosphereSaturation(t);
+				if (q > saturation)
+				{
+					auto dq = (q - saturation) * c_atmosphere_condensation_rate;
+					q -= dq;
+					c += dq;
+					t += c_atmosphere_latent_heat * dq;
+				}
+				else if (c > 0.f)
+				{
+					auto dq = std::min(c, (saturation - q) * c_atmosphere_condensation_rate);
+					q += dq;
+					c -= dq;
+					t -= c_atmosphere_latent_heat * dq;
+				}
+
+				// Each slab owns its own columns, so accumulating rain here doesn't race
+				if (c > c_atmosphere_rain_threshold)
+				{
+					auto r = (c - c_atmosphere_rain_threshold) * rain;
+					c -= r;
+					m_precipitation[static_cast<size_t>(z) * m_x + x] += r;
+				}
+			}
+		}
+	});
+}
+
+void ClayEngine::AtmosphereSolver::Step(float dt)
+{
+	LockGuard lock(m_mutex);
+
+	applyForces(dt);
+	advect(dt);
+	project(dt);
+	condense(dt);
+	++m_tick;
+}
+
+void ClayEngine::AtmosphereSolver::Start()
+{
+	if (m_thread.joinable()) return;
+
+	m_promise = PROMISE{};
+	m_thread = THREAD{ AtmosphereTickFunctor(), std::move(m_promise.get_future()), this };
+}
+
+void ClayEngine::AtmosphereSolver::Stop()
+{
+	if (!m_thread.joinable()) return;
+
+	m_promise.set_value();
+	m_thread.join();
+}
+
+ClayEngine::AtmosphereSample ClayEngine::AtmosphereSolver::Sample(int x, int y, int z) const
+{
+	AtmosphereSample result = {};
+	if (!m_region.Contains(x, y, z)) return result;
+
+	auto cx = (x - m_region.Min.X) >> m_cell_bits, cy = (y - m_region.Min.Y) >> m_cell_bits, cz = (z - m_region.Min.Z) >> m_cell_bits;
+	auto i = index(cx, cy, cz);
+
+	LockGuard lock(m_mutex);
+	result.Temperature = m_fields.Temperature[i];
+	result.Pressure = m_fields.Pressure[i];
+	result.Humidity = m_fields.Humidity[i];
+	result.Cloud = m_fields.Cloud[i];
+	result.VelocityX = .5f * (m_fields.VelocityX[faceX(cx, cy, cz)] + m_fields.VelocityX[faceX(cx + 1, cy, cz)]);
+	result.VelocityY = .5f * (m_fields.VelocityY[faceY(cx, cy, cz)] + m_fields.VelocityY[faceY(cx, cy + 1, cz)]);
+	result.VelocityZ = .5f * (m_fields.VelocityZ[faceZ(cx, cy, cz)] + m_fields.VelocityZ[faceZ(cx, cy, cz + 1)]);
+	result.Solid = m_solid[i] != 0;
+	return result;
+}
+
+void ClayEngine::AtmosphereSolver::TakePrecipitation(std::vector<float>& columns)
+{
+	LockGuard lock(m_mutex);
+
+	columns.swap(m_precipitation);
+	m_precipitation.assign(static_cast<size_t>(m_x) * m_z, 0.f);
+}
+
+float ClayEngine::AtmosphereSolver::GetMaxDivergence() const
+{
+	LockGuard lock(m_mutex);
+
+	auto result = 0.f;
+	for (auto z = 0; z < m_z; ++z)
+		for (auto y = 0; y < m_y; ++y)
+			for (auto x = 0; x < m_x; ++x)
+			{
+				if (m_solid[index(x, y, z)]) continue;
+				result = std::max(result, std::abs(divergence(x, y, z)));
+			}
+	return result;
+}
+#pragma endregion
+
+ClayEngine::AtmosphereBenchmark ClayEngine::RunAtmosphereBenchmark(int cellsPerAxis, int ticks)
+{
+	AtmosphereBenchmark result = {};
+	result.Ticks = ticks;
+
+	// One cell per voxel keeps the terrain grid small, the solver cost only depends on the cell count
+	VoxelBox region = { { 0, 0, 0 }, { cellsPerAxis, cellsPerAxis, cellsPerAxis } };
+	Voxel rock(.5f, .5f, .5f, 0);
+	const uint32_t solid = rock;
+
+	VoxelGrid terrain;
+	for (auto z = 0; z < cellsPerAxis; ++z)
+	{
+		for (auto x = 0; x < cellsPerAxis; ++x)
+		{
+			auto height = static_cast<int>(cellsPerAxis * .25f + std::sin(x * .2f) * 4.f + std::cos(z * .15f) * 4.f);
+			terrain.Fill({ { x, 0, z }, { x + 1, std::max(height, 1), z + 1 } }, solid);
+		}
+	}
+
+	auto run = [&](WorkerPoolRaw pool, double& rate) {
+		AtmosphereSolver solver(pool, region, 0);
+		solver.Load(terrain);
+
+		auto start = std::chrono::steady_clock::now();
+		for (auto tick = 0; tick < ticks; ++tick) solver.Step();
+		rate = PerSecond(solver.GetCellCount() * static_cast<size_t>(ticks), std::chrono::steady_clock::now() - start);
+
+		result.CellCount = solver.GetCellCount();
+	};
+
+	WorkerPool single(1);
+	run(&single, result.SingleThreadCellsPerSecond);
+
+	WorkerPool pool;
+	result.ThreadCount = pool.GetThreadCount();
+	run(&pool, result.CellsPerSecond);
+
+	std::wstringstream wss;
+	wss << std::fixed << std::setprecision(2)
+		<< L"AtmosphereSolver " << result.CellCount << L" cells x " << ticks << L" ticks"
+		<< L" | 1 thread " << result.SingleThreadCellsPerSecond / 1e6
+		<< L" | " << result.ThreadCount << L" threads " << result.CellsPerSecond / 1e6 << L" Mcells/sec"
+		<< L" | scaling " << (result.SingleThreadCellsPerSecond > 0. ? result.CellsPerSecond / result.SingleThreadCellsPerSecond : 0.) << L"x";
+	WriteLine(wss.str());
+
+	return result;
+}
@@ -0,0 +1,228 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* Coarse grid atmosphere solver for VaporState (temperature, pressure, etc.) */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "VoxelGrid.h"
+#include "WorkerPool.h"
+
+namespace ClayEngine
+{
+	constexpr auto c_atmosphere_cell_bits{ 3 }; // One atmosphere cell per 8^3 voxels
+	constexpr auto c_atmosphere_voxel_metres{ 1.f };
+	constexpr auto c_atmosphere_time_step{ 1.f }; // Simulated seconds per tick
+	constexpr auto c_atmosphere_tick_interval{ std::chrono::milliseconds(100) }; // Real time between ticks when running
+
+	constexpr auto c_atmosphere_ground_temperature{ 20.f }; // Celsius at y = 0
+	constexpr auto c_atmosphere_lapse_rate{ .0065f }; // Degrees lost per metre of altitude
+	constexpr auto c_atmosphere_buoyancy{ .033f }; // g / T, m/s^2 per degree warmer than the environment
+	constexpr auto c_atmosphere_condensate_weight{ 9.81f }; // Clouds are dragged down by the water they carry
+	constexpr auto c_atmosphere_relaxation{ .001f }; // Per second, pull back toward the environment profile
+	constexpr auto c_atmosphere_surface_heating{ .01f }; // Degrees per second in cells resting on solid ground
+	constexpr auto c_atmosphere_surface_evaporation{ 2e-6f }; // Humidity per second added over solid ground
+	constexpr auto c_atmosphere_latent_heat{ 2500.f }; // L / cp, degrees per unit of humidity condensed
+	constexpr auto c_atmosphere_condensation_rate{ .5f }; // Share of the excess over saturation condensed per tick
+	constexpr auto c_atmosphere_rain_threshold{ 1e-3f }; // Cloud water above this falls out as rain
+	constexpr auto c_atmosphere_rain_rate{ .1f }; // Per second
+
+	constexpr auto c_multigrid_smooth_steps{ 2 }; // Red-black Gauss-Seidel sweeps before and after each restriction
+	constexpr auto c_multigrid_coarse_steps{ 16 };
+	constexpr auto c_multigrid_cycles{ 2 }; // V-cycles per tick, the previous pressure is the initial guess
+	constexpr size_t c_multigrid_parallel_cells{ 8192 }; // Smaller levels are swept on the calling thread, a pool batch costs more than they do
+
+	/// <summary>
+	/// Saturation mixing ratio (kg/kg) at temperature in Celsius, Tetens' formula at 1000hPa
+	/// </summary>
+	float AtmosphereSaturation(float temperature);
+
+	/// <summary>
+	/// VaporState fields in structure-of-arrays form, x-fastest. Scalars hold one float per coarse cell,
+	/// velocities sit on the cell faces they cross (a MAC grid), so VelocityX has X + 1 faces per row,
+	/// VelocityY has Y + 1 rows per slab and VelocityZ has Z + 1 slabs.
+	/// </summary>
+	struct AtmosphereFields
+	{
+		std::vector<float> Temperature = {}; // Celsius
+		std::vector<float> Pressure = {}; // Dynamic pressure from the projection, relative to hydrostatic
+		std::vector<float> Humidity = {}; // Vapour mixing ratio, kg/kg
+		std::vector<float> Cloud = {}; // Condensed water mixing ratio, kg/kg
+		std::vector<float> VelocityX = {}; // m/s through the face between cells x - 1 and x
+		std::vector<float> VelocityY = {};
+		std::vector<float> VelocityZ = {};
+
+		void Resize(int x, int y, int z);
+	};
+
+	struct AtmosphereSample
+	{
+		float Temperature = 0.f;
+		float Pressure = 0.f;
+		float Humidity = 0.f;
+		float Cloud = 0.f;
+		float VelocityX = 0.f;
+		float VelocityY = 0.f;
+		float VelocityZ = 0.f;
+		bool Solid = false;
+	};
+
+	class AtmosphereSolver;
+
+	/// <summary>
+	/// This functor serves as the entry point for the atmosphere's fixed tick thread
+	/// </summary>
+	struct AtmosphereTickFunctor
+	{
+		void operator()(FUTURE future, AtmosphereSolver* solver);
+	};
+
+	/// <summary>
+	/// Weather over a region of voxels on a coarse staggered grid, scalars at cell centres and velocity
+	/// on cell faces. Each fixed tick applies buoyancy and surface heating, advects every field with a
+	/// semi-Lagrangian step, projects the velocity to be divergence free with a multigrid Poisson solve
+	/// and then condenses, evaporates and rains out water. Faces on walls and obstacles are closed, so
+	/// the 7-point Laplacian the solve inverts is exactly the divergence of the face pressure gradient
+	/// and leaves no checkerboard mode. Every pass is split across the WorkerPool by z slab, except on
+	/// coarse multigrid levels, and the Gauss-Seidel smoother runs red-black, so the result doesn't
+	/// depend on the thread count.
+	/// </summary>
+	class AtmosphereSolver
+	{
+		struct MultigridLevel
+		{
+			int X = 0;
+			int Y = 0;
+			int Z = 0;
+			float H2 = 1.f; // Squared cell size
+			const uint8_t* Solid = nullptr; // Obstacles, only the finest level has them
+			std::vector<float> Solution = {};
+			std::vector<float> Rhs = {};
+			std::vector<float> Residual = {};
+		};
+		using MultigridLevels = std::vector<MultigridLevel>;
+
+		WorkerPoolRaw m_pool = nullptr;
+		VoxelBox m_region = {};
+		int m_cell_bits = c_atmosphere_cell_bits;
+		float m_cell_metres = 1.f;
+		int m_x = 0;
+		int m_y = 0;
+		int m_z = 0;
+
+		AtmosphereFields m_fields = {};
+		AtmosphereFields m_scratch = {}; // Advection target, swapped with m_fields afterwards
+		std::vector<uint8_t> m_solid = {};
+		std::vector<float> m_precipitation = {}; // Per x,z column, rain accumulated since the last TakePrecipitation
+		std::vector<double> m_slab_sums = {};
+		MultigridLevels m_levels = {};
+		uint64_t m_tick = 0;
+
+		mutable MUTEX m_mutex = {}; // Held for the duration of a tick
+		THREAD m_thread;
+		PROMISE m_promise = {};
+
+		size_t index(int x, int y, int z) const { return (static_cast<size_t>(z) * m_y + y) * m_x + x; }
+		size_t faceX(int x, int y, int z) const { return (static_cast<size_t>(z) * m_y + y) * (m_x + 1) + x; }
+		size_t faceY(int x, int y, int z) const { return (static_cast<size_t>(z) * (m_y + 1) + y) * m_x + x; }
+		size_t faceZ(int x, int y, int z) const { return index(x, y, z); }
+		bool openX(int x, int y, int z) const { return x > 0 && x < m_x && !m_solid[index(x - 1, y, z)] && !m_solid[index(x, y, z)]; }
+		bool openY(int x, int y, int z) const { return y > 0 && y < m_y && !m_solid[index(x, y - 1, z)] && !m_solid[index(x, y, z)]; }
+		bool openZ(int x, int y, int z) const { return z > 0 && z < m_z && !m_solid[index(x, y, z - 1)] && !m_solid[index(x, y, z)]; }
+		float environment(int y) const;
+		/// <summary>
+		/// Trilinear lookups at a position in cell units, cell x's centre is at x
+		/// </summary>
+		float sample(const std::vector<float>& field, float x, float y, float z) const;
+		float sampleX(float x, float y, float z) const;
+		float sampleY(float x, float y, float z) const;
+		float sampleZ(float x, float y, float z) const;
+		float divergence(int x, int y, int z) const;
+
+		void applyForces(float dt);
+		void advect(float dt);
+		void project(float dt);
+		void condense(float dt);
+
+		void forEachSlab(const MultigridLevel& level, const WorkerJob& job);
+		void smooth(MultigridLevel& level, int sweeps);
+		void computeResidual(MultigridLevel& level);
+		void restrictResidual(const MultigridLevel& fine, MultigridLevel& coarse);
+		void prolong(const MultigridLevel& coarse, MultigridLevel& fine);
+		void vcycle(size_t depth);
+
+	public:
+		/// <summary>
+		/// region is in voxel coordinates, cellBits sets the coarse cell to 2^cellBits voxels per edge
+		/// </summary>
+		AtmosphereSolver(WorkerPoolRaw pool, const VoxelBox& region, int cellBits = c_atmosphere_cell_bits);
+		~AtmosphereSolver();
+
+		AtmosphereSolver(const AtmosphereSolver&) = delete;
+		AtmosphereSolver& operator=(const AtmosphereSolver&) = delete;
+
+		/// <summary>
+		/// Marks coarse cells that are mostly solid voxels as obstacles and resets the air to the
+		/// environment profile at half saturation
+		/// </summary>
+		void Load(const VoxelGrid& voxels);
+
+		/// <summary>
+		/// Advances one fixed tick of dt simulated seconds on the calling thread and the pool
+		/// </summary>
+		void Step(float dt = c_atmosphere_time_step);
+
+		/// <summary>
+		/// Runs Step on a dedicated thread every c_atmosphere_tick_interval until Stop is called
+		/// </summary>
+		void Start();
+		void Stop();
+		bool IsRunning() const { return m_thread.joinable(); }
+
+		/// <summary>
+		/// State of the coarse cell containing voxel x,y,z, its velocity averaged from the faces, safe to call while running
+		/// </summary>
+		AtmosphereSample Sample(int x, int y, int z) const;
+		/// <summary>
+		/// Swaps out the rain accumulated per x,z column (x-fastest, GetSizeX() * GetSizeZ()) and resets it
+		/// </summary>
+		void TakePrecipitation(std::vector<float>& columns);
+		/// <summary>
+		/// Direct access to the fields, only while the solver isn't running
+		/// </summary>
+		const AtmosphereFields& GetFields() const { return m_fields; }
+
+		int GetSizeX() const { return m_x; }
+		int GetSizeY() const { return m_y; }
+		int GetSizeZ() const { return m_z; }
+		size_t GetCellCount() const { return static_cast<size_t>(m_x) * m_y * m_z; }
+		uint64_t GetTick() const { return m_tick; }
+		/// <summary>
+		/// Largest remaining divergence after the last projection, in 1/s
+		/// </summary>
+		float GetMaxDivergence() const;
+	};
+	using AtmosphereSolverPtr = std::unique_ptr<AtmosphereSolver>;
+
+	struct AtmosphereBenchmark
+	{
+		size_t ThreadCount = 0;
+		size_t CellCount = 0;
+		int Ticks = 0;
+		double SingleThreadCellsPerSecond = 0.;
+		double CellsPerSecond = 0.;
+	};
+
+	/// <summary>
+	/// Steps a cellsPerAxis^3 atmosphere over hilly terrain for ticks ticks on one thread and on every
+	/// hardware thread, and writes the cell updates per second to the console
+	/// </summary>
+	AtmosphereBenchmark RunAtmosphereBenchmark(int cellsPerAxis = 64, int ticks = 10);
+}
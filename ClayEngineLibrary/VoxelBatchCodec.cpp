@@ -0,0 +1,346 @@
+#include "pch.h"
+#include "VoxelBatchCodec.h"
+#include "Strings.h"
+#include "Benchmark.h"
+
+#include <random>
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+using namespace ClayEngine;
+
+namespace
+{
+	constexpr auto c_vector_code_limit = static_cast<float>(c_voxel_vector_code_max);
+	constexpr auto c_lod_limit = static_cast<float>(c_voxel_lod_max);
+
+	inline uint32_t encodeScalar(const float* quad)
+	{
+		auto pack = [](float value, float offset, float ratio, float limit) -> uint32_t
+		{
+			auto r = std::floor((value + offset) / ratio);
+			if (!(r > 0.f)) return 0u; // Also catches NaN
+			return static_cast<uint32_t>(std::min(r, limit));
+		};
+
+		auto z = pack(quad[0], -c_voxel_vector_min, c_vector_pack_ratio, c_vector_code_limit);
+		auto y = pack(quad[1], -c_voxel_vector_min, c_vector_pack_ratio, c_vector_code_limit);
+		auto x = pack(quad[2], -c_voxel_vector_min, c_vector_pack_ratio, c_vector_code_limit);
+		auto l = pack(quad[3], 0.f, 1.f, c_lod_limit);
+
+		return z | (y << 8) | (x << 16) | (l << 24);
+	}
+
+	inline void decodeScalar(uint32_t packed, float* quad)
+	{
+		quad[0] = c_voxel_decode_table[packed & 0xFF];
+		quad[1] = c_voxel_decode_table[(packed >> 8) & 0xFF];
+		quad[2] = c_voxel_decode_table[(packed >> 16) & 0xFF];
+		quad[3] = static_cast<float>((packed >> 24) & c_voxel_lod_max);
+	}
+
+	void encodeRangeScalar(const float* source, uint32_t* destination, size_t count)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			destination[i] = encodeScalar(source + i * 4);
+		}
+	}
+
+	void decodeRangeScalar(const uint32_t* source, float* destination, size_t count)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			decodeScalar(source[i], destination + i * 4);
+		}
+	}
+
+	#pragma region SSE4.1 Kernels
+	// One voxel per XMM register, lanes are z,y,x,lod which lines up with the little-endian byte
+	// order of the packed word, so two saturating packs produce the final uint32_t directly.
+	CLAY_TARGET_SSE41 inline __m128i encodeQuadSSE41(__m128 quad, __m128 offset, __m128 ratio, __m128 limit)
+	{
+		auto r = _mm_floor_ps(_mm_div_ps(_mm_add_ps(quad, offset), ratio));
+		r = _mm_max_ps(r, _mm_setzero_ps()); // NaN in r selects zero
+		r = _mm_min_ps(r, limit);
+		return _mm_cvttps_epi32(r);
+	}
+
+	CLAY_TARGET_SSE41 void encodeRangeSSE41(const float* source, uint32_t* destination, size_t count)
+	{
+		const auto offset = _mm_setr_ps(-c_voxel_vector_min, -c_voxel_vector_min, -c_voxel_vector_min, 0.f);
+		const auto ratio = _mm_setr_ps(c_vector_pack_ratio, c_vector_pack_ratio, c_vector_pack_ratio, 1.f);
+		const auto limit = _mm_setr_ps(c_vector_code_limit, c_vector_code_limit, c_vector_code_limit, c_lod_limit);
+
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			auto a = encodeQuadSSE41(_mm_loadu_ps(source + (i + 0) * 4), offset, ratio, limit);
+			auto b = encodeQuadSSE41(_mm_loadu_ps(source + (i + 1) * 4), offset, ratio, limit);
+			auto c = encodeQuadSSE41(_mm_loadu_ps(source + (i + 2) * 4), offset, ratio, limit);
+			auto d = encodeQuadSSE41(_mm_loadu_ps(source + (i + 3) * 4), offset, ratio, limit);
+
+			auto packed = _mm_packus_epi16(_mm_packus_epi32(a, b), _mm_packus_epi32(c, d));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), packed);
+		}
+
+		encodeRangeScalar(source + i * 4, destination + i, count - i);
+	}
+
+	CLAY_TARGET_SSE41 void decodeRangeSSE41(const uint32_t* source, float* destination, size_t count)
+	{
+		const auto offset = _mm_setr_ps(c_voxel_vector_min, c_voxel_vector_min, c_voxel_vector_min, 0.f);
+		const auto ratio = _mm_setr_ps(c_vector_pack_ratio, c_vector_pack_ratio, c_vector_pack_ratio, 1.f);
+		const auto mask = _mm_setr_epi32(0xFF, 0xFF, 0xFF, static_cast<int>(c_voxel_lod_max));
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			auto bytes = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(static_cast<int>(source[i])));
+			auto values = _mm_cvtepi32_ps(_mm_and_si128(bytes, mask));
+			_mm_storeu_ps(destination + i * 4, _mm_add_ps(_mm_mul_ps(values, ratio), offset));
+		}
+	}
+	#pragma endregion
+
+	#pragma region AVX2 Kernels
+	// Two voxels per YMM register. The packs work per 128 bit lane, so the eight results come
+	// out as 0,2,4,6,1,3,5,7 and one cross-lane permute puts them back in order.
+	CLAY_TARGET_AVX2 inline __m256i encodePairAVX2(__m256 pair, __m256 offset, __m256 ratio, __m256 limit)
+	{
+		auto r = _mm256_floor_ps(_mm256_div_ps(_mm256_add_ps(pair, offset), ratio));
+		r = _mm256_max_ps(r, _mm256_setzero_ps());
+		r = _mm256_min_ps(r, limit);
+		return _mm256_cvttps_epi32(r);
+	}
+
+	CLAY_TARGET_AVX2 void encodeRangeAVX2(const float* source, uint32_t* destination, size_t count)
+	{
+		const auto offset = _mm256_setr_ps(
+			-c_voxel_vector_min, -c_voxel_vector_min, -c_voxel_vector_min, 0.f,
+			-c_voxel_vector_min, -c_voxel_vector_min, -c_voxel_vector_min, 0.f);
+		const auto ratio = _mm256_setr_ps(
+			c_vector_pack_ratio, c_vector_pack_ratio, c_vector_pack_ratio, 1.f,
+			c_vector_pack_ratio, c_vector_pack_ratio, c_vector_pack_ratio, 1.f);
+		const auto limit = _mm256_setr_ps(
+			c_vector_code_limit, c_vector_code_limit, c_vector_code_limit, c_lod_limit,
+			c_vector_code_limit, c_vector_code_limit, c_vector_code_limit, c_lod_limit);
+		const auto order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8)
+		{
+			auto a = encodePairAVX2(_mm256_loadu_ps(source + (i + 0) * 4), offset, ratio, limit);
+			auto b = encodePairAVX2(_mm256_loadu_ps(source + (i + 2) * 4), offset, ratio, limit);
+			auto c = encodePairAVX2(_mm256_loadu_ps(source + (i + 4) * 4), offset, ratio, limit);
+			auto d = encodePairAVX2(_mm256_loadu_ps(source + (i + 6) * 4), offset, ratio, limit);
+
+			auto packed = _mm256_packus_epi16(_mm256_packus_epi32(a, b), _mm256_packus_epi32(c, d));
+			packed = _mm256_permutevar8x32_epi32(packed, order);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i), packed);
+		}
+
+		encodeRangeSSE41(source + i * 4, destination + i, count - i);
+	}
+
+	CLAY_TARGET_AVX2 void decodeRangeAVX2(const uint32_t* source, float* destination, size_t count)
+	{
+		const auto offset = _mm256_setr_ps(
+			c_voxel_vector_min, c_voxel_vector_min, c_voxel_vector_min, 0.f,
+			c_voxel_vector_min, c_voxel_vector_min, c_voxel_vector_min, 0.f);
+		const auto ratio = _mm256_setr_ps(
+			c_vector_pack_ratio, c_vector_pack_ratio, c_vector_pack_ratio, 1.f,
+			c_vector_pack_ratio, c_vector_pack_ratio, c_vector_pack_ratio, 1.f);
+		const auto lod = static_cast<int>(c_voxel_lod_max);
+		const auto mask = _mm256_setr_epi32(0xFF, 0xFF, 0xFF, lod, 0xFF, 0xFF, 0xFF, lod);
+
+		size_t i = 0;
+		for (; i + 2 <= count; i += 2)
+		{
+			auto bytes = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(source + i)));
+			auto values = _mm256_cvtepi32_ps(_mm256_and_si256(bytes, mask));
+			_mm256_storeu_ps(destination + i * 4, _mm256_add_ps(_mm256_mul_ps(values, ratio), offset));
+		}
+
+		decodeRangeScalar(source + i, destination + i * 4, count - i);
+	}
+	#pragma endregion
+
+	void cpuid(int leaf, int subleaf, int (&registers)[4])
+	{
+	#if defined(_MSC_VER)
+		__cpuidex(registers, leaf, subleaf);
+	#else
+		unsigned int a = 0, b = 0, c = 0, d = 0;
+		__cpuid_count(leaf, subleaf, a, b, c, d);
+		registers[0] = static_cast<int>(a);
+		registers[1] = static_cast<int>(b);
+		registers[2] = static_cast<int>(c);
+		registers[3] = static_cast<int>(d);
+	#endif
+	}
+
+	uint64_t xgetbv0()
+	{
+	#if defined(_MSC_VER)
+		return _xgetbv(0);
+	#else
+		uint32_t lo = 0, hi = 0;
+		__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+		return (static_cast<uint64_t>(hi) << 32) | lo;
+	#endif
+	}
+}
+
+ClayEngine::VoxelBatchCodec::VoxelBatchCodec()
+	: m_kernel(DetectKernel())
+{
+
+}
+
+ClayEngine::VoxelBatchCodec::VoxelBatchCodec(VoxelCodecKernel kernel)
+	: m_kernel(ClampKernel(kernel))
+{
+}
+
+void ClayEngine::VoxelBatchCodec::Encode(const float* source, uint32_t* destination, size_t count) const
+{
+	switch (m_kernel)
+	{
+	case VoxelCodecKernel::AVX2:
+		encodeRangeAVX2(source, destination, count);
+		break;
+	case VoxelCodecKernel::SSE41:
+		encodeRangeSSE41(source, destination, count);
+		break;
+	default:
+		encodeRangeScalar(source, destination, count);
+		break;
+	}
+}
+
+void ClayEngine::VoxelBatchCodec::Decode(const uint32_t* source, float* destination, size_t count) const
+{
+	switch (m_kernel)
+	{
+	case VoxelCodecKernel::AVX2:
+		decodeRangeAVX2(source, destination, count);
+		break;
+	case VoxelCodecKernel::SSE41:
+		decodeRangeSSE41(source, destination, count);
+		break;
+	default:
+		decodeRangeScalar(source, destination, count);
+		break;
+	}
+}
+
+ClayEngine::VoxelCodecKernel ClayEngine::VoxelBatchCodec::DetectKernel()
+{
+	static const auto s_kernel = []()
+	{
+		int regs[4] = {};
+		cpuid(0, 0, regs);
+		auto maxLeaf = regs[0];
+		if (maxLeaf < 1) return VoxelCodecKernel::Scalar;
+
+		cpuid(1, 0, regs);
+		auto sse41 = (regs[2] & (1 << 19)) != 0;
+		auto osxsave = (regs[2] & (1 << 27)) != 0;
+		auto avx = (regs[2] & (1 << 28)) != 0;
+		if (!sse41) return VoxelCodecKernel::Scalar;
+
+		// The OS has to save XMM and YMM state on context switch before AVX is usable
+		if (maxLeaf >= 7 && osxsave && avx && (xgetbv0() & 0x6) == 0x6)
+		{
+			cpuid(7, 0, regs);
+			if (regs[1] & (1 << 5)) return VoxelCodecKernel::AVX2;
+		}
+
+		return VoxelCodecKernel::SSE41;
+	}();
+
+	return s_kernel;
+}
+
+ClayEngine::VoxelCodecKernel ClayEngine::VoxelBatchCodec::ClampKernel(VoxelCodecKernel kernel)
+{
+	auto detected = DetectKernel();
+	return static_cast<int>(kernel) > static_cast<int>(detected) ? detected : kernel;
+}
+
+const wchar_t* ClayEngine::VoxelBatchCodec::GetKernelName(VoxelCodecKernel kernel)
+{
+	switch (kernel)
+	{
+	case VoxelCodecKernel::AVX2:
+		return L"AVX2";
+	case VoxelCodecKernel::SSE41:
+		return L"SSE4.1";
+	default:
+		return L"Scalar";
+	}
+}
+
+ClayEngine::VoxelCodecBenchmark ClayEngine::RunVoxelCodecBenchmark(size_t voxelCount)
+{
+	VoxelCodecBenchmark result = {};
+	result.VoxelCount = voxelCount;
+
+	std::mt19937 rng(1974u);
+	std::uniform_real_distribution<float> vectors(c_voxel_vector_min, c_voxel_vector_max);
+	std::uniform_int_distribution<unsigned int> lods(0u, c_voxel_lod_max);
+
+	std::vector<float> source(voxelCount * 4);
+	for (size_t i = 0; i < voxelCount; ++i)
+	{
+		source[i * 4 + 0] = vectors(rng);
+		source[i * 4 + 1] = vectors(rng);
+		source[i * 4 + 2] = vectors(rng);
+		source[i * 4 + 3] = static_cast<float>(lods(rng));
+	}
+
+	std::vector<uint32_t> packed(voxelCount);
+	std::vector<float> unpacked(voxelCount * 4);
+
+	// Baseline, the existing per-voxel path
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < voxelCount; ++i)
+	{
+		auto q = &source[i * 4];
+		Voxel v(q[0], q[1], q[2], static_cast<unsigned int>(q[3]));
+		packed[i] = v;
+	}
+	result.ConstructorVoxelsPerSecond = PerSecond(voxelCount, std::chrono::steady_clock::now() - start);
+
+	VoxelBatchCodec scalar(VoxelCodecKernel::Scalar);
+	start = std::chrono::steady_clock::now();
+	scalar.Encode(source.data(), packed.data(), voxelCount);
+	result.ScalarEncodeVoxelsPerSecond = PerSecond(voxelCount, std::chrono::steady_clock::now() - start);
+
+	VoxelBatchCodec codec;
+	result.Kernel = codec.GetKernel();
+
+	start = std::chrono::steady_clock::now();
+	codec.Encode(source.data(), packed.data(), voxelCount);
+	result.BatchEncodeVoxelsPerSecond = PerSecond(voxelCount, std::chrono::steady_clock::now() - start);
+
+	start = std::chrono::steady_clock::now();
+	codec.Decode(packed.data(), unpacked.data(), voxelCount);
+	result.BatchDecodeVoxelsPerSecond = PerSecond(voxelCount, std::chrono::steady_clock::now() - start);
+
+	std::wstringstream wss;
+	wss << std::fixed << std::setprecision(1)
+		<< L"VoxelBatchCodec " << voxelCount << L" voxels, kernel " << VoxelBatchCodec::GetKernelName(result.Kernel)
+		<< L" | Voxel() " << result.ConstructorVoxelsPerSecond / 1e6
+		<< L" | Scalar encode " << result.ScalarEncodeVoxelsPerSecond / 1e6
+		<< L" | Batch encode " << result.BatchEncodeVoxelsPerSecond / 1e6
+		<< L" | Batch decode " << result.BatchDecodeVoxelsPerSecond / 1e6 << L" Mvoxels/sec";
+	WriteLine(wss.str());
+
+	return result;
+}
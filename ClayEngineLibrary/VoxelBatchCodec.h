@@ -0,0 +1,88 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* Batched SIMD encode/decode of packed Voxel vectors                         */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <cstdint>
+#include <cstddef>
+
+#include "Voxel.h"
+
+// Marks a function that uses SSE4.1 or AVX2 intrinsics. MSVC will emit any intrinsic regardless
+// of /arch, GCC and Clang need the target on the function. Only call one after DetectKernel.
+#if defined(__GNUC__) || defined(__clang__)
+#define CLAY_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define CLAY_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define CLAY_TARGET_SSE41
+#define CLAY_TARGET_AVX2
+#endif
+
+namespace ClayEngine
+{
+	/// <summary>
+	/// The instruction set used by a VoxelBatchCodec, picked at runtime from CPUID unless forced
+	/// </summary>
+	enum class VoxelCodecKernel
+	{
+		Scalar,
+		SSE41,
+		AVX2,
+	};
+
+	/// <summary>
+	/// Encodes and decodes contiguous spans of (z,y,x,lod) float quads to and from the packed
+	/// 32 bit layout used by Voxel. Output is bit identical to Voxel(float,float,float,unsigned)
+	/// for vectors in range; out of range vectors and LOD values are clamped instead of wrapping.
+	/// </summary>
+	class VoxelBatchCodec
+	{
+		VoxelCodecKernel m_kernel = VoxelCodecKernel::Scalar;
+
+	public:
+		VoxelBatchCodec();
+		VoxelBatchCodec(VoxelCodecKernel kernel);
+		~VoxelBatchCodec() = default;
+
+		/// <summary>
+		/// Packs count voxels, source holds count * 4 floats in z,y,x,lod order
+		/// </summary>
+		void Encode(const float* source, uint32_t* destination, size_t count) const;
+		/// <summary>
+		/// Unpacks count voxels into count * 4 floats in z,y,x,lod order, flags are discarded
+		/// </summary>
+		void Decode(const uint32_t* source, float* destination, size_t count) const;
+
+		VoxelCodecKernel GetKernel() const { return m_kernel; }
+
+		/// <summary>
+		/// Returns the widest kernel supported by both the CPU and the OS (AVX2 needs YMM state saving)
+		/// </summary>
+		static VoxelCodecKernel DetectKernel();
+		/// <summary>
+		/// Lowers kernel to DetectKernel when the hardware can't execute it
+		/// </summary>
+		static VoxelCodecKernel ClampKernel(VoxelCodecKernel kernel);
+		static const wchar_t* GetKernelName(VoxelCodecKernel kernel);
+	};
+
+	struct VoxelCodecBenchmark
+	{
+		size_t VoxelCount = 0;
+		double ConstructorVoxelsPerSecond = 0.; // Voxel(float,float,float,unsigned) one at a time
+		double ScalarEncodeVoxelsPerSecond = 0.;
+		double BatchEncodeVoxelsPerSecond = 0.;
+		double BatchDecodeVoxelsPerSecond = 0.;
+		VoxelCodecKernel Kernel = VoxelCodecKernel::Scalar;
+	};
+
+	/// <summary>
+	/// Times the Voxel constructor against the scalar and detected batch kernels over voxelCount
+	/// random vectors and writes the results to the console
+	/// </summary>
+	VoxelCodecBenchmark RunVoxelCodecBenchmark(size_t voxelCount = 1ull << 22);
+}
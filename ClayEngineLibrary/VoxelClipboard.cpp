@@ -0,0 +1,156 @@
+#include "pch.h"
+#include "VoxelClipboard.h"
+
+using namespace ClayEngine;
+
+namespace
+{
+	VoxelBox offsetBox(const VoxelBox& box, VoxelCoord offset)
+	{
+		return {
+			{ box.Min.X + offset.X, box.Min.Y + offset.Y, box.Min.Z + offset.Z },
+			{ box.Max.X + offset.X, box.Max.Y + offset.Y, box.Max.Z + offset.Z }
+		};
+	}
+}
+
+#pragma region Voxel Clipboard Implementation
+void ClayEngine::VoxelClipboard::Copy(const VoxelGrid& grid, const VoxelBox& box, int level)
+{
+	Clear();
+	if (box.IsEmpty()) return;
+
+	m_size = { box.SizeX(), box.SizeY(), box.SizeZ() };
+	m_bricks = { (m_size.X + c_voxel_chunk_mask) >> c_voxel_chunk_bits, (m_size.Y + c_voxel_chunk_mask) >> c_voxel_chunk_bits, (m_size.Z + c_voxel_chunk_mask) >> c_voxel_chunk_bits };
+	m_data.resize(static_cast<size_t>(m_bricks.X) * m_bricks.Y * m_bricks.Z);
+
+	// Only one brick is ever staged uncompressed, the edge bricks are padded out with air
+	std::vector<uint32_t> dense(c_voxel_chunk_volume);
+	auto chunk = std::make_unique<VoxelChunk>();
+
+	for (auto bz = 0; bz < m_bricks.Z; ++bz)
+		for (auto by = 0; by < m_bricks.Y; ++by)
+			for (auto bx = 0; bx < m_bricks.X; ++bx)
+			{
+				VoxelCoord min = { bx * c_voxel_chunk_size, by * c_voxel_chunk_size, bz * c_voxel_chunk_size };
+				VoxelBox local = {
+					min,
+					{ std::min(m_size.X, min.X + c_voxel_chunk_size), std::min(m_size.Y, min.Y + c_voxel_chunk_size), std::min(m_size.Z, min.Z + c_voxel_chunk_size) }
+				};
+				grid.CopyTo(offsetBox(local, box.Min), dense.data());
+
+				chunk->Fill(c_voxel_empty);
+				auto source = dense.data();
+				for (auto z = 0; z < local.SizeZ(); ++z)
+					for (auto y = 0; y < local.SizeY(); ++y)
+						for (auto x = 0; x < local.SizeX(); ++x)
+							chunk->Set(x, y, z, *source++);
+
+				auto& brick = m_data[getBrick(bx, by, bz)];
+				brick.Compress(chunk->Voxels, true, level);
+				m_compressed_size += brick.GetSize();
+			}
+}
+
+void ClayEngine::VoxelClipboard::Clear()
+{
+	m_size = {};
+	m_bricks = {};
+	m_data.clear();
+	m_data.shrink_to_fit();
+	m_compressed_size = 0;
+}
+
+bool ClayEngine::VoxelClipboard::ForEachBrick(const VoxelClipboardVisitor& visitor) const
+{
+	if (m_data.empty()) return true;
+
+	auto decoder = std::make_unique<VoxelChunkDecoder>();
+	auto chunk = std::make_unique<VoxelChunk>();
+	std::vector<uint32_t> dense(c_voxel_chunk_volume);
+
+	for (auto bz = 0; bz < m_bricks.Z; ++bz)
+		for (auto by = 0; by < m_bricks.Y; ++by)
+			for (auto bx = 0; bx < m_bricks.X; ++bx)
+			{
+				if (!decoder->Decode(m_data[getBrick(bx, by, bz)], *chunk)) return false;
+
+				VoxelCoord min = { bx * c_voxel_chunk_size, by * c_voxel_chunk_size, bz * c_voxel_chunk_size };
+				VoxelBox local = {
+					min,
+					{ std::min(m_size.X, min.X + c_voxel_chunk_size), std::min(m_size.Y, min.Y + c_voxel_chunk_size), std::min(m_size.Z, min.Z + c_voxel_chunk_size) }
+				};
+
+				auto destination = dense.data();
+				for (auto z = 0; z < local.SizeZ(); ++z)
+					for (auto y = 0; y < local.SizeY(); ++y)
+						for (auto x = 0; x < local.SizeX(); ++x)
+							*destination++ = chunk->Get(x, y, z);
+
+				visitor(local, dense.data());
+			}
+
+	return true;
+}
+
+bool ClayEngine::VoxelClipboard::Validate() const
+{
+	auto decoder = std::make_unique<VoxelChunkDecoder>();
+	auto chunk = std::make_unique<VoxelChunk>();
+
+	for (auto& brick : m_data)
+		if (!decoder->Decode(brick, *chunk)) return false;
+
+	return true;
+}
+
+bool ClayEngine::VoxelClipboard::DecodeBrick(int bx, int by, int bz, VoxelChunkDecoder& decoder, VoxelChunk& chunk) const
+{
+	if (bx < 0 || by < 0 || bz < 0 || bx >= m_bricks.X || by >= m_bricks.Y || bz >= m_bricks.Z) return false;
+	return decoder.Decode(m_data[getBrick(bx, by, bz)], chunk);
+}
+
+bool ClayEngine::VoxelClipboard::Paste(VoxelGrid& grid, VoxelCoord origin, bool air) const
+{
+	// Decoding twice is cheaper than leaving half a paste behind
+	if (!Validate()) return false;
+
+	std::vector<uint32_t> merged = {};
+
+	return ForEachBrick([&](const VoxelBox& box, const uint32_t* voxels) {
+		auto target = offsetBox(box, origin);
+		if (air)
+		{
+			grid.CopyFrom(target, voxels);
+			return;
+		}
+
+		// Read what is there and let it show through the selection's air
+		merged.resize(box.Volume());
+		grid.CopyTo(target, merged.data());
+		for (size_t i = 0; i < merged.size(); ++i) if (voxels[i] != c_voxel_empty) merged[i] = voxels[i];
+		grid.CopyFrom(target, merged.data());
+	});
+}
+
+bool ClayEngine::VoxelClipboard::Paste(VoxelEditOverlay& overlay, VoxelCoord origin, bool air) const
+{
+	// Validated before BeginEdit, a corrupt brick must not commit a partial paste as an undo step
+	if (!Validate()) return false;
+
+	overlay.BeginEdit();
+	try
+	{
+		auto result = ForEachBrick([&](const VoxelBox& box, const uint32_t* voxels) {
+			overlay.CopyFrom(offsetBox(box, origin), voxels, air);
+		});
+		overlay.EndEdit();
+		return result;
+	}
+	catch (...)
+	{
+		overlay.AbortEdit();
+		throw;
+	}
+}
+#pragma endregion
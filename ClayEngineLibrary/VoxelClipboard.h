@@ -0,0 +1,91 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* Compressed copy/paste clipboard that streams one brick at a time           */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "VoxelGrid.h"
+#include "VoxelCompression.h"
+#include "VoxelEditOverlay.h"
+
+namespace ClayEngine
+{
+	/// <summary>
+	/// Receives one brick of a paste, box is in clipboard space (0 based) and voxels is a dense x-fastest
+	/// array of box.Volume() words that is only valid for the call
+	/// </summary>
+	using VoxelClipboardVisitor = std::function<void(const VoxelBox& box, const uint32_t* voxels)>;
+
+	/// <summary>
+	/// A copied region kept as chunk sized bricks aligned to the selection's minimum corner, each one
+	/// palette + RLE encoded and deflated by CompressedVoxelChunk. Copy and paste stage a single brick
+	/// at a time, so memory follows the compressed size of the selection rather than its volume and
+	/// the whole selection is never expanded at once.
+	/// </summary>
+	class VoxelClipboard
+	{
+		VoxelCoord m_size = {};
+		VoxelCoord m_bricks = {}; // Bricks along each axis
+		std::vector<CompressedVoxelChunk> m_data = {}; // x-fastest by brick
+		size_t m_compressed_size = 0;
+
+		size_t getBrick(int bx, int by, int bz) const { return (static_cast<size_t>(bz) * m_bricks.Y + by) * m_bricks.X + bx; }
+
+	public:
+		VoxelClipboard() = default;
+		~VoxelClipboard() = default;
+
+		VoxelClipboard(const VoxelClipboard&) = delete;
+		VoxelClipboard& operator=(const VoxelClipboard&) = delete;
+
+		/// <summary>
+		/// Replaces the contents with box from grid, deflating with the given zlib level
+		/// </summary>
+		void Copy(const VoxelGrid& grid, const VoxelBox& box, int level = Z_BEST_SPEED);
+		void Clear();
+
+		/// <summary>
+		/// Decodes the bricks one after another and hands each to visitor, returns false if one is corrupt
+		/// </summary>
+		bool ForEachBrick(const VoxelClipboardVisitor& visitor) const;
+
+		/// <summary>
+		/// Decodes every brick without keeping any, returns false if one is corrupt
+		/// </summary>
+		bool Validate() const;
+
+		/// <summary>
+		/// Decodes brick bx,by,bz (chunk sized, 0 based from the selection corner) into chunk for random
+		/// access samplers, voxels past the selection edge read as air
+		/// </summary>
+		bool DecodeBrick(int bx, int by, int bz, VoxelChunkDecoder& decoder, VoxelChunk& chunk) const;
+
+		/// <summary>
+		/// Writes the selection into grid with its minimum corner at origin. With air false the empty
+		/// voxels of the selection leave the grid as it was. The bricks are validated first, so a corrupt
+		/// clipboard returns false without writing anything.
+		/// </summary>
+		bool Paste(VoxelGrid& grid, VoxelCoord origin, bool air = true) const;
+		/// <summary>
+		/// Pastes into an edit overlay as a single undo step, or returns false with no step if a brick is
+		/// corrupt. A throw while pasting aborts the edit, see VoxelEditOverlay::AbortEdit.
+		/// </summary>
+		bool Paste(VoxelEditOverlay& overlay, VoxelCoord origin, bool air = true) const;
+
+		const VoxelCoord& GetSize() const { return m_size; }
+		const VoxelCoord& GetBrickCounts() const { return m_bricks; }
+		size_t GetVolume() const { return static_cast<size_t>(m_size.X) * m_size.Y * m_size.Z; }
+		size_t GetBrickCount() const { return m_data.size(); }
+		size_t GetCompressedSize() const { return m_compressed_size; }
+		bool IsEmpty() const { return m_data.empty(); }
+	};
+	using VoxelClipboardPtr = std::unique_ptr<VoxelClipboard>;
+}
@@ -0,0 +1,474 @@
+#include "pch.h"
+#include "VoxelCollision.h"
+#include "VoxelOctree.h"
+#include "Strings.h"
+#include "Benchmark.h"
+
+#include <random>
+
+using namespace ClayEngine;
+
+namespace
+{
+	constexpr auto c_infinity{ std::numeric_limits<double>::infinity() };
+
+	/// <summary>
+	/// A shape and its motion flattened for the tests below, Reach is the half size of the shape's bounding box
+	/// </summary>
+	struct Query
+	{
+		VoxelShapeType Type = VoxelShapeType::Box;
+		double Point[3] = {};
+		double Motion[3] = {};
+		double Reach[3] = {};
+		double HalfHeight = 0.;
+		double Radius = 0.;
+	};
+
+	Query makeQuery(const VoxelShape& shape, const double (&motion)[3])
+	{
+		Query q = {};
+		q.Type = shape.Type;
+		q.HalfHeight = std::max(shape.HalfHeight, 0.);
+		q.Radius = std::max(shape.Radius, 0.);
+		for (auto i = 0; i < 3; ++i)
+		{
+			q.Point[i] = shape.Center[i];
+			q.Motion[i] = motion[i];
+			q.Reach[i] = shape.Type == VoxelShapeType::Box ? std::abs(shape.HalfExtents[i]) : q.Radius + (i == 1 ? q.HalfHeight : 0.);
+		}
+		return q;
+	}
+
+	/// <summary>
+	/// Closed slab test of the motion segment, up to limit, against [low, high] grown by the shape's reach.
+	/// Never rejects anything the exact tests could hit.
+	/// </summary>
+	bool mayTouch(const Query& q, const double (&low)[3], const double (&high)[3], double limit)
+	{
+		auto enter = 0.;
+		auto exit = limit;
+		for (auto i = 0; i < 3; ++i)
+		{
+			auto a = low[i] - q.Reach[i];
+			auto b = high[i] + q.Reach[i];
+			if (q.Motion[i] == 0.)
+			{
+				if (q.Point[i] < a || q.Point[i] > b) return false;
+				continue;
+			}
+
+			auto t1 = (a - q.Point[i]) / q.Motion[i];
+			auto t2 = (b - q.Point[i]) / q.Motion[i];
+			enter = std::max(enter, std::min(t1, t2));
+			exit = std::min(exit, std::max(t1, t2));
+			if (enter > exit) return false;
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Open slab test of the moving point against [low, high], the point has to pass through the
+	/// inside, grazing a face or edge doesn't count. Enter is negative when the point starts inside.
+	/// </summary>
+	bool slab(const Query& q, const double (&low)[3], const double (&high)[3], double& enter, int& axis)
+	{
+		enter = -c_infinity;
+		axis = -1;
+		auto exit = c_infinity;
+		for (auto i = 0; i < 3; ++i)
+		{
+			if (q.Motion[i] == 0.)
+			{
+				if (q.Point[i] <= low[i] || q.Point[i] >= high[i]) return false;
+				continue;
+			}
+
+			auto t1 = (low[i] - q.Point[i]) / q.Motion[i];
+			auto t2 = (high[i] - q.Point[i]) / q.Motion[i];
+			auto near = std::min(t1, t2);
+			if (near > enter)
+			{
+				enter = near;
+				axis = i;
+			}
+			exit = std::min(exit, std::max(t1, t2));
+		}
+		return exit > std::max(enter, 0.) && enter < 1.;
+	}
+
+	/// <summary>
+	/// Push out normal for a point inside [low, high], along the axis of least penetration
+	/// </summary>
+	void pushOut(const double (&point)[3], const double (&low)[3], const double (&high)[3], double (&normal)[3])
+	{
+		auto best = c_infinity;
+		auto axis = 0;
+		auto sign = 1.;
+		for (auto i = 0; i < 3; ++i)
+		{
+			auto below = point[i] - low[i];
+			auto above = high[i] - point[i];
+			if (below < best) { best = below; axis = i; sign = -1.; }
+			if (above < best) { best = above; axis = i; sign = 1.; }
+		}
+		normal[0] = normal[1] = normal[2] = 0.;
+		normal[axis] = sign;
+	}
+
+	/// <summary>
+	/// Entering root of |from + t * motion| = radius over the given axes, false when the path misses or only grazes
+	/// </summary>
+	bool sphere(const double* from, const double* motion, int count, double radius, double& t)
+	{
+		auto a = 0.;
+		auto b = 0.;
+		auto c = -radius * radius;
+		for (auto i = 0; i < count; ++i)
+		{
+			a += motion[i] * motion[i];
+			b += from[i] * motion[i];
+			c += from[i] * from[i];
+		}
+		if (a == 0.) return false;
+
+		auto disc = b * b - a * c;
+		if (disc <= 0.) return false;
+
+		t = (-b - std::sqrt(disc)) / a;
+		return t >= 0. && t < 1.;
+	}
+
+	/// <summary>
+	/// Time of impact of q against the voxel at x, y, z, false when it misses within the motion
+	/// </summary>
+	bool touch(const Query& q, int x, int y, int z, double& time, double (&normal)[3], bool& start)
+	{
+		const double low[3] = { static_cast<double>(x), static_cast<double>(y), static_cast<double>(z) };
+		const double high[3] = { low[0] + 1., low[1] + 1., low[2] + 1. };
+
+		if (q.Type == VoxelShapeType::Box)
+		{
+			// Minkowski sum, the box centre against the voxel grown by the half extents
+			double grownLow[3], grownHigh[3];
+			for (auto i = 0; i < 3; ++i)
+			{
+				grownLow[i] = low[i] - q.Reach[i];
+				grownHigh[i] = high[i] + q.Reach[i];
+			}
+
+			auto enter = 0.;
+			auto axis = -1;
+			if (!slab(q, grownLow, grownHigh, enter, axis)) return false;
+
+			start = enter < 0.;
+			time = std::max(enter, 0.);
+			if (start) pushOut(q.Point, grownLow, grownHigh, normal);
+			else
+			{
+				normal[0] = normal[1] = normal[2] = 0.;
+				normal[axis] = q.Motion[axis] > 0. ? -1. : 1.;
+			}
+			return true;
+		}
+
+		// The capsule centre against the voxel stretched by HalfHeight in y and rounded by Radius: three
+		// slabs grown by Radius along one axis each, a cylinder along every edge and a sphere at every
+		// corner. Each edge cylinder's end caps sit inside its corner spheres, so they need no test.
+		const double core[2][3] = { { low[0], low[1] - q.HalfHeight, low[2] }, { high[0], high[1] + q.HalfHeight, high[2] } };
+		const auto r = q.Radius;
+
+		double closest[3];
+		auto distance = 0.;
+		for (auto i = 0; i < 3; ++i)
+		{
+			closest[i] = std::min(std::max(q.Point[i], core[0][i]), core[1][i]);
+			distance += (q.Point[i] - closest[i]) * (q.Point[i] - closest[i]);
+		}
+		if (distance < r * r)
+		{
+			start = true;
+			time = 0.;
+			if (distance > 0.)
+			{
+				distance = std::sqrt(distance);
+				for (auto i = 0; i < 3; ++i) normal[i] = (q.Point[i] - closest[i]) / distance;
+			}
+			else pushOut(q.Point, core[0], core[1], normal);
+			return true;
+		}
+
+		start = false;
+		auto best = 1.;
+		auto found = false;
+
+		for (auto k = 0; k < 3; ++k)
+		{
+			double grownLow[3] = { core[0][0], core[0][1], core[0][2] };
+			double grownHigh[3] = { core[1][0], core[1][1], core[1][2] };
+			grownLow[k] -= r;
+			grownHigh[k] += r;
+
+			auto enter = 0.;
+			auto axis = -1;
+			if (slab(q, grownLow, grownHigh, enter, axis) && enter < best)
+			{
+				best = enter;
+				found = true;
+				normal[0] = normal[1] = normal[2] = 0.;
+				normal[axis] = q.Motion[axis] > 0. ? -1. : 1.;
+			}
+		}
+
+		for (auto k = 0; k < 3; ++k)
+		{
+			const auto u = (k + 1) % 3;
+			const auto v = (k + 2) % 3;
+			const double motion[2] = { q.Motion[u], q.Motion[v] };
+			for (auto corner = 0; corner < 4; ++corner)
+			{
+				const double from[2] = { q.Point[u] - core[corner & 1][u], q.Point[v] - core[corner >> 1][v] };
+				auto t = 0.;
+				if (!sphere(from, motion, 2, r, t) || t >= best) continue;
+
+				auto along = q.Point[k] + q.Motion[k] * t;
+				if (along < core[0][k] || along > core[1][k]) continue;
+
+				best = t;
+				found = true;
+				normal[k] = 0.;
+				normal[u] = (from[0] + motion[0] * t) / r;
+				normal[v] = (from[1] + motion[1] * t) / r;
+			}
+		}
+
+		for (auto corner = 0; corner < 8; ++corner)
+		{
+			const double from[3] = { q.Point[0] - core[corner & 1][0], q.Point[1] - core[(corner >> 1) & 1][1], q.Point[2] - core[corner >> 2][2] };
+			auto t = 0.;
+			if (!sphere(from, q.Motion, 3, r, t) || t >= best) continue;
+
+			best = t;
+			found = true;
+			for (auto i = 0; i < 3; ++i) normal[i] = (from[i] + q.Motion[i] * t) / r;
+		}
+
+		time = best;
+		return found;
+	}
+
+	/// <summary>
+	/// Keeps the earliest contact, a shape that starts inside wins ties so StartSolid is never lost
+	/// </summary>
+	void consider(const Query& q, int x, int y, int z, uint32_t value, VoxelSweepHit& hit)
+	{
+		auto time = 0.;
+		double normal[3] = {};
+		auto start = false;
+		if (!touch(q, x, y, z, time, normal, start)) return;
+
+		if (hit.Hit && !(time < hit.Time || (start && !hit.StartSolid && time <= hit.Time))) return;
+
+		hit.Hit = true;
+		hit.StartSolid = start;
+		hit.Time = time;
+		for (auto i = 0; i < 3; ++i) hit.Normal[i] = normal[i];
+		hit.Position = { x, y, z };
+		hit.Value = value;
+	}
+
+	/// <summary>
+	/// Inclusive range of voxels the swept bounds of q cover
+	/// </summary>
+	void sweptVoxels(const Query& q, int (&low)[3], int (&high)[3])
+	{
+		for (auto i = 0; i < 3; ++i)
+		{
+			auto a = std::min(q.Point[i], q.Point[i] + q.Motion[i]) - q.Reach[i];
+			auto b = std::max(q.Point[i], q.Point[i] + q.Motion[i]) + q.Reach[i];
+			low[i] = static_cast<int>(std::floor(a));
+			high[i] = static_cast<int>(std::ceil(b)) - 1;
+		}
+	}
+
+	/// <summary>
+	/// Every voxel of the swept bounds through GetVoxel with no culling, what the benchmark compares against
+	/// </summary>
+	bool sweepNaive(const VoxelGrid& grid, const VoxelSweep& sweep, VoxelSweepHit& hit)
+	{
+		hit = {};
+		auto q = makeQuery(sweep.Shape, sweep.Motion);
+
+		int low[3], high[3];
+		sweptVoxels(q, low, high);
+		for (auto z = low[2]; z <= high[2]; ++z)
+			for (auto y = low[1]; y <= high[1]; ++y)
+				for (auto x = low[0]; x <= high[0]; ++x)
+				{
+					auto value = grid.GetVoxel(x, y, z);
+					if (!IsVoxelEmpty(value)) consider(q, x, y, z, value, hit);
+				}
+
+		if (!hit.Hit) hit.Time = 1.;
+		return hit.Hit;
+	}
+}
+
+#pragma region Voxel Collider Implementation
+ClayEngine::VoxelCollider::VoxelCollider(const VoxelGrid& grid, WorkerPoolRaw pool)
+	: m_grid(&grid)
+	, m_pool(pool)
+{
+}
+
+bool ClayEngine::VoxelCollider::Sweep(const VoxelShape& shape, const double (&motion)[3], VoxelSweepHit& hit) const
+{
+	hit = {};
+	auto q = makeQuery(shape, motion);
+
+	int low[3], high[3];
+	sweptVoxels(q, low, high);
+
+	for (auto cz = low[2] >> c_voxel_chunk_bits; cz <= high[2] >> c_voxel_chunk_bits; ++cz)
+		for (auto cy = low[1] >> c_voxel_chunk_bits; cy <= high[1] >> c_voxel_chunk_bits; ++cy)
+			for (auto cx = low[0] >> c_voxel_chunk_bits; cx <= high[0] >> c_voxel_chunk_bits; ++cx)
+			{
+				auto chunk = m_grid->GetChunk(cx, cy, cz);
+				if (!chunk) continue;
+
+				// Broadphase, skip the chunk if the motion can't reach it before the best contact so far
+				const int origin[3] = { cx * c_voxel_chunk_size, cy * c_voxel_chunk_size, cz * c_voxel_chunk_size };
+				const double chunkLow[3] = { static_cast<double>(origin[0]), static_cast<double>(origin[1]), static_cast<double>(origin[2]) };
+				const double chunkHigh[3] = { chunkLow[0] + c_voxel_chunk_size, chunkLow[1] + c_voxel_chunk_size, chunkLow[2] + c_voxel_chunk_size };
+				if (!mayTouch(q, chunkLow, chunkHigh, hit.Hit ? hit.Time : 1.)) continue;
+
+				int from[3], to[3];
+				for (auto i = 0; i < 3; ++i)
+				{
+					from[i] = std::max(low[i], origin[i]);
+					to[i] = std::min(high[i], origin[i] + c_voxel_chunk_mask);
+				}
+
+				for (auto z = from[2]; z <= to[2]; ++z)
+					for (auto y = from[1]; y <= to[1]; ++y)
+						for (auto x = from[0]; x <= to[0]; ++x)
+						{
+							auto value = chunk->Voxels[MortonIndex(x, y, z)];
+							if (IsVoxelEmpty(value)) continue;
+
+							const double voxelLow[3] = { static_cast<double>(x), static_cast<double>(y), static_cast<double>(z) };
+							const double voxelHigh[3] = { voxelLow[0] + 1., voxelLow[1] + 1., voxelLow[2] + 1. };
+							if (!mayTouch(q, voxelLow, voxelHigh, hit.Hit ? hit.Time : 1.)) continue;
+
+							consider(q, x, y, z, value, hit);
+						}
+			}
+
+	if (!hit.Hit) hit.Time = 1.;
+	return hit.Hit;
+}
+
+void ClayEngine::VoxelCollider::Sweep(const VoxelSweep* sweeps, size_t count, VoxelSweepHit* hits) const
+{
+	auto jobs = (count + c_collision_batch_size - 1) / c_collision_batch_size;
+	auto job = [&](size_t index, size_t) {
+		auto end = std::min(count, (index + 1) * c_collision_batch_size);
+		for (auto i = index * c_collision_batch_size; i < end; ++i) Sweep(sweeps[i].Shape, sweeps[i].Motion, hits[i]);
+	};
+
+	if (m_pool) m_pool->ParallelFor(jobs, job);
+	else for (size_t i = 0; i < jobs; ++i) job(i, 0);
+}
+
+bool ClayEngine::VoxelCollider::Overlaps(const VoxelShape& shape) const
+{
+	const double still[3] = {};
+	VoxelSweepHit hit = {};
+	return Sweep(shape, still, hit) && hit.StartSolid;
+}
+#pragma endregion
+
+ClayEngine::VoxelCollisionBenchmark ClayEngine::RunVoxelCollisionBenchmark(WorkerPoolRaw pool, size_t sweepCount)
+{
+	VoxelCollisionBenchmark result = {};
+	result.SweepCount = sweepCount;
+	result.ThreadCount = pool ? pool->GetThreadCount() : 1;
+
+	// Same rolling heightmap as the raycast benchmark
+	VoxelGrid terrain;
+	std::vector<int> heights(256 * 256);
+	for (auto z = 0; z < 256; ++z)
+		for (auto x = 0; x < 256; ++x)
+		{
+			auto h = static_cast<int>(24. + 10. * std::sin(x * .05) * std::cos(z * .04));
+			heights[z * 256 + x] = h;
+			terrain.Fill({ { x, 0, z }, { x + 1, h, z + 1 } }, 1);
+		}
+
+	std::mt19937 rng(11);
+	std::uniform_real_distribution<double> across(4., 252.);
+	std::uniform_real_distribution<double> spread(-1., 1.);
+
+	// Players walking, jumping and falling near the surface, a few of them already clipped into it
+	std::vector<VoxelSweep> sweeps(sweepCount);
+	for (size_t i = 0; i < sweepCount; ++i)
+	{
+		auto& sweep = sweeps[i];
+		auto& shape = sweep.Shape;
+		shape.Center[0] = across(rng);
+		shape.Center[2] = across(rng);
+		auto ground = heights[static_cast<int>(shape.Center[2]) * 256 + static_cast<int>(shape.Center[0])];
+
+		if (i & 1)
+		{
+			shape.Type = VoxelShapeType::Capsule;
+			shape.HalfHeight = .55;
+			shape.Radius = .35;
+			shape.Center[1] = ground + .9 + 1.5 * (spread(rng) + .8);
+		}
+		else
+		{
+			shape.HalfExtents[0] = shape.HalfExtents[2] = .3;
+			shape.HalfExtents[1] = .9;
+			shape.Center[1] = ground + .9 + 1.5 * (spread(rng) + .8);
+		}
+
+		sweep.Motion[0] = 1.5 * spread(rng);
+		sweep.Motion[1] = -1. + .75 * spread(rng);
+		sweep.Motion[2] = 1.5 * spread(rng);
+	}
+
+	std::vector<VoxelSweepHit> naive(sweepCount), single(sweepCount), batch(sweepCount);
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < sweepCount; ++i) sweepNaive(terrain, sweeps[i], naive[i]);
+	result.NaiveSweepsPerSecond = PerSecond(sweepCount, std::chrono::steady_clock::now() - start);
+
+	VoxelCollider collider(terrain, pool);
+
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < sweepCount; ++i) collider.Sweep(sweeps[i].Shape, sweeps[i].Motion, single[i]);
+	result.SingleSweepsPerSecond = PerSecond(sweepCount, std::chrono::steady_clock::now() - start);
+
+	start = std::chrono::steady_clock::now();
+	collider.Sweep(sweeps.data(), sweepCount, batch.data());
+	result.BatchSweepsPerSecond = PerSecond(sweepCount, std::chrono::steady_clock::now() - start);
+
+	for (size_t i = 0; i < sweepCount; ++i)
+	{
+		auto& a = naive[i];
+		auto& b = batch[i];
+		if (a.Hit != b.Hit || a.StartSolid != b.StartSolid || a.Time != b.Time) ++result.Mismatches;
+	}
+
+	std::wstringstream wss;
+	wss << std::fixed << std::setprecision(2)
+		<< L"VoxelCollision " << result.SweepCount << L" sweeps"
+		<< L" | Naive " << result.NaiveSweepsPerSecond / 1e6 << L" Msweeps/sec"
+		<< L" | Broadphase " << result.SingleSweepsPerSecond / 1e6 << L" Msweeps/sec"
+		<< L" | Batched " << result.ThreadCount << L" threads " << result.BatchSweepsPerSecond / 1e6 << L" Msweeps/sec"
+		<< L" | Mismatches " << result.Mismatches;
+	WriteLine(wss.str());
+
+	return result;
+}
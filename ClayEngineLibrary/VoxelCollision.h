@@ -0,0 +1,109 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* Swept box and capsule queries against voxel terrain, no renderer required  */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "VoxelGrid.h"
+#include "WorkerPool.h"
+
+namespace ClayEngine
+{
+	constexpr auto c_collision_batch_size{ 64 }; // Sweeps per job in a batched query
+
+	enum class VoxelShapeType
+	{
+		Box,
+		Capsule,
+	};
+
+	/// <summary>
+	/// Shape of a mover in voxel coordinates. Capsules stand upright, a vertical segment of length
+	/// 2 * HalfHeight through Center swept by a sphere of Radius.
+	/// </summary>
+	struct VoxelShape
+	{
+		VoxelShapeType Type = VoxelShapeType::Box;
+		double Center[3] = {};
+		double HalfExtents[3] = { .5, .5, .5 }; // Box
+		double HalfHeight = .5; // Capsule
+		double Radius = .5; // Capsule
+	};
+
+	/// <summary>
+	/// One mover of a tick, Shape moves by Motion
+	/// </summary>
+	struct VoxelSweep
+	{
+		VoxelShape Shape = {};
+		double Motion[3] = {};
+	};
+
+	struct VoxelSweepHit
+	{
+		bool Hit = false;
+		bool StartSolid = false; // The shape already overlapped solid voxels before moving, Time is 0
+		double Time = 1.; // Share of Motion the shape can travel before touching, 1 when nothing was hit
+		double Normal[3] = {}; // Unit contact normal pointing from the voxel towards the shape
+		VoxelCoord Position = {}; // Grid coordinates of the voxel that was hit
+		uint32_t Value = c_voxel_empty;
+	};
+
+	/// <summary>
+	/// Answers collision queries against a VoxelGrid for server side movement validation. A sweep
+	/// visits only the chunks its swept bounds touch, culls each one with a conservative slab test
+	/// against the motion segment (skipping chunks that don't exist outright), does the same per solid
+	/// voxel, and only then runs the exact time of impact test. Shapes resting exactly on a surface do
+	/// not count as touching it, so standing on the ground and walking along it never reports a hit.
+	/// Queries are const and may run on many threads at once as long as the grid isn't being edited.
+	/// </summary>
+	class VoxelCollider
+	{
+		const VoxelGrid* m_grid = nullptr;
+		WorkerPoolRaw m_pool = nullptr;
+
+	public:
+		VoxelCollider(const VoxelGrid& grid, WorkerPoolRaw pool = nullptr);
+		~VoxelCollider() = default;
+
+		VoxelCollider(const VoxelCollider&) = delete;
+		VoxelCollider& operator=(const VoxelCollider&) = delete;
+
+		/// <summary>
+		/// Earliest contact of shape moving by motion, returns hit.Hit
+		/// </summary>
+		bool Sweep(const VoxelShape& shape, const double (&motion)[3], VoxelSweepHit& hit) const;
+		/// <summary>
+		/// Sweeps count movers across the worker pool, hits[i] answers sweeps[i]
+		/// </summary>
+		void Sweep(const VoxelSweep* sweeps, size_t count, VoxelSweepHit* hits) const;
+		/// <summary>
+		/// True when shape overlaps a solid voxel where it stands
+		/// </summary>
+		bool Overlaps(const VoxelShape& shape) const;
+	};
+	using VoxelColliderPtr = std::unique_ptr<VoxelCollider>;
+
+	struct VoxelCollisionBenchmark
+	{
+		size_t SweepCount = 0;
+		size_t ThreadCount = 0;
+		double NaiveSweepsPerSecond = 0.; // Every voxel in the swept bounds through VoxelGrid::GetVoxel
+		double SingleSweepsPerSecond = 0.; // Broadphase, one mover at a time on the calling thread
+		double BatchSweepsPerSecond = 0.; // Broadphase, batched across pool
+		size_t Mismatches = 0; // Sweeps where the naive and broadphase results differ, should be 0
+	};
+
+	/// <summary>
+	/// Sweeps sweepCount boxes and capsules walking and falling over a 256 x 64 x 256 heightmap and
+	/// writes the sweeps per second for each method to the console
+	/// </summary>
+	VoxelCollisionBenchmark RunVoxelCollisionBenchmark(WorkerPoolRaw pool, size_t sweepCount = 1u << 14);
+}
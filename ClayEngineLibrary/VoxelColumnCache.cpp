@@ -0,0 +1,124 @@
+#include "pch.h"
+#include "VoxelColumnCache.h"
+
+using namespace ClayEngine;
+
+void ClayEngine::VoxelColumn::UpdateBounds()
+{
+	if (Heights.empty())
+	{
+		MinHeight = MaxHeight = 0.f;
+		return;
+	}
+
+	auto bounds = std::minmax_element(Heights.begin(), Heights.end());
+	MinHeight = *bounds.first;
+	MaxHeight = *bounds.second;
+}
+
+#pragma region Column Cache Implementation
+ClayEngine::VoxelColumnCache::VoxelColumnCache(VoxelColumnGenerator generator, int size, size_t capacity, size_t shards)
+	: m_generator(std::move(generator))
+	, m_size(size)
+{
+	if (!m_generator) throw std::runtime_error("ClayEngine::VoxelColumnCache requires a generator");
+
+	shards = std::max<size_t>(shards, 1);
+	m_shard_capacity = std::max<size_t>(capacity / shards, 1);
+	for (size_t i = 0; i < shards; ++i) m_shards.push_back(std::make_unique<Shard>());
+}
+
+uint64_t ClayEngine::VoxelColumnCache::makeKey(int level, int x, int z)
+{
+	// 8 bits of level and 28 bits of each axis, two's complement wraps are fine for a key
+	return (static_cast<uint64_t>(level & 0xFF) << 56)
+		| (static_cast<uint64_t>(static_cast<uint32_t>(x) & 0x0FFFFFFFu) << 28)
+		| static_cast<uint64_t>(static_cast<uint32_t>(z) & 0x0FFFFFFFu);
+}
+
+ClayEngine::VoxelColumnCache::Shard& ClayEngine::VoxelColumnCache::getShard(uint64_t key) const
+{
+	// Neighbouring columns differ in the low bits, mix them up so they spread across shards
+	auto h = key * 0x9E3779B97F4A7C15ull;
+	return *m_shards[(h >> 32) % m_shards.size()];
+}
+
+ClayEngine::VoxelColumnView ClayEngine::VoxelColumnCache::Get(int level, int x, int z)
+{
+	auto key = makeKey(level, x, z);
+	auto& shard = getShard(key);
+
+	std::promise<VoxelColumnView> promise;
+	std::shared_future<VoxelColumnView> pending = {};
+	uint64_t generation = 0;
+	{
+		LockGuard lock(shard.Mutex);
+
+		auto it = shard.Index.find(key);
+		if (it != shard.Index.end())
+		{
+			shard.Lru.splice(shard.Lru.begin(), shard.Lru, it->second);
+			pending = it->second->Column;
+			++m_hits;
+		}
+		else
+		{
+			++m_misses;
+			generation = ++shard.Generations;
+			shard.Lru.push_front({ key, promise.get_future().share(), generation });
+			shard.Index[key] = shard.Lru.begin();
+
+			while (shard.Lru.size() > m_shard_capacity)
+			{
+				shard.Index.erase(shard.Lru.back().Key);
+				shard.Lru.pop_back();
+				++m_evictions;
+			}
+		}
+	}
+
+	// Wait outside the lock, the column may still be generating on another thread
+	if (pending.valid()) return pending.get();
+
+	try
+	{
+		auto column = std::make_shared<VoxelColumn>();
+		column->Level = level;
+		column->X = x;
+		column->Z = z;
+		column->Size = m_size;
+		column->Heights.resize(static_cast<size_t>(m_size) * m_size);
+		m_generator(*column);
+
+		VoxelColumnView view = std::move(column);
+		promise.set_value(view);
+		return view;
+	}
+	catch (...)
+	{
+		// Don't cache the failure, the next request gets to try again. The entry may have been evicted
+		// and the key generated again meanwhile, that newer entry isn't ours to drop.
+		{
+			LockGuard lock(shard.Mutex);
+			auto it = shard.Index.find(key);
+			if (it != shard.Index.end() && it->second->Generation == generation)
+			{
+				shard.Lru.erase(it->second);
+				shard.Index.erase(it);
+			}
+		}
+		promise.set_exception(std::current_exception());
+		throw;
+	}
+}
+
+void ClayEngine::VoxelColumnCache::Clear()
+{
+	for (auto& shard : m_shards)
+	{
+		LockGuard lock(shard->Mutex);
+		shard->Index.clear();
+		shard->Lru.clear();
+	}
+}
+#pragma endregion
@@ -0,0 +1,124 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* Concurrent LRU cache of per-column 2D data for heightmap generator layers  */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "Services.h"
+
+namespace ClayEngine
+{
+	constexpr auto c_column_cache_capacity{ 4096 }; // Columns kept across all shards
+	constexpr auto c_column_cache_shards{ 16 }; // Independent locks, keeps generator threads from queueing on one mutex
+
+	/// <summary>
+	/// 2D data for one vertical stack of cells at one LOD, Size x Size samples x-fastest. Every cell
+	/// in the stack shares it, so the 2D noise behind it is computed once per column instead of once
+	/// per cell.
+	/// </summary>
+	struct VoxelColumn
+	{
+		int Level = 0;
+		int X = 0;
+		int Z = 0;
+		int Size = 0;
+		std::vector<float> Heights = {};
+		float MinHeight = 0.f; // Bounds over Heights, lets layers settle whole cells without a voxel loop
+		float MaxHeight = 0.f;
+
+		float GetHeight(int x, int z) const { return Heights[static_cast<size_t>(z) * Size + x]; }
+		/// <summary>
+		/// Recomputes MinHeight and MaxHeight, generators call this once Heights is filled
+		/// </summary>
+		void UpdateBounds();
+	};
+
+	/// <summary>
+	/// Read-only view handed to layers, it stays valid after the column is evicted from the cache
+	/// </summary>
+	using VoxelColumnView = std::shared_ptr<const VoxelColumn>;
+
+	/// <summary>
+	/// Fills column (Level, X, Z are already set) with the data for that column
+	/// </summary>
+	using VoxelColumnGenerator = std::function<void(VoxelColumn& column)>;
+
+	struct VoxelColumnCacheStats
+	{
+		uint64_t Hits = 0;
+		uint64_t Misses = 0;
+		uint64_t Evictions = 0;
+	};
+
+	/// <summary>
+	/// Sharded LRU of columns keyed by (level, x, z), safe to use from every generator thread. A miss
+	/// runs the generator outside the shard lock, threads that ask for the same column meanwhile wait
+	/// for that one result instead of generating it again.
+	/// </summary>
+	class VoxelColumnCache
+	{
+		struct Entry
+		{
+			uint64_t Key = 0;
+			std::shared_future<VoxelColumnView> Column = {};
+			uint64_t Generation = 0; // Tells a later entry for Key apart from one that was evicted
+		};
+		using Entries = std::list<Entry>;
+
+		struct Shard
+		{
+			MUTEX Mutex = {};
+			Entries Lru = {}; // Most recently used first
+			std::unordered_map<uint64_t, Entries::iterator> Index = {};
+			uint64_t Generations = 0;
+		};
+		using ShardPtr = std::unique_ptr<Shard>;
+
+		VoxelColumnGenerator m_generator = nullptr;
+		int m_size = 0;
+		size_t m_shard_capacity = 0;
+		std::vector<ShardPtr> m_shards = {};
+
+		std::atomic<uint64_t> m_hits = 0;
+		std::atomic<uint64_t> m_misses = 0;
+		std::atomic<uint64_t> m_evictions = 0;
+
+		static uint64_t makeKey(int level, int x, int z);
+		Shard& getShard(uint64_t key) const;
+
+	public:
+		/// <summary>
+		/// size is the column edge in samples, usually the generator's block size
+		/// </summary>
+		VoxelColumnCache(VoxelColumnGenerator generator, int size, size_t capacity = c_column_cache_capacity, size_t shards = c_column_cache_shards);
+		~VoxelColumnCache() = default;
+
+		VoxelColumnCache(const VoxelColumnCache&) = delete;
+		VoxelColumnCache& operator=(const VoxelColumnCache&) = delete;
+
+		/// <summary>
+		/// Returns the column, generating it on this thread if no one has, rethrows if the generator threw
+		/// </summary>
+		VoxelColumnView Get(int level, int x, int z);
+		/// <summary>
+		/// Drops every cached column, views already handed out stay valid
+		/// </summary>
+		void Clear();
+
+		int GetSize() const { return m_size; }
+		VoxelColumnCacheStats GetStats() const { return { m_hits.load(), m_misses.load(), m_evictions.load() }; }
+	};
+	using VoxelColumnCachePtr = std::unique_ptr<VoxelColumnCache>;
+}
@@ -0,0 +1,253 @@
+#include "pch.h"
+#include "VoxelCompression.h"
+
+#include <cstring>
+#include <unordered_map>
+
+using namespace ClayEngine;
+
+namespace
+{
+	void writeVarint(std::vector<uint8_t>& out, uint32_t value)
+	{
+		while (value >= 0x80)
+		{
+			out.push_back(static_cast<uint8_t>(value | 0x80));
+			value >>= 7;
+		}
+		out.push_back(static_cast<uint8_t>(value));
+	}
+
+	bool readVarint(const uint8_t*& cursor, const uint8_t* end, uint32_t& value)
+	{
+		value = 0;
+		for (auto shift = 0; shift < 32 && cursor < end; shift += 7)
+		{
+			auto b = *cursor++;
+			value |= static_cast<uint32_t>(b & 0x7F) << shift;
+			if (!(b & 0x80)) return true;
+		}
+		return false;
+	}
+
+	/// <summary>
+	/// LSB first bit reader over a bounded byte range
+	/// </summary>
+	struct BitReader
+	{
+		const uint8_t* Cursor;
+		const uint8_t* End;
+		uint64_t Bits = 0;
+		uint32_t Count = 0;
+
+		bool Read(uint32_t width, uint32_t& value)
+		{
+			while (Count < width)
+			{
+				if (Cursor == End) return false;
+				Bits |= static_cast<uint64_t>(*Cursor++) << Count;
+				Count += 8;
+			}
+			value = static_cast<uint32_t>(Bits & ((1ull << width) - 1));
+			Bits >>= width;
+			Count -= width;
+			return true;
+		}
+	};
+}
+
+#pragma region Compressed Voxel Chunk Implementation
+ClayEngine::CompressedVoxelChunk::CompressedVoxelChunk(const VoxelChunk& chunk, bool deflate, int level)
+{
+	Compress(chunk.Voxels, deflate, level);
+}
+
+void ClayEngine::CompressedVoxelChunk::Compress(const uint32_t* voxels, bool deflate, int level)
+{
+	std::unordered_map<uint32_t, uint32_t> lookup = {};
+	std::vector<uint32_t> palette = {};
+	std::vector<uint32_t> indices = {};
+	std::vector<uint32_t> lengths = {};
+
+	for (auto i = 0; i < c_voxel_chunk_volume; ++i)
+	{
+		auto it = lookup.find(voxels[i]);
+		if (it == lookup.end())
+		{
+			it = lookup.emplace(voxels[i], static_cast<uint32_t>(palette.size())).first;
+			palette.push_back(voxels[i]);
+		}
+
+		if (!indices.empty() && indices.back() == it->second) ++lengths.back();
+		else
+		{
+			indices.push_back(it->second);
+			lengths.push_back(1);
+		}
+	}
+
+	CompressedChunkHeader header = {};
+	while ((1u << header.IndexBits) < palette.size()) ++header.IndexBits;
+	header.PaletteCount = static_cast<uint32_t>(palette.size());
+	header.RunCount = static_cast<uint32_t>(indices.size());
+
+	std::vector<uint8_t> payload = {};
+	payload.reserve(palette.size() * sizeof(uint32_t) + indices.size() * 3);
+
+	payload.resize(palette.size() * sizeof(uint32_t));
+	memcpy(payload.data(), palette.data(), payload.size());
+
+	uint64_t bits = 0;
+	uint32_t count = 0;
+	for (auto index : indices)
+	{
+		bits |= static_cast<uint64_t>(index) << count;
+		count += header.IndexBits;
+		while (count >= 8)
+		{
+			payload.push_back(static_cast<uint8_t>(bits));
+			bits >>= 8;
+			count -= 8;
+		}
+	}
+	if (count > 0) payload.push_back(static_cast<uint8_t>(bits));
+
+	for (auto length : lengths) writeVarint(payload, length);
+
+	header.PayloadSize = static_cast<uint32_t>(payload.size());
+
+	// Only keep the deflated form when it actually wins, tiny palettes often don't
+	if (deflate)
+	{
+		auto bound = compressBound(static_cast<uLong>(payload.size()));
+		m_data.resize(c_compressed_chunk_header_size + bound);
+
+		auto packed = static_cast<uLongf>(bound);
+		if (compress2(m_data.data() + c_compressed_chunk_header_size, &packed, payload.data(), static_cast<uLong>(payload.size()), level) == Z_OK && packed < payload.size())
+		{
+			header.Flags |= c_compressed_chunk_deflated;
+			m_data.resize(c_compressed_chunk_header_size + packed);
+			memcpy(m_data.data(), &header, c_compressed_chunk_header_size);
+			m_data.shrink_to_fit();
+			return;
+		}
+	}
+
+	m_data.resize(c_compressed_chunk_header_size + payload.size());
+	memcpy(m_data.data(), &header, c_compressed_chunk_header_size);
+	memcpy(m_data.data() + c_compressed_chunk_header_size, payload.data(), payload.size());
+	m_data.shrink_to_fit();
+}
+
+void ClayEngine::CompressedVoxelChunk::SetData(const uint8_t* data, size_t size)
+{
+	m_data.assign(data, data + size);
+}
+
+bool ClayEngine::CompressedVoxelChunk::IsDeflated() const
+{
+	return m_data.size() >= c_compressed_chunk_header_size && (m_data[1] & c_compressed_chunk_deflated);
+}
+
+uint32_t ClayEngine::CompressedVoxelChunk::GetPaletteCount() const
+{
+	if (m_data.size() < c_compressed_chunk_header_size) return 0;
+
+	CompressedChunkHeader header = {};
+	memcpy(&header, m_data.data(), c_compressed_chunk_header_size);
+	return header.PaletteCount;
+}
+#pragma endregion
+
+#pragma region Voxel Chunk Decoder Implementation
+voidpf ClayEngine::VoxelChunkDecoder::arenaAlloc(voidpf opaque, uInt items, uInt size)
+{
+	auto decoder = static_cast<VoxelChunkDecoder*>(opaque);
+
+	auto bytes = (static_cast<size_t>(items) * size + 15) & ~size_t(15);
+	if (decoder->m_arena_used + bytes > c_inflate_arena_size) return Z_NULL;
+
+	auto p = decoder->m_arena + decoder->m_arena_used;
+	decoder->m_arena_used += bytes;
+	return p;
+}
+
+void ClayEngine::VoxelChunkDecoder::arenaFree(voidpf, voidpf)
+{
+	// inflateReset keeps its state and window, so the arena only ever grows to one stream's worth
+}
+
+ClayEngine::VoxelChunkDecoder::VoxelChunkDecoder()
+{
+	m_stream.zalloc = arenaAlloc;
+	m_stream.zfree = arenaFree;
+	m_stream.opaque = this;
+
+	if (inflateInit(&m_stream) != Z_OK) throw std::runtime_error("ClayEngine::VoxelChunkDecoder inflateInit() FAILED");
+	m_stream_ready = true;
+}
+
+ClayEngine::VoxelChunkDecoder::~VoxelChunkDecoder()
+{
+	if (m_stream_ready) inflateEnd(&m_stream);
+}
+
+bool ClayEngine::VoxelChunkDecoder::Decode(const uint8_t* data, size_t size, uint32_t* destination)
+{
+	if (!data || size < c_compressed_chunk_header_size) return false;
+
+	CompressedChunkHeader header = {};
+	memcpy(&header, data, c_compressed_chunk_header_size);
+
+	if (header.Version != c_compressed_chunk_version) return false;
+	if (header.PayloadSize > c_compressed_chunk_max_payload || header.IndexBits > 16) return false;
+	if (header.PaletteCount == 0 || header.PaletteCount > static_cast<uint32_t>(c_voxel_chunk_volume)) return false;
+
+	const uint8_t* payload = data + c_compressed_chunk_header_size;
+	if (header.Flags & c_compressed_chunk_deflated)
+	{
+		if (inflateReset(&m_stream) != Z_OK) return false;
+
+		m_stream.next_in = const_cast<Bytef*>(payload);
+		m_stream.avail_in = static_cast<uInt>(size - c_compressed_chunk_header_size);
+		m_stream.next_out = m_payload;
+		m_stream.avail_out = header.PayloadSize;
+
+		if (inflate(&m_stream, Z_FINISH) != Z_STREAM_END || m_stream.total_out != header.PayloadSize) return false;
+		payload = m_payload;
+	}
+	else if (size - c_compressed_chunk_header_size < header.PayloadSize)
+	{
+		return false;
+	}
+
+	const auto end = payload + header.PayloadSize;
+	const auto palette = payload;
+	const auto paletteBytes = static_cast<size_t>(header.PaletteCount) * sizeof(uint32_t);
+	const auto indexBytes = (static_cast<size_t>(header.RunCount) * header.IndexBits + 7) / 8;
+	if (paletteBytes + indexBytes > header.PayloadSize) return false;
+
+	BitReader indices = { palette + paletteBytes, palette + paletteBytes + indexBytes };
+	auto lengths = palette + paletteBytes + indexBytes;
+
+	uint32_t position = 0;
+	for (uint32_t run = 0; run < header.RunCount; ++run)
+	{
+		uint32_t index = 0, length = 0;
+		if (!indices.Read(header.IndexBits, index) || !readVarint(lengths, end, length)) return false;
+		if (index >= header.PaletteCount || length > c_voxel_chunk_volume - position) return false;
+
+		uint32_t value = 0;
+		memcpy(&value, palette + index * sizeof(uint32_t), sizeof(uint32_t));
+		std::fill_n(destination + position, length, value);
+		position += length;
+	}
+
+	return position == static_cast<uint32_t>(c_voxel_chunk_volume);
+}
+
+bool ClayEngine::VoxelChunkDecoder::Decode(const CompressedVoxelChunk& chunk, VoxelChunk& destination)
+{
+	return Decode(chunk.GetData(), chunk.GetSize(), destination.Voxels);
+}
+#pragma endregion
@@ -0,0 +1,107 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* Palette + RLE compressed voxel chunks with optional deflate stage          */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "zlib.h"
+
+#include "VoxelGrid.h"
+
+namespace ClayEngine
+{
+	constexpr uint8_t c_compressed_chunk_version{ 1 };
+	constexpr uint8_t c_compressed_chunk_deflated{ 0x01 };
+	constexpr auto c_compressed_chunk_header_size{ 16u };
+
+	// Largest payload a chunk can produce: a full palette, every run one voxel long (15 bit indices, 3 byte varints)
+	constexpr auto c_compressed_chunk_max_payload{ c_voxel_chunk_volume * 4u + c_voxel_chunk_volume * 2u + c_voxel_chunk_volume * 3u };
+	// Inflate keeps about 7KiB of state plus a 32KiB window, this is carved out of the decoder instead of the heap
+	constexpr auto c_inflate_arena_size{ 64u * 1024u };
+
+	/// <summary>
+	/// Fixed 16 byte header in front of every compressed chunk, the payload that follows is
+	/// palette words, bit-packed run indices, then varint run lengths, optionally deflated
+	/// </summary>
+	struct CompressedChunkHeader
+	{
+		uint8_t Version = c_compressed_chunk_version;
+		uint8_t Flags = 0;
+		uint8_t IndexBits = 0;
+		uint8_t Reserved = 0;
+		uint32_t PaletteCount = 0;
+		uint32_t RunCount = 0;
+		uint32_t PayloadSize = 0; // Size of the payload before deflate
+	};
+	static_assert(sizeof(CompressedChunkHeader) == c_compressed_chunk_header_size, "CompressedChunkHeader must stay 16 bytes, it is written to disk as-is");
+
+	/// <summary>
+	/// A VoxelChunk reduced to a palette of its distinct packed words and runs of palette indices
+	/// along the Morton curve (the chunk's storage order). Chunks of a few materials shrink from
+	/// 128KiB to a few hundred bytes before deflate is even considered.
+	/// </summary>
+	class CompressedVoxelChunk
+	{
+		std::vector<uint8_t> m_data = {};
+
+	public:
+		CompressedVoxelChunk() = default;
+		CompressedVoxelChunk(const VoxelChunk& chunk, bool deflate = false, int level = Z_BEST_SPEED);
+		~CompressedVoxelChunk() = default;
+
+		/// <summary>
+		/// Compresses c_voxel_chunk_volume Morton ordered words
+		/// </summary>
+		void Compress(const uint32_t* voxels, bool deflate = false, int level = Z_BEST_SPEED);
+		/// <summary>
+		/// Adopts an already compressed blob, e.g. one read back from disk
+		/// </summary>
+		void SetData(const uint8_t* data, size_t size);
+
+		const uint8_t* GetData() const { return m_data.data(); }
+		size_t GetSize() const { return m_data.size(); }
+		bool IsEmpty() const { return m_data.empty(); }
+		bool IsDeflated() const;
+		uint32_t GetPaletteCount() const;
+	};
+	using CompressedVoxelChunkPtr = std::unique_ptr<CompressedVoxelChunk>;
+
+	/// <summary>
+	/// Expands compressed chunks into caller owned memory. All scratch space, including zlib's inflate
+	/// state, lives inside the decoder so Decode never touches the heap. It is ~360KiB, so make one per
+	/// worker thread with std::make_unique and reuse it.
+	/// </summary>
+	class VoxelChunkDecoder
+	{
+		z_stream m_stream = {};
+		bool m_stream_ready = false;
+
+		size_t m_arena_used = 0;
+		alignas(16) uint8_t m_arena[c_inflate_arena_size];
+		uint8_t m_payload[c_compressed_chunk_max_payload];
+
+		static voidpf arenaAlloc(voidpf opaque, uInt items, uInt size);
+		static void arenaFree(voidpf opaque, voidpf address);
+
+	public:
+		VoxelChunkDecoder();
+		~VoxelChunkDecoder();
+
+		VoxelChunkDecoder(const VoxelChunkDecoder&) = delete;
+		VoxelChunkDecoder& operator=(const VoxelChunkDecoder&) = delete;
+
+		/// <summary>
+		/// Writes c_voxel_chunk_volume Morton ordered words to destination, returns false if the data is corrupt
+		/// </summary>
+		bool Decode(const uint8_t* data, size_t size, uint32_t* destination);
+		bool Decode(const CompressedVoxelChunk& chunk, VoxelChunk& destination);
+	};
+	using VoxelChunkDecoderPtr = std::unique_ptr<VoxelChunkDecoder>;
+}
@@ -0,0 +1,394 @@
+#include "pch.h"
+#include "VoxelEditOverlay.h"
+
+using namespace ClayEngine;
+
+#pragma region Brick and Cell Implementation
+bool ClayEngine::VoxelEditBrick::IsEmpty() const
+{
+	for (auto word : Mask) if (word) return false;
+	return true;
+}
+
+size_t ClayEngine::VoxelEditBrick::GetCount() const
+{
+	size_t count = 0;
+	for (auto word : Mask) for (; word; word &= word - 1) ++count;
+	return count;
+}
+
+bool ClayEngine::VoxelEditCell::IsEmpty() const
+{
+	for (auto& brick : Bricks) if (brick) return false;
+	return true;
+}
+#pragma endregion
+
+#pragma region Edit Overlay Implementation
+template<typename Function>
+void ClayEngine::VoxelEditOverlay::forEachBrick(const VoxelBox& box, Function function)
+{
+	if (box.IsEmpty()) return;
+
+	// Walk the box a brick at a time, function gets the cell, the brick within it and the part of box inside the brick
+	for (auto bz = box.Min.Z >> c_edit_brick_bits; bz <= (box.Max.Z - 1) >> c_edit_brick_bits; ++bz)
+	for (auto by = box.Min.Y >> c_edit_brick_bits; by <= (box.Max.Y - 1) >> c_edit_brick_bits; ++by)
+	for (auto bx = box.Min.X >> c_edit_brick_bits; bx <= (box.Max.X - 1) >> c_edit_brick_bits; ++bx)
+	{
+		auto x = bx * c_edit_brick_size;
+		auto y = by * c_edit_brick_size;
+		auto z = bz * c_edit_brick_size;
+
+		VoxelBox clip = {
+			{ std::max(box.Min.X, x), std::max(box.Min.Y, y), std::max(box.Min.Z, z) },
+			{ std::min(box.Max.X, x + c_edit_brick_size), std::min(box.Max.Y, y + c_edit_brick_size), std::min(box.Max.Z, z + c_edit_brick_size) }
+		};
+
+		auto key = VoxelGrid::MakeChunkKey(x >> c_voxel_chunk_bits, y >> c_voxel_chunk_bits, z >> c_voxel_chunk_bits);
+		function(key, VoxelEditCell::Index(x, y, z), clip);
+	}
+}
+
+ClayEngine::VoxelEditCell& ClayEngine::VoxelEditOverlay::openCell(ChunkKey key)
+{
+	auto it = m_open_cells.find(key);
+	if (it != m_open_cells.end()) return *it->second.second;
+
+	// First touch in this edit, copy the 64 brick pointers and keep the old cell for the journal
+	VoxelEditCellPtr before = nullptr;
+	auto found = m_cells.find(key);
+	if (found != m_cells.end()) before = found->second;
+
+	auto cell = before ? std::make_shared<VoxelEditCell>(*before) : std::make_shared<VoxelEditCell>();
+	m_open_cells.emplace(key, std::make_pair(before, cell));
+	m_cells[key] = cell;
+	m_dirty.insert(key);
+	return *cell;
+}
+
+ClayEngine::VoxelEditBrick& ClayEngine::VoxelEditOverlay::openBrick(VoxelEditCell& cell, size_t brick)
+{
+	auto& slot = cell.Bricks[brick];
+	if (slot)
+	{
+		auto it = m_open_bricks.find(slot.get());
+		if (it != m_open_bricks.end()) return *it->second;
+	}
+
+	auto copy = slot ? std::make_shared<VoxelEditBrick>(*slot) : std::make_shared<VoxelEditBrick>();
+	m_open_bricks.emplace(copy.get(), copy);
+	slot = copy;
+	return *copy;
+}
+
+void ClayEngine::VoxelEditOverlay::closeEdit()
+{
+	JournalEntry entry = {};
+	entry.reserve(m_open_cells.size());
+
+	for (auto& element : m_open_cells)
+	{
+		auto& before = element.second.first;
+		auto& cell = element.second.second;
+
+		VoxelEditCellPtr after = cell;
+		if (cell->IsEmpty())
+		{
+			m_cells.erase(element.first);
+			after = nullptr;
+		}
+
+		if (before || after) entry.push_back({ element.first, before, after });
+	}
+
+	m_open_cells.clear();
+	m_open_bricks.clear();
+
+	if (entry.empty()) return;
+
+	m_undo.push_back(std::move(entry));
+	while (m_undo.size() > c_edit_journal_limit) m_undo.pop_front();
+	m_redo.clear();
+}
+
+void ClayEngine::VoxelEditOverlay::abortEdit() noexcept
+{
+	// Put back the cells the edit replaced, openCell left every key it touched in m_cells
+	for (auto& element : m_open_cells)
+	{
+		auto found = m_cells.find(element.first);
+		if (found == m_cells.end()) continue;
+		if (element.second.first) found->second = element.second.first;
+		else m_cells.erase(found);
+	}
+
+	m_open_cells.clear();
+	m_open_bricks.clear();
+}
+
+void ClayEngine::VoxelEditOverlay::restore(const JournalEntry& entry, bool after)
+{
+	for (auto& record : entry)
+	{
+		auto& cell = after ? record.After : record.Before;
+		if (cell) m_cells[record.Key] = cell;
+		else m_cells.erase(record.Key);
+		m_dirty.insert(record.Key);
+	}
+}
+
+void ClayEngine::VoxelEditOverlay::applyCell(const VoxelEditCell& cell, VoxelChunk& chunk)
+{
+	for (size_t b = 0; b < cell.Bricks.size(); ++b)
+	{
+		auto& brick = cell.Bricks[b];
+		if (!brick) continue;
+
+		auto bx = static_cast<int>(b % c_edit_bricks_per_axis) * c_edit_brick_size;
+		auto by = static_cast<int>(b / c_edit_bricks_per_axis % c_edit_bricks_per_axis) * c_edit_brick_size;
+		auto bz = static_cast<int>(b / (c_edit_bricks_per_axis * c_edit_bricks_per_axis)) * c_edit_brick_size;
+
+		// One mask word covers 8 rows of the brick, skip the words with no edits
+		for (size_t w = 0; w < c_edit_brick_volume / 64; ++w)
+		{
+			auto word = brick->Mask[w];
+			if (!word) continue;
+
+			for (size_t bit = 0; bit < 64; ++bit)
+			{
+				if (!((word >> bit) & 1)) continue;
+
+				auto i = w * 64 + bit;
+				auto x = static_cast<int>(i & c_edit_brick_mask);
+				auto y = static_cast<int>((i >> c_edit_brick_bits) & c_edit_brick_mask);
+				auto z = static_cast<int>(i >> (2 * c_edit_brick_bits));
+				chunk.Set(bx + x, by + y, bz + z, brick->Values[i]);
+			}
+		}
+	}
+}
+
+void ClayEngine::VoxelEditOverlay::BeginEdit()
+{
+	std::unique_lock lock(m_mutex);
+	++m_depth;
+}
+
+void ClayEngine::VoxelEditOverlay::EndEdit()
+{
+	std::unique_lock lock(m_mutex);
+	if (m_depth == 0) throw std::runtime_error("ClayEngine::VoxelEditOverlay::EndEdit without BeginEdit");
+	if (--m_depth == 0) closeEdit();
+}
+
+void ClayEngine::VoxelEditOverlay::AbortEdit()
+{
+	std::unique_lock lock(m_mutex);
+	if (m_depth == 0) throw std::runtime_error("ClayEngine::VoxelEditOverlay::AbortEdit without BeginEdit");
+	if (--m_depth == 0) abortEdit();
+}
+
+void ClayEngine::VoxelEditOverlay::SetVoxel(int x, int y, int z, uint32_t value)
+{
+	FillBox({ { x, y, z }, { x + 1, y + 1, z + 1 } }, value);
+}
+
+void ClayEngine::VoxelEditOverlay::FillBox(const VoxelBox& box, uint32_t value)
+{
+	std::unique_lock lock(m_mutex);
+	EditScope edit(*this);
+
+	// Whole bricks all point at this one, it is never opened for writing so sharing it is safe
+	VoxelEditBrickPtr uniform = nullptr;
+
+	forEachBrick(box, [&](ChunkKey key, size_t b, const VoxelBox& clip) {
+		auto& cell = openCell(key);
+
+		if (clip.Volume() == c_edit_brick_volume)
+		{
+			if (!uniform)
+			{
+				auto brick = std::make_shared<VoxelEditBrick>();
+				std::fill(std::begin(brick->Mask), std::end(brick->Mask), ~0ull);
+				std::fill(std::begin(brick->Values), std::end(brick->Values), value);
+				uniform = std::move(brick);
+			}
+			cell.Bricks[b] = uniform;
+			return;
+		}
+
+		auto& brick = openBrick(cell, b);
+		for (auto z = clip.Min.Z; z < clip.Max.Z; ++z)
+			for (auto y = clip.Min.Y; y < clip.Max.Y; ++y)
+				for (auto x = clip.Min.X; x < clip.Max.X; ++x)
+					brick.Set(VoxelEditBrick::Index(x, y, z), value);
+	});
+
+	edit.Close();
+}
+
+void ClayEngine::VoxelEditOverlay::RevertBox(const VoxelBox& box)
+{
+	std::unique_lock lock(m_mutex);
+	EditScope edit(*this);
+
+	forEachBrick(box, [&](ChunkKey key, size_t b, const VoxelBox& clip) {
+		// Leave cells and bricks without edits alone, reverting them changes nothing
+		auto found = m_cells.find(key);
+		if (found == m_cells.end() || !found->second->Bricks[b]) return;
+
+		auto& cell = openCell(key);
+		if (clip.Volume() == c_edit_brick_volume)
+		{
+			cell.Bricks[b] = nullptr;
+			return;
+		}
+
+		auto& brick = openBrick(cell, b);
+		for (auto z = clip.Min.Z; z < clip.Max.Z; ++z)
+			for (auto y = clip.Min.Y; y < clip.Max.Y; ++y)
+				for (auto x = clip.Min.X; x < clip.Max.X; ++x)
+					brick.Clear(VoxelEditBrick::Index(x, y, z));
+
+		if (brick.IsEmpty()) cell.Bricks[b] = nullptr;
+	});
+
+	edit.Close();
+}
+
+void ClayEngine::VoxelEditOverlay::CopyFrom(const VoxelBox& box, const uint32_t* source, bool air)
+{
+	std::unique_lock lock(m_mutex);
+	EditScope edit(*this);
+
+	auto sx = static_cast<size_t>(box.SizeX());
+	auto sy = static_cast<size_t>(box.SizeY());
+
+	forEachBrick(box, [&](ChunkKey key, size_t b, const VoxelBox& clip) {
+		auto& cell = openCell(key);
+		auto& brick = openBrick(cell, b);
+		for (auto z = clip.Min.Z; z < clip.Max.Z; ++z)
+			for (auto y = clip.Min.Y; y < clip.Max.Y; ++y)
+			{
+				auto row = source + (static_cast<size_t>(z - box.Min.Z) * sy + (y - box.Min.Y)) * sx;
+				for (auto x = clip.Min.X; x < clip.Max.X; ++x)
+				{
+					auto value = row[x - box.Min.X];
+					if (air || value != c_voxel_empty) brick.Set(VoxelEditBrick::Index(x, y, z), value);
+				}
+			}
+
+		if (brick.IsEmpty()) cell.Bricks[b] = nullptr;
+	});
+
+	edit.Close();
+}
+
+bool ClayEngine::VoxelEditOverlay::Undo()
+{
+	std::unique_lock lock(m_mutex);
+	if (m_depth) throw std::runtime_error("ClayEngine::VoxelEditOverlay::Undo inside an open edit");
+	if (m_undo.empty()) return false;
+
+	restore(m_undo.back(), false);
+	m_redo.push_back(std::move(m_undo.back()));
+	m_undo.pop_back();
+	return true;
+}
+
+bool ClayEngine::VoxelEditOverlay::Redo()
+{
+	std::unique_lock lock(m_mutex);
+	if (m_depth) throw std::runtime_error("ClayEngine::VoxelEditOverlay::Redo inside an open edit");
+	if (m_redo.empty()) return false;
+
+	restore(m_redo.back(), true);
+	m_undo.push_back(std::move(m_redo.back()));
+	m_redo.pop_back();
+	return true;
+}
+
+bool ClayEngine::VoxelEditOverlay::CanUndo() const
+{
+	std::shared_lock lock(m_mutex);
+	return !m_undo.empty();
+}
+
+bool ClayEngine::VoxelEditOverlay::CanRedo() const
+{
+	std::shared_lock lock(m_mutex);
+	return !m_redo.empty();
+}
+
+void ClayEngine::VoxelEditOverlay::ClearHistory()
+{
+	std::unique_lock lock(m_mutex);
+	m_undo.clear();
+	m_redo.clear();
+}
+
+bool ClayEngine::VoxelEditOverlay::TryGetVoxel(int x, int y, int z, uint32_t& value) const
+{
+	std::shared_lock lock(m_mutex);
+
+	auto it = m_cells.find(VoxelGrid::MakeChunkKey(x >> c_voxel_chunk_bits, y >> c_voxel_chunk_bits, z >> c_voxel_chunk_bits));
+	if (it == m_cells.end()) return false;
+
+	auto& brick = it->second->Bricks[VoxelEditCell::Index(x, y, z)];
+	if (!brick) return false;
+
+	auto i = VoxelEditBrick::Index(x, y, z);
+	if (!brick->Has(i)) return false;
+
+	value = brick->Values[i];
+	return true;
+}
+
+void ClayEngine::VoxelEditOverlay::ApplyTo(int cx, int cy, int cz, VoxelChunk& chunk) const
+{
+	std::shared_lock lock(m_mutex);
+
+	auto it = m_cells.find(VoxelGrid::MakeChunkKey(cx, cy, cz));
+	if (it != m_cells.end()) applyCell(*it->second, chunk);
+}
+
+void ClayEngine::VoxelEditOverlay::ApplyTo(VoxelGrid& grid) const
+{
+	std::shared_lock lock(m_mutex);
+
+	for (auto& element : m_cells)
+	{
+		auto coord = VoxelGrid::GetChunkCoord(element.first);
+		auto chunk = grid.GetChunk(coord.X, coord.Y, coord.Z);
+		if (!chunk) chunk = grid.MakeChunk(coord.X, coord.Y, coord.Z);
+		applyCell(*element.second, *chunk);
+	}
+}
+
+void ClayEngine::VoxelEditOverlay::TakeDirtyCells(std::vector<VoxelCoord>& cells)
+{
+	std::unique_lock lock(m_mutex);
+
+	cells.reserve(cells.size() + m_dirty.size());
+	for (auto key : m_dirty) cells.push_back(VoxelGrid::GetChunkCoord(key));
+	m_dirty.clear();
+}
+
+size_t ClayEngine::VoxelEditOverlay::GetCellCount() const
+{
+	std::shared_lock lock(m_mutex);
+	return m_cells.size();
+}
+
+size_t ClayEngine::VoxelEditOverlay::GetUndoDepth() const
+{
+	std::shared_lock lock(m_mutex);
+	return m_undo.size();
+}
+
+size_t ClayEngine::VoxelEditOverlay::GetRedoDepth() const
+{
+	std::shared_lock lock(m_mutex);
+	return m_redo.size();
+}
+#pragma endregion
@@ -0,0 +1,191 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* Copy-on-write voxel edits over a procedural base, with undo/redo journal   */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "VoxelGrid.h"
+
+namespace ClayEngine
+{
+	constexpr auto c_edit_brick_bits{ 3 };
+	constexpr auto c_edit_brick_size{ 1 << c_edit_brick_bits }; // 8 voxels per edge
+	constexpr auto c_edit_brick_mask{ c_edit_brick_size - 1 };
+	constexpr auto c_edit_brick_volume{ c_edit_brick_size * c_edit_brick_size * c_edit_brick_size };
+	constexpr auto c_edit_bricks_per_axis{ c_voxel_chunk_size / c_edit_brick_size };
+	constexpr auto c_edit_bricks_per_cell{ c_edit_bricks_per_axis * c_edit_bricks_per_axis * c_edit_bricks_per_axis };
+	constexpr auto c_edit_journal_limit{ 256 }; // Undo steps kept, the oldest are forgotten
+
+	/// <summary>
+	/// Edited voxels of one 8^3 brick, Mask marks which of Values override the base. Bricks are never
+	/// changed once published, an edit copies the brick it touches and every other brick is shared
+	/// between the live overlay and the journal.
+	/// </summary>
+	struct VoxelEditBrick
+	{
+		uint64_t Mask[c_edit_brick_volume / 64] = {};
+		uint32_t Values[c_edit_brick_volume] = {};
+
+		static size_t Index(int x, int y, int z) { return (static_cast<size_t>(z & c_edit_brick_mask) * c_edit_brick_size + (y & c_edit_brick_mask)) * c_edit_brick_size + (x & c_edit_brick_mask); }
+
+		bool Has(size_t i) const { return (Mask[i >> 6] >> (i & 63)) & 1; }
+		void Set(size_t i, uint32_t value) { Mask[i >> 6] |= 1ull << (i & 63); Values[i] = value; }
+		void Clear(size_t i) { Mask[i >> 6] &= ~(1ull << (i & 63)); }
+		bool IsEmpty() const;
+		size_t GetCount() const;
+	};
+	using VoxelEditBrickPtr = std::shared_ptr<const VoxelEditBrick>;
+
+	/// <summary>
+	/// Edits of one cell (a VoxelGrid chunk), nullptr bricks are untouched
+	/// </summary>
+	struct VoxelEditCell
+	{
+		std::array<VoxelEditBrickPtr, c_edit_bricks_per_cell> Bricks = {};
+
+		static size_t Index(int x, int y, int z) { return ((static_cast<size_t>((z & c_voxel_chunk_mask) >> c_edit_brick_bits) * c_edit_bricks_per_axis) + ((y & c_voxel_chunk_mask) >> c_edit_brick_bits)) * c_edit_bricks_per_axis + ((x & c_voxel_chunk_mask) >> c_edit_brick_bits); }
+
+		bool IsEmpty() const;
+	};
+	using VoxelEditCellPtr = std::shared_ptr<const VoxelEditCell>;
+
+	/// <summary>
+	/// Sparse voxel edits layered over a base the overlay never writes to, usually procedural output
+	/// or a VoxelGrid loaded from disk. Edits are grouped between BeginEdit and EndEdit into one journal
+	/// entry that only holds the before and after pointers of the cells it touched, so an undo step
+	/// costs the bricks that changed rather than a copy of the cells. Box edits that cover whole bricks
+	/// share one uniform brick instead of writing voxels. Every cell an edit, undo or redo touches is
+	/// added to the dirty set for remeshing. Reads may run on other threads while edits are made.
+	/// </summary>
+	class VoxelEditOverlay
+	{
+		using ChunkKey = VoxelGrid::ChunkKey;
+		using CellMap = std::unordered_map<ChunkKey, VoxelEditCellPtr>;
+
+		struct JournalRecord
+		{
+			ChunkKey Key = 0;
+			VoxelEditCellPtr Before = nullptr;
+			VoxelEditCellPtr After = nullptr;
+		};
+		using JournalEntry = std::vector<JournalRecord>;
+
+		mutable std::shared_mutex m_mutex = {};
+		CellMap m_cells = {};
+		std::deque<JournalEntry> m_undo = {};
+		std::vector<JournalEntry> m_redo = {};
+		std::unordered_set<ChunkKey> m_dirty = {};
+
+		// State of the open edit, cells and bricks in here were copied by it and may be written in place
+		int m_depth = 0;
+		std::unordered_map<ChunkKey, std::pair<VoxelEditCellPtr, std::shared_ptr<VoxelEditCell>>> m_open_cells = {};
+		std::unordered_map<const VoxelEditBrick*, std::shared_ptr<VoxelEditBrick>> m_open_bricks = {}; // Owned here too so a freed address can't be mistaken for an open brick
+
+		/// <summary>
+		/// Holds the edit open for one box edit. Close ends it; leaving by an exception instead restores
+		/// the cells the edit had opened, so a throw never leaves the depth raised or half an edit applied.
+		/// </summary>
+		struct EditScope
+		{
+			VoxelEditOverlay& Overlay;
+			bool Closed = false;
+
+			EditScope(VoxelEditOverlay& overlay) : Overlay(overlay) { ++Overlay.m_depth; }
+			~EditScope() { if (!Closed && --Overlay.m_depth == 0) Overlay.abortEdit(); }
+
+			EditScope(const EditScope&) = delete;
+			EditScope& operator=(const EditScope&) = delete;
+
+			void Close() { Closed = true; if (--Overlay.m_depth == 0) Overlay.closeEdit(); }
+		};
+
+		VoxelEditCell& openCell(ChunkKey key);
+		VoxelEditBrick& openBrick(VoxelEditCell& cell, size_t brick);
+		void closeEdit();
+		void abortEdit() noexcept;
+		void restore(const JournalEntry& entry, bool after);
+		static void applyCell(const VoxelEditCell& cell, VoxelChunk& chunk);
+
+		template<typename Function>
+		static void forEachBrick(const VoxelBox& box, Function function);
+
+	public:
+		VoxelEditOverlay() = default;
+		~VoxelEditOverlay() = default;
+
+		VoxelEditOverlay(const VoxelEditOverlay&) = delete;
+		VoxelEditOverlay& operator=(const VoxelEditOverlay&) = delete;
+
+		/// <summary>
+		/// Groups the following edits into one undo step, calls nest and the outermost EndEdit commits.
+		/// Edits made outside a Begin/End pair are a step each.
+		/// </summary>
+		void BeginEdit();
+		void EndEdit();
+		/// <summary>
+		/// Closes a BeginEdit without committing. The outermost one puts back every cell the edit
+		/// changed and records no undo step, a nested one leaves that to the edit around it.
+		/// </summary>
+		void AbortEdit();
+
+		void SetVoxel(int x, int y, int z, uint32_t value);
+		/// <summary>
+		/// Sets every voxel in box, bricks the box covers completely share a single uniform brick
+		/// </summary>
+		void FillBox(const VoxelBox& box, uint32_t value);
+		/// <summary>
+		/// Drops the edits inside box so it reads from the base again
+		/// </summary>
+		void RevertBox(const VoxelBox& box);
+		/// <summary>
+		/// Writes a dense x-fastest array of box.Volume() words into box, as VoxelGrid::CopyFrom. With air
+		/// false the c_voxel_empty words are skipped and whatever was there shows through.
+		/// </summary>
+		void CopyFrom(const VoxelBox& box, const uint32_t* source, bool air = true);
+
+		bool Undo();
+		bool Redo();
+		bool CanUndo() const;
+		bool CanRedo() const;
+		/// <summary>
+		/// Forgets the undo and redo history, the edits themselves stay
+		/// </summary>
+		void ClearHistory();
+
+		/// <summary>
+		/// True with the edited value if x,y,z has been edited, false if it reads from the base
+		/// </summary>
+		bool TryGetVoxel(int x, int y, int z, uint32_t& value) const;
+		/// <summary>
+		/// Overwrites the edited voxels of cell cx,cy,cz in chunk, which holds the base values
+		/// </summary>
+		void ApplyTo(int cx, int cy, int cz, VoxelChunk& chunk) const;
+		/// <summary>
+		/// Writes every edit into grid
+		/// </summary>
+		void ApplyTo(VoxelGrid& grid) const;
+
+		/// <summary>
+		/// Moves the cells changed since the last call into cells, in no particular order
+		/// </summary>
+		void TakeDirtyCells(std::vector<VoxelCoord>& cells);
+
+		size_t GetCellCount() const;
+		size_t GetUndoDepth() const;
+		size_t GetRedoDepth() const;
+	};
+	using VoxelEditOverlayPtr = std::unique_ptr<VoxelEditOverlay>;
+}
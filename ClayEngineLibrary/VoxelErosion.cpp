@@ -0,0 +1,414 @@
+#include "pch.h"
+#include "VoxelErosion.h"
+#include "VoxelOctree.h"
+#include "Strings.h"
+#include "Benchmark.h"
+
+using namespace ClayEngine;
+
+namespace
+{
+	// Strides through a halo buffer, x-fastest with y pointing up
+	constexpr int c_stride_y = c_erosion_halo_size;
+	constexpr int c_stride_z = c_erosion_halo_size * c_erosion_halo_size;
+	constexpr int c_lateral[4] = { -1, 1, -c_stride_z, c_stride_z };
+
+	constexpr uint32_t c_bedrock_word{ c_erosion_bedrock };
+
+	constexpr int haloIndex(int x, int y, int z)
+	{
+		return (z + 1) * c_stride_z + (y + 1) * c_stride_y + (x + 1);
+	}
+
+	inline uint8_t stateOf(uint32_t w) { return static_cast<uint8_t>(w); }
+	inline int loadOf(uint32_t w) { return static_cast<int>((w >> 16) & 0xFF); }
+	inline int waterOf(uint32_t w) { return stateOf(w) == c_erosion_liquid ? static_cast<int>(w >> 24) : 0; }
+	inline bool isOpen(uint32_t w) { return stateOf(w) == c_erosion_air || stateOf(w) == c_erosion_liquid; }
+	inline bool isSupport(uint32_t w) { return stateOf(w) == c_erosion_solid || stateOf(w) == c_erosion_bedrock; }
+
+	/// <summary>
+	/// Water a liquid cell pours into the cell below it this tick
+	/// </summary>
+	int flowDown(const uint32_t* cell)
+	{
+		if (stateOf(*cell) != c_erosion_liquid || !isOpen(cell[-c_stride_y])) return 0;
+		return std::min(waterOf(*cell), c_erosion_water_max - waterOf(cell[-c_stride_y]));
+	}
+
+	/// <summary>
+	/// Water a liquid cell spreads into its neighbour at offset, from what is left after falling
+	/// </summary>
+	int flowSide(const uint32_t* cell, int offset)
+	{
+		if (stateOf(*cell) != c_erosion_liquid || !isOpen(cell[offset])) return 0;
+
+		auto remaining = waterOf(*cell) - flowDown(cell);
+		auto level = waterOf(cell[offset]);
+		return remaining > level ? (remaining - level) / c_erosion_spread_divisor : 0;
+	}
+
+	/// <summary>
+	/// Sediment that travels with flow, in proportion to the share of the cell's water that moved
+	/// </summary>
+	int carried(const uint32_t* cell, int flow)
+	{
+		return flow ? loadOf(*cell) * flow / waterOf(*cell) : 0;
+	}
+
+	uint32_t stepSolid(const uint32_t* cell)
+	{
+		auto solid = UnpackErosionCell(*cell);
+
+		auto wet = waterOf(cell[-1]) + waterOf(cell[1]) + waterOf(cell[-c_stride_y]) + waterOf(cell[c_stride_y]) + waterOf(cell[-c_stride_z]) + waterOf(cell[c_stride_z]);
+		auto load = static_cast<int>(solid.Load);
+		if (wet) load += ((wet >> c_erosion_absorb_shift) * (256 - solid.Hardness)) >> 8;
+		else if (load > 0) --load;
+
+		// Fully saturated, the solid now moves as if it were water
+		if (load >= 255) return PackErosionCell({ c_erosion_liquid, 0, 255, static_cast<uint8_t>(c_erosion_suspension_water) });
+
+		solid.Load = static_cast<uint8_t>(load);
+		return PackErosionCell(solid);
+	}
+
+	uint32_t stepOpen(const uint32_t* cell)
+	{
+		auto water = waterOf(*cell);
+		auto load = water ? loadOf(*cell) : 0;
+
+		auto out = flowDown(cell);
+		auto loadOut = carried(cell, out);
+		for (auto offset : c_lateral)
+		{
+			auto flow = flowSide(cell, offset);
+			out += flow;
+			loadOut += carried(cell, flow);
+		}
+
+		auto above = cell + c_stride_y;
+		auto in = flowDown(above);
+		auto loadIn = carried(above, in);
+		for (auto offset : c_lateral)
+		{
+			auto source = cell + offset;
+			auto flow = flowSide(source, -offset);
+			in += flow;
+			loadIn += carried(source, flow);
+		}
+
+		water = std::clamp(water - out + in, 0, c_erosion_water_max);
+		water = std::max(water - c_erosion_evaporation, 0);
+		load = std::clamp(load - loadOut + loadIn, 0, 255);
+
+		if (water > 0) return PackErosionCell({ c_erosion_liquid, 0, static_cast<uint8_t>(load), static_cast<uint8_t>(water) });
+
+		// Dried out, heavy suspensions settle where they have something to rest on
+		if (load >= c_erosion_deposit_load && isSupport(cell[-c_stride_y])) return PackErosionCell({ c_erosion_solid, c_erosion_deposit_hardness, 0, 0 });
+
+		return PackErosionCell({});
+	}
+
+	/// <summary>
+	/// Uniform blocks of air, bedrock or dry solid can't change, so a chunk whose whole halo is one of
+	/// those is copied forward instead of stepped
+	/// </summary>
+	bool isAtRest(uint32_t w)
+	{
+		return w == PackErosionCell({}) || stateOf(w) == c_erosion_bedrock || (stateOf(w) == c_erosion_solid && loadOf(w) == 0);
+	}
+}
+
+#pragma region Erosion Simulation Implementation
+ClayEngine::ErosionSimulation::ErosionSimulation(WorkerPoolRaw pool, const VoxelBox& chunks)
+	: m_pool(pool)
+	, m_chunks(chunks)
+{
+	if (!m_pool) throw std::runtime_error("ClayEngine::ErosionSimulation requires a WorkerPool");
+	if (m_chunks.IsEmpty()) throw std::runtime_error("ClayEngine::ErosionSimulation region is empty");
+
+	auto count = m_chunks.Volume();
+	m_front.reserve(count);
+	m_back.reserve(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		m_front.push_back(m_chunk_pool.MakeChunk());
+		m_back.push_back(m_chunk_pool.MakeChunk());
+	}
+
+	m_halos.resize(m_pool->GetThreadCount());
+	for (auto& halo : m_halos) halo.resize(c_erosion_halo_volume);
+}
+
+ClayEngine::ErosionSimulation::~ErosionSimulation()
+{
+	for (auto chunk : m_front) m_chunk_pool.FreeChunk(chunk);
+	for (auto chunk : m_back) m_chunk_pool.FreeChunk(chunk);
+}
+
+size_t ClayEngine::ErosionSimulation::getChunkIndex(int cx, int cy, int cz) const
+{
+	return (static_cast<size_t>(cz - m_chunks.Min.Z) * m_chunks.SizeY() + (cy - m_chunks.Min.Y)) * m_chunks.SizeX() + (cx - m_chunks.Min.X);
+}
+
+const ClayEngine::VoxelChunk* ClayEngine::ErosionSimulation::getFrontChunk(int cx, int cy, int cz) const
+{
+	if (!m_chunks.Contains(cx, cy, cz)) return nullptr;
+	return m_front[getChunkIndex(cx, cy, cz)];
+}
+
+void ClayEngine::ErosionSimulation::gatherHalo(size_t chunk, uint32_t* halo) const
+{
+	auto nx = static_cast<size_t>(m_chunks.SizeX());
+	auto ny = static_cast<size_t>(m_chunks.SizeY());
+	auto cx = m_chunks.Min.X + static_cast<int>(chunk % nx);
+	auto cy = m_chunks.Min.Y + static_cast<int>((chunk / nx) % ny);
+	auto cz = m_chunks.Min.Z + static_cast<int>(chunk / (nx * ny));
+
+	const VoxelChunk* neighbours[27] = {};
+	for (auto dz = -1; dz <= 1; ++dz)
+		for (auto dy = -1; dy <= 1; ++dy)
+			for (auto dx = -1; dx <= 1; ++dx)
+				neighbours[(dz + 1) * 9 + (dy + 1) * 3 + (dx + 1)] = getFrontChunk(cx + dx, cy + dy, cz + dz);
+
+	const auto self = m_front[chunk];
+	for (auto z = 0; z < c_voxel_chunk_size; ++z)
+		for (auto y = 0; y < c_voxel_chunk_size; ++y)
+			for (auto x = 0; x < c_voxel_chunk_size; ++x)
+				halo[haloIndex(x, y, z)] = self->Get(x, y, z);
+
+	// The one voxel shell comes from the 26 neighbours, space outside the region reads as bedrock
+	auto shell = [&](int x, int y, int z) {
+		auto dx = x < 0 ? -1 : (x >= c_voxel_chunk_size ? 1 : 0);
+		auto dy = y < 0 ? -1 : (y >= c_voxel_chunk_size ? 1 : 0);
+		auto dz = z < 0 ? -1 : (z >= c_voxel_chunk_size ? 1 : 0);
+		auto neighbour = neighbours[(dz + 1) * 9 + (dy + 1) * 3 + (dx + 1)];
+		halo[haloIndex(x, y, z)] = neighbour ? neighbour->Get(x & c_voxel_chunk_mask, y & c_voxel_chunk_mask, z & c_voxel_chunk_mask) : c_bedrock_word;
+	};
+
+	for (auto z = -1; z <= c_voxel_chunk_size; ++z)
+	{
+		for (auto y = -1; y <= c_voxel_chunk_size; ++y)
+		{
+			if (z < 0 || z == c_voxel_chunk_size || y < 0 || y == c_voxel_chunk_size)
+			{
+				for (auto x = -1; x <= c_voxel_chunk_size; ++x) shell(x, y, z);
+			}
+			else
+			{
+				shell(-1, y, z);
+				shell(c_voxel_chunk_size, y, z);
+			}
+		}
+	}
+}
+
+void ClayEngine::ErosionSimulation::stepChunk(size_t chunk, uint32_t* halo)
+{
+	gatherHalo(chunk, halo);
+
+	auto destination = m_back[chunk];
+	if (isAtRest(halo[0]) && std::all_of(halo + 1, halo + c_erosion_halo_volume, [&](uint32_t w) { return w == halo[0]; }))
+	{
+		destination->Fill(halo[0]);
+		++m_skipped;
+		return;
+	}
+
+	for (auto z = 0; z < c_voxel_chunk_size; ++z)
+	{
+		for (auto y = 0; y < c_voxel_chunk_size; ++y)
+		{
+			auto row = halo + haloIndex(0, y, z);
+			for (auto x = 0; x < c_voxel_chunk_size; ++x)
+			{
+				auto cell = row + x;
+				uint32_t next = *cell;
+				switch (stateOf(*cell))
+				{
+				case c_erosion_bedrock: break;
+				case c_erosion_solid: next = stepSolid(cell); break;
+				default: next = stepOpen(cell); break;
+				}
+				destination->Set(x, y, z, next);
+			}
+		}
+	}
+}
+
+void ClayEngine::ErosionSimulation::Load(const VoxelGrid& voxels, uint8_t hardness)
+{
+	auto solid = PackErosionCell({ c_erosion_solid, hardness, 0, 0 });
+
+	for (size_t i = 0; i < m_front.size(); ++i)
+	{
+		auto nx = static_cast<size_t>(m_chunks.SizeX());
+		auto ny = static_cast<size_t>(m_chunks.SizeY());
+		auto source = voxels.GetChunk(m_chunks.Min.X + static_cast<int>(i % nx), m_chunks.Min.Y + static_cast<int>((i / nx) % ny), m_chunks.Min.Z + static_cast<int>(i / (nx * ny)));
+
+		// Both are Morton ordered, so words map across one to one
+		auto destination = m_front[i];
+		if (!source)
+		{
+			destination->Fill(PackErosionCell({}));
+			continue;
+		}
+		for (auto m = 0; m < c_voxel_chunk_volume; ++m)
+		{
+			destination->Voxels[m] = IsVoxelEmpty(source->Voxels[m]) ? PackErosionCell({}) : solid;
+		}
+	}
+}
+
+void ClayEngine::ErosionSimulation::Store(VoxelGrid& voxels) const
+{
+	Voxel centre(.5f, .5f, .5f, 0);
+	const uint32_t deposit = centre;
+
+	for (size_t i = 0; i < m_front.size(); ++i)
+	{
+		auto nx = static_cast<size_t>(m_chunks.SizeX());
+		auto ny = static_cast<size_t>(m_chunks.SizeY());
+		auto cx = m_chunks.Min.X + static_cast<int>(i % nx);
+		auto cy = m_chunks.Min.Y + static_cast<int>((i / nx) % ny);
+		auto cz = m_chunks.Min.Z + static_cast<int>(i / (nx * ny));
+
+		auto source = m_front[i];
+		auto destination = voxels.GetChunk(cx, cy, cz);
+		for (auto m = 0; m < c_voxel_chunk_volume; ++m)
+		{
+			auto solid = isSupport(source->Voxels[m]);
+			auto was = destination && !IsVoxelEmpty(destination->Voxels[m]);
+			if (solid && !was)
+			{
+				if (!destination) destination = voxels.MakeChunk(cx, cy, cz);
+				destination->Voxels[m] = deposit;
+			}
+			else if (!solid && was)
+			{
+				destination->Voxels[m] = c_voxel_empty;
+			}
+		}
+	}
+}
+
+void ClayEngine::ErosionSimulation::AddWater(const VoxelBox& box, uint8_t water)
+{
+	auto minX = std::max(box.Min.X, m_chunks.Min.X * c_voxel_chunk_size);
+	auto minY = std::max(box.Min.Y, m_chunks.Min.Y * c_voxel_chunk_size);
+	auto minZ = std::max(box.Min.Z, m_chunks.Min.Z * c_voxel_chunk_size);
+	auto maxX = std::min(box.Max.X, m_chunks.Max.X * c_voxel_chunk_size);
+	auto maxY = std::min(box.Max.Y, m_chunks.Max.Y * c_voxel_chunk_size);
+	auto maxZ = std::min(box.Max.Z, m_chunks.Max.Z * c_voxel_chunk_size);
+
+	for (auto z = minZ; z < maxZ; ++z)
+		for (auto y = minY; y < maxY; ++y)
+			for (auto x = minX; x < maxX; ++x)
+			{
+				auto cell = GetCell(x, y, z);
+				if (cell.State != c_erosion_air && cell.State != c_erosion_liquid) continue;
+
+				if (cell.State == c_erosion_air) cell = {};
+				cell.State = c_erosion_liquid;
+				cell.Water = static_cast<uint8_t>(std::min(cell.Water + water, c_erosion_water_max));
+				SetCell(x, y, z, cell);
+			}
+}
+
+ClayEngine::ErosionCell ClayEngine::ErosionSimulation::GetCell(int x, int y, int z) const
+{
+	auto chunk = getFrontChunk(x >> c_voxel_chunk_bits, y >> c_voxel_chunk_bits, z >> c_voxel_chunk_bits);
+	if (!chunk) return UnpackErosionCell(c_bedrock_word);
+	return UnpackErosionCell(chunk->Get(x & c_voxel_chunk_mask, y & c_voxel_chunk_mask, z & c_voxel_chunk_mask));
+}
+
+void ClayEngine::ErosionSimulation::SetCell(int x, int y, int z, const ErosionCell& cell)
+{
+	auto cx = x >> c_voxel_chunk_bits;
+	auto cy = y >> c_voxel_chunk_bits;
+	auto cz = z >> c_voxel_chunk_bits;
+	if (!m_chunks.Contains(cx, cy, cz)) throw std::runtime_error("ClayEngine::ErosionSimulation::SetCell outside the simulated region");
+
+	m_front[getChunkIndex(cx, cy, cz)]->Set(x & c_voxel_chunk_mask, y & c_voxel_chunk_mask, z & c_voxel_chunk_mask, PackErosionCell(cell));
+}
+
+void ClayEngine::ErosionSimulation::Run(int ticks)
+{
+	for (auto tick = 0; tick < ticks; ++tick)
+	{
+		m_pool->ParallelFor(m_front.size(), [this](size_t chunk, size_t worker) { stepChunk(chunk, m_halos[worker].data()); });
+
+		std::swap(m_front, m_back);
+		++m_tick;
+	}
+}
+
+uint64_t ClayEngine::ErosionSimulation::GetChecksum() const
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (auto chunk : m_front)
+	{
+		for (auto w : chunk->Voxels)
+		{
+			hash = (hash ^ w) * 1099511628211ull;
+		}
+	}
+	return hash;
+}
+#pragma endregion
+
+ClayEngine::ErosionBenchmark ClayEngine::RunErosionBenchmark(int chunksPerAxis, int ticks)
+{
+	ErosionBenchmark result = {};
+	result.Ticks = ticks;
+
+	// Rolling hills filling roughly the lower half of the region with a layer of rain above the peaks
+	auto size = chunksPerAxis * c_voxel_chunk_size;
+	VoxelBox region = { { 0, 0, 0 }, { chunksPerAxis, chunksPerAxis, chunksPerAxis } };
+	Voxel rock(.5f, .5f, .5f, 0);
+	const uint32_t solid = rock;
+
+	VoxelGrid terrain;
+	auto peak = 0;
+	for (auto z = 0; z < size; ++z)
+	{
+		for (auto x = 0; x < size; ++x)
+		{
+			auto height = static_cast<int>(size * .4f + std::sin(x * .07f) * 8.f + std::cos(z * .05f) * 8.f + std::sin((x + z) * .13f) * 3.f);
+			height = std::clamp(height, 1, size - 8);
+			peak = std::max(peak, height);
+			terrain.Fill({ { x, 0, z }, { x + 1, height, z + 1 } }, solid);
+		}
+	}
+	VoxelBox rain = { { 0, peak + 1, 0 }, { size, peak + 5, size } };
+
+	auto run = [&](WorkerPoolRaw pool, double& rate) {
+		ErosionSimulation simulation(pool, region);
+		simulation.Load(terrain);
+		simulation.AddWater(rain, 200);
+
+		auto start = std::chrono::steady_clock::now();
+		simulation.Run(ticks);
+		rate = PerSecond(simulation.GetVoxelCount() * static_cast<size_t>(ticks), std::chrono::steady_clock::now() - start);
+
+		result.VoxelCount = simulation.GetVoxelCount();
+		return simulation.GetChecksum();
+	};
+
+	WorkerPool single(1);
+	auto expected = run(&single, result.SingleThreadUpdatesPerSecond);
+
+	WorkerPool pool;
+	result.ThreadCount = pool.GetThreadCount();
+	auto actual = run(&pool, result.UpdatesPerSecond);
+	result.Deterministic = expected == actual;
+
+	std::wstringstream wss;
+	wss << std::fixed << std::setprecision(1)
+		<< L"ErosionSimulation " << result.VoxelCount << L" voxels x " << ticks << L" ticks"
+		<< L" | 1 thread " << result.SingleThreadUpdatesPerSecond / 1e6
+		<< L" | " << result.ThreadCount << L" threads " << result.UpdatesPerSecond / 1e6 << L" Mupdates/sec"
+		<< L" | " << (result.Deterministic ? L"deterministic" : L"NOT deterministic");
+	WriteLine(wss.str());
+
+	return result;
+}
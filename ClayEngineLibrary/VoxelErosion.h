@@ -0,0 +1,148 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* Double buffered cellular automaton for water erosion of voxel solids       */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "VoxelGrid.h"
+#include "WorkerPool.h"
+
+namespace ClayEngine
+{
+	constexpr uint8_t c_erosion_air{ 0 };
+	constexpr uint8_t c_erosion_solid{ 1 };
+	constexpr uint8_t c_erosion_liquid{ 2 };
+	constexpr uint8_t c_erosion_bedrock{ 3 }; // Never changes, also what lies outside the simulated region
+
+	constexpr auto c_erosion_water_max{ 255 };
+	constexpr auto c_erosion_spread_divisor{ 5 }; // Lateral flow moves 1/5 of the level difference to each side
+	constexpr auto c_erosion_evaporation{ 1 }; // Water lost by every liquid cell per tick
+	constexpr auto c_erosion_absorb_shift{ 4 }; // Saturation gained per tick is (adjacent water >> 4) scaled by softness
+	constexpr auto c_erosion_suspension_water{ 64 }; // Water a saturated solid releases when it turns into a suspension
+	constexpr auto c_erosion_deposit_load{ 128 }; // Sediment a drying suspension needs to redeposit as a solid
+	constexpr uint8_t c_erosion_deposit_hardness{ 64 };
+	constexpr uint8_t c_erosion_default_hardness{ 128 };
+
+	constexpr auto c_erosion_halo_size{ c_voxel_chunk_size + 2 }; // A chunk plus one cell of each neighbour
+	constexpr auto c_erosion_halo_volume{ c_erosion_halo_size * c_erosion_halo_size * c_erosion_halo_size };
+
+	/// <summary>
+	/// Four byte erosion state of one voxel, stored in VoxelChunks the same way packed Voxels are.
+	/// Load is the erosion progress of a solid (saturation) and the sediment suspended in a liquid, so
+	/// a solid whose Load reaches 255 becomes a liquid carrying all of it and a liquid that dries out
+	/// with enough Load left settles back into a solid.
+	/// </summary>
+	struct ErosionCell
+	{
+		uint8_t State = c_erosion_air;
+		uint8_t Hardness = 0;
+		uint8_t Load = 0;
+		uint8_t Water = 0;
+	};
+
+	constexpr uint32_t PackErosionCell(const ErosionCell& cell)
+	{
+		return static_cast<uint32_t>(cell.State) | (static_cast<uint32_t>(cell.Hardness) << 8) | (static_cast<uint32_t>(cell.Load) << 16) | (static_cast<uint32_t>(cell.Water) << 24);
+	}
+
+	constexpr ErosionCell UnpackErosionCell(uint32_t packed)
+	{
+		return ErosionCell{ static_cast<uint8_t>(packed), static_cast<uint8_t>(packed >> 8), static_cast<uint8_t>(packed >> 16), static_cast<uint8_t>(packed >> 24) };
+	}
+
+	/// <summary>
+	/// Erosion over a box of chunks. Each tick reads only the front buffer and writes only the back
+	/// buffer, every chunk first gathers a one voxel halo from its neighbours and is then advanced
+	/// independently on the WorkerPool. Cells are a pure function of their 3x3x3 neighbourhood, so the
+	/// result after N ticks is identical whatever the thread count.
+	///
+	/// Per tick liquids fall into open cells below, spread a share of the level difference sideways,
+	/// carry their sediment proportionally and evaporate. Solids touching water gain saturation scaled
+	/// by their softness (255 - Hardness) and dry out slowly otherwise.
+	/// </summary>
+	class ErosionSimulation
+	{
+		WorkerPoolRaw m_pool = nullptr;
+		VoxelBox m_chunks = {};
+
+		VoxelChunkPool m_chunk_pool = {};
+		std::vector<VoxelChunkRaw> m_front = {};
+		std::vector<VoxelChunkRaw> m_back = {};
+		std::vector<std::vector<uint32_t>> m_halos = {}; // One gather buffer per pool thread
+
+		uint64_t m_tick = 0;
+		std::atomic<uint64_t> m_skipped = 0;
+
+		size_t getChunkIndex(int cx, int cy, int cz) const;
+		const VoxelChunk* getFrontChunk(int cx, int cy, int cz) const;
+		void gatherHalo(size_t chunk, uint32_t* halo) const;
+		void stepChunk(size_t chunk, uint32_t* halo);
+
+	public:
+		/// <summary>
+		/// chunks is the simulated region in chunk coordinates, everything outside it acts as bedrock
+		/// </summary>
+		ErosionSimulation(WorkerPoolRaw pool, const VoxelBox& chunks);
+		~ErosionSimulation();
+
+		ErosionSimulation(const ErosionSimulation&) = delete;
+		ErosionSimulation& operator=(const ErosionSimulation&) = delete;
+
+		/// <summary>
+		/// Seeds the region from voxels, non-empty voxels become solids of the given hardness
+		/// </summary>
+		void Load(const VoxelGrid& voxels, uint8_t hardness = c_erosion_default_hardness);
+		/// <summary>
+		/// Writes the result back, eroded solids become empty and deposits become solid voxels
+		/// </summary>
+		void Store(VoxelGrid& voxels) const;
+		/// <summary>
+		/// Adds water to every open cell in box (voxel coordinates), e.g. a rain layer
+		/// </summary>
+		void AddWater(const VoxelBox& box, uint8_t water);
+
+		ErosionCell GetCell(int x, int y, int z) const;
+		void SetCell(int x, int y, int z, const ErosionCell& cell);
+
+		/// <summary>
+		/// Advances the whole region by ticks steps
+		/// </summary>
+		void Run(int ticks);
+
+		uint64_t GetTick() const { return m_tick; }
+		size_t GetVoxelCount() const { return m_front.size() * c_voxel_chunk_volume; }
+		/// <summary>
+		/// Chunk steps skipped because the chunk and its halo were uniform and at rest
+		/// </summary>
+		uint64_t GetSkippedChunks() const { return m_skipped; }
+		/// <summary>
+		/// FNV-1a hash of the current state, equal hashes across runs confirm determinism
+		/// </summary>
+		uint64_t GetChecksum() const;
+	};
+	using ErosionSimulationPtr = std::unique_ptr<ErosionSimulation>;
+
+	struct ErosionBenchmark
+	{
+		size_t ThreadCount = 0;
+		size_t VoxelCount = 0;
+		int Ticks = 0;
+		double SingleThreadUpdatesPerSecond = 0.;
+		double UpdatesPerSecond = 0.;
+		bool Deterministic = false; // Single and multi threaded runs ended in the same state
+	};
+
+	/// <summary>
+	/// Erodes a generated terrain of chunksPerAxis^3 chunks for ticks steps on one thread and on every
+	/// hardware thread, and writes the voxel updates per second to the console
+	/// </summary>
+	ErosionBenchmark RunErosionBenchmark(int chunksPerAxis = 4, int ticks = 16);
+}
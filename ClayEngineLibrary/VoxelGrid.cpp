@@ -0,0 +1,441 @@
+#include "pch.h"
+#include "VoxelGrid.h"
+
+using namespace ClayEngine;
+
+namespace
+{
+	inline int chunkOf(int v) { return v >> c_voxel_chunk_bits; } // Arithmetic shift floors negative coordinates
+	inline int localOf(int v) { return v & c_voxel_chunk_mask; }
+
+	/// <summary>
+	/// Calls fn(chunk, clipped box in world coordinates) for every chunk overlapping box
+	/// </summary>
+	template<typename Fn>
+	void forEachChunk(const VoxelBox& box, Fn fn)
+	{
+		if (box.IsEmpty()) return;
+
+		for (auto cz = chunkOf(box.Min.Z); cz <= chunkOf(box.Max.Z - 1); ++cz)
+		for (auto cy = chunkOf(box.Min.Y); cy <= chunkOf(box.Max.Y - 1); ++cy)
+		for (auto cx = chunkOf(box.Min.X); cx <= chunkOf(box.Max.X - 1); ++cx)
+		{
+			VoxelBox clip = {};
+			clip.Min = { std::max(box.Min.X, cx * c_voxel_chunk_size), std::max(box.Min.Y, cy * c_voxel_chunk_size), std::max(box.Min.Z, cz * c_voxel_chunk_size) };
+			clip.Max = { std::min(box.Max.X, (cx + 1) * c_voxel_chunk_size), std::min(box.Max.Y, (cy + 1) * c_voxel_chunk_size), std::min(box.Max.Z, (cz + 1) * c_voxel_chunk_size) };
+			fn(VoxelCoord{ cx, cy, cz }, clip);
+		}
+	}
+
+	/// <summary>
+	/// Smallest Morton index above morton whose voxel lies in the box with corner indices low and high,
+	/// c_voxel_chunk_volume when there is none. This is BIGMIN from Tropf and Herzog: walk the bits from
+	/// the top and narrow the box to the half the next index has to come from. morton must be outside the box.
+	/// </summary>
+	uint32_t nextMortonInBox(uint32_t morton, uint32_t low, uint32_t high)
+	{
+		uint32_t next = c_voxel_chunk_volume;
+		for (auto bit = 3 * c_voxel_chunk_bits - 1; bit >= 0; --bit)
+		{
+			const auto mask = 1u << bit;
+
+			// This bit and the lower bits of the same axis
+			uint32_t axis = 0;
+			for (auto b = bit; b >= 0; b -= 3) axis |= 1u << b;
+
+			auto m = (morton & mask) != 0, l = (low & mask) != 0, h = (high & mask) != 0;
+			if (!m && !l && h)
+			{
+				// Either the upper half, from its low corner, or keep looking in the lower half
+				next = (low & ~axis) | mask;
+				high = (high & ~axis) | (axis & ~mask);
+			}
+			else if (!m && l) return low;
+			else if (m && !h) return next;
+			else if (m && !l) low = (low & ~axis) | mask;
+		}
+		return next;
+	}
+
+	inline size_t denseIndex(const VoxelBox& box, int x, int y, int z)
+	{
+		return (static_cast<size_t>(z - box.Min.Z) * box.SizeY() + static_cast<size_t>(y - box.Min.Y)) * box.SizeX() + static_cast<size_t>(x - box.Min.X);
+	}
+}
+
+#pragma region Voxel Chunk Implementation
+void ClayEngine::VoxelChunk::Fill(uint32_t value)
+{
+	std::fill_n(Voxels, c_voxel_chunk_volume, value);
+}
+
+bool ClayEngine::VoxelChunk::IsUniform() const
+{
+	auto first = Voxels[0];
+	return std::all_of(Voxels + 1, Voxels + c_voxel_chunk_volume, [first](uint32_t v) { return v == first; });
+}
+#pragma endregion
+
+#pragma region Voxel Chunk Pool Implementation
+void ClayEngine::VoxelChunkPool::addSlab()
+{
+	m_slabs.emplace_back(std::make_unique<VoxelChunk[]>(c_voxel_chunk_pool_slab));
+	auto slab = m_slabs.back().get();
+
+	m_free.reserve(m_free.size() + c_voxel_chunk_pool_slab);
+	for (auto i = c_voxel_chunk_pool_slab; i > 0; --i)
+	{
+		m_free.push_back(&slab[i - 1]);
+	}
+}
+
+ClayEngine::VoxelChunkRaw ClayEngine::VoxelChunkPool::MakeChunk(uint32_t value)
+{
+	VoxelChunkRaw chunk = nullptr;
+	{
+		std::lock_guard lock(m_mutex);
+
+		if (m_free.empty()) addSlab();
+		chunk = m_free.back();
+		m_free.pop_back();
+		++m_in_use;
+	}
+
+	chunk->Fill(value);
+	return chunk;
+}
+
+void ClayEngine::VoxelChunkPool::FreeChunk(VoxelChunkRaw chunk)
+{
+	if (!chunk) return;
+
+	std::lock_guard lock(m_mutex);
+	m_free.push_back(chunk);
+	--m_in_use;
+}
+
+size_t ClayEngine::VoxelChunkPool::GetChunksInUse()
+{
+	std::lock_guard lock(m_mutex);
+	return m_in_use;
+}
+
+size_t ClayEngine::VoxelChunkPool::GetChunksReserved()
+{
+	std::lock_guard lock(m_mutex);
+	return m_slabs.size() * c_voxel_chunk_pool_slab;
+}
+#pragma endregion
+
+#pragma region Voxel Grid Implementation
+ClayEngine::VoxelGrid::VoxelGrid(VoxelChunkPoolRaw pool)
+	: m_pool(pool)
+{
+	if (!m_pool)
+	{
+		m_owned_pool = std::make_unique<VoxelChunkPool>();
+		m_pool = m_owned_pool.get();
+	}
+}
+
+ClayEngine::VoxelGrid::~VoxelGrid()
+{
+	for (auto& element : m_chunks)
+	{
+		m_pool->FreeChunk(element.second);
+	}
+	m_chunks.clear();
+}
+
+ClayEngine::VoxelGrid::ChunkKey ClayEngine::VoxelGrid::MakeChunkKey(int cx, int cy, int cz)
+{
+	// 21 bits per axis covers +/- 2^20 chunks, 33 million voxels in each direction
+	return (static_cast<ChunkKey>(cx & 0x1FFFFF) << 42) | (static_cast<ChunkKey>(cy & 0x1FFFFF) << 21) | static_cast<ChunkKey>(cz & 0x1FFFFF);
+}
+
+ClayEngine::VoxelCoord ClayEngine::VoxelGrid::GetChunkCoord(ChunkKey key)
+{
+	auto extend = [](ChunkKey v) { return static_cast<int>(static_cast<int64_t>(v << 43) >> 43); };
+	return VoxelCoord{ extend(key >> 42), extend(key >> 21), extend(key) };
+}
+
+ClayEngine::VoxelChunkRaw ClayEngine::VoxelGrid::GetChunk(int cx, int cy, int cz) const
+{
+	auto it = m_chunks.find(MakeChunkKey(cx, cy, cz));
+	return it == m_chunks.end() ? nullptr : it->second;
+}
+
+ClayEngine::VoxelChunkRaw ClayEngine::VoxelGrid::MakeChunk(int cx, int cy, int cz, uint32_t value)
+{
+	auto& chunk = m_chunks[MakeChunkKey(cx, cy, cz)];
+	if (chunk) chunk->Fill(value);
+	else chunk = m_pool->MakeChunk(value);
+	return chunk;
+}
+
+void ClayEngine::VoxelGrid::FreeChunk(int cx, int cy, int cz)
+{
+	auto it = m_chunks.find(MakeChunkKey(cx, cy, cz));
+	if (it == m_chunks.end()) return;
+
+	m_pool->FreeChunk(it->second);
+	m_chunks.erase(it);
+}
+
+uint32_t ClayEngine::VoxelGrid::GetVoxel(int x, int y, int z) const
+{
+	auto chunk = GetChunk(chunkOf(x), chunkOf(y), chunkOf(z));
+	return chunk ? chunk->Get(localOf(x), localOf(y), localOf(z)) : c_voxel_empty;
+}
+
+void ClayEngine::VoxelGrid::SetVoxel(int x, int y, int z, uint32_t value)
+{
+	auto chunk = GetChunk(chunkOf(x), chunkOf(y), chunkOf(z));
+	if (!chunk)
+	{
+		if (value == c_voxel_empty) return;
+		chunk = MakeChunk(chunkOf(x), chunkOf(y), chunkOf(z));
+	}
+	chunk->Set(localOf(x), localOf(y), localOf(z), value);
+}
+
+void ClayEngine::VoxelGrid::Fill(const VoxelBox& box, uint32_t value)
+{
+	forEachChunk(box, [&](VoxelCoord c, const VoxelBox& clip)
+		{
+			if (clip.Volume() == static_cast<size_t>(c_voxel_chunk_volume))
+			{
+				if (value == c_voxel_empty) FreeChunk(c.X, c.Y, c.Z);
+				else MakeChunk(c.X, c.Y, c.Z, value);
+				return;
+			}
+
+			auto chunk = GetChunk(c.X, c.Y, c.Z);
+			if (!chunk)
+			{
+				if (value == c_voxel_empty) return;
+				chunk = MakeChunk(c.X, c.Y, c.Z);
+			}
+
+			for (auto z = clip.Min.Z; z < clip.Max.Z; ++z)
+			for (auto y = clip.Min.Y; y < clip.Max.Y; ++y)
+			for (auto x = clip.Min.X; x < clip.Max.X; ++x)
+			{
+				chunk->Set(localOf(x), localOf(y), localOf(z), value);
+			}
+		});
+}
+
+void ClayEngine::VoxelGrid::CopyTo(const VoxelBox& box, uint32_t* destination) const
+{
+	forEachChunk(box, [&](VoxelCoord c, const VoxelBox& clip)
+		{
+			auto chunk = GetChunk(c.X, c.Y, c.Z);
+
+			for (auto z = clip.Min.Z; z < clip.Max.Z; ++z)
+			for (auto y = clip.Min.Y; y < clip.Max.Y; ++y)
+			{
+				auto row = destination + denseIndex(box, clip.Min.X, y, z);
+				if (!chunk)
+				{
+					std::fill_n(row, clip.SizeX(), c_voxel_empty);
+					continue;
+				}
+
+				// Hoist the y and z bits out of the row, only x changes along it
+				auto yz = (c_morton_table[localOf(y)] << 1) | (c_morton_table[localOf(z)] << 2);
+				for (auto x = clip.Min.X; x < clip.Max.X; ++x)
+				{
+					*row++ = chunk->Voxels[yz | c_morton_table[localOf(x)]];
+				}
+			}
+		});
+}
+
+void ClayEngine::VoxelGrid::CopyFrom(const VoxelBox& box, const uint32_t* source)
+{
+	forEachChunk(box, [&](VoxelCoord c, const VoxelBox& clip)
+		{
+			auto chunk = GetChunk(c.X, c.Y, c.Z);
+
+			for (auto z = clip.Min.Z; z < clip.Max.Z; ++z)
+			for (auto y = clip.Min.Y; y < clip.Max.Y; ++y)
+			{
+				auto row = source + denseIndex(box, clip.Min.X, y, z);
+				if (!chunk)
+				{
+					// Don't allocate a chunk just to store air
+					if (std::all_of(row, row + clip.SizeX(), [](uint32_t v) { return v == c_voxel_empty; })) continue;
+					chunk = MakeChunk(c.X, c.Y, c.Z);
+				}
+
+				auto yz = (c_morton_table[localOf(y)] << 1) | (c_morton_table[localOf(z)] << 2);
+				for (auto x = clip.Min.X; x < clip.Max.X; ++x)
+				{
+					chunk->Voxels[yz | c_morton_table[localOf(x)]] = *row++;
+				}
+			}
+		});
+}
+
+void ClayEngine::VoxelGrid::CopyRegion(const VoxelGrid& source, const VoxelBox& box, VoxelCoord origin)
+{
+	// Staging through a dense buffer keeps both sides on their fast row paths and makes
+	// overlapping copies within the same grid safe
+	auto staging = source.Slice(box);
+
+	VoxelBox target = {};
+	target.Min = origin;
+	target.Max = { origin.X + box.SizeX(), origin.Y + box.SizeY(), origin.Z + box.SizeZ() };
+	CopyFrom(target, staging.data());
+}
+
+std::vector<uint32_t> ClayEngine::VoxelGrid::Slice(const VoxelBox& box) const
+{
+	std::vector<uint32_t> v(box.Volume());
+	CopyTo(box, v.data());
+	return v;
+}
+
+ClayEngine::VoxelGrid::Region ClayEngine::VoxelGrid::Iterate(const VoxelBox& box) const
+{
+	return Region(this, box);
+}
+#pragma endregion
+
+#pragma region Voxel Grid Cursor Implementation
+ClayEngine::VoxelGrid::Cursor::Cursor(const VoxelGrid* grid, VoxelCoord chunk, VoxelCoord local)
+	: m_grid(grid), m_local(local)
+{
+	SetChunk(chunk);
+}
+
+void ClayEngine::VoxelGrid::Cursor::SetChunk(VoxelCoord chunk)
+{
+	m_chunk = chunk;
+
+	auto i = 0;
+	for (auto dz = -1; dz <= 1; ++dz)
+	for (auto dy = -1; dy <= 1; ++dy)
+	for (auto dx = -1; dx <= 1; ++dx)
+	{
+		m_neighbours[i++] = m_grid->GetChunk(chunk.X + dx, chunk.Y + dy, chunk.Z + dz);
+	}
+}
+
+ClayEngine::VoxelCoord ClayEngine::VoxelGrid::Cursor::GetPosition() const
+{
+	return VoxelCoord{ m_chunk.X * c_voxel_chunk_size + m_local.X, m_chunk.Y * c_voxel_chunk_size + m_local.Y, m_chunk.Z * c_voxel_chunk_size + m_local.Z };
+}
+
+uint32_t ClayEngine::VoxelGrid::Cursor::GetValue() const
+{
+	auto chunk = m_neighbours[13];
+	return chunk ? chunk->Get(m_local.X, m_local.Y, m_local.Z) : c_voxel_empty;
+}
+
+uint32_t ClayEngine::VoxelGrid::Cursor::GetNeighbour(int dx, int dy, int dz) const
+{
+	auto x = m_local.X + dx;
+	auto y = m_local.Y + dy;
+	auto z = m_local.Z + dz;
+
+	auto chunk = m_neighbours[(chunkOf(x) + 1) + (chunkOf(y) + 1) * 3 + (chunkOf(z) + 1) * 9];
+	return chunk ? chunk->Get(localOf(x), localOf(y), localOf(z)) : c_voxel_empty;
+}
+#pragma endregion
+
+#pragma region Voxel Grid Region Implementation
+ClayEngine::VoxelGrid::Region::Region(const VoxelGrid* grid, const VoxelBox& box)
+	: m_grid(grid), m_box(box)
+{
+	if (m_box.IsEmpty()) return;
+
+	m_chunks.Min = { chunkOf(box.Min.X), chunkOf(box.Min.Y), chunkOf(box.Min.Z) };
+	m_chunks.Max = { chunkOf(box.Max.X - 1) + 1, chunkOf(box.Max.Y - 1) + 1, chunkOf(box.Max.Z - 1) + 1 };
+}
+
+ClayEngine::VoxelGrid::Region::Iterator::Iterator(const Region* region)
+	: m_region(region)
+{
+	if (m_region->m_box.IsEmpty()) return;
+
+	m_end = false;
+	m_chunk = m_region->m_chunks.Min;
+	m_cursor = Cursor(m_region->m_grid, m_chunk, VoxelCoord{});
+	clipChunk();
+
+	while (!seekInChunk())
+	{
+		if (!advanceChunk())
+		{
+			m_end = true;
+			return;
+		}
+	}
+}
+
+bool ClayEngine::VoxelGrid::Region::Iterator::advanceChunk()
+{
+	const auto& chunks = m_region->m_chunks;
+
+	if (++m_chunk.X == chunks.Max.X)
+	{
+		m_chunk.X = chunks.Min.X;
+		if (++m_chunk.Y == chunks.Max.Y)
+		{
+			m_chunk.Y = chunks.Min.Y;
+			if (++m_chunk.Z == chunks.Max.Z) return false;
+		}
+	}
+
+	m_cursor.SetChunk(m_chunk);
+	clipChunk();
+	return true;
+}
+
+void ClayEngine::VoxelGrid::Region::Iterator::clipChunk()
+{
+	const auto& box = m_region->m_box;
+	const auto bx = m_chunk.X * c_voxel_chunk_size;
+	const auto by = m_chunk.Y * c_voxel_chunk_size;
+	const auto bz = m_chunk.Z * c_voxel_chunk_size;
+
+	// Every chunk in m_chunks overlaps the box, so the clip is never empty
+	m_low = { std::max(box.Min.X - bx, 0), std::max(box.Min.Y - by, 0), std::max(box.Min.Z - bz, 0) };
+	m_high = { std::min(box.Max.X - bx, c_voxel_chunk_size) - 1, std::min(box.Max.Y - by, c_voxel_chunk_size) - 1, std::min(box.Max.Z - bz, c_voxel_chunk_size) - 1 };
+	m_morton_low = MortonIndex(m_low.X, m_low.Y, m_low.Z);
+	m_morton_high = MortonIndex(m_high.X, m_high.Y, m_high.Z);
+	m_morton = m_morton_low;
+}
+
+bool ClayEngine::VoxelGrid::Region::Iterator::seekInChunk()
+{
+	// Runs of indices inside the box are walked one by one, gaps are jumped over
+	while (m_morton <= m_morton_high)
+	{
+		VoxelCoord local = { static_cast<int>(MortonCompact(m_morton)), static_cast<int>(MortonCompact(m_morton >> 1)), static_cast<int>(MortonCompact(m_morton >> 2)) };
+		if (local.X >= m_low.X && local.X <= m_high.X && local.Y >= m_low.Y && local.Y <= m_high.Y && local.Z >= m_low.Z && local.Z <= m_high.Z)
+		{
+			m_cursor.SetLocal(local);
+			return true;
+		}
+		m_morton = nextMortonInBox(m_morton, m_morton_low, m_morton_high);
+	}
+	return false;
+}
+
+ClayEngine::VoxelGrid::Region::Iterator& ClayEngine::VoxelGrid::Region::Iterator::operator++()
+{
+	++m_morton;
+	while (!seekInChunk())
+	{
+		if (!advanceChunk())
+		{
+			m_end = true;
+			break;
+		}
+	}
+	return *this;
+}
+#pragma endregion
@@ -0,0 +1,279 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* Chunked voxel grid with Morton ordered chunks and a chunk pool             */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "Voxel.h"
+
+namespace ClayEngine
+{
+	constexpr auto c_voxel_chunk_bits{ 5 };
+	constexpr auto c_voxel_chunk_size{ 1 << c_voxel_chunk_bits }; // 32 voxels per edge
+	constexpr auto c_voxel_chunk_mask{ c_voxel_chunk_size - 1 };
+	constexpr auto c_voxel_chunk_volume{ c_voxel_chunk_size * c_voxel_chunk_size * c_voxel_chunk_size }; // 32768 words, 128KiB
+	constexpr auto c_voxel_chunk_pool_slab{ 64 }; // Chunks allocated per slab, 8MiB
+
+	constexpr uint32_t c_voxel_empty{ 0u }; // Value read back from space that has no chunk
+
+	/// <summary>
+	/// Spreads the five bits of a local chunk coordinate three bits apart, x takes bit 0, y bit 1, z bit 2
+	/// </summary>
+	constexpr uint32_t MortonSpread(uint32_t v)
+	{
+		v &= 0x1F;
+		v = (v | (v << 8)) & 0x100F;
+		v = (v | (v << 4)) & 0x10C3;
+		v = (v | (v << 2)) & 0x1249;
+		return v;
+	}
+
+	/// <summary>
+	/// Reverse of MortonSpread, gathers every third bit back into a five bit coordinate
+	/// </summary>
+	constexpr uint32_t MortonCompact(uint32_t v)
+	{
+		v &= 0x1249;
+		v = (v | (v >> 2)) & 0x10C3;
+		v = (v | (v >> 4)) & 0x100F;
+		v = (v | (v >> 8)) & 0x1F;
+		return v;
+	}
+
+	constexpr std::array<uint32_t, c_voxel_chunk_size> MakeMortonTable()
+	{
+		std::array<uint32_t, c_voxel_chunk_size> table = {};
+		for (auto i = 0; i < c_voxel_chunk_size; ++i) table[i] = MortonSpread(static_cast<uint32_t>(i));
+		return table;
+	}
+	constexpr auto c_morton_table = MakeMortonTable();
+
+	/// <summary>
+	/// Z-order index of a local voxel inside a chunk, neighbours in 3D stay close in memory
+	/// </summary>
+	constexpr uint32_t MortonIndex(int x, int y, int z)
+	{
+		return c_morton_table[x & c_voxel_chunk_mask] | (c_morton_table[y & c_voxel_chunk_mask] << 1) | (c_morton_table[z & c_voxel_chunk_mask] << 2);
+	}
+
+	struct VoxelCoord
+	{
+		int X = 0;
+		int Y = 0;
+		int Z = 0;
+	};
+
+	/// <summary>
+	/// Axis aligned box of voxels, Min is inclusive and Max is exclusive
+	/// </summary>
+	struct VoxelBox
+	{
+		VoxelCoord Min = {};
+		VoxelCoord Max = {};
+
+		int SizeX() const { return Max.X - Min.X; }
+		int SizeY() const { return Max.Y - Min.Y; }
+		int SizeZ() const { return Max.Z - Min.Z; }
+		size_t Volume() const { return IsEmpty() ? 0 : static_cast<size_t>(SizeX()) * SizeY() * SizeZ(); }
+		bool IsEmpty() const { return Max.X <= Min.X || Max.Y <= Min.Y || Max.Z <= Min.Z; }
+		bool Contains(int x, int y, int z) const { return x >= Min.X && x < Max.X && y >= Min.Y && y < Max.Y && z >= Min.Z && z < Max.Z; }
+	};
+
+	/// <summary>
+	/// A fixed 32^3 block of packed Voxel words stored in Morton order
+	/// </summary>
+	struct alignas(64) VoxelChunk
+	{
+		uint32_t Voxels[c_voxel_chunk_volume];
+
+		uint32_t Get(int x, int y, int z) const { return Voxels[MortonIndex(x, y, z)]; }
+		void Set(int x, int y, int z, uint32_t value) { Voxels[MortonIndex(x, y, z)] = value; }
+		void Fill(uint32_t value);
+		bool IsUniform() const;
+	};
+	using VoxelChunkRaw = VoxelChunk*;
+
+	/// <summary>
+	/// Hands out VoxelChunks from large slabs and keeps released chunks on a free list so that
+	/// streaming terrain in and out does not hit the heap for every 128KiB block.
+	/// </summary>
+	class VoxelChunkPool
+	{
+		using Slab = std::unique_ptr<VoxelChunk[]>;
+
+		std::mutex m_mutex = {};
+		std::vector<Slab> m_slabs = {};
+		std::vector<VoxelChunkRaw> m_free = {};
+		size_t m_in_use = 0;
+
+		void addSlab();
+
+	public:
+		VoxelChunkPool() = default;
+		~VoxelChunkPool() = default;
+
+		/// <summary>
+		/// Returns a chunk with every voxel set to value
+		/// </summary>
+		VoxelChunkRaw MakeChunk(uint32_t value = c_voxel_empty);
+		void FreeChunk(VoxelChunkRaw chunk);
+
+		size_t GetChunksInUse();
+		size_t GetChunksReserved();
+	};
+	using VoxelChunkPoolPtr = std::unique_ptr<VoxelChunkPool>;
+	using VoxelChunkPoolRaw = VoxelChunkPool*;
+
+	/// <summary>
+	/// Sparse world of VoxelChunks keyed by chunk coordinate. Reads from space without a chunk
+	/// return c_voxel_empty, writes create the chunk on demand.
+	/// </summary>
+	class VoxelGrid
+	{
+	public:
+		using ChunkKey = uint64_t;
+		using ChunkMap = std::unordered_map<ChunkKey, VoxelChunkRaw>;
+
+		class Cursor;
+		class Region;
+
+	private:
+		VoxelChunkPoolPtr m_owned_pool = nullptr;
+		VoxelChunkPoolRaw m_pool = nullptr;
+		ChunkMap m_chunks = {};
+
+	public:
+		/// <summary>
+		/// Grids may share a pool, pass nullptr to give this grid its own
+		/// </summary>
+		VoxelGrid(VoxelChunkPoolRaw pool = nullptr);
+		~VoxelGrid();
+
+		VoxelGrid(const VoxelGrid&) = delete;
+		VoxelGrid& operator=(const VoxelGrid&) = delete;
+
+		static ChunkKey MakeChunkKey(int cx, int cy, int cz);
+		static VoxelCoord GetChunkCoord(ChunkKey key);
+
+		VoxelChunkRaw GetChunk(int cx, int cy, int cz) const;
+		VoxelChunkRaw MakeChunk(int cx, int cy, int cz, uint32_t value = c_voxel_empty);
+		void FreeChunk(int cx, int cy, int cz);
+		const ChunkMap& GetChunks() const { return m_chunks; }
+
+		uint32_t GetVoxel(int x, int y, int z) const;
+		void SetVoxel(int x, int y, int z, uint32_t value);
+
+		/// <summary>
+		/// Sets every voxel in box to value, chunks completely covered are filled wholesale
+		/// </summary>
+		void Fill(const VoxelBox& box, uint32_t value);
+		/// <summary>
+		/// Writes box into destination as a dense x-fastest array of box.Volume() words
+		/// </summary>
+		void CopyTo(const VoxelBox& box, uint32_t* destination) const;
+		/// <summary>
+		/// Reads a dense x-fastest array of box.Volume() words into box
+		/// </summary>
+		void CopyFrom(const VoxelBox& box, const uint32_t* source);
+		/// <summary>
+		/// Copies box from source into this grid with its minimum corner at origin, source may be this grid
+		/// and the regions may overlap
+		/// </summary>
+		void CopyRegion(const VoxelGrid& source, const VoxelBox& box, VoxelCoord origin);
+		/// <summary>
+		/// Convenience wrapper over CopyTo that returns the slice as a new buffer
+		/// </summary>
+		std::vector<uint32_t> Slice(const VoxelBox& box) const;
+
+		/// <summary>
+		/// Iterable view of box, visited chunk by chunk in Morton order with cheap access to the 26 neighbours
+		/// </summary>
+		Region Iterate(const VoxelBox& box) const;
+	};
+	using VoxelGridPtr = std::unique_ptr<VoxelGrid>;
+	using VoxelGridRaw = VoxelGrid*;
+
+	/// <summary>
+	/// Position inside a VoxelGrid that keeps the surrounding 3x3x3 chunks resolved, so neighbour
+	/// lookups are a table lookup instead of a hash probe even across chunk borders.
+	/// </summary>
+	class VoxelGrid::Cursor
+	{
+		const VoxelGrid* m_grid = nullptr;
+		VoxelCoord m_chunk = {};
+		VoxelCoord m_local = {};
+		std::array<const VoxelChunk*, 27> m_neighbours = {};
+
+	public:
+		Cursor() = default;
+		Cursor(const VoxelGrid* grid, VoxelCoord chunk, VoxelCoord local);
+
+		void SetChunk(VoxelCoord chunk);
+		void SetLocal(VoxelCoord local) { m_local = local; }
+
+		VoxelCoord GetPosition() const;
+		const VoxelCoord& GetChunkCoord() const { return m_chunk; }
+		const VoxelCoord& GetLocalCoord() const { return m_local; }
+
+		uint32_t GetValue() const;
+		/// <summary>
+		/// Value of the voxel at offset dx,dy,dz, each in the range -32..32
+		/// </summary>
+		uint32_t GetNeighbour(int dx, int dy, int dz) const;
+	};
+
+	/// <summary>
+	/// Range returned by VoxelGrid::Iterate for use with range-for
+	/// </summary>
+	class VoxelGrid::Region
+	{
+		const VoxelGrid* m_grid = nullptr;
+		VoxelBox m_box = {};
+		VoxelBox m_chunks = {};
+
+	public:
+		class Iterator
+		{
+			const Region* m_region = nullptr;
+			Cursor m_cursor = {};
+			VoxelCoord m_chunk = {};
+			uint32_t m_morton = 0;
+			bool m_end = true;
+
+			// The box clipped to the current chunk, local and inclusive, and the Morton indices of its corners
+			VoxelCoord m_low = {};
+			VoxelCoord m_high = {};
+			uint32_t m_morton_low = 0;
+			uint32_t m_morton_high = 0;
+
+			void clipChunk();
+			bool advanceChunk();
+			bool seekInChunk();
+
+		public:
+			Iterator() = default;
+			Iterator(const Region* region);
+
+			const Cursor& operator*() const { return m_cursor; }
+			const Cursor* operator->() const { return &m_cursor; }
+			Iterator& operator++();
+			bool operator==(const Iterator& other) const { return m_end == other.m_end && (m_end || (m_morton == other.m_morton && m_chunk.X == other.m_chunk.X && m_chunk.Y == other.m_chunk.Y && m_chunk.Z == other.m_chunk.Z)); }
+			bool operator!=(const Iterator& other) const { return !(*this == other); }
+		};
+
+		Region(const VoxelGrid* grid, const VoxelBox& box);
+
+		Iterator begin() const { return Iterator(this); }
+		Iterator end() const { return Iterator(); }
+	};
+}
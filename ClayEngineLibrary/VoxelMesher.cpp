@@ -0,0 +1,635 @@
+#include "pch.h"
+#include "VoxelMesher.h"
+#include "VoxelOctree.h"
+#include "Strings.h"
+#include "Benchmark.h"
+
+#include <array>
+#include <cstring>
+#include <random>
+#include <unordered_map>
+
+using namespace ClayEngine;
+
+namespace
+{
+	constexpr int c_n = c_voxel_chunk_size;
+	constexpr int c_d = c_mesher_density_size;
+	constexpr int c_o = c_mesher_occupancy_size;
+
+	// Cube corners are numbered by their offset bits, x = 1, y = 2, z = 4
+	constexpr int c_edge_corners[12][2] = {
+		{ 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 }, // x
+		{ 0, 2 }, { 1, 3 }, { 4, 6 }, { 5, 7 }, // y
+		{ 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 }, // z
+	};
+	constexpr int c_edge_axis[12] = { 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2 };
+
+	constexpr int c_mc_max_centers{ 3 }; // Loops of four or more crossings, at most three fit on twelve edges
+
+	/// <summary>
+	/// Triangles for each of the 256 corner configurations, as triples of cube edges. Codes from 12 up
+	/// name the centre of a loop in Centers, a vertex made per cube from the loop's edge vertices.
+	/// </summary>
+	struct MarchingCubesTable
+	{
+		uint8_t Count[256] = {};
+		uint8_t Edges[256][36] = {};
+		uint8_t CenterCount[256] = {};
+		uint8_t Centers[256][c_mc_max_centers][13] = {}; // Loop length, then its edges
+	};
+
+	/// <summary>
+	/// True when the crossings on two cube edges lie on a common face, an edge lies on the two faces
+	/// across the axes it doesn't run along
+	/// </summary>
+	bool shareFace(int e0, int e1)
+	{
+		for (auto axis = 0; axis < 3; ++axis)
+		{
+			if (axis == c_edge_axis[e0] || axis == c_edge_axis[e1]) continue;
+			if (((c_edge_corners[e0][0] >> axis) & 1) == ((c_edge_corners[e1][0] >> axis) & 1)) return true;
+		}
+		return false;
+	}
+
+	/// <summary>
+	/// Derives the table instead of carrying the usual 4KiB literal. On every face the crossing edges are
+	/// joined into segments that cut off the inside corners (the choice only depends on the face, so the
+	/// two cubes sharing it always agree and the surface has no cracks), and the segments chain into
+	/// closed loops around the cube. A loop is fanned from a crossing whose diagonals all go through the
+	/// cube: a diagonal lying on a face could be drawn the same way by the cube on the other side and
+	/// leave the edge on three triangles. When no crossing qualifies the loop is fanned from its centre.
+	/// </summary>
+	MarchingCubesTable makeMarchingCubesTable()
+	{
+		MarchingCubesTable table = {};
+
+		int edgeOf[8][8] = {};
+		for (auto e = 0; e < 12; ++e)
+		{
+			edgeOf[c_edge_corners[e][0]][c_edge_corners[e][1]] = e;
+			edgeOf[c_edge_corners[e][1]][c_edge_corners[e][0]] = e;
+		}
+
+		for (auto config = 0; config < 256; ++config)
+		{
+			auto inside = [config](int corner) { return (config >> corner) & 1; };
+
+			int next[12] = {};
+			std::fill(std::begin(next), std::end(next), -1);
+
+			for (auto axis = 0; axis < 3; ++axis)
+			{
+				for (auto side = 0; side < 2; ++side)
+				{
+					// Corners counter-clockwise seen from outside the cube
+					auto b = (axis + 1) % 3, c = (axis + 2) % 3;
+					int corners[4] = { side << axis, (side << axis) | (1 << b), (side << axis) | (1 << b) | (1 << c), (side << axis) | (1 << c) };
+					if (!side) std::swap(corners[1], corners[3]);
+
+					for (auto k = 0; k < 4; ++k)
+					{
+						auto from = corners[k], to = corners[(k + 1) & 3];
+						if (!inside(from) || inside(to)) continue;
+
+						// Walk back to the nearest edge entering the inside, that segment cuts off corner 'from'
+						for (auto j = 1; j < 4; ++j)
+						{
+							auto m = (k - j + 4) & 3;
+							if (!inside(corners[m]) && inside(corners[(m + 1) & 3]))
+							{
+								next[edgeOf[from][to]] = edgeOf[corners[m]][corners[(m + 1) & 3]];
+								break;
+							}
+						}
+					}
+				}
+			}
+
+			auto emit = [&](int a, int b, int c) {
+				auto t = table.Count[config]++;
+				table.Edges[config][t * 3 + 0] = static_cast<uint8_t>(a);
+				table.Edges[config][t * 3 + 1] = static_cast<uint8_t>(b);
+				table.Edges[config][t * 3 + 2] = static_cast<uint8_t>(c);
+			};
+
+			bool used[12] = {};
+			for (auto start = 0; start < 12; ++start)
+			{
+				if (next[start] < 0 || used[start]) continue;
+
+				int loop[12] = {};
+				auto length = 0;
+				for (auto e = start; !used[e]; e = next[e])
+				{
+					used[e] = true;
+					loop[length++] = e;
+				}
+
+				auto apex = -1;
+				for (auto k = 0; k < length && apex < 0; ++k)
+				{
+					auto inner = true;
+					for (auto j = 2; j + 1 < length && inner; ++j) inner = !shareFace(loop[k], loop[(k + j) % length]);
+					if (inner) apex = k;
+				}
+
+				if (apex >= 0)
+				{
+					for (auto i = 1; i + 1 < length; ++i) emit(loop[apex], loop[(apex + i + 1) % length], loop[(apex + i) % length]);
+				}
+				else
+				{
+					auto center = table.CenterCount[config]++;
+					auto& entry = table.Centers[config][center];
+					entry[0] = static_cast<uint8_t>(length);
+					for (auto i = 0; i < length; ++i) entry[1 + i] = static_cast<uint8_t>(loop[i]);
+
+					for (auto i = 0; i < length; ++i) emit(12 + center, loop[(i + 1) % length], loop[i]);
+				}
+			}
+		}
+
+		return table;
+	}
+
+	const MarchingCubesTable& getMarchingCubesTable()
+	{
+		static const MarchingCubesTable table = makeMarchingCubesTable();
+		return table;
+	}
+
+	constexpr size_t densityIndex(int x, int y, int z)
+	{
+		return (static_cast<size_t>(z + 2) * c_d + (y + 2)) * c_d + (x + 2);
+	}
+
+	void normalise(float (&v)[3])
+	{
+		auto length = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+		if (length <= 1e-12f) { v[0] = 0.f; v[1] = 1.f; v[2] = 0.f; return; }
+		v[0] /= length; v[1] /= length; v[2] /= length;
+	}
+
+	/// <summary>
+	/// Planar mapping along the dominant axis of the normal
+	/// </summary>
+	void setTextureCoordinate(VoxelMeshVertex& vertex)
+	{
+		auto ax = std::abs(vertex.Normal[0]), ay = std::abs(vertex.Normal[1]), az = std::abs(vertex.Normal[2]);
+		auto u = 0, v = 2;
+		if (ax >= ay && ax >= az) { u = 2; v = 1; }
+		else if (az >= ay) { u = 0; v = 1; }
+		vertex.TextureCoordinate[0] = vertex.Position[u] * c_mesher_texture_scale;
+		vertex.TextureCoordinate[1] = vertex.Position[v] * c_mesher_texture_scale;
+	}
+
+	/// <summary>
+	/// Least squares vertex for the planes (point, normal) crossing a cell, solved around the mass point
+	/// with a truncated pseudo-inverse so flat and edge-like cells stay stable
+	/// </summary>
+	struct QefSolver
+	{
+		float Ata[3][3] = {};
+		float Atb[3] = {};
+		float Mass[3] = {};
+		int Count = 0;
+
+		void Add(const float (&p)[3], const float (&n)[3])
+		{
+			auto d = n[0] * p[0] + n[1] * p[1] + n[2] * p[2];
+			for (auto i = 0; i < 3; ++i)
+			{
+				for (auto j = 0; j < 3; ++j) Ata[i][j] += n[i] * n[j];
+				Atb[i] += n[i] * d;
+				Mass[i] += p[i];
+			}
+			++Count;
+		}
+
+		void Solve(float (&x)[3]) const
+		{
+			float m[3] = { Mass[0] / Count, Mass[1] / Count, Mass[2] / Count };
+			float r[3] = {};
+			for (auto i = 0; i < 3; ++i) r[i] = Atb[i] - (Ata[i][0] * m[0] + Ata[i][1] * m[1] + Ata[i][2] * m[2]);
+
+			// Jacobi eigen decomposition of the symmetric 3x3 normal matrix
+			float a[3][3] = {}, v[3][3] = { { 1.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, { 0.f, 0.f, 1.f } };
+			memcpy(a, Ata, sizeof(a));
+			for (auto sweep = 0; sweep < 8; ++sweep)
+			{
+				for (auto p = 0; p < 2; ++p)
+				{
+					for (auto q = p + 1; q < 3; ++q)
+					{
+						if (std::abs(a[p][q]) < 1e-9f) continue;
+
+						auto theta = (a[q][q] - a[p][p]) / (2.f * a[p][q]);
+						auto t = (theta >= 0.f ? 1.f : -1.f) / (std::abs(theta) + std::sqrt(theta * theta + 1.f));
+						auto c = 1.f / std::sqrt(t * t + 1.f), s = t * c;
+
+						float rot[3][3] = { { 1.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, { 0.f, 0.f, 1.f } };
+						rot[p][p] = c; rot[q][q] = c; rot[p][q] = s; rot[q][p] = -s;
+
+						float ar[3][3] = {}, na[3][3] = {}, nv[3][3] = {};
+						for (auto i = 0; i < 3; ++i)
+							for (auto j = 0; j < 3; ++j)
+								for (auto k = 0; k < 3; ++k)
+								{
+									ar[i][j] += a[i][k] * rot[k][j];
+									nv[i][j] += v[i][k] * rot[k][j];
+								}
+						for (auto i = 0; i < 3; ++i)
+							for (auto j = 0; j < 3; ++j)
+								for (auto k = 0; k < 3; ++k) na[i][j] += rot[k][i] * ar[k][j];
+
+						memcpy(a, na, sizeof(a));
+						memcpy(v, nv, sizeof(v));
+					}
+				}
+			}
+
+			// x = m + V * pinv(W) * V^T * r
+			for (auto i = 0; i < 3; ++i) x[i] = m[i];
+			for (auto k = 0; k < 3; ++k)
+			{
+				if (std::abs(a[k][k]) < c_mesher_qef_threshold) continue;
+
+				auto projected = (v[0][k] * r[0] + v[1][k] * r[1] + v[2][k] * r[2]) / a[k][k];
+				for (auto i = 0; i < 3; ++i) x[i] += v[i][k] * projected;
+			}
+		}
+	};
+
+	using MeshEdgeKey = std::array<uint32_t, 6>; // Bits of the two end positions
+
+	struct MeshEdgeHash
+	{
+		size_t operator()(const MeshEdgeKey& key) const
+		{
+			uint64_t h = 0xCBF29CE484222325ULL;
+			for (auto element : key) h = (h ^ element) * 0x100000001B3ULL;
+			return static_cast<size_t>(h);
+		}
+	};
+
+	/// <summary>
+	/// Counts directed edges, keyed by their end positions so chunk borders join, that are missing an
+	/// equal number of reverse edges (open) or are used by more than one triangle (non-manifold)
+	/// </summary>
+	void checkManifold(const std::vector<VoxelMesh>& meshes, size_t& open, size_t& nonManifold)
+	{
+		std::unordered_map<MeshEdgeKey, uint32_t, MeshEdgeHash> edges = {};
+		for (const auto& mesh : meshes)
+		{
+			for (size_t t = 0; t < mesh.Indices.size(); t += 3)
+			{
+				for (auto k = 0; k < 3; ++k)
+				{
+					MeshEdgeKey key = {};
+					memcpy(&key[0], mesh.Vertices[mesh.Indices[t + k]].Position, sizeof(float) * 3);
+					memcpy(&key[3], mesh.Vertices[mesh.Indices[t + (k + 1) % 3]].Position, sizeof(float) * 3);
+					++edges[key];
+				}
+			}
+		}
+
+		open = nonManifold = 0;
+		for (const auto& element : edges)
+		{
+			if (element.second > 1) ++nonManifold;
+
+			MeshEdgeKey reverse = { element.first[3], element.first[4], element.first[5], element.first[0], element.first[1], element.first[2] };
+			auto it = edges.find(reverse);
+			if (it == edges.end() || it->second != element.second) ++open;
+		}
+	}
+}
+
+ClayEngine::VoxelMesherScratch::VoxelMesherScratch()
+{
+	Occupancy.resize(static_cast<size_t>(c_o) * c_o * c_o);
+	Density.resize(static_cast<size_t>(c_d) * c_d * c_d);
+	Gradient.resize(Density.size() * 3);
+	EdgeVertices.resize(static_cast<size_t>(c_n + 1) * (c_n + 1) * (c_n + 1) * 3);
+	CellVertices.resize(static_cast<size_t>(c_n + 2) * (c_n + 2) * (c_n + 2));
+}
+
+#pragma region Voxel Mesher Implementation
+ClayEngine::VoxelMesher::VoxelMesher(WorkerPoolRaw pool)
+	: m_pool(pool)
+{
+	auto threads = m_pool ? m_pool->GetThreadCount() : 1;
+	for (size_t i = 0; i < threads; ++i) m_scratch.push_back(std::make_unique<VoxelMesherScratch>());
+
+	getMarchingCubesTable();
+}
+
+bool ClayEngine::VoxelMesher::buildDensity(const VoxelGrid& grid, VoxelCoord chunk, VoxelMesherScratch& scratch) const
+{
+	VoxelCoord origin = { chunk.X * c_n, chunk.Y * c_n, chunk.Z * c_n };
+	grid.CopyTo({ { origin.X - 3, origin.Y - 3, origin.Z - 3 }, { origin.X + c_n + 3, origin.Y + c_n + 3, origin.Z + c_n + 3 } }, scratch.Occupancy.data());
+	for (auto& v : scratch.Occupancy) v = IsVoxelEmpty(v) ? 0u : 1u;
+
+	// All air or all solid around the chunk, nothing to extract
+	auto first = scratch.Occupancy.front();
+	if (std::all_of(scratch.Occupancy.begin(), scratch.Occupancy.end(), [first](uint32_t v) { return v == first; })) return false;
+
+	// Corner p is shared by voxels p-1 and p on each axis, occupancy index = voxel + 3
+	auto occupancy = [&](int x, int y, int z) { return scratch.Occupancy[(static_cast<size_t>(z + 3) * c_o + (y + 3)) * c_o + (x + 3)]; };
+	for (auto z = -2; z <= c_n + 2; ++z)
+		for (auto y = -2; y <= c_n + 2; ++y)
+			for (auto x = -2; x <= c_n + 2; ++x)
+			{
+				auto solid = occupancy(x - 1, y - 1, z - 1) + occupancy(x, y - 1, z - 1) + occupancy(x - 1, y, z - 1) + occupancy(x, y, z - 1)
+					+ occupancy(x - 1, y - 1, z) + occupancy(x, y - 1, z) + occupancy(x - 1, y, z) + occupancy(x, y, z);
+				scratch.Density[densityIndex(x, y, z)] = static_cast<float>(solid) / 8.f - .5f - c_mesher_iso;
+			}
+
+	// Central differences over the samples the cells can touch
+	for (auto z = -1; z <= c_n + 1; ++z)
+		for (auto y = -1; y <= c_n + 1; ++y)
+			for (auto x = -1; x <= c_n + 1; ++x)
+			{
+				auto g = &scratch.Gradient[densityIndex(x, y, z) * 3];
+				g[0] = (scratch.Density[densityIndex(x + 1, y, z)] - scratch.Density[densityIndex(x - 1, y, z)]) * .5f;
+				g[1] = (scratch.Density[densityIndex(x, y + 1, z)] - scratch.Density[densityIndex(x, y - 1, z)]) * .5f;
+				g[2] = (scratch.Density[densityIndex(x, y, z + 1)] - scratch.Density[densityIndex(x, y, z - 1)]) * .5f;
+			}
+
+	return true;
+}
+
+void ClayEngine::VoxelMesher::marchCubes(VoxelCoord origin, VoxelMesherScratch& scratch, VoxelMesh& mesh) const
+{
+	const auto& table = getMarchingCubesTable();
+	std::fill(scratch.EdgeVertices.begin(), scratch.EdgeVertices.end(), c_mesher_no_vertex);
+
+	auto edgeVertex = [&](int x, int y, int z, int axis) {
+		auto& slot = scratch.EdgeVertices[((static_cast<size_t>(z) * (c_n + 1) + y) * (c_n + 1) + x) * 3 + axis];
+		if (slot != c_mesher_no_vertex) return slot;
+
+		int q[3] = { x, y, z };
+		++q[axis];
+		auto i0 = densityIndex(x, y, z), i1 = densityIndex(q[0], q[1], q[2]);
+		auto d0 = scratch.Density[i0], d1 = scratch.Density[i1];
+		auto t = d0 / (d0 - d1);
+
+		VoxelMeshVertex vertex = {};
+		vertex.Position[0] = static_cast<float>(origin.X + x);
+		vertex.Position[1] = static_cast<float>(origin.Y + y);
+		vertex.Position[2] = static_cast<float>(origin.Z + z);
+		vertex.Position[axis] += t;
+
+		float n[3] = {};
+		for (auto i = 0; i < 3; ++i) n[i] = -(scratch.Gradient[i0 * 3 + i] + (scratch.Gradient[i1 * 3 + i] - scratch.Gradient[i0 * 3 + i]) * t);
+		normalise(n);
+		memcpy(vertex.Normal, n, sizeof(n));
+		setTextureCoordinate(vertex);
+
+		slot = static_cast<uint32_t>(mesh.Vertices.size());
+		mesh.Vertices.push_back(vertex);
+		return slot;
+	};
+
+	for (auto z = 0; z < c_n; ++z)
+		for (auto y = 0; y < c_n; ++y)
+			for (auto x = 0; x < c_n; ++x)
+			{
+				auto config = 0;
+				for (auto corner = 0; corner < 8; ++corner)
+				{
+					if (scratch.Density[densityIndex(x + (corner & 1), y + ((corner >> 1) & 1), z + ((corner >> 2) & 1))] > 0.f) config |= 1 << corner;
+				}
+				if (config == 0 || config == 255) continue;
+
+				auto cubeVertex = [&](int e) {
+					auto corner = c_edge_corners[e][0];
+					return edgeVertex(x + (corner & 1), y + ((corner >> 1) & 1), z + ((corner >> 2) & 1), c_edge_axis[e]);
+				};
+
+				// Loop centres belong to this cube alone, the mean of the loop's crossings
+				uint32_t centers[c_mc_max_centers] = {};
+				for (auto c = 0; c < table.CenterCount[config]; ++c)
+				{
+					const auto& entry = table.Centers[config][c];
+
+					VoxelMeshVertex vertex = {};
+					for (auto i = 0; i < entry[0]; ++i)
+					{
+						const auto& crossing = mesh.Vertices[cubeVertex(entry[1 + i])];
+						for (auto k = 0; k < 3; ++k)
+						{
+							vertex.Position[k] += crossing.Position[k] / entry[0];
+							vertex.Normal[k] += crossing.Normal[k];
+						}
+					}
+					normalise(vertex.Normal);
+					setTextureCoordinate(vertex);
+
+					centers[c] = static_cast<uint32_t>(mesh.Vertices.size());
+					mesh.Vertices.push_back(vertex);
+				}
+
+				for (auto i = 0; i < table.Count[config] * 3; ++i)
+				{
+					auto e = table.Edges[config][i];
+					mesh.Indices.push_back(e < 12 ? cubeVertex(e) : centers[e - 12]);
+				}
+			}
+}
+
+void ClayEngine::VoxelMesher::contour(VoxelCoord origin, VoxelMesherScratch& scratch, VoxelMesh& mesh) const
+{
+	std::fill(scratch.CellVertices.begin(), scratch.CellVertices.end(), c_mesher_no_vertex);
+
+	// Cells run from -1 to c_n so the quads on the chunk's low faces have all four of their cells
+	auto cellVertex = [&](int x, int y, int z) {
+		auto& slot = scratch.CellVertices[(static_cast<size_t>(z + 1) * (c_n + 2) + (y + 1)) * (c_n + 2) + (x + 1)];
+		if (slot != c_mesher_no_vertex) return slot;
+
+		QefSolver qef = {};
+		float normal[3] = {};
+		for (auto e = 0; e < 12; ++e)
+		{
+			auto a = c_edge_corners[e][0], b = c_edge_corners[e][1];
+			auto ia = densityIndex(x + (a & 1), y + ((a >> 1) & 1), z + ((a >> 2) & 1));
+			auto ib = densityIndex(x + (b & 1), y + ((b >> 1) & 1), z + ((b >> 2) & 1));
+			auto da = scratch.Density[ia], db = scratch.Density[ib];
+			if ((da > 0.f) == (db > 0.f)) continue;
+
+			auto t = da / (da - db);
+			float p[3] = { static_cast<float>(a & 1), static_cast<float>((a >> 1) & 1), static_cast<float>((a >> 2) & 1) };
+			p[c_edge_axis[e]] += t;
+
+			float n[3] = {};
+			for (auto i = 0; i < 3; ++i) n[i] = -(scratch.Gradient[ia * 3 + i] + (scratch.Gradient[ib * 3 + i] - scratch.Gradient[ia * 3 + i]) * t);
+			normalise(n);
+
+			qef.Add(p, n);
+			for (auto i = 0; i < 3; ++i) normal[i] += n[i];
+		}
+
+		float position[3] = {};
+		qef.Solve(position);
+
+		// Solved relative to the cell corner so both chunks sharing a border cell produce the same bits,
+		// and kept inside the cell since a vertex that escapes folds the neighbouring quads over
+		VoxelMeshVertex vertex = {};
+		vertex.Position[0] = static_cast<float>(origin.X + x) + std::clamp(position[0], 0.f, 1.f);
+		vertex.Position[1] = static_cast<float>(origin.Y + y) + std::clamp(position[1], 0.f, 1.f);
+		vertex.Position[2] = static_cast<float>(origin.Z + z) + std::clamp(position[2], 0.f, 1.f);
+		normalise(normal);
+		memcpy(vertex.Normal, normal, sizeof(normal));
+		setTextureCoordinate(vertex);
+
+		slot = static_cast<uint32_t>(mesh.Vertices.size());
+		mesh.Vertices.push_back(vertex);
+		return slot;
+	};
+
+	// Every sign changing lattice edge owned by this chunk becomes a quad joining the four cells around it
+	for (auto z = 0; z < c_n; ++z)
+		for (auto y = 0; y < c_n; ++y)
+			for (auto x = 0; x < c_n; ++x)
+			{
+				auto d0 = scratch.Density[densityIndex(x, y, z)];
+				for (auto axis = 0; axis < 3; ++axis)
+				{
+					int q[3] = { x, y, z };
+					++q[axis];
+					auto d1 = scratch.Density[densityIndex(q[0], q[1], q[2])];
+					if ((d0 > 0.f) == (d1 > 0.f)) continue;
+
+					auto b = (axis + 1) % 3, c = (axis + 2) % 3;
+					int p0[3] = { x, y, z }, p1[3] = { x, y, z }, p3[3] = { x, y, z };
+					--p0[b]; --p0[c];
+					--p1[c];
+					--p3[b];
+
+					auto v0 = cellVertex(p0[0], p0[1], p0[2]);
+					auto v1 = cellVertex(p1[0], p1[1], p1[2]);
+					auto v2 = cellVertex(x, y, z);
+					auto v3 = cellVertex(p3[0], p3[1], p3[2]);
+
+					// v0..v3 circle the edge counter-clockwise around +axis, which faces out when the solid is at the low end
+					if (d0 > 0.f) mesh.Indices.insert(mesh.Indices.end(), { v0, v1, v2, v0, v2, v3 });
+					else mesh.Indices.insert(mesh.Indices.end(), { v0, v2, v1, v0, v3, v2 });
+				}
+			}
+}
+
+void ClayEngine::VoxelMesher::MeshChunk(const VoxelGrid& grid, VoxelCoord chunk, VoxelMeshMethod method, VoxelMesh& mesh, size_t worker)
+{
+	if (worker >= m_scratch.size()) throw std::runtime_error("ClayEngine::VoxelMesher worker index out of range");
+
+	mesh.Chunk = chunk;
+	mesh.Clear();
+
+	auto& scratch = *m_scratch[worker];
+	if (!buildDensity(grid, chunk, scratch)) return;
+
+	VoxelCoord origin = { chunk.X * c_n, chunk.Y * c_n, chunk.Z * c_n };
+	if (method == VoxelMeshMethod::MarchingCubes) marchCubes(origin, scratch, mesh);
+	else contour(origin, scratch, mesh);
+}
+
+void ClayEngine::VoxelMesher::MeshChunks(const VoxelGrid& grid, const std::vector<VoxelCoord>& chunks, VoxelMeshMethod method, std::vector<VoxelMesh>& meshes)
+{
+	meshes.resize(chunks.size());
+
+	if (!m_pool)
+	{
+		for (size_t i = 0; i < chunks.size(); ++i) MeshChunk(grid, chunks[i], method, meshes[i], 0);
+		return;
+	}
+
+	m_pool->ParallelFor(chunks.size(), [&](size_t i, size_t worker) { MeshChunk(grid, chunks[i], method, meshes[i], worker); });
+}
+#pragma endregion
+
+ClayEngine::VoxelMesherBenchmark ClayEngine::RunVoxelMesherBenchmark(int chunksPerAxis)
+{
+	VoxelMesherBenchmark result = {};
+
+	// Rolling hills with a cave carved through them so both methods see overhangs
+	auto size = chunksPerAxis * c_n;
+	Voxel rock(.5f, .5f, .5f, 0);
+	const uint32_t solid = rock;
+
+	VoxelGrid terrain;
+	for (auto z = 0; z < size; ++z)
+	{
+		for (auto x = 0; x < size; ++x)
+		{
+			auto height = static_cast<int>(size * .5f + std::sin(x * .09f) * 10.f + std::cos(z * .07f) * 10.f + std::sin((x + z) * .21f) * 3.f);
+			terrain.Fill({ { x, 0, z }, { x + 1, std::clamp(height, 1, size), z + 1 } }, solid);
+		}
+	}
+	auto radius = size / 6;
+	for (auto z = -radius; z <= radius; ++z)
+		for (auto y = -radius; y <= radius; ++y)
+			for (auto x = 0; x < size; ++x)
+			{
+				if (y * y + z * z <= radius * radius) terrain.SetVoxel(x, size / 3 + y, size / 2 + z, c_voxel_empty);
+			}
+
+	std::vector<VoxelCoord> chunks = {};
+	for (auto z = 0; z < chunksPerAxis; ++z)
+		for (auto y = 0; y < chunksPerAxis; ++y)
+			for (auto x = 0; x < chunksPerAxis; ++x) chunks.push_back({ x, y, z });
+	result.ChunkCount = chunks.size();
+
+	WorkerPool pool;
+	result.ThreadCount = pool.GetThreadCount();
+	VoxelMesher mesher(&pool);
+	std::vector<VoxelMesh> meshes = {};
+
+	auto run = [&](VoxelMeshMethod method, double& cells, double& triangles) {
+		mesher.MeshChunks(terrain, chunks, method, meshes); // Warm the per-thread scratch and mesh capacity
+
+		auto start = std::chrono::steady_clock::now();
+		mesher.MeshChunks(terrain, chunks, method, meshes);
+		auto elapsed = std::chrono::steady_clock::now() - start;
+
+		size_t count = 0;
+		for (const auto& mesh : meshes) count += mesh.GetTriangleCount();
+		cells = PerSecond(chunks.size() * c_voxel_chunk_volume, elapsed);
+		triangles = PerSecond(count, elapsed);
+	};
+
+	run(VoxelMeshMethod::MarchingCubes, result.MarchingCubesCellsPerSecond, result.MarchingCubesTrianglesPerSecond);
+	run(VoxelMeshMethod::DualContouring, result.DualContouringCellsPerSecond, result.DualContouringTrianglesPerSecond);
+
+	// White noise in one chunk hits every ambiguous face, meshed with the chunks around it so the surface is closed
+	VoxelGrid noise;
+	std::mt19937 rng(0);
+	for (auto z = 0; z < c_n; ++z)
+		for (auto y = 0; y < c_n; ++y)
+			for (auto x = 0; x < c_n; ++x)
+			{
+				if (rng() & 1) noise.SetVoxel(x, y, z, solid);
+			}
+
+	std::vector<VoxelCoord> around = {};
+	for (auto z = -1; z <= 1; ++z)
+		for (auto y = -1; y <= 1; ++y)
+			for (auto x = -1; x <= 1; ++x) around.push_back({ x, y, z });
+
+	mesher.MeshChunks(noise, around, VoxelMeshMethod::MarchingCubes, meshes);
+	checkManifold(meshes, result.MarchingCubesOpenEdges, result.MarchingCubesNonManifoldEdges);
+	mesher.MeshChunks(noise, around, VoxelMeshMethod::DualContouring, meshes);
+	checkManifold(meshes, result.DualContouringOpenEdges, result.DualContouringNonManifoldEdges);
+
+	std::wstringstream wss;
+	wss << std::fixed << std::setprecision(2)
+		<< L"VoxelMesher " << result.ChunkCount << L" chunks on " << result.ThreadCount << L" threads"
+		<< L" | Marching cubes " << result.MarchingCubesCellsPerSecond / 1e6 << L" Mcells/sec " << result.MarchingCubesTrianglesPerSecond / 1e6 << L" Mtris/sec"
+		<< L" | Dual contouring " << result.DualContouringCellsPerSecond / 1e6 << L" Mcells/sec " << result.DualContouringTrianglesPerSecond / 1e6 << L" Mtris/sec"
+		<< L" | Noise open/non-manifold edges MC " << result.MarchingCubesOpenEdges << L"/" << result.MarchingCubesNonManifoldEdges
+		<< L" DC " << result.DualContouringOpenEdges << L"/" << result.DualContouringNonManifoldEdges;
+	WriteLine(wss.str());
+
+	return result;
+}
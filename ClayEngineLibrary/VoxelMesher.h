@@ -0,0 +1,131 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* CPU surface extraction, marching cubes and dual contouring                 */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "VoxelGrid.h"
+#include "WorkerPool.h"
+
+namespace ClayEngine
+{
+	constexpr auto c_mesher_iso{ -1.f / 16.f }; // Sits between the density steps so no sample lands exactly on the surface
+	constexpr auto c_mesher_texture_scale{ .125f }; // Texture repeats every 8 voxels
+	constexpr auto c_mesher_qef_threshold{ .1f }; // Eigenvalues below this are treated as zero when solving the QEF
+	constexpr uint32_t c_mesher_no_vertex{ 0xFFFFFFFFu };
+
+	// Sample lattice around a chunk: occupancy reads three voxels past each face, density two samples past each
+	// face, so the gradients on the border cells are central differences and match the neighbouring chunk's
+	constexpr auto c_mesher_occupancy_size{ c_voxel_chunk_size + 6 };
+	constexpr auto c_mesher_density_size{ c_voxel_chunk_size + 5 };
+
+	enum class VoxelMeshMethod
+	{
+		MarchingCubes,
+		DualContouring,
+	};
+
+	/// <summary>
+	/// Same memory layout as DirectX::VertexPositionNormalTexture (XMFLOAT3, XMFLOAT3, XMFLOAT2) so
+	/// the buffers can be uploaded with its InputElements, but without pulling DirectX into the mesher
+	/// </summary>
+	struct VoxelMeshVertex
+	{
+		float Position[3];
+		float Normal[3];
+		float TextureCoordinate[2];
+	};
+	static_assert(sizeof(VoxelMeshVertex) == 32, "VoxelMeshVertex must match VertexPositionNormalTexture");
+
+	/// <summary>
+	/// Indexed triangle list for one chunk, positions are in grid voxel units and triangles wind
+	/// counter-clockwise seen from outside the solid
+	/// </summary>
+	struct VoxelMesh
+	{
+		VoxelCoord Chunk = {};
+		std::vector<VoxelMeshVertex> Vertices = {};
+		std::vector<uint32_t> Indices = {};
+
+		size_t GetTriangleCount() const { return Indices.size() / 3; }
+		void Clear() { Vertices.clear(); Indices.clear(); }
+	};
+
+	/// <summary>
+	/// Per-thread working memory, sized once and reused for every chunk the thread meshes
+	/// </summary>
+	struct VoxelMesherScratch
+	{
+		std::vector<uint32_t> Occupancy = {};
+		std::vector<float> Density = {}; // Signed distance from c_mesher_iso, positive inside
+		std::vector<float> Gradient = {}; // Three floats per density sample
+		std::vector<uint32_t> EdgeVertices = {}; // Marching cubes, one slot per lattice edge
+		std::vector<uint32_t> CellVertices = {}; // Dual contouring, one slot per cell
+
+		VoxelMesherScratch();
+	};
+	using VoxelMesherScratchPtr = std::unique_ptr<VoxelMesherScratch>;
+
+	/// <summary>
+	/// Builds triangle meshes from a VoxelGrid without the VoxelFarm contouring library. The density
+	/// at each voxel corner is the share of the eight voxels around it that are solid, which the
+	/// mesher surfaces either with marching cubes (vertices on lattice edges, shared through an edge
+	/// cache) or with dual contouring (one vertex per cell placed by a QEF over the edge crossings
+	/// and their normals, shared through a cell cache). Neighbouring chunks read each other's border
+	/// voxels, so their meshes meet without cracks.
+	/// </summary>
+	class VoxelMesher
+	{
+		WorkerPoolRaw m_pool = nullptr;
+		std::vector<VoxelMesherScratchPtr> m_scratch = {};
+
+		bool buildDensity(const VoxelGrid& grid, VoxelCoord chunk, VoxelMesherScratch& scratch) const;
+		void marchCubes(VoxelCoord origin, VoxelMesherScratch& scratch, VoxelMesh& mesh) const;
+		void contour(VoxelCoord origin, VoxelMesherScratch& scratch, VoxelMesh& mesh) const;
+
+	public:
+		/// <summary>
+		/// pool may be nullptr when only MeshChunk is used from a single thread
+		/// </summary>
+		VoxelMesher(WorkerPoolRaw pool = nullptr);
+		~VoxelMesher() = default;
+
+		/// <summary>
+		/// Meshes one chunk using the scratch space of worker, which must not be in use by another thread
+		/// </summary>
+		void MeshChunk(const VoxelGrid& grid, VoxelCoord chunk, VoxelMeshMethod method, VoxelMesh& mesh, size_t worker = 0);
+		/// <summary>
+		/// Meshes every chunk in chunks across the pool, meshes is resized to match
+		/// </summary>
+		void MeshChunks(const VoxelGrid& grid, const std::vector<VoxelCoord>& chunks, VoxelMeshMethod method, std::vector<VoxelMesh>& meshes);
+	};
+	using VoxelMesherPtr = std::unique_ptr<VoxelMesher>;
+
+	struct VoxelMesherBenchmark
+	{
+		size_t ThreadCount = 0;
+		size_t ChunkCount = 0;
+		double MarchingCubesCellsPerSecond = 0.;
+		double MarchingCubesTrianglesPerSecond = 0.;
+		double DualContouringCellsPerSecond = 0.;
+		double DualContouringTrianglesPerSecond = 0.;
+		size_t MarchingCubesOpenEdges = 0; // Closed surface check on a noise chunk, should be 0
+		size_t MarchingCubesNonManifoldEdges = 0; // Should be 0
+		size_t DualContouringOpenEdges = 0; // Should be 0
+		size_t DualContouringNonManifoldEdges = 0; // One vertex per cell, so cells crossed by two sheets pinch them together
+	};
+
+	/// <summary>
+	/// Meshes a generated terrain of chunksPerAxis^3 chunks with both methods on every hardware thread,
+	/// checks both meshes of a chunk of noise for a closed edge-manifold surface, and writes cells/sec,
+	/// triangles/sec and the edge counts to the console
+	/// </summary>
+	VoxelMesherBenchmark RunVoxelMesherBenchmark(int chunksPerAxis = 4);
+}
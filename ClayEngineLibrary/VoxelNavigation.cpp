@@ -0,0 +1,799 @@
+#include "pch.h"
+#include "VoxelNavigation.h"
+#include "VoxelOctree.h"
+#include "Strings.h"
+#include "Benchmark.h"
+
+#include <random>
+
+using namespace ClayEngine;
+
+namespace
+{
+	constexpr auto c_unreached{ std::numeric_limits<uint32_t>::max() };
+	constexpr int c_moves[4][2] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 } }; // Sideways steps in x and z
+	constexpr int c_rises[3] = { 0, 1, -1 };
+
+	int chunkOf(int v) { return v >> c_voxel_chunk_bits; }
+
+	int localIndex(int x, int y, int z)
+	{
+		return ((z & c_voxel_chunk_mask) << (2 * c_voxel_chunk_bits)) | ((y & c_voxel_chunk_mask) << c_voxel_chunk_bits) | (x & c_voxel_chunk_mask);
+	}
+
+	VoxelCoord localCoord(int index)
+	{
+		return { index & c_voxel_chunk_mask, (index >> c_voxel_chunk_bits) & c_voxel_chunk_mask, index >> (2 * c_voxel_chunk_bits) };
+	}
+
+	bool testBit(const std::array<uint64_t, c_nav_cluster_words>& bits, int index) { return (bits[index >> 6] >> (index & 63)) & 1; }
+	void setBit(std::array<uint64_t, c_nav_cluster_words>& bits, int index) { bits[index >> 6] |= 1ull << (index & 63); }
+
+	bool sameCell(const VoxelCoord& a, const VoxelCoord& b) { return a.X == b.X && a.Y == b.Y && a.Z == b.Z; }
+
+	/// <summary>
+	/// Fewest moves between two cells, each move covers one cell in x or z and at most one in y
+	/// </summary>
+	uint32_t lowerBound(const VoxelCoord& a, const VoxelCoord& b)
+	{
+		auto across = std::abs(a.X - b.X) + std::abs(a.Z - b.Z);
+		auto up = std::abs(a.Y - b.Y);
+		return static_cast<uint32_t>(std::max(across, up));
+	}
+
+	/// <summary>
+	/// Stepping between cells a rise of one apart needs the extra headroom on the lower of the two
+	/// </summary>
+	bool canStep(int rise, bool fromTall, bool toTall) { return rise == 0 || (rise > 0 ? fromTall : toTall); }
+
+	void pushOpen(std::vector<std::pair<uint32_t, uint32_t>>& open, uint32_t estimate, uint32_t index)
+	{
+		open.emplace_back(estimate, index);
+		std::push_heap(open.begin(), open.end(), std::greater<>());
+	}
+
+	std::pair<uint32_t, uint32_t> popOpen(std::vector<std::pair<uint32_t, uint32_t>>& open)
+	{
+		std::pop_heap(open.begin(), open.end(), std::greater<>());
+		auto top = open.back();
+		open.pop_back();
+		return top;
+	}
+
+	uint32_t nextGeneration(uint32_t& generation, std::vector<uint32_t>& stamps)
+	{
+		if (++generation == 0)
+		{
+			std::fill(stamps.begin(), stamps.end(), 0u);
+			generation = 1;
+		}
+		return generation;
+	}
+
+	/// <summary>
+	/// Walkability straight from the grid, what the benchmark's naive search uses
+	/// </summary>
+	bool walkableCell(const VoxelGrid& grid, int x, int y, int z, bool& tall)
+	{
+		if (IsVoxelEmpty(grid.GetVoxel(x, y - 1, z))) return false;
+		for (auto h = 0; h < c_nav_agent_height; ++h)
+			if (!IsVoxelEmpty(grid.GetVoxel(x, y + h, z))) return false;
+		tall = IsVoxelEmpty(grid.GetVoxel(x, y + c_nav_agent_height, z));
+		return true;
+	}
+
+	int64_t cellKey(int x, int y, int z)
+	{
+		return (static_cast<int64_t>(x & 0x1FFFFF) << 42) | (static_cast<int64_t>(y & 0x1FFFFF) << 21) | static_cast<int64_t>(z & 0x1FFFFF);
+	}
+
+	/// <summary>
+	/// Plain A* over every cell with hashed state, the benchmark's baseline and the optimal cost to compare against
+	/// </summary>
+	bool findPathNaive(const VoxelGrid& grid, const VoxelPathRequest& request, uint32_t& cost)
+	{
+		auto tall = false;
+		if (!walkableCell(grid, request.Start.X, request.Start.Y, request.Start.Z, tall)) return false;
+		if (!walkableCell(grid, request.Goal.X, request.Goal.Y, request.Goal.Z, tall)) return false;
+
+		struct State
+		{
+			uint32_t Cost;
+			bool Tall;
+		};
+		std::unordered_map<int64_t, State> states;
+		std::unordered_map<int64_t, VoxelCoord> cells;
+		std::vector<std::pair<uint32_t, int64_t>> open;
+
+		auto startKey = cellKey(request.Start.X, request.Start.Y, request.Start.Z);
+		walkableCell(grid, request.Start.X, request.Start.Y, request.Start.Z, tall);
+		states[startKey] = { 0, tall };
+		cells[startKey] = request.Start;
+		open.emplace_back(lowerBound(request.Start, request.Goal), startKey);
+
+		while (!open.empty())
+		{
+			std::pop_heap(open.begin(), open.end(), std::greater<>());
+			auto top = open.back();
+			open.pop_back();
+
+			auto& state = states[top.second];
+			auto c = cells[top.second];
+			if (top.first != state.Cost + lowerBound(c, request.Goal)) continue;
+			if (sameCell(c, request.Goal))
+			{
+				cost = state.Cost;
+				return true;
+			}
+
+			auto from = state;
+			for (auto& move : c_moves)
+				for (auto rise : c_rises)
+				{
+					VoxelCoord n = { c.X + move[0], c.Y + rise, c.Z + move[1] };
+					auto nextTall = false;
+					if (!walkableCell(grid, n.X, n.Y, n.Z, nextTall) || !canStep(rise, from.Tall, nextTall)) continue;
+
+					auto key = cellKey(n.X, n.Y, n.Z);
+					auto found = states.find(key);
+					if (found != states.end() && found->second.Cost <= from.Cost + 1) continue;
+
+					states[key] = { from.Cost + 1, nextTall };
+					cells[key] = n;
+					open.emplace_back(from.Cost + 1 + lowerBound(n, request.Goal), key);
+					std::push_heap(open.begin(), open.end(), std::greater<>());
+				}
+		}
+		return false;
+	}
+
+	double milliseconds(std::chrono::steady_clock::duration elapsed)
+	{
+		return std::chrono::duration<double, std::milli>(elapsed).count();
+	}
+}
+
+#pragma region Voxel Navigation Scratch Implementation
+ClayEngine::VoxelNavScratch::VoxelNavScratch()
+	: Cost(c_voxel_chunk_volume)
+	, Stamp(c_voxel_chunk_volume)
+	, Parent(c_voxel_chunk_volume)
+{
+}
+#pragma endregion
+
+#pragma region Voxel Navigator Implementation
+ClayEngine::VoxelNavigator::VoxelNavigator(const VoxelGrid& grid, WorkerPoolRaw pool)
+	: m_grid(&grid)
+	, m_pool(pool)
+{
+	auto threads = (pool ? pool->GetThreadCount() : 1) + 1;
+	for (size_t i = 0; i < threads; ++i) m_scratch.push_back(std::make_unique<VoxelNavScratch>());
+
+	Rebuild();
+}
+
+bool ClayEngine::VoxelNavigator::summarise(Cluster& cluster) const
+{
+	cluster.Walkable = {};
+	cluster.Tall = {};
+
+	// Cells near the top and bottom read their floor and headroom from the chunks above and below
+	const VoxelChunkRaw chunks[3] = {
+		m_grid->GetChunk(cluster.Coord.X, cluster.Coord.Y - 1, cluster.Coord.Z),
+		m_grid->GetChunk(cluster.Coord.X, cluster.Coord.Y, cluster.Coord.Z),
+		m_grid->GetChunk(cluster.Coord.X, cluster.Coord.Y + 1, cluster.Coord.Z),
+	};
+	if (!chunks[0] && !chunks[1]) return false;
+
+	constexpr auto span = c_voxel_chunk_size + c_nav_agent_height + 2;
+	bool solid[span];
+	auto any = false;
+
+	for (auto z = 0; z < c_voxel_chunk_size; ++z)
+		for (auto x = 0; x < c_voxel_chunk_size; ++x)
+		{
+			// solid[i] is local y = i - 1
+			for (auto i = 0; i < span; ++i)
+			{
+				auto y = i - 1 + c_voxel_chunk_size;
+				auto chunk = chunks[y >> c_voxel_chunk_bits];
+				solid[i] = chunk && !IsVoxelEmpty(chunk->Voxels[MortonIndex(x, y, z)]);
+			}
+
+			for (auto y = 0; y < c_voxel_chunk_size; ++y)
+			{
+				if (!solid[y]) continue;
+
+				auto clear = true;
+				for (auto h = 0; h < c_nav_agent_height && clear; ++h) clear = !solid[y + 1 + h];
+				if (!clear) continue;
+
+				auto index = localIndex(x, y, z);
+				setBit(cluster.Walkable, index);
+				if (!solid[y + 1 + c_nav_agent_height]) setBit(cluster.Tall, index);
+				any = true;
+			}
+		}
+
+	return any;
+}
+
+uint32_t ClayEngine::VoxelNavigator::makeNode(const VoxelCoord& cell, ChunkKey cluster)
+{
+	uint32_t id = 0;
+	if (m_free.empty())
+	{
+		id = static_cast<uint32_t>(m_nodes.size());
+		m_nodes.emplace_back();
+	}
+	else
+	{
+		id = m_free.back();
+		m_free.pop_back();
+	}
+
+	auto& node = m_nodes[id];
+	node.Cell = cell;
+	node.Cluster = cluster;
+	node.Edges.clear();
+	node.Live = true;
+	m_clusters[cluster]->Nodes.push_back(id);
+	++m_node_count;
+	return id;
+}
+
+void ClayEngine::VoxelNavigator::removeLink(const Link& link)
+{
+	auto found = m_links.find(link);
+	if (found == m_links.end()) return;
+
+	for (auto id : found->second)
+	{
+		auto& node = m_nodes[id];
+		auto cluster = m_clusters.find(node.Cluster);
+		if (cluster != m_clusters.end())
+		{
+			auto& nodes = cluster->second->Nodes;
+			nodes.erase(std::remove(nodes.begin(), nodes.end(), id), nodes.end());
+		}
+
+		node.Edges.clear();
+		node.Live = false;
+		m_free.push_back(id);
+		--m_node_count;
+	}
+	m_links.erase(found);
+}
+
+void ClayEngine::VoxelNavigator::buildLink(const Link& link)
+{
+	auto& from = *m_clusters[link.first];
+	auto& to = *m_clusters[link.second];
+
+	struct Crossing
+	{
+		VoxelCoord From;
+		VoxelCoord To;
+		int Local; // Index of From in its cluster
+	};
+	std::vector<Crossing> crossings;
+
+	const VoxelCoord origin = { from.Coord.X * c_voxel_chunk_size, from.Coord.Y * c_voxel_chunk_size, from.Coord.Z * c_voxel_chunk_size };
+	for (auto word = 0; word < c_nav_cluster_words; ++word)
+	{
+		if (!from.Walkable[word]) continue;
+		for (auto index = word * 64; index < (word + 1) * 64; ++index)
+		{
+			if (!testBit(from.Walkable, index)) continue;
+			auto local = localCoord(index);
+
+			// Only cells on the skin of the cluster can step out of it
+			if (local.X != 0 && local.X != c_voxel_chunk_mask && local.Y != 0 && local.Y != c_voxel_chunk_mask && local.Z != 0 && local.Z != c_voxel_chunk_mask) continue;
+
+			const VoxelCoord cell = { origin.X + local.X, origin.Y + local.Y, origin.Z + local.Z };
+			auto tall = testBit(from.Tall, index);
+			for (auto& move : c_moves)
+				for (auto rise : c_rises)
+				{
+					const VoxelCoord next = { cell.X + move[0], cell.Y + rise, cell.Z + move[1] };
+					if (VoxelGrid::MakeChunkKey(chunkOf(next.X), chunkOf(next.Y), chunkOf(next.Z)) != link.second) continue;
+
+					auto target = localIndex(next.X, next.Y, next.Z);
+					if (!testBit(to.Walkable, target) || !canStep(rise, tall, testBit(to.Tall, target))) continue;
+
+					crossings.push_back({ cell, next, index });
+				}
+		}
+	}
+	if (crossings.empty()) return;
+
+	// Crossings whose cells are a step apart on both sides are one entrance
+	std::vector<size_t> parent(crossings.size());
+	for (size_t i = 0; i < parent.size(); ++i) parent[i] = i;
+	auto root = [&](size_t i) {
+		while (parent[i] != i) i = parent[i] = parent[parent[i]];
+		return i;
+	};
+
+	std::unordered_multimap<int, size_t> byCell;
+	for (size_t i = 0; i < crossings.size(); ++i) byCell.emplace(crossings[i].Local, i);
+
+	auto adjacent = [&](const Cluster& cluster, const VoxelCoord& a, const VoxelCoord& b) {
+		auto across = std::abs(a.X - b.X) + std::abs(a.Z - b.Z);
+		auto rise = b.Y - a.Y;
+		if (across != 1 || std::abs(rise) > 1) return false;
+		return canStep(rise, testBit(cluster.Tall, localIndex(a.X, a.Y, a.Z)), testBit(cluster.Tall, localIndex(b.X, b.Y, b.Z)));
+	};
+
+	for (size_t i = 0; i < crossings.size(); ++i)
+	{
+		auto& a = crossings[i];
+		for (auto& move : c_moves)
+			for (auto rise : c_rises)
+			{
+				const VoxelCoord next = { a.From.X + move[0], a.From.Y + rise, a.From.Z + move[1] };
+				if (VoxelGrid::MakeChunkKey(chunkOf(next.X), chunkOf(next.Y), chunkOf(next.Z)) != link.first) continue;
+
+				auto range = byCell.equal_range(localIndex(next.X, next.Y, next.Z));
+				for (auto it = range.first; it != range.second; ++it)
+				{
+					auto& b = crossings[it->second];
+					if (!adjacent(from, a.From, b.From) || !(sameCell(a.To, b.To) || adjacent(to, a.To, b.To))) continue;
+					parent[root(it->second)] = root(i);
+				}
+			}
+	}
+
+	std::map<size_t, std::vector<size_t>> entrances;
+	for (size_t i = 0; i < crossings.size(); ++i) entrances[root(i)].push_back(i);
+
+	auto& nodes = m_links[link];
+	for (auto& entrance : entrances)
+	{
+		// The middle crossing of the run stands for all of it
+		auto& crossing = crossings[entrance.second[entrance.second.size() / 2]];
+		auto a = makeNode(crossing.From, link.first);
+		auto b = makeNode(crossing.To, link.second);
+		m_nodes[a].Mate = b;
+		m_nodes[b].Mate = a;
+		nodes.push_back(a);
+		nodes.push_back(b);
+	}
+}
+
+void ClayEngine::VoxelNavigator::buildEdges(Cluster& cluster, VoxelNavScratch& scratch)
+{
+	for (auto id : cluster.Nodes)
+	{
+		auto& node = m_nodes[id];
+		node.Edges.clear();
+		search(cluster, node.Cell, nullptr, scratch);
+
+		for (auto other : cluster.Nodes)
+		{
+			if (other == id) continue;
+
+			auto& cell = m_nodes[other].Cell;
+			auto index = localIndex(cell.X, cell.Y, cell.Z);
+			if (scratch.Stamp[index] == scratch.Generation) node.Edges.push_back({ other, scratch.Cost[index] });
+		}
+	}
+}
+
+void ClayEngine::VoxelNavigator::rebuild(const std::set<ChunkKey>& affected)
+{
+	// Every link that can cross into an affected cluster, one step sideways with at most one up or down
+	static const VoxelCoord offsets[] = {
+		{ 1, -1, 0 }, { -1, -1, 0 }, { 0, -1, 1 }, { 0, -1, -1 },
+		{ 1, 0, 0 }, { -1, 0, 0 }, { 0, 0, 1 }, { 0, 0, -1 },
+		{ 1, 1, 0 }, { -1, 1, 0 }, { 0, 1, 1 }, { 0, 1, -1 },
+		{ 0, 1, 0 }, { 0, -1, 0 },
+	};
+
+	std::set<Link> links;
+	std::set<ChunkKey> touched;
+	for (auto key : affected)
+	{
+		auto c = VoxelGrid::GetChunkCoord(key);
+		touched.insert(key);
+		for (auto& o : offsets)
+		{
+			auto other = VoxelGrid::MakeChunkKey(c.X + o.X, c.Y + o.Y, c.Z + o.Z);
+			links.insert(key < other ? Link{ key, other } : Link{ other, key });
+			touched.insert(other);
+		}
+	}
+
+	for (auto& link : links) removeLink(link);
+
+	for (auto key : affected)
+	{
+		auto cluster = std::make_unique<Cluster>();
+		cluster->Coord = VoxelGrid::GetChunkCoord(key);
+		if (summarise(*cluster)) m_clusters[key] = std::move(cluster);
+		else m_clusters.erase(key);
+	}
+
+	for (auto& link : links)
+		if (m_clusters.count(link.first) && m_clusters.count(link.second)) buildLink(link);
+
+	std::vector<Cluster*> clusters;
+	for (auto key : touched)
+	{
+		auto found = m_clusters.find(key);
+		if (found != m_clusters.end()) clusters.push_back(found->second.get());
+	}
+
+	auto job = [&](size_t index, size_t worker) { buildEdges(*clusters[index], *m_scratch[worker]); };
+	if (m_pool) m_pool->ParallelFor(clusters.size(), job);
+	else for (size_t i = 0; i < clusters.size(); ++i) job(i, 0);
+}
+
+void ClayEngine::VoxelNavigator::Rebuild()
+{
+	std::unique_lock<std::shared_mutex> lock(m_mutex);
+
+	m_clusters.clear();
+	m_links.clear();
+	m_nodes.clear();
+	m_free.clear();
+	m_node_count = 0;
+
+	// A chunk holds the floor of the bottom row of the chunk above it
+	std::set<ChunkKey> affected;
+	for (auto& element : m_grid->GetChunks())
+	{
+		auto c = VoxelGrid::GetChunkCoord(element.first);
+		affected.insert(element.first);
+		affected.insert(VoxelGrid::MakeChunkKey(c.X, c.Y + 1, c.Z));
+	}
+	rebuild(affected);
+}
+
+void ClayEngine::VoxelNavigator::Repair(const std::vector<VoxelCoord>& cells)
+{
+	std::unique_lock<std::shared_mutex> lock(m_mutex);
+
+	// An edit moves floors for the cluster above and headroom for the cluster below
+	std::set<ChunkKey> affected;
+	for (auto& c : cells)
+		for (auto dy = -1; dy <= 1; ++dy) affected.insert(VoxelGrid::MakeChunkKey(c.X, c.Y + dy, c.Z));
+	rebuild(affected);
+}
+
+const ClayEngine::VoxelNavigator::Cluster* ClayEngine::VoxelNavigator::findCluster(int x, int y, int z) const
+{
+	auto found = m_clusters.find(VoxelGrid::MakeChunkKey(chunkOf(x), chunkOf(y), chunkOf(z)));
+	return found == m_clusters.end() ? nullptr : found->second.get();
+}
+
+bool ClayEngine::VoxelNavigator::isWalkable(int x, int y, int z) const
+{
+	auto cluster = findCluster(x, y, z);
+	return cluster && testBit(cluster->Walkable, localIndex(x, y, z));
+}
+
+bool ClayEngine::VoxelNavigator::snap(VoxelCoord& cell) const
+{
+	for (auto depth = 0; depth <= c_nav_snap_depth; ++depth)
+	{
+		if (isWalkable(cell.X, cell.Y - depth, cell.Z))
+		{
+			cell.Y -= depth;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool ClayEngine::VoxelNavigator::search(const Cluster& cluster, const VoxelCoord& from, const VoxelCoord* to, VoxelNavScratch& scratch) const
+{
+	auto generation = nextGeneration(scratch.Generation, scratch.Stamp);
+	auto& open = scratch.Open;
+	open.clear();
+
+	// A* inside one cluster towards to, or a flood of the whole cluster when there is no target
+	auto goal = to ? localCoord(localIndex(to->X, to->Y, to->Z)) : VoxelCoord{};
+	auto estimate = [&](const VoxelCoord& c) { return to ? lowerBound(c, goal) : 0u; };
+	auto target = to ? localIndex(to->X, to->Y, to->Z) : -1;
+
+	auto start = localIndex(from.X, from.Y, from.Z);
+	scratch.Cost[start] = 0;
+	scratch.Stamp[start] = generation;
+	scratch.Parent[start] = -1;
+	pushOpen(open, estimate(localCoord(start)), static_cast<uint32_t>(start));
+
+	while (!open.empty())
+	{
+		auto top = popOpen(open);
+		auto index = static_cast<int>(top.second);
+		auto c = localCoord(index);
+		auto cost = scratch.Cost[index];
+		if (top.first != cost + estimate(c)) continue;
+		if (index == target) return true;
+
+		auto tall = testBit(cluster.Tall, index);
+		for (auto& move : c_moves)
+			for (auto rise : c_rises)
+			{
+				const VoxelCoord n = { c.X + move[0], c.Y + rise, c.Z + move[1] };
+				if (n.X < 0 || n.X >= c_voxel_chunk_size || n.Y < 0 || n.Y >= c_voxel_chunk_size || n.Z < 0 || n.Z >= c_voxel_chunk_size) continue;
+
+				auto next = localIndex(n.X, n.Y, n.Z);
+				if (!testBit(cluster.Walkable, next) || !canStep(rise, tall, testBit(cluster.Tall, next))) continue;
+				if (scratch.Stamp[next] == generation && scratch.Cost[next] <= cost + 1) continue;
+
+				scratch.Cost[next] = cost + 1;
+				scratch.Stamp[next] = generation;
+				scratch.Parent[next] = index;
+				pushOpen(open, cost + 1 + estimate(n), static_cast<uint32_t>(next));
+			}
+	}
+	return target < 0;
+}
+
+void ClayEngine::VoxelNavigator::trace(const Cluster& cluster, const VoxelCoord& from, const VoxelCoord& to, VoxelNavScratch& scratch, std::vector<VoxelCoord>& cells) const
+{
+	if (!search(cluster, from, &to, scratch)) throw std::runtime_error("ClayEngine::VoxelNavigator::trace no local path between nodes of one cluster");
+
+	const VoxelCoord origin = { cluster.Coord.X * c_voxel_chunk_size, cluster.Coord.Y * c_voxel_chunk_size, cluster.Coord.Z * c_voxel_chunk_size };
+	auto first = cells.size();
+	for (auto index = localIndex(to.X, to.Y, to.Z); index >= 0; index = scratch.Parent[index])
+	{
+		auto c = localCoord(index);
+		cells.push_back({ origin.X + c.X, origin.Y + c.Y, origin.Z + c.Z });
+	}
+	std::reverse(cells.begin() + first, cells.end());
+
+	// The joint with the previous leg is already in the path
+	if (first > 0 && sameCell(cells[first - 1], cells[first])) cells.erase(cells.begin() + first);
+}
+
+bool ClayEngine::VoxelNavigator::findPath(const VoxelPathRequest& request, VoxelPath& path, VoxelNavScratch& scratch) const
+{
+	path = {};
+
+	auto start = request.Start;
+	auto goal = request.Goal;
+	if (!snap(start) || !snap(goal)) return false;
+
+	auto& from = *findCluster(start.X, start.Y, start.Z);
+	auto& to = *findCluster(goal.X, goal.Y, goal.Z);
+
+	// Short trips stay inside one cluster and never touch the abstract graph
+	if (&from == &to && search(from, start, &goal, scratch))
+	{
+		trace(from, start, goal, scratch, path.Cells);
+		path.Found = true;
+		path.Cost = static_cast<uint32_t>(path.Cells.size() - 1);
+		return true;
+	}
+
+	// Temporary edges from the start and to the goal, kept out of the shared graph so queries can overlap
+	auto reach = [&](const Cluster& cluster, const VoxelCoord& cell, std::vector<Edge>& edges) {
+		search(cluster, cell, nullptr, scratch);
+		for (auto id : cluster.Nodes)
+		{
+			auto& c = m_nodes[id].Cell;
+			auto index = localIndex(c.X, c.Y, c.Z);
+			if (scratch.Stamp[index] == scratch.Generation) edges.push_back({ id, scratch.Cost[index] });
+		}
+	};
+
+	std::vector<Edge> starts, goals;
+	reach(from, start, starts);
+	reach(to, goal, goals);
+	if (starts.empty() || goals.empty()) return false;
+
+	if (scratch.NodeCost.size() < m_nodes.size())
+	{
+		scratch.NodeCost.resize(m_nodes.size());
+		scratch.NodeStamp.resize(m_nodes.size());
+		scratch.NodeParent.resize(m_nodes.size());
+	}
+	auto generation = nextGeneration(scratch.NodeGeneration, scratch.NodeStamp);
+	auto& open = scratch.Open;
+	open.clear();
+
+	auto relax = [&](uint32_t id, uint32_t cost, uint32_t parent) {
+		if (scratch.NodeStamp[id] == generation && scratch.NodeCost[id] <= cost) return;
+		scratch.NodeCost[id] = cost;
+		scratch.NodeStamp[id] = generation;
+		scratch.NodeParent[id] = parent;
+		pushOpen(open, cost + lowerBound(m_nodes[id].Cell, goal), id);
+	};
+	for (auto& edge : starts) relax(edge.To, edge.Cost, c_unreached);
+
+	auto best = c_unreached;
+	auto last = c_unreached;
+	while (!open.empty())
+	{
+		auto top = popOpen(open);
+		if (top.first >= best) break;
+
+		auto id = top.second;
+		auto& node = m_nodes[id];
+		auto cost = scratch.NodeCost[id];
+		if (top.first != cost + lowerBound(node.Cell, goal)) continue;
+
+		for (auto& edge : goals)
+		{
+			if (edge.To == id && cost + edge.Cost < best)
+			{
+				best = cost + edge.Cost;
+				last = id;
+			}
+		}
+
+		relax(node.Mate, cost + 1, id);
+		for (auto& edge : node.Edges) relax(edge.To, cost + edge.Cost, id);
+	}
+	if (best == c_unreached) return false;
+
+	// Refine, each hop is either one step through an entrance or a local path inside one cluster
+	std::vector<uint32_t> chain;
+	for (auto id = last; id != c_unreached; id = scratch.NodeParent[id]) chain.push_back(id);
+	std::reverse(chain.begin(), chain.end());
+
+	trace(from, start, m_nodes[chain.front()].Cell, scratch, path.Cells);
+	for (size_t i = 1; i < chain.size(); ++i)
+	{
+		auto& a = m_nodes[chain[i - 1]];
+		auto& b = m_nodes[chain[i]];
+		if (a.Cluster == b.Cluster) trace(*m_clusters.at(a.Cluster), a.Cell, b.Cell, scratch, path.Cells);
+		else path.Cells.push_back(b.Cell);
+	}
+	trace(to, m_nodes[chain.back()].Cell, goal, scratch, path.Cells);
+
+	path.Found = true;
+	path.Cost = static_cast<uint32_t>(path.Cells.size() - 1);
+	return true;
+}
+
+bool ClayEngine::VoxelNavigator::FindPath(const VoxelPathRequest& request, VoxelPath& path) const
+{
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
+	return findPath(request, path, *m_scratch.back());
+}
+
+void ClayEngine::VoxelNavigator::FindPaths(const VoxelPathRequest* requests, size_t count, VoxelPath* paths) const
+{
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
+
+	auto jobs = (count + c_nav_batch_size - 1) / c_nav_batch_size;
+	auto job = [&](size_t index, size_t worker) {
+		auto end = std::min(count, (index + 1) * c_nav_batch_size);
+		for (auto i = index * c_nav_batch_size; i < end; ++i) findPath(requests[i], paths[i], *m_scratch[worker]);
+	};
+
+	if (m_pool) m_pool->ParallelFor(jobs, job);
+	else for (size_t i = 0; i < jobs; ++i) job(i, 0);
+}
+
+bool ClayEngine::VoxelNavigator::IsWalkable(int x, int y, int z) const
+{
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
+	return isWalkable(x, y, z);
+}
+
+size_t ClayEngine::VoxelNavigator::GetClusterCount() const
+{
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
+	return m_clusters.size();
+}
+
+size_t ClayEngine::VoxelNavigator::GetNodeCount() const
+{
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
+	return m_node_count;
+}
+#pragma endregion
+
+ClayEngine::VoxelNavigationBenchmark ClayEngine::RunVoxelNavigationBenchmark(WorkerPoolRaw pool, size_t pathCount)
+{
+	VoxelNavigationBenchmark result = {};
+	result.PathCount = pathCount;
+	result.ThreadCount = pool ? pool->GetThreadCount() : 1;
+
+	// Rolling heightmap crossed by walls every 64 cells, each with a gap somewhere along it
+	VoxelGrid terrain;
+	std::vector<int> heights(256 * 256);
+	for (auto z = 0; z < 256; ++z)
+		for (auto x = 0; x < 256; ++x)
+		{
+			auto h = static_cast<int>(24. + 10. * std::sin(x * .05) * std::cos(z * .04));
+			heights[z * 256 + x] = h;
+			terrain.Fill({ { x, 0, z }, { x + 1, h, z + 1 } }, 1);
+		}
+	for (auto wall = 1; wall < 4; ++wall)
+	{
+		auto x = wall * 64;
+		auto gap = 40 + wall * 50;
+		terrain.Fill({ { x, 0, 0 }, { x + 1, 48, gap } }, 2);
+		terrain.Fill({ { x, 0, gap + 3 }, { x + 1, 48, 256 } }, 2);
+	}
+
+	std::mt19937 rng(5);
+	std::uniform_int_distribution<int> across(0, 255);
+	auto pick = [&]() {
+		auto x = across(rng);
+		while (x % 64 == 0) x = across(rng);
+		auto z = across(rng);
+		return VoxelCoord{ x, heights[z * 256 + x], z };
+	};
+
+	std::vector<VoxelPathRequest> requests(pathCount);
+	for (auto& request : requests)
+	{
+		request.Start = pick();
+		request.Goal = pick();
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	VoxelNavigator navigator(terrain, pool);
+	result.BuildMilliseconds = milliseconds(std::chrono::steady_clock::now() - start);
+	result.ClusterCount = navigator.GetClusterCount();
+	result.NodeCount = navigator.GetNodeCount();
+
+	std::vector<VoxelPath> single(pathCount), batch(pathCount);
+
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < pathCount; ++i) navigator.FindPath(requests[i], single[i]);
+	result.SinglePathsPerSecond = PerSecond(pathCount, std::chrono::steady_clock::now() - start);
+
+	start = std::chrono::steady_clock::now();
+	navigator.FindPaths(requests.data(), pathCount, batch.data());
+	result.BatchPathsPerSecond = PerSecond(pathCount, std::chrono::steady_clock::now() - start);
+
+	// The naive search is far slower, so it only answers the first few requests
+	auto naiveCount = std::min<size_t>(pathCount, 64);
+	std::vector<uint32_t> optimal(naiveCount);
+	std::vector<bool> found(naiveCount);
+
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < naiveCount; ++i)
+	{
+		uint32_t cost = 0;
+		found[i] = findPathNaive(terrain, requests[i], cost);
+		optimal[i] = cost;
+	}
+	result.NaivePathsPerSecond = PerSecond(naiveCount, std::chrono::steady_clock::now() - start);
+
+	size_t compared = 0;
+	for (size_t i = 0; i < naiveCount; ++i)
+	{
+		if (found[i] != batch[i].Found) ++result.Mismatches;
+		else if (found[i] && optimal[i] > 0)
+		{
+			result.CostRatio += static_cast<double>(batch[i].Cost) / optimal[i];
+			++compared;
+		}
+	}
+	if (compared) result.CostRatio /= compared;
+
+	// Cut a trench through the middle of one cluster and repair just that corner of the map
+	terrain.Fill({ { 100, 0, 100 }, { 104, 48, 124 } }, c_voxel_empty);
+	std::vector<VoxelCoord> cells;
+	for (auto cz = 100 >> c_voxel_chunk_bits; cz <= 123 >> c_voxel_chunk_bits; ++cz)
+		for (auto cy = 0; cy <= 47 >> c_voxel_chunk_bits; ++cy)
+			for (auto cx = 100 >> c_voxel_chunk_bits; cx <= 103 >> c_voxel_chunk_bits; ++cx) cells.push_back({ cx, cy, cz });
+
+	start = std::chrono::steady_clock::now();
+	navigator.Repair(cells);
+	result.RepairMilliseconds = milliseconds(std::chrono::steady_clock::now() - start);
+
+	std::wstringstream wss;
+	wss << std::fixed << std::setprecision(2)
+		<< L"VoxelNavigation " << result.PathCount << L" paths, " << result.ClusterCount << L" clusters, " << result.NodeCount << L" nodes"
+		<< L" | Build " << result.BuildMilliseconds << L" ms"
+		<< L" | Repair " << result.RepairMilliseconds << L" ms"
+		<< L" | Naive " << result.NaivePathsPerSecond << L" paths/sec"
+		<< L" | Hierarchical " << result.SinglePathsPerSecond << L" paths/sec"
+		<< L" | Batched " << result.ThreadCount << L" threads " << result.BatchPathsPerSecond << L" paths/sec"
+		<< L" | Cost ratio " << result.CostRatio
+		<< L" | Mismatches " << result.Mismatches;
+	WriteLine(wss.str());
+
+	return result;
+}
@@ -0,0 +1,184 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* Hierarchical (HPA*) pathfinding over walkable voxel surfaces               */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "VoxelGrid.h"
+#include "WorkerPool.h"
+
+namespace ClayEngine
+{
+	constexpr auto c_nav_agent_height{ 2 }; // Air cells an agent needs above its floor
+	constexpr auto c_nav_snap_depth{ 4 }; // Request endpoints above the ground are dropped onto it by up to this much
+	constexpr auto c_nav_batch_size{ 16 }; // Path requests per job in a batched query
+	constexpr auto c_nav_cluster_words{ c_voxel_chunk_volume / 64 }; // One bit per cell of a cluster
+
+	struct VoxelPathRequest
+	{
+		VoxelCoord Start = {}; // Cell the agent's feet are in
+		VoxelCoord Goal = {};
+	};
+
+	struct VoxelPath
+	{
+		bool Found = false;
+		uint32_t Cost = 0; // Steps, each move is one cell across with at most one cell up or down
+		std::vector<VoxelCoord> Cells = {}; // Start to goal inclusive
+	};
+
+	/// <summary>
+	/// Per-thread search memory, local arrays cover one cluster, node arrays grow with the abstract graph.
+	/// Generations avoid clearing either between searches.
+	/// </summary>
+	struct VoxelNavScratch
+	{
+		std::vector<uint32_t> Cost = {};
+		std::vector<uint32_t> Stamp = {};
+		std::vector<int32_t> Parent = {};
+		uint32_t Generation = 0;
+
+		std::vector<uint32_t> NodeCost = {};
+		std::vector<uint32_t> NodeStamp = {};
+		std::vector<uint32_t> NodeParent = {};
+		uint32_t NodeGeneration = 0;
+
+		std::vector<std::pair<uint32_t, uint32_t>> Open = {}; // Heap of (estimate, index)
+
+		VoxelNavScratch();
+	};
+	using VoxelNavScratchPtr = std::unique_ptr<VoxelNavScratch>;
+
+	/// <summary>
+	/// HPA* navigation for server NPCs. A cell is walkable when it and the c_nav_agent_height - 1 cells
+	/// above it are air and the cell below is solid, and agents move one cell sideways at a time,
+	/// stepping up or down by one when there is headroom. Each chunk is a cluster holding bitsets of
+	/// its walkable cells. Where walkable cells of two clusters meet, every connected run of crossings
+	/// becomes one entrance with a node on each side, and the nodes inside a cluster are joined by
+	/// their local path lengths. Queries search that abstract graph and then refine each hop with a
+	/// local A* inside one cluster, so their cost barely depends on the size of the map.
+	///
+	/// Repair takes the cells an edit dirtied (VoxelEditOverlay::TakeDirtyCells, VoxelSculptStats::Cells)
+	/// and rebuilds only those clusters, the ones directly above and below them whose floor or headroom
+	/// they hold, and the links and local edges of their neighbours. Queries may run on many threads at
+	/// once; Repair waits for them and the grid must not be edited while either runs.
+	/// </summary>
+	class VoxelNavigator
+	{
+		using ChunkKey = VoxelGrid::ChunkKey;
+		using Link = std::pair<ChunkKey, ChunkKey>; // Lower key first
+
+		struct Cluster
+		{
+			VoxelCoord Coord = {};
+			std::array<uint64_t, c_nav_cluster_words> Walkable = {};
+			std::array<uint64_t, c_nav_cluster_words> Tall = {}; // Walkable with one more cell of headroom, needed to step up or down
+			std::vector<uint32_t> Nodes = {};
+		};
+		using ClusterPtr = std::unique_ptr<Cluster>;
+
+		struct Edge
+		{
+			uint32_t To = 0;
+			uint32_t Cost = 0;
+		};
+
+		struct Node
+		{
+			VoxelCoord Cell = {};
+			ChunkKey Cluster = 0;
+			uint32_t Mate = 0; // Node on the other side of the entrance, one step away
+			std::vector<Edge> Edges = {}; // Other nodes of the same cluster
+			bool Live = false;
+		};
+
+		const VoxelGrid* m_grid = nullptr;
+		WorkerPoolRaw m_pool = nullptr;
+		std::vector<VoxelNavScratchPtr> m_scratch = {}; // One per pool thread, the last for FindPath
+
+		mutable std::shared_mutex m_mutex = {};
+		std::unordered_map<ChunkKey, ClusterPtr> m_clusters = {};
+		std::map<Link, std::vector<uint32_t>> m_links = {}; // Nodes of both sides of every entrance between two clusters
+		std::vector<Node> m_nodes = {};
+		std::vector<uint32_t> m_free = {};
+		size_t m_node_count = 0;
+
+		void rebuild(const std::set<ChunkKey>& affected);
+		bool summarise(Cluster& cluster) const;
+		void removeLink(const Link& link);
+		void buildLink(const Link& link);
+		void buildEdges(Cluster& cluster, VoxelNavScratch& scratch);
+		uint32_t makeNode(const VoxelCoord& cell, ChunkKey cluster);
+
+		const Cluster* findCluster(int x, int y, int z) const;
+		bool isWalkable(int x, int y, int z) const;
+		bool snap(VoxelCoord& cell) const;
+		bool search(const Cluster& cluster, const VoxelCoord& from, const VoxelCoord* to, VoxelNavScratch& scratch) const;
+		void trace(const Cluster& cluster, const VoxelCoord& from, const VoxelCoord& to, VoxelNavScratch& scratch, std::vector<VoxelCoord>& cells) const;
+		bool findPath(const VoxelPathRequest& request, VoxelPath& path, VoxelNavScratch& scratch) const;
+
+	public:
+		VoxelNavigator(const VoxelGrid& grid, WorkerPoolRaw pool = nullptr);
+		~VoxelNavigator() = default;
+
+		VoxelNavigator(const VoxelNavigator&) = delete;
+		VoxelNavigator& operator=(const VoxelNavigator&) = delete;
+
+		/// <summary>
+		/// Builds clusters, entrances and edges for every chunk of the grid
+		/// </summary>
+		void Rebuild();
+		/// <summary>
+		/// Rebuilds only what the given dirty cells can have changed
+		/// </summary>
+		void Repair(const std::vector<VoxelCoord>& cells);
+
+		/// <summary>
+		/// Path between two walkable cells, endpoints up to c_nav_snap_depth above the ground are dropped
+		/// onto it first. Uses scratch reserved for the calling thread, so only one thread at a time.
+		/// </summary>
+		bool FindPath(const VoxelPathRequest& request, VoxelPath& path) const;
+		/// <summary>
+		/// Answers count requests across the worker pool, paths[i] answers requests[i]
+		/// </summary>
+		void FindPaths(const VoxelPathRequest* requests, size_t count, VoxelPath* paths) const;
+
+		bool IsWalkable(int x, int y, int z) const;
+		size_t GetClusterCount() const;
+		size_t GetNodeCount() const;
+	};
+	using VoxelNavigatorPtr = std::unique_ptr<VoxelNavigator>;
+
+	struct VoxelNavigationBenchmark
+	{
+		size_t PathCount = 0;
+		size_t ThreadCount = 0;
+		size_t ClusterCount = 0;
+		size_t NodeCount = 0;
+		double BuildMilliseconds = 0.;
+		double RepairMilliseconds = 0.; // Repair after cutting a trench across one cluster
+		double NaivePathsPerSecond = 0.; // A* over every cell, on a subset of the requests
+		double SinglePathsPerSecond = 0.; // Hierarchical, one request at a time on the calling thread
+		double BatchPathsPerSecond = 0.; // Hierarchical, batched across pool
+		double CostRatio = 0.; // Mean hierarchical cost over optimal cost on the naive subset
+		size_t Mismatches = 0; // Requests where exactly one of the two found a path, should be 0
+	};
+
+	/// <summary>
+	/// Builds navigation over a 256 x 64 x 256 heightmap crossed by walls with gaps, answers pathCount
+	/// random requests and writes the build and repair times and paths per second to the console
+	/// </summary>
+	VoxelNavigationBenchmark RunVoxelNavigationBenchmark(WorkerPoolRaw pool, size_t pathCount = 1u << 12);
+}
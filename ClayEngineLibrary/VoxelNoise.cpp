@@ -0,0 +1,480 @@
+#include "pch.h"
+#include "VoxelNoise.h"
+#include "Strings.h"
+#include "Benchmark.h"
+
+#include <immintrin.h>
+
+using namespace ClayEngine;
+
+namespace
+{
+	constexpr uint32_t c_hash_x = 0x8DA6B343u;
+	constexpr uint32_t c_hash_y = 0xD8163841u;
+	constexpr uint32_t c_hash_z = 0xCB1AB31Fu;
+	constexpr uint32_t c_hash_mix = 0x2C1B3C6Du;
+	constexpr uint32_t c_octave_seed = 0x9E3779B9u; // Each octave gets its own lattice so they don't line up at the origin
+
+	#pragma region Scalar Kernel
+	/// <summary>
+	/// Four bit gradient index for a lattice corner, hx/hy/hz are the corner coordinates times c_hash_x/y/z
+	/// </summary>
+	inline uint32_t hashCorner(uint32_t hx, uint32_t hy, uint32_t hz, uint32_t seed)
+	{
+		auto h = seed ^ hx ^ hy ^ hz;
+		h ^= h >> 15;
+		h *= c_hash_mix;
+		h ^= h >> 12;
+		return h >> 28;
+	}
+
+	/// <summary>
+	/// Dot product with one of the twelve cube edge gradients (four repeated), as in improved Perlin noise
+	/// </summary>
+	template<typename T>
+	inline T gradient(uint32_t h, T x, T y, T z)
+	{
+		auto u = h < 8 ? x : y;
+		auto v = h < 4 ? y : (h == 12 || h == 14 ? x : z);
+		return ((h & 1) ? -u : u) + ((h & 2) ? -v : v);
+	}
+
+	template<typename T>
+	inline T fade(T t)
+	{
+		return t * t * t * (t * (t * T(6) - T(15)) + T(10));
+	}
+
+	template<typename T>
+	inline T lerp(T a, T b, T t)
+	{
+		return a + t * (b - a);
+	}
+
+	template<typename T>
+	T gradientNoise(T x, T y, T z, uint32_t seed)
+	{
+		auto fx = std::floor(x), fy = std::floor(y), fz = std::floor(z);
+		auto hx0 = static_cast<uint32_t>(static_cast<int32_t>(fx)) * c_hash_x, hx1 = hx0 + c_hash_x;
+		auto hy0 = static_cast<uint32_t>(static_cast<int32_t>(fy)) * c_hash_y, hy1 = hy0 + c_hash_y;
+		auto hz0 = static_cast<uint32_t>(static_cast<int32_t>(fz)) * c_hash_z, hz1 = hz0 + c_hash_z;
+
+		auto x0 = x - fx, y0 = y - fy, z0 = z - fz;
+		auto x1 = x0 - T(1), y1 = y0 - T(1), z1 = z0 - T(1);
+		auto u = fade(x0), v = fade(y0), w = fade(z0);
+
+		auto g000 = gradient(hashCorner(hx0, hy0, hz0, seed), x0, y0, z0);
+		auto g100 = gradient(hashCorner(hx1, hy0, hz0, seed), x1, y0, z0);
+		auto g010 = gradient(hashCorner(hx0, hy1, hz0, seed), x0, y1, z0);
+		auto g110 = gradient(hashCorner(hx1, hy1, hz0, seed), x1, y1, z0);
+		auto g001 = gradient(hashCorner(hx0, hy0, hz1, seed), x0, y0, z1);
+		auto g101 = gradient(hashCorner(hx1, hy0, hz1, seed), x1, y0, z1);
+		auto g011 = gradient(hashCorner(hx0, hy1, hz1, seed), x0, y1, z1);
+		auto g111 = gradient(hashCorner(hx1, hy1, hz1, seed), x1, y1, z1);
+
+		return lerp(lerp(lerp(g000, g100, u), lerp(g010, g110, u), v), lerp(lerp(g001, g101, u), lerp(g011, g111, u), v), w);
+	}
+
+	template<typename T>
+	T fractal(T x, T y, T z, const VoxelNoiseSettings& settings)
+	{
+		auto sum = T(0), amplitude = T(1), frequency = static_cast<T>(settings.Frequency);
+		for (auto octave = 0; octave < settings.Octaves; ++octave)
+		{
+			sum += amplitude * gradientNoise(x * frequency, y * frequency, z * frequency, settings.Seed + octave * c_octave_seed);
+			amplitude *= static_cast<T>(settings.Persistence);
+			frequency *= static_cast<T>(settings.Lacunarity);
+		}
+		return sum;
+	}
+
+	template<typename T>
+	void fillRowScalar(T ox, T oy, T oz, T step, int begin, int end, const VoxelNoiseSettings& settings, T* row)
+	{
+		for (auto x = begin; x < end; ++x) row[x] = fractal(ox + static_cast<T>(x) * step, oy, oz, settings);
+	}
+	#pragma endregion
+
+	#pragma region AVX2 Float Kernel
+	CLAY_TARGET_AVX2 inline __m256i hashCorner8(__m256i hx, __m256i hy, __m256i hz, __m256i seed)
+	{
+		auto h = _mm256_xor_si256(_mm256_xor_si256(seed, hx), _mm256_xor_si256(hy, hz));
+		h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 15));
+		h = _mm256_mullo_epi32(h, _mm256_set1_epi32(static_cast<int>(c_hash_mix)));
+		h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 12));
+		return _mm256_srli_epi32(h, 28);
+	}
+
+	CLAY_TARGET_AVX2 inline __m256 gradient8(__m256i h, __m256 x, __m256 y, __m256 z)
+	{
+		auto lt8 = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(8), h));
+		auto lt4 = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(4), h));
+		auto xv = _mm256_castsi256_ps(_mm256_or_si256(_mm256_cmpeq_epi32(h, _mm256_set1_epi32(12)), _mm256_cmpeq_epi32(h, _mm256_set1_epi32(14))));
+
+		auto u = _mm256_blendv_ps(y, x, lt8);
+		auto v = _mm256_blendv_ps(_mm256_blendv_ps(z, x, xv), y, lt4);
+
+		// Negation is a sign flip, the same as the scalar kernel's unary minus
+		auto su = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(1)), 31));
+		auto sv = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(2)), 30));
+		return _mm256_add_ps(_mm256_xor_ps(u, su), _mm256_xor_ps(v, sv));
+	}
+
+	CLAY_TARGET_AVX2 inline __m256 fade8(__m256 t)
+	{
+		auto inner = _mm256_add_ps(_mm256_mul_ps(t, _mm256_sub_ps(_mm256_mul_ps(t, _mm256_set1_ps(6.f)), _mm256_set1_ps(15.f))), _mm256_set1_ps(10.f));
+		return _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(t, t), t), inner);
+	}
+
+	CLAY_TARGET_AVX2 inline __m256 lerp8(__m256 a, __m256 b, __m256 t)
+	{
+		return _mm256_add_ps(a, _mm256_mul_ps(t, _mm256_sub_ps(b, a)));
+	}
+
+	CLAY_TARGET_AVX2 __m256 gradientNoise8(__m256 x, __m256 y, __m256 z, uint32_t seed)
+	{
+		auto fx = _mm256_floor_ps(x), fy = _mm256_floor_ps(y), fz = _mm256_floor_ps(z);
+		auto hx0 = _mm256_mullo_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(static_cast<int>(c_hash_x)));
+		auto hy0 = _mm256_mullo_epi32(_mm256_cvttps_epi32(fy), _mm256_set1_epi32(static_cast<int>(c_hash_y)));
+		auto hz0 = _mm256_mullo_epi32(_mm256_cvttps_epi32(fz), _mm256_set1_epi32(static_cast<int>(c_hash_z)));
+		auto hx1 = _mm256_add_epi32(hx0, _mm256_set1_epi32(static_cast<int>(c_hash_x)));
+		auto hy1 = _mm256_add_epi32(hy0, _mm256_set1_epi32(static_cast<int>(c_hash_y)));
+		auto hz1 = _mm256_add_epi32(hz0, _mm256_set1_epi32(static_cast<int>(c_hash_z)));
+		auto s = _mm256_set1_epi32(static_cast<int>(seed));
+
+		auto one = _mm256_set1_ps(1.f);
+		auto x0 = _mm256_sub_ps(x, fx), y0 = _mm256_sub_ps(y, fy), z0 = _mm256_sub_ps(z, fz);
+		auto x1 = _mm256_sub_ps(x0, one), y1 = _mm256_sub_ps(y0, one), z1 = _mm256_sub_ps(z0, one);
+		auto u = fade8(x0), v = fade8(y0), w = fade8(z0);
+
+		auto g000 = gradient8(hashCorner8(hx0, hy0, hz0, s), x0, y0, z0);
+		auto g100 = gradient8(hashCorner8(hx1, hy0, hz0, s), x1, y0, z0);
+		auto g010 = gradient8(hashCorner8(hx0, hy1, hz0, s), x0, y1, z0);
+		auto g110 = gradient8(hashCorner8(hx1, hy1, hz0, s), x1, y1, z0);
+		auto g001 = gradient8(hashCorner8(hx0, hy0, hz1, s), x0, y0, z1);
+		auto g101 = gradient8(hashCorner8(hx1, hy0, hz1, s), x1, y0, z1);
+		auto g011 = gradient8(hashCorner8(hx0, hy1, hz1, s), x0, y1, z1);
+		auto g111 = gradient8(hashCorner8(hx1, hy1, hz1, s), x1, y1, z1);
+
+		return lerp8(lerp8(lerp8(g000, g100, u), lerp8(g010, g110, u), v), lerp8(lerp8(g001, g101, u), lerp8(g011, g111, u), v), w);
+	}
+
+	CLAY_TARGET_AVX2 void fillRowAVX2(float ox, float oy, float oz, float step, int size, const VoxelNoiseSettings& settings, float* row)
+	{
+		auto x = 0;
+		for (; x + 8 <= size; x += 8)
+		{
+			auto lanes = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(x), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+			auto px = _mm256_add_ps(_mm256_set1_ps(ox), _mm256_mul_ps(lanes, _mm256_set1_ps(step)));
+
+			auto sum = _mm256_setzero_ps();
+			auto amplitude = 1.f, frequency = static_cast<float>(settings.Frequency);
+			for (auto octave = 0; octave < settings.Octaves; ++octave)
+			{
+				auto f = _mm256_set1_ps(frequency);
+				auto n = gradientNoise8(_mm256_mul_ps(px, f), _mm256_set1_ps(oy * frequency), _mm256_set1_ps(oz * frequency), settings.Seed + octave * c_octave_seed);
+				sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(amplitude), n));
+				amplitude *= static_cast<float>(settings.Persistence);
+				frequency *= static_cast<float>(settings.Lacunarity);
+			}
+			_mm256_storeu_ps(row + x, sum);
+		}
+		fillRowScalar(ox, oy, oz, step, x, size, settings, row);
+	}
+	#pragma endregion
+
+	#pragma region AVX2 Double Kernel
+	CLAY_TARGET_AVX2 inline __m128i hashCorner4(__m128i hx, __m128i hy, __m128i hz, __m128i seed)
+	{
+		auto h = _mm_xor_si128(_mm_xor_si128(seed, hx), _mm_xor_si128(hy, hz));
+		h = _mm_xor_si128(h, _mm_srli_epi32(h, 15));
+		h = _mm_mullo_epi32(h, _mm_set1_epi32(static_cast<int>(c_hash_mix)));
+		h = _mm_xor_si128(h, _mm_srli_epi32(h, 12));
+		return _mm_srli_epi32(h, 28);
+	}
+
+	CLAY_TARGET_AVX2 inline __m256d widenMask(__m128i mask)
+	{
+		return _mm256_castsi256_pd(_mm256_cvtepi32_epi64(mask));
+	}
+
+	CLAY_TARGET_AVX2 inline __m256d gradient4(__m128i h, __m256d x, __m256d y, __m256d z)
+	{
+		auto lt8 = widenMask(_mm_cmpgt_epi32(_mm_set1_epi32(8), h));
+		auto lt4 = widenMask(_mm_cmpgt_epi32(_mm_set1_epi32(4), h));
+		auto xv = widenMask(_mm_or_si128(_mm_cmpeq_epi32(h, _mm_set1_epi32(12)), _mm_cmpeq_epi32(h, _mm_set1_epi32(14))));
+
+		auto u = _mm256_blendv_pd(y, x, lt8);
+		auto v = _mm256_blendv_pd(_mm256_blendv_pd(z, x, xv), y, lt4);
+
+		auto su = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_cvtepi32_epi64(_mm_and_si128(h, _mm_set1_epi32(1))), 63));
+		auto sv = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_cvtepi32_epi64(_mm_and_si128(h, _mm_set1_epi32(2))), 62));
+		return _mm256_add_pd(_mm256_xor_pd(u, su), _mm256_xor_pd(v, sv));
+	}
+
+	CLAY_TARGET_AVX2 inline __m256d fade4(__m256d t)
+	{
+		auto inner = _mm256_add_pd(_mm256_mul_pd(t, _mm256_sub_pd(_mm256_mul_pd(t, _mm256_set1_pd(6.)), _mm256_set1_pd(15.))), _mm256_set1_pd(10.));
+		return _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(t, t), t), inner);
+	}
+
+	CLAY_TARGET_AVX2 inline __m256d lerp4(__m256d a, __m256d b, __m256d t)
+	{
+		return _mm256_add_pd(a, _mm256_mul_pd(t, _mm256_sub_pd(b, a)));
+	}
+
+	CLAY_TARGET_AVX2 __m256d gradientNoise4(__m256d x, __m256d y, __m256d z, uint32_t seed)
+	{
+		auto fx = _mm256_floor_pd(x), fy = _mm256_floor_pd(y), fz = _mm256_floor_pd(z);
+		auto hx0 = _mm_mullo_epi32(_mm256_cvttpd_epi32(fx), _mm_set1_epi32(static_cast<int>(c_hash_x)));
+		auto hy0 = _mm_mullo_epi32(_mm256_cvttpd_epi32(fy), _mm_set1_epi32(static_cast<int>(c_hash_y)));
+		auto hz0 = _mm_mullo_epi32(_mm256_cvttpd_epi32(fz), _mm_set1_epi32(static_cast<int>(c_hash_z)));
+		auto hx1 = _mm_add_epi32(hx0, _mm_set1_epi32(static_cast<int>(c_hash_x)));
+		auto hy1 = _mm_add_epi32(hy0, _mm_set1_epi32(static_cast<int>(c_hash_y)));
+		auto hz1 = _mm_add_epi32(hz0, _mm_set1_epi32(static_cast<int>(c_hash_z)));
+		auto s = _mm_set1_epi32(static_cast<int>(seed));
+
+		auto one = _mm256_set1_pd(1.);
+		auto x0 = _mm256_sub_pd(x, fx), y0 = _mm256_sub_pd(y, fy), z0 = _mm256_sub_pd(z, fz);
+		auto x1 = _mm256_sub_pd(x0, one), y1 = _mm256_sub_pd(y0, one), z1 = _mm256_sub_pd(z0, one);
+		auto u = fade4(x0), v = fade4(y0), w = fade4(z0);
+
+		auto g000 = gradient4(hashCorner4(hx0, hy0, hz0, s), x0, y0, z0);
+		auto g100 = gradient4(hashCorner4(hx1, hy0, hz0, s), x1, y0, z0);
+		auto g010 = gradient4(hashCorner4(hx0, hy1, hz0, s), x0, y1, z0);
+		auto g110 = gradient4(hashCorner4(hx1, hy1, hz0, s), x1, y1, z0);
+		auto g001 = gradient4(hashCorner4(hx0, hy0, hz1, s), x0, y0, z1);
+		auto g101 = gradient4(hashCorner4(hx1, hy0, hz1, s), x1, y0, z1);
+		auto g011 = gradient4(hashCorner4(hx0, hy1, hz1, s), x0, y1, z1);
+		auto g111 = gradient4(hashCorner4(hx1, hy1, hz1, s), x1, y1, z1);
+
+		return lerp4(lerp4(lerp4(g000, g100, u), lerp4(g010, g110, u), v), lerp4(lerp4(g001, g101, u), lerp4(g011, g111, u), v), w);
+	}
+
+	CLAY_TARGET_AVX2 void fillRowAVX2(double ox, double oy, double oz, double step, int size, const VoxelNoiseSettings& settings, double* row)
+	{
+		auto x = 0;
+		for (; x + 4 <= size; x += 4)
+		{
+			auto lanes = _mm256_cvtepi32_pd(_mm_add_epi32(_mm_set1_epi32(x), _mm_setr_epi32(0, 1, 2, 3)));
+			auto px = _mm256_add_pd(_mm256_set1_pd(ox), _mm256_mul_pd(lanes, _mm256_set1_pd(step)));
+
+			auto sum = _mm256_setzero_pd();
+			auto amplitude = 1., frequency = settings.Frequency;
+			for (auto octave = 0; octave < settings.Octaves; ++octave)
+			{
+				auto f = _mm256_set1_pd(frequency);
+				auto n = gradientNoise4(_mm256_mul_pd(px, f), _mm256_set1_pd(oy * frequency), _mm256_set1_pd(oz * frequency), settings.Seed + octave * c_octave_seed);
+				sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_set1_pd(amplitude), n));
+				amplitude *= settings.Persistence;
+				frequency *= settings.Lacunarity;
+			}
+			_mm256_storeu_pd(row + x, sum);
+		}
+		fillRowScalar(ox, oy, oz, step, x, size, settings, row);
+	}
+	#pragma endregion
+
+	template<typename T>
+	void fillBlock(VoxelCodecKernel kernel, const T (&origin)[3], T step, int size, const VoxelNoiseSettings& settings, T* field)
+	{
+		for (auto z = 0; z < size; ++z)
+		{
+			auto oz = origin[2] + static_cast<T>(z) * step;
+			for (auto y = 0; y < size; ++y)
+			{
+				auto oy = origin[1] + static_cast<T>(y) * step;
+				auto row = field + (static_cast<size_t>(z) * size + y) * size;
+
+				if (kernel == VoxelCodecKernel::AVX2) fillRowAVX2(origin[0], oy, oz, step, size, settings, row);
+				else fillRowScalar(origin[0], oy, oz, step, 0, size, settings, row);
+			}
+		}
+	}
+
+	template<typename T>
+	void fillPlane(VoxelCodecKernel kernel, const T (&origin)[2], T step, int size, const VoxelNoiseSettings& settings, T* field)
+	{
+		for (auto z = 0; z < size; ++z)
+		{
+			auto oz = origin[1] + static_cast<T>(z) * step;
+			auto row = field + static_cast<size_t>(z) * size;
+
+			if (kernel == VoxelCodecKernel::AVX2) fillRowAVX2(origin[0], T(0), oz, step, size, settings, row);
+			else fillRowScalar(origin[0], T(0), oz, step, 0, size, settings, row);
+		}
+	}
+}
+
+ClayEngine::VoxelNoise::VoxelNoise()
+	: VoxelNoise(VoxelBatchCodec::DetectKernel())
+{
+
+}
+
+ClayEngine::VoxelNoise::VoxelNoise(VoxelCodecKernel kernel)
+	: m_kernel(VoxelBatchCodec::ClampKernel(kernel))
+{
+	// Only AVX2 has a vector path here
+	if (m_kernel != VoxelCodecKernel::AVX2) m_kernel = VoxelCodecKernel::Scalar;
+}
+
+void ClayEngine::VoxelNoise::FillBlock(const float (&origin)[3], float step, int size, const VoxelNoiseSettings& settings, float* field) const
+{
+	fillBlock(m_kernel, origin, step, size, settings, field);
+}
+
+void ClayEngine::VoxelNoise::FillBlock(const double (&origin)[3], double step, int size, const VoxelNoiseSettings& settings, double* field) const
+{
+	fillBlock(m_kernel, origin, step, size, settings, field);
+}
+
+void ClayEngine::VoxelNoise::FillPlane(const float (&origin)[2], float step, int size, const VoxelNoiseSettings& settings, float* field) const
+{
+	fillPlane(m_kernel, origin, step, size, settings, field);
+}
+
+void ClayEngine::VoxelNoise::FillPlane(const double (&origin)[2], double step, int size, const VoxelNoiseSettings& settings, double* field) const
+{
+	fillPlane(m_kernel, origin, step, size, settings, field);
+}
+
+float ClayEngine::VoxelNoise::Sample(float x, float y, float z, const VoxelNoiseSettings& settings)
+{
+	return fractal(x, y, z, settings);
+}
+
+double ClayEngine::VoxelNoise::Sample(double x, double y, double z, const VoxelNoiseSettings& settings)
+{
+	return fractal(x, y, z, settings);
+}
+
+void ClayEngine::VoxelNoise::GetBounds(const double (&min)[3], const double (&max)[3], const VoxelNoiseSettings& settings, double& low, double& high, int depth)
+{
+	double centre[3] = {}, half = 0.;
+	for (auto axis = 0; axis < 3; ++axis)
+	{
+		centre[axis] = (min[axis] + max[axis]) * .5;
+		half += (max[axis] - min[axis]) * (max[axis] - min[axis]) * .25;
+	}
+	half = std::sqrt(half);
+
+	low = high = 0.;
+	auto amplitude = 1., frequency = settings.Frequency;
+	for (auto octave = 0; octave < settings.Octaves; ++octave)
+	{
+		auto reach = c_noise_slope_bound * half * frequency;
+		if (reach >= c_noise_value_bound)
+		{
+			// Octaves finer than the box can take any value, no need to sample them
+			low -= c_noise_value_bound * std::abs(amplitude);
+			high += c_noise_value_bound * std::abs(amplitude);
+		}
+		else
+		{
+			auto value = gradientNoise(centre[0] * frequency, centre[1] * frequency, centre[2] * frequency, settings.Seed + octave * c_octave_seed);
+			auto a = amplitude * std::max(value - reach, -c_noise_value_bound);
+			auto b = amplitude * std::min(value + reach, c_noise_value_bound);
+			low += std::min(a, b);
+			high += std::max(a, b);
+		}
+		amplitude *= settings.Persistence;
+		frequency *= settings.Lacunarity;
+	}
+
+	if (depth <= 0 || low > 0. || high <= 0.) return;
+
+	// Still ambiguous, the octants have smaller reach and their union is at least as tight
+	auto childLow = std::numeric_limits<double>::max(), childHigh = std::numeric_limits<double>::lowest();
+	auto positive = false, negative = false;
+	for (auto octant = 0; octant < 8; ++octant)
+	{
+		double lo[3] = {}, hi[3] = {};
+		for (auto axis = 0; axis < 3; ++axis)
+		{
+			auto upper = (octant >> axis) & 1;
+			lo[axis] = upper ? centre[axis] : min[axis];
+			hi[axis] = upper ? max[axis] : centre[axis];
+		}
+
+		double l = 0., h = 0.;
+		GetBounds(lo, hi, settings, l, h, depth - 1);
+		childLow = std::min(childLow, l);
+		childHigh = std::max(childHigh, h);
+
+		// One octant certainly positive and another certainly not, the box has both signs whatever the rest say
+		positive |= l > 0.;
+		negative |= h <= 0.;
+		if (positive && negative) return;
+	}
+	low = std::max(low, childLow);
+	high = std::min(high, childHigh);
+}
+
+ClayEngine::VoxelNoiseBenchmark ClayEngine::RunVoxelNoiseBenchmark(int blockSize, int blocks)
+{
+	VoxelNoiseBenchmark result = {};
+
+	auto volume = static_cast<size_t>(blockSize) * blockSize * blockSize;
+	result.VoxelCount = volume * blocks;
+
+	VoxelNoiseSettings settings = {};
+	settings.Octaves = 2;
+	settings.Frequency = 1. / 32.;
+
+	std::vector<float> floats(volume);
+	std::vector<double> doubles(volume);
+	auto checksum = 0.;
+
+	// The old layer loop, one call per voxel with the coordinate math inline
+	auto start = std::chrono::steady_clock::now();
+	for (auto b = 0; b < blocks; ++b)
+	{
+		for (auto z = 0; z < blockSize; ++z)
+			for (auto y = 0; y < blockSize; ++y)
+				for (auto x = 0; x < blockSize; ++x)
+				{
+					doubles[(static_cast<size_t>(z) * blockSize + y) * blockSize + x] = VoxelNoise::Sample(static_cast<double>(b * blockSize + x), static_cast<double>(y), static_cast<double>(z), settings);
+				}
+		checksum += doubles[volume / 2];
+	}
+	result.SampleVoxelsPerSecond = PerSecond(result.VoxelCount, std::chrono::steady_clock::now() - start);
+
+	auto run = [&](const VoxelNoise& noise, double& floatRate, double& doubleRate) {
+		start = std::chrono::steady_clock::now();
+		for (auto b = 0; b < blocks; ++b)
+		{
+			const float origin[3] = { static_cast<float>(b * blockSize), 0.f, 0.f };
+			noise.FillBlock(origin, 1.f, blockSize, settings, floats.data());
+			checksum += floats[volume / 2];
+		}
+		floatRate = PerSecond(result.VoxelCount, std::chrono::steady_clock::now() - start);
+
+		start = std::chrono::steady_clock::now();
+		for (auto b = 0; b < blocks; ++b)
+		{
+			const double origin[3] = { static_cast<double>(b * blockSize), 0., 0. };
+			noise.FillBlock(origin, 1., blockSize, settings, doubles.data());
+			checksum += doubles[volume / 2];
+		}
+		doubleRate = PerSecond(result.VoxelCount, std::chrono::steady_clock::now() - start);
+	};
+
+	VoxelNoise scalar(VoxelCodecKernel::Scalar);
+	run(scalar, result.ScalarFloatVoxelsPerSecond, result.ScalarDoubleVoxelsPerSecond);
+
+	VoxelNoise batch;
+	result.Kernel = batch.GetKernel();
+	run(batch, result.BatchFloatVoxelsPerSecond, result.BatchDoubleVoxelsPerSecond);
+
+	std::wstringstream wss;
+	wss << std::fixed << std::setprecision(2)
+		<< L"VoxelNoise " << result.VoxelCount << L" voxels"
+		<< L" | Sample " << result.SampleVoxelsPerSecond / 1e6 << L" Mvox/sec"
+		<< L" | Scalar float " << result.ScalarFloatVoxelsPerSecond / 1e6 << L" double " << result.ScalarDoubleVoxelsPerSecond / 1e6 << L" Mvox/sec"
+		<< L" | " << VoxelBatchCodec::GetKernelName(result.Kernel) << L" float " << result.BatchFloatVoxelsPerSecond / 1e6 << L" double " << result.BatchDoubleVoxelsPerSecond / 1e6 << L" Mvox/sec"
+		<< L" (checksum " << checksum << L")";
+	WriteLine(wss.str());
+
+	return result;
+}
@@ -0,0 +1,99 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* Block-wide fractal gradient noise with AVX2 and scalar kernels             */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <cstdint>
+#include <cstddef>
+
+#include "VoxelBatchCodec.h"
+
+namespace ClayEngine
+{
+	// Padded bounds for one octave. The exact worst case comes from maximising over the sample's place in
+	// its lattice cell and the edge gradient each of the eight corners may pick. |noise| peaks at 1.036
+	// near (.645, .481, .5). |gradient of noise| peaks at 3.75 = 2 * fade'(1/2) at the cell centre along
+	// an axis: each corner's weight changes at fade'(1/2) / 4 = 15/32 there, and an edge gradient
+	// perpendicular to that axis dots to 1 with the corner's half-diagonal offset.
+	constexpr auto c_noise_value_bound{ 1.1 }; // |noise| never exceeds this
+	constexpr auto c_noise_slope_bound{ 4. }; // |gradient of noise| never exceeds this, per lattice unit
+	constexpr auto c_noise_bounds_depth{ 3 }; // Octree splits GetBounds may use to settle the sign of a box
+
+	/// <summary>
+	/// Fractal sum settings, octave i samples at Frequency * Lacunarity^i with weight Persistence^i
+	/// </summary>
+	struct VoxelNoiseSettings
+	{
+		int Octaves = 1;
+		double Frequency = 1.;
+		double Persistence = .5;
+		double Lacunarity = 2.;
+		uint32_t Seed = 0;
+	};
+
+	/// <summary>
+	/// Improved Perlin gradient noise evaluated a block at a time. The lattice gradients come from an
+	/// integer hash instead of a permutation table so the AVX2 kernels need no gathers, and every
+	/// kernel performs the same operations in the same order, so the scalar and AVX2 results are
+	/// identical. Output of a single octave is in [-1, 1].
+	/// </summary>
+	class VoxelNoise
+	{
+		VoxelCodecKernel m_kernel = VoxelCodecKernel::Scalar; // SSE4.1 has no noise kernel and runs the scalar one
+
+	public:
+		VoxelNoise();
+		VoxelNoise(VoxelCodecKernel kernel);
+		~VoxelNoise() = default;
+
+		/// <summary>
+		/// Fills size^3 samples x-fastest, field[(z * size + y) * size + x] is the noise at origin + (x, y, z) * step
+		/// </summary>
+		void FillBlock(const float (&origin)[3], float step, int size, const VoxelNoiseSettings& settings, float* field) const;
+		void FillBlock(const double (&origin)[3], double step, int size, const VoxelNoiseSettings& settings, double* field) const;
+		/// <summary>
+		/// Fills size^2 samples of the y = 0 plane for heightmaps, field[z * size + x] is the noise at
+		/// (origin[0] + x * step, 0, origin[1] + z * step)
+		/// </summary>
+		void FillPlane(const float (&origin)[2], float step, int size, const VoxelNoiseSettings& settings, float* field) const;
+		void FillPlane(const double (&origin)[2], double step, int size, const VoxelNoiseSettings& settings, double* field) const;
+
+		/// <summary>
+		/// One sample, for callers that only need a few points
+		/// </summary>
+		static float Sample(float x, float y, float z, const VoxelNoiseSettings& settings);
+		static double Sample(double x, double y, double z, const VoxelNoiseSettings& settings);
+
+		/// <summary>
+		/// Interval bounds of the fractal sum over the box [min, max]: each octave is the centre sample
+		/// plus or minus its slope bound times the half diagonal, clamped to the value bound. While the
+		/// interval still contains zero the box is split into octants, up to depth times, and the union
+		/// of the children is returned. Conservative, so a box with high &lt;= 0 or low &gt; 0 never
+		/// changes sign inside.
+		/// </summary>
+		static void GetBounds(const double (&min)[3], const double (&max)[3], const VoxelNoiseSettings& settings, double& low, double& high, int depth = c_noise_bounds_depth);
+
+		VoxelCodecKernel GetKernel() const { return m_kernel; }
+	};
+
+	struct VoxelNoiseBenchmark
+	{
+		size_t VoxelCount = 0;
+		double SampleVoxelsPerSecond = 0.; // Sample() once per voxel in double, as the layers used to
+		double ScalarFloatVoxelsPerSecond = 0.;
+		double ScalarDoubleVoxelsPerSecond = 0.;
+		double BatchFloatVoxelsPerSecond = 0.;
+		double BatchDoubleVoxelsPerSecond = 0.;
+		VoxelCodecKernel Kernel = VoxelCodecKernel::Scalar;
+	};
+
+	/// <summary>
+	/// Fills blocks blockSize^3 blocks of two octave noise per-voxel, with the scalar kernel and with
+	/// the detected kernel, and writes the voxels per second to the console
+	/// </summary>
+	VoxelNoiseBenchmark RunVoxelNoiseBenchmark(int blockSize = 40, int blocks = 64);
+}
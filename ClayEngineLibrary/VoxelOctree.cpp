@@ -0,0 +1,140 @@
+#include "pch.h"
+#include "VoxelOctree.h"
+
+using namespace ClayEngine;
+
+namespace
+{
+	/// <summary>
+	/// Representative of eight children: air unless at least half of them are solid, otherwise the
+	/// average of the solid children's vectors
+	/// </summary>
+	uint32_t summariseChildren(const VoxelOctreeNode (&children)[8], int height)
+	{
+		auto solid = 0;
+		float z = 0.f, y = 0.f, x = 0.f;
+
+		for (const auto& child : children)
+		{
+			if (IsVoxelEmpty(child.Voxel)) continue;
+
+			++solid;
+			z += c_voxel_decode_table[child.Voxel & 0xFF];
+			y += c_voxel_decode_table[(child.Voxel >> 8) & 0xFF];
+			x += c_voxel_decode_table[(child.Voxel >> 16) & 0xFF];
+		}
+
+		if (solid * 2 < 8) return SetVoxelLod(c_voxel_empty, static_cast<unsigned int>(height));
+
+		auto n = static_cast<float>(solid);
+		Voxel v(z / n, y / n, x / n, 0);
+		return SetVoxelLod(v, static_cast<unsigned int>(height));
+	}
+}
+
+ClayEngine::VoxelOctreeNode ClayEngine::VoxelOctree::buildNode(const VoxelGrid& grid, int x, int y, int z, int height, const VoxelChunk* chunk)
+{
+	VoxelOctreeNode node = {};
+
+	// Once a node fits inside one chunk resolve the chunk, missing and uniform chunks collapse here
+	if (!chunk && height <= c_voxel_chunk_bits)
+	{
+		chunk = grid.GetChunk(x >> c_voxel_chunk_bits, y >> c_voxel_chunk_bits, z >> c_voxel_chunk_bits);
+		if (!chunk || (height == c_voxel_chunk_bits && chunk->IsUniform()))
+		{
+			node.Voxel = SetVoxelLod(chunk ? chunk->Voxels[0] : c_voxel_empty, static_cast<unsigned int>(height));
+			return node;
+		}
+	}
+
+	if (height == 0)
+	{
+		node.Voxel = VoxelContent(chunk->Get(x & c_voxel_chunk_mask, y & c_voxel_chunk_mask, z & c_voxel_chunk_mask));
+		return node;
+	}
+
+	auto half = 1 << (height - 1);
+	VoxelOctreeNode children[8] = {};
+	for (auto i = 0; i < 8; ++i)
+	{
+		children[i] = buildNode(grid, x + ((i & 1) ? half : 0), y + ((i & 2) ? half : 0), z + ((i & 4) ? half : 0), height - 1, chunk);
+	}
+
+	// Collapse when every child is itself a collapsed node holding the same content
+	auto uniform = true;
+	for (auto i = 0; i < 8 && uniform; ++i)
+	{
+		uniform = children[i].IsLeaf() && VoxelContent(children[i].Voxel) == VoxelContent(children[0].Voxel);
+	}
+	if (uniform)
+	{
+		node.Voxel = SetVoxelLod(children[0].Voxel, static_cast<unsigned int>(height));
+		return node;
+	}
+
+	node.Voxel = summariseChildren(children, height);
+	node.FirstChild = static_cast<uint32_t>(m_nodes.size());
+	m_nodes.insert(m_nodes.end(), std::begin(children), std::end(children));
+	return node;
+}
+
+void ClayEngine::VoxelOctree::Build(const VoxelGrid& grid, VoxelCoord origin, int depth)
+{
+	if (depth < 0 || depth > c_octree_max_depth) throw std::runtime_error("ClayEngine::VoxelOctree depth out of range");
+
+	// Nodes may not straddle chunks, so the origin has to sit on a chunk (or node, if smaller) boundary
+	auto alignment = (1 << std::min(depth, static_cast<int>(c_voxel_chunk_bits))) - 1;
+	if ((origin.X & alignment) || (origin.Y & alignment) || (origin.Z & alignment)) throw std::runtime_error("ClayEngine::VoxelOctree origin is not aligned");
+
+	Clear();
+	m_origin = origin;
+	m_depth = depth;
+	m_root = buildNode(grid, origin.X, origin.Y, origin.Z, depth, nullptr);
+	m_nodes.shrink_to_fit();
+}
+
+void ClayEngine::VoxelOctree::Clear()
+{
+	m_nodes.clear();
+	m_root = {};
+	m_depth = 0;
+}
+
+uint32_t ClayEngine::VoxelOctree::GetVoxel(int x, int y, int z, unsigned int lod) const
+{
+	auto lx = x - m_origin.X;
+	auto ly = y - m_origin.Y;
+	auto lz = z - m_origin.Z;
+	auto size = GetSize();
+	if (lx < 0 || ly < 0 || lz < 0 || lx >= size || ly >= size || lz >= size) return c_voxel_empty;
+
+	auto node = &m_root;
+	auto height = m_depth;
+	while (static_cast<unsigned int>(height) > lod && !node->IsLeaf())
+	{
+		--height;
+		auto child = ((lx >> height) & 1) | (((ly >> height) & 1) << 1) | (((lz >> height) & 1) << 2);
+		node = &m_nodes[node->FirstChild + child];
+	}
+	return node->Voxel;
+}
+
+void ClayEngine::VoxelOctree::visitNode(const VoxelOctreeNode& node, int x, int y, int z, int height, unsigned int lod, const NodeCallback& fn) const
+{
+	if (node.IsLeaf() || static_cast<unsigned int>(height) <= lod)
+	{
+		if (!IsVoxelEmpty(node.Voxel)) fn(VoxelCoord{ x, y, z }, 1 << height, node.Voxel);
+		return;
+	}
+
+	auto half = 1 << (height - 1);
+	for (auto i = 0; i < 8; ++i)
+	{
+		visitNode(m_nodes[node.FirstChild + i], x + ((i & 1) ? half : 0), y + ((i & 2) ? half : 0), z + ((i & 4) ? half : 0), height - 1, lod, fn);
+	}
+}
+
+void ClayEngine::VoxelOctree::ForEachNode(unsigned int lod, const NodeCallback& fn) const
+{
+	visitNode(m_root, m_origin.X, m_origin.Y, m_origin.Z, m_depth, lod, fn);
+}
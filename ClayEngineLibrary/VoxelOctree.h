@@ -0,0 +1,100 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* Sparse voxel octree with per-node LOD stored in the Voxel LOD nibble       */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "Voxel.h"
+#include "VoxelGrid.h"
+
+namespace ClayEngine
+{
+	constexpr uint32_t c_octree_no_children{ 0xFFFFFFFFu };
+	constexpr auto c_octree_max_depth{ static_cast<int>(c_voxel_lod_max) }; // Node heights live in the LOD nibble, Build rejects deeper trees
+	static_assert(c_octree_max_depth <= static_cast<int>(c_voxel_lod_max), "Octree node heights must fit the voxel LOD nibble");
+	static_assert(c_octree_max_depth <= 20, "Octree node extents must stay inside VoxelGrid's 21 bit chunk range");
+
+	/// <summary>
+	/// Strips the LOD nibble so packed words can be compared by content
+	/// </summary>
+	constexpr uint32_t VoxelContent(uint32_t packed) { return packed & ~c_voxel_lod_mask; }
+	constexpr bool IsVoxelEmpty(uint32_t packed) { return VoxelContent(packed) == c_voxel_empty; }
+	constexpr uint32_t SetVoxelLod(uint32_t packed, unsigned int lod)
+	{
+		return VoxelContent(packed) | ((lod > c_voxel_lod_max ? c_voxel_lod_max : lod) << c_voxel_lod_shift);
+	}
+	constexpr unsigned int GetVoxelLod(uint32_t packed) { return (packed & c_voxel_lod_mask) >> c_voxel_lod_shift; }
+
+	/// <summary>
+	/// Eight bytes per node, the eight children of a node are stored contiguously starting at FirstChild
+	/// </summary>
+	struct VoxelOctreeNode
+	{
+		uint32_t Voxel = c_voxel_empty; // Representative packed voxel, the LOD nibble holds the node height
+		uint32_t FirstChild = c_octree_no_children;
+
+		bool IsLeaf() const { return FirstChild == c_octree_no_children; }
+	};
+
+	/// <summary>
+	/// Sparse voxel octree over a cube of 2^depth voxels. Every interior node carries a representative
+	/// voxel that summarises its children, with its height above the leaves written to the LOD nibble,
+	/// and any subtree whose voxels are all the same collapses into a single node. Mostly air or mostly
+	/// solid terrain therefore costs a handful of nodes, and a query at a coarse LOD stops descending as
+	/// soon as it reaches a node of that height.
+	/// </summary>
+	class VoxelOctree
+	{
+	public:
+		using NodeCallback = std::function<void(VoxelCoord min, int size, uint32_t voxel)>;
+
+	private:
+		VoxelCoord m_origin = {};
+		int m_depth = 0;
+		VoxelOctreeNode m_root = {};
+		std::vector<VoxelOctreeNode> m_nodes = {};
+
+		VoxelOctreeNode buildNode(const VoxelGrid& grid, int x, int y, int z, int height, const VoxelChunk* chunk);
+		void visitNode(const VoxelOctreeNode& node, int x, int y, int z, int height, unsigned int lod, const NodeCallback& fn) const;
+
+	public:
+		VoxelOctree() = default;
+		~VoxelOctree() = default;
+
+		/// <summary>
+		/// Builds the octree over the cube [origin, origin + 2^depth) of grid, chunks that are missing or
+		/// uniform collapse without visiting their voxels. Throws for depth above c_octree_max_depth.
+		/// </summary>
+		void Build(const VoxelGrid& grid, VoxelCoord origin, int depth);
+		void Clear();
+
+		/// <summary>
+		/// Returns the packed voxel covering x,y,z (grid coordinates) at the requested LOD, 0 being full
+		/// detail. Each LOD step doubles the edge of the node that answers, the LOD nibble of the result
+		/// tells the caller the height it actually came from.
+		/// </summary>
+		uint32_t GetVoxel(int x, int y, int z, unsigned int lod = 0) const;
+
+		/// <summary>
+		/// Visits the non-empty nodes that make up the volume at the requested LOD, collapsed nodes are
+		/// reported once at their own size
+		/// </summary>
+		void ForEachNode(unsigned int lod, const NodeCallback& fn) const;
+
+		const VoxelCoord& GetOrigin() const { return m_origin; }
+		int GetDepth() const { return m_depth; }
+		int GetSize() const { return 1 << m_depth; }
+		size_t GetNodeCount() const { return m_nodes.size() + 1; }
+		size_t GetMemoryUsage() const { return sizeof(VoxelOctree) + m_nodes.capacity() * sizeof(VoxelOctreeNode); }
+	};
+	using VoxelOctreePtr = std::unique_ptr<VoxelOctree>;
+	using VoxelOctreeRaw = VoxelOctree*;
+}
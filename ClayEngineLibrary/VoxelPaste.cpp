@@ -0,0 +1,509 @@
+#include "pch.h"
+#include "VoxelPaste.h"
+#include "Strings.h"
+#include "Benchmark.h"
+
+#include <immintrin.h>
+
+using namespace ClayEngine;
+
+namespace
+{
+	constexpr auto c_n = c_voxel_chunk_size;
+	static_assert(c_n <= 32, "gatherRowAVX2 marks a row's lanes in one 32 bit mask");
+	constexpr auto c_out_of_range = INT32_MIN; // What cvttps gives for a float outside int range
+
+	/// <summary>
+	/// Clipboard coordinates of one destination row, position i is base + i * step, with the floor of
+	/// each as an int for the lookups
+	/// </summary>
+	void transformRowScalar(const float (&base)[3], const float (&step)[3], VoxelPasteScratch& scratch)
+	{
+		float* out[3] = { scratch.X, scratch.Y, scratch.Z };
+		int32_t* cells[3] = { scratch.IX, scratch.IY, scratch.IZ };
+
+		for (auto axis = 0; axis < 3; ++axis)
+			for (auto i = 0; i < c_n; ++i)
+			{
+				auto v = base[axis] + static_cast<float>(i) * step[axis];
+				auto f = std::floor(v);
+				out[axis][i] = v;
+				cells[axis][i] = (f >= -2147483648.f && f < 2147483648.f) ? static_cast<int32_t>(f) : c_out_of_range;
+			}
+	}
+
+	CLAY_TARGET_AVX2 void transformRowAVX2(const float (&base)[3], const float (&step)[3], VoxelPasteScratch& scratch)
+	{
+		float* out[3] = { scratch.X, scratch.Y, scratch.Z };
+		int32_t* cells[3] = { scratch.IX, scratch.IY, scratch.IZ };
+		const auto lanes = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+
+		for (auto axis = 0; axis < 3; ++axis)
+		{
+			auto b = _mm256_set1_ps(base[axis]);
+			auto s = _mm256_set1_ps(step[axis]);
+
+			// Same multiply then add as the scalar row, no FMA, so both kernels land on the same voxels
+			for (auto i = 0; i < c_n; i += 8)
+			{
+				auto t = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(i)), lanes);
+				auto v = _mm256_add_ps(b, _mm256_mul_ps(t, s));
+				_mm256_store_ps(out[axis] + i, v);
+				_mm256_store_si256(reinterpret_cast<__m256i*>(cells[axis] + i), _mm256_cvttps_epi32(_mm256_floor_ps(v)));
+			}
+		}
+	}
+
+	bool inside(const VoxelCoord& size, int32_t x, int32_t y, int32_t z)
+	{
+		return x >= 0 && y >= 0 && z >= 0 && x < size.X && y < size.Y && z < size.Z;
+	}
+
+	CLAY_TARGET_AVX2 __m256i mortonSpreadAVX2(__m256i v)
+	{
+		v = _mm256_and_si256(v, _mm256_set1_epi32(c_voxel_chunk_mask));
+		v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 8)), _mm256_set1_epi32(0x100F));
+		v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 4)), _mm256_set1_epi32(0x10C3));
+		v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 2)), _mm256_set1_epi32(0x1249));
+		return v;
+	}
+
+	/// <summary>
+	/// Nearest samples for the first count positions of a transformed row, 8 at a time. A group whose
+	/// lanes are all inside the clipboard and in one brick has its Morton indices built in registers
+	/// and its voxels gathered from that brick; the returned mask has a bit per lane written, the other
+	/// groups (straddling a brick edge or the clipboard bounds) are left to the scalar sampler.
+	/// </summary>
+	CLAY_TARGET_AVX2 uint32_t gatherRowAVX2(const VoxelClipboard& clipboard, VoxelPasteScratch& scratch, int count, bool air, uint32_t* voxels, uint8_t* covered, bool& any)
+	{
+		const auto& size = clipboard.GetSize();
+		const auto zero = _mm256_setzero_si256();
+		const auto lastX = _mm256_set1_epi32(size.X - 1), lastY = _mm256_set1_epi32(size.Y - 1), lastZ = _mm256_set1_epi32(size.Z - 1);
+		const auto empty = _mm256_set1_epi32(static_cast<int>(c_voxel_empty));
+
+		uint32_t gathered = 0;
+		for (auto i = 0; i + 8 <= count; i += 8)
+		{
+			auto x = _mm256_load_si256(reinterpret_cast<const __m256i*>(scratch.IX + i));
+			auto y = _mm256_load_si256(reinterpret_cast<const __m256i*>(scratch.IY + i));
+			auto z = _mm256_load_si256(reinterpret_cast<const __m256i*>(scratch.IZ + i));
+
+			// Negative (and out of range) coordinates fail the first compare, the clipboard size the second
+			auto outside = _mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi32(zero, x), _mm256_cmpgt_epi32(zero, y)), _mm256_cmpgt_epi32(zero, z));
+			outside = _mm256_or_si256(outside, _mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi32(x, lastX), _mm256_cmpgt_epi32(y, lastY)), _mm256_cmpgt_epi32(z, lastZ)));
+			if (!_mm256_testz_si256(outside, outside)) continue;
+
+			auto bx = _mm256_srai_epi32(x, c_voxel_chunk_bits), by = _mm256_srai_epi32(y, c_voxel_chunk_bits), bz = _mm256_srai_epi32(z, c_voxel_chunk_bits);
+			auto bx0 = scratch.IX[i] >> c_voxel_chunk_bits, by0 = scratch.IY[i] >> c_voxel_chunk_bits, bz0 = scratch.IZ[i] >> c_voxel_chunk_bits;
+			auto same = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi32(bx, _mm256_set1_epi32(bx0)), _mm256_cmpeq_epi32(by, _mm256_set1_epi32(by0))), _mm256_cmpeq_epi32(bz, _mm256_set1_epi32(bz0)));
+			if (_mm256_movemask_epi8(same) != -1) continue;
+
+			// Lanes the scalar sampler would find no brick for are uncovered there too
+			gathered |= 0xFFu << i;
+			auto brick = scratch.GetBrick(clipboard, bx0, by0, bz0);
+			if (!brick)
+			{
+				std::fill(voxels + i, voxels + i + 8, c_voxel_empty);
+				std::fill(covered + i, covered + i + 8, static_cast<uint8_t>(0));
+				continue;
+			}
+
+			auto morton = _mm256_or_si256(_mm256_or_si256(mortonSpreadAVX2(x), _mm256_slli_epi32(mortonSpreadAVX2(y), 1)), _mm256_slli_epi32(mortonSpreadAVX2(z), 2));
+			auto values = _mm256_i32gather_epi32(reinterpret_cast<const int*>(brick->Voxels), morton, 4);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(voxels + i), values);
+
+			auto mask = air ? 0 : _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(values, empty)));
+			for (auto lane = 0; lane < 8; ++lane) covered[i + lane] = (mask >> lane) & 1 ? 0 : 1;
+			any |= mask != 0xFF;
+		}
+		return gathered;
+	}
+}
+
+#pragma region Voxel Transform Implementation
+ClayEngine::VoxelTransform ClayEngine::VoxelTransform::Translation(double x, double y, double z)
+{
+	VoxelTransform result = {};
+	result.M[0][3] = x;
+	result.M[1][3] = y;
+	result.M[2][3] = z;
+	return result;
+}
+
+ClayEngine::VoxelTransform ClayEngine::VoxelTransform::Scale(double x, double y, double z)
+{
+	VoxelTransform result = {};
+	result.M[0][0] = x;
+	result.M[1][1] = y;
+	result.M[2][2] = z;
+	return result;
+}
+
+ClayEngine::VoxelTransform ClayEngine::VoxelTransform::Rotation(const double (&quaternion)[4])
+{
+	auto x = quaternion[0], y = quaternion[1], z = quaternion[2], w = quaternion[3];
+
+	VoxelTransform result = {};
+	result.M[0][0] = 1. - 2. * (y * y + z * z);
+	result.M[0][1] = 2. * (x * y - z * w);
+	result.M[0][2] = 2. * (x * z + y * w);
+	result.M[1][0] = 2. * (x * y + z * w);
+	result.M[1][1] = 1. - 2. * (x * x + z * z);
+	result.M[1][2] = 2. * (y * z - x * w);
+	result.M[2][0] = 2. * (x * z - y * w);
+	result.M[2][1] = 2. * (y * z + x * w);
+	result.M[2][2] = 1. - 2. * (x * x + y * y);
+	return result;
+}
+
+ClayEngine::VoxelTransform ClayEngine::VoxelTransform::operator*(const VoxelTransform& rhs) const
+{
+	VoxelTransform result = {};
+	for (auto r = 0; r < 3; ++r)
+	{
+		for (auto c = 0; c < 4; ++c)
+			result.M[r][c] = M[r][0] * rhs.M[0][c] + M[r][1] * rhs.M[1][c] + M[r][2] * rhs.M[2][c];
+		result.M[r][3] += M[r][3];
+	}
+	return result;
+}
+
+void ClayEngine::VoxelTransform::Apply(const double (&point)[3], double (&result)[3]) const
+{
+	for (auto r = 0; r < 3; ++r) result[r] = M[r][0] * point[0] + M[r][1] * point[1] + M[r][2] * point[2] + M[r][3];
+}
+
+bool ClayEngine::VoxelTransform::Inverse(VoxelTransform& result) const
+{
+	// Inverse of the 3x3 part by cofactors, then the translation is carried through it
+	double c[3][3] = {};
+	c[0][0] = M[1][1] * M[2][2] - M[1][2] * M[2][1];
+	c[0][1] = M[0][2] * M[2][1] - M[0][1] * M[2][2];
+	c[0][2] = M[0][1] * M[1][2] - M[0][2] * M[1][1];
+	c[1][0] = M[1][2] * M[2][0] - M[1][0] * M[2][2];
+	c[1][1] = M[0][0] * M[2][2] - M[0][2] * M[2][0];
+	c[1][2] = M[0][2] * M[1][0] - M[0][0] * M[1][2];
+	c[2][0] = M[1][0] * M[2][1] - M[1][1] * M[2][0];
+	c[2][1] = M[0][1] * M[2][0] - M[0][0] * M[2][1];
+	c[2][2] = M[0][0] * M[1][1] - M[0][1] * M[1][0];
+
+	auto determinant = M[0][0] * c[0][0] + M[0][1] * c[1][0] + M[0][2] * c[2][0];
+	if (std::abs(determinant) < 1e-12) return false;
+
+	for (auto r = 0; r < 3; ++r)
+	{
+		for (auto k = 0; k < 3; ++k) result.M[r][k] = c[r][k] / determinant;
+		result.M[r][3] = -(result.M[r][0] * M[0][3] + result.M[r][1] * M[1][3] + result.M[r][2] * M[2][3]);
+	}
+	return true;
+}
+#pragma endregion
+
+#pragma region Paste Scratch Implementation
+ClayEngine::VoxelPasteScratch::VoxelPasteScratch()
+	: Decoder(std::make_unique<VoxelChunkDecoder>())
+{
+	Voxels.resize(c_voxel_chunk_volume);
+	Covered.resize(c_voxel_chunk_volume);
+}
+
+const ClayEngine::VoxelChunk* ClayEngine::VoxelPasteScratch::GetBrick(const VoxelClipboard& clipboard, int bx, int by, int bz)
+{
+	const auto& counts = clipboard.GetBrickCounts();
+	auto index = (bz * counts.Y + by) * counts.X + bx;
+	++Clock;
+
+	CachedBrick* victim = &Bricks[0];
+	for (auto& brick : Bricks)
+	{
+		if (brick.Index == index)
+		{
+			brick.Used = Clock;
+			return brick.Chunk.get();
+		}
+		if (brick.Used < victim->Used) victim = &brick;
+	}
+
+	if (!victim->Chunk) victim->Chunk = std::make_unique<VoxelChunk>();
+	if (!clipboard.DecodeBrick(bx, by, bz, *Decoder, *victim->Chunk))
+	{
+		victim->Index = -1;
+		victim->Used = 0;
+		return nullptr;
+	}
+
+	victim->Index = index;
+	victim->Used = Clock;
+	return victim->Chunk.get();
+}
+
+void ClayEngine::VoxelPasteScratch::Reset()
+{
+	for (auto& brick : Bricks)
+	{
+		brick.Index = -1;
+		brick.Used = 0;
+	}
+	Clock = 0;
+}
+#pragma endregion
+
+#pragma region Voxel Paster Implementation
+ClayEngine::VoxelPaster::VoxelPaster(WorkerPoolRaw pool)
+	: VoxelPaster(pool, VoxelBatchCodec::DetectKernel())
+{
+
+}
+
+ClayEngine::VoxelPaster::VoxelPaster(WorkerPoolRaw pool, VoxelCodecKernel kernel)
+	: m_pool(pool)
+	, m_kernel(VoxelBatchCodec::ClampKernel(kernel))
+{
+	auto threads = m_pool ? m_pool->GetThreadCount() : 1;
+	for (size_t i = 0; i < threads; ++i) m_scratch.push_back(std::make_unique<VoxelPasteScratch>());
+}
+
+ClayEngine::VoxelBox ClayEngine::VoxelPaster::GetBounds(const VoxelClipboard& clipboard, const VoxelTransform& transform)
+{
+	if (clipboard.IsEmpty()) return {};
+
+	const auto& size = clipboard.GetSize();
+	double low[3] = { DBL_MAX, DBL_MAX, DBL_MAX };
+	double high[3] = { -DBL_MAX, -DBL_MAX, -DBL_MAX };
+
+	for (auto corner = 0; corner < 8; ++corner)
+	{
+		const double point[3] = { (corner & 1) ? size.X : 0., (corner & 2) ? size.Y : 0., (corner & 4) ? size.Z : 0. };
+		double result[3] = {};
+		transform.Apply(point, result);
+		for (auto axis = 0; axis < 3; ++axis)
+		{
+			low[axis] = std::min(low[axis], result[axis]);
+			high[axis] = std::max(high[axis], result[axis]);
+		}
+	}
+
+	return {
+		{ static_cast<int>(std::floor(low[0])), static_cast<int>(std::floor(low[1])), static_cast<int>(std::floor(low[2])) },
+		{ static_cast<int>(std::ceil(high[0])), static_cast<int>(std::ceil(high[1])), static_cast<int>(std::ceil(high[2])) }
+	};
+}
+
+bool ClayEngine::VoxelPaster::pasteTile(const VoxelClipboard& clipboard, const VoxelPasteSettings& settings, const VoxelTransform& inverse, const VoxelBox& tile, VoxelPasteScratch& scratch) const
+{
+	const auto& size = clipboard.GetSize();
+	const auto trilinear = settings.Filter == VoxelPasteFilter::Trilinear;
+
+	// Trilinear looks at the 8 voxels whose centres surround the sample, so shift by half a voxel
+	const auto shift = trilinear ? .5 : 0.;
+	const float step[3] = { static_cast<float>(inverse.M[0][0]), static_cast<float>(inverse.M[1][0]), static_cast<float>(inverse.M[2][0]) };
+
+	auto sample = [&](int32_t x, int32_t y, int32_t z, uint32_t& value) {
+		if (!inside(size, x, y, z)) return false;
+		auto brick = scratch.GetBrick(clipboard, x >> c_voxel_chunk_bits, y >> c_voxel_chunk_bits, z >> c_voxel_chunk_bits);
+		if (!brick) return false;
+		value = brick->Get(x, y, z);
+		return true;
+	};
+
+	auto any = false;
+	size_t i = 0;
+	for (auto z = tile.Min.Z; z < tile.Max.Z; ++z)
+		for (auto y = tile.Min.Y; y < tile.Max.Y; ++y)
+		{
+			// Row origin in double so far away pastes keep their precision, the steps along it are small
+			const double centre[3] = { tile.Min.X + .5, y + .5, z + .5 };
+			double origin[3] = {};
+			inverse.Apply(centre, origin);
+			const float base[3] = { static_cast<float>(origin[0] - shift), static_cast<float>(origin[1] - shift), static_cast<float>(origin[2] - shift) };
+
+			if (m_kernel == VoxelCodecKernel::AVX2) transformRowAVX2(base, step, scratch);
+			else transformRowScalar(base, step, scratch);
+
+			uint32_t gathered = 0;
+			if (!trilinear && m_kernel == VoxelCodecKernel::AVX2) gathered = gatherRowAVX2(clipboard, scratch, tile.SizeX(), settings.Air, scratch.Voxels.data() + i, scratch.Covered.data() + i, any);
+
+			for (auto x = 0; x < tile.SizeX(); ++x, ++i)
+			{
+				if ((gathered >> x) & 1) continue;
+
+				uint32_t value = c_voxel_empty;
+				auto covered = false;
+
+				if (!trilinear)
+				{
+					covered = sample(scratch.IX[x], scratch.IY[x], scratch.IZ[x], value);
+				}
+				else if (scratch.IX[x] != c_out_of_range && scratch.IY[x] != c_out_of_range && scratch.IZ[x] != c_out_of_range)
+				{
+					// Vote among the 8 neighbours by trilinear weight, the selection counts as covering
+					// the voxel when at least half the weight falls inside it
+					float f[3] = { scratch.X[x] - scratch.IX[x], scratch.Y[x] - scratch.IY[x], scratch.Z[x] - scratch.IZ[x] };
+					uint32_t values[8] = {};
+					float weights[8] = {};
+					auto distinct = 0;
+					auto total = 0.f;
+
+					for (auto corner = 0; corner < 8; ++corner)
+					{
+						auto dx = corner & 1, dy = (corner >> 1) & 1, dz = (corner >> 2) & 1;
+						uint32_t v = 0;
+						if (!sample(scratch.IX[x] + dx, scratch.IY[x] + dy, scratch.IZ[x] + dz, v)) continue;
+
+						auto w = (dx ? f[0] : 1.f - f[0]) * (dy ? f[1] : 1.f - f[1]) * (dz ? f[2] : 1.f - f[2]);
+						total += w;
+
+						auto k = 0;
+						while (k < distinct && values[k] != v) ++k;
+						if (k == distinct)
+						{
+							values[k] = v;
+							weights[k] = 0.f;
+							++distinct;
+						}
+						weights[k] += w;
+					}
+
+					if (total >= .5f)
+					{
+						auto best = 0;
+						for (auto k = 1; k < distinct; ++k) if (weights[k] > weights[best]) best = k;
+						value = values[best];
+						covered = true;
+					}
+				}
+
+				if (covered && !settings.Air && value == c_voxel_empty) covered = false;
+				scratch.Voxels[i] = value;
+				scratch.Covered[i] = covered ? 1 : 0;
+				any |= covered;
+			}
+		}
+
+	return any;
+}
+
+ClayEngine::VoxelPasteStats ClayEngine::VoxelPaster::Paste(const VoxelClipboard& clipboard, const VoxelPasteSettings& settings, VoxelGrid& grid)
+{
+	return Paste(clipboard, settings, [&](const VoxelBox& box, const uint32_t* voxels, const uint8_t* covered) {
+		// A tile is one cell and no two tiles share one, so only the chunk map needs the lock and the
+		// covered voxels are written straight into the chunk while other workers write theirs
+		VoxelChunkRaw chunk = nullptr;
+		{
+			auto cx = box.Min.X >> c_voxel_chunk_bits, cy = box.Min.Y >> c_voxel_chunk_bits, cz = box.Min.Z >> c_voxel_chunk_bits;
+
+			LockGuard lock(m_mutex);
+			chunk = grid.GetChunk(cx, cy, cz);
+			if (!chunk) chunk = grid.MakeChunk(cx, cy, cz);
+		}
+
+		size_t i = 0;
+		for (auto z = box.Min.Z; z < box.Max.Z; ++z)
+			for (auto y = box.Min.Y; y < box.Max.Y; ++y)
+				for (auto x = box.Min.X; x < box.Max.X; ++x, ++i)
+				{
+					if (covered[i]) chunk->Set(x, y, z, voxels[i]);
+				}
+	});
+}
+
+ClayEngine::VoxelPasteStats ClayEngine::VoxelPaster::Paste(const VoxelClipboard& clipboard, const VoxelPasteSettings& settings, const VoxelPasteCommit& commit)
+{
+	VoxelPasteStats stats = {};
+
+	VoxelTransform inverse = {};
+	if (clipboard.IsEmpty() || !settings.Transform.Inverse(inverse)) return stats;
+
+	auto bounds = GetBounds(clipboard, settings.Transform);
+	if (bounds.IsEmpty()) return stats;
+
+	// One tile per destination cell the bounds overlap
+	std::vector<VoxelBox> tiles = {};
+	for (auto cz = bounds.Min.Z >> c_voxel_chunk_bits; cz <= (bounds.Max.Z - 1) >> c_voxel_chunk_bits; ++cz)
+		for (auto cy = bounds.Min.Y >> c_voxel_chunk_bits; cy <= (bounds.Max.Y - 1) >> c_voxel_chunk_bits; ++cy)
+			for (auto cx = bounds.Min.X >> c_voxel_chunk_bits; cx <= (bounds.Max.X - 1) >> c_voxel_chunk_bits; ++cx)
+			{
+				VoxelCoord min = { cx * c_voxel_chunk_size, cy * c_voxel_chunk_size, cz * c_voxel_chunk_size };
+				tiles.push_back({
+					{ std::max(bounds.Min.X, min.X), std::max(bounds.Min.Y, min.Y), std::max(bounds.Min.Z, min.Z) },
+					{ std::min(bounds.Max.X, min.X + c_n), std::min(bounds.Max.Y, min.Y + c_n), std::min(bounds.Max.Z, min.Z + c_n) }
+				});
+			}
+	stats.Tiles = tiles.size();
+
+	for (auto& scratch : m_scratch) scratch->Reset();
+
+	std::atomic<size_t> committed = 0;
+	std::atomic<size_t> voxels = 0;
+	auto job = [&](size_t index, size_t worker) {
+		auto& scratch = *m_scratch[worker];
+		const auto& tile = tiles[index];
+		if (!pasteTile(clipboard, settings, inverse, tile, scratch)) return;
+
+		commit(tile, scratch.Voxels.data(), scratch.Covered.data());
+
+		size_t count = 0;
+		for (size_t i = 0; i < tile.Volume(); ++i) count += scratch.Covered[i];
+		voxels += count;
+		++committed;
+	};
+
+	if (m_pool) m_pool->ParallelFor(tiles.size(), job);
+	else for (size_t i = 0; i < tiles.size(); ++i) job(i, 0);
+
+	stats.Committed = committed;
+	stats.Voxels = voxels;
+	return stats;
+}
+#pragma endregion
+
+ClayEngine::VoxelPasteBenchmark ClayEngine::RunVoxelPasteBenchmark(WorkerPoolRaw pool, int size)
+{
+	VoxelPasteBenchmark result = {};
+
+	// A prefab with some structure, a hollow shell of one material around a core of another
+	VoxelGrid source;
+	VoxelBox box = { { 0, 0, 0 }, { size, size, size } };
+	source.Fill(box, 1);
+	source.Fill({ { 4, 4, 4 }, { size - 4, size - 4, size - 4 } }, c_voxel_empty);
+	source.Fill({ { size / 3, size / 3, size / 3 }, { 2 * size / 3, 2 * size / 3, 2 * size / 3 } }, 2);
+
+	VoxelClipboard clipboard;
+	clipboard.Copy(source, box);
+
+	const auto angle = 3.14159265358979 / 12.; // Half of 30 degrees
+	const double yaw[4] = { 0., std::sin(angle), 0., std::cos(angle) };
+	const double pitch[4] = { std::sin(angle), 0., 0., std::cos(angle) };
+
+	VoxelPasteSettings settings = {};
+	settings.Transform = VoxelTransform::Translation(1000., 0., 1000.) * VoxelTransform::Rotation(yaw) * VoxelTransform::Rotation(pitch) * VoxelTransform::Scale(1.5, 1.5, 1.5);
+	result.VoxelCount = VoxelPaster::GetBounds(clipboard, settings.Transform).Volume();
+
+	auto run = [&](VoxelPaster& paster) {
+		VoxelGrid destination;
+		auto start = std::chrono::steady_clock::now();
+		paster.Paste(clipboard, settings, destination);
+		return PerSecond(result.VoxelCount, std::chrono::steady_clock::now() - start);
+	};
+
+	VoxelPaster scalar(nullptr, VoxelCodecKernel::Scalar);
+	result.ScalarVoxelsPerSecond = run(scalar);
+
+	VoxelPaster batch(pool);
+	result.Kernel = batch.GetKernel();
+	result.ThreadCount = pool ? pool->GetThreadCount() : 1;
+	result.BatchVoxelsPerSecond = run(batch);
+
+	settings.Filter = VoxelPasteFilter::Trilinear;
+	result.TrilinearVoxelsPerSecond = run(batch);
+
+	std::wstringstream wss;
+	wss << std::fixed << std::setprecision(2)
+		<< L"VoxelPaste " << result.VoxelCount << L" voxels"
+		<< L" | Scalar 1 thread " << result.ScalarVoxelsPerSecond / 1e6 << L" Mvox/sec"
+		<< L" | " << VoxelBatchCodec::GetKernelName(result.Kernel) << L" " << result.ThreadCount << L" threads " << result.BatchVoxelsPerSecond / 1e6 << L" Mvox/sec"
+		<< L" | Trilinear " << result.TrilinearVoxelsPerSecond / 1e6 << L" Mvox/sec";
+	WriteLine(wss.str());
+
+	return result;
+}
@@ -0,0 +1,176 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* Parallel tiled resampling of rotated and scaled clipboard pastes           */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "Services.h"
+#include "VoxelBatchCodec.h"
+#include "VoxelClipboard.h"
+#include "WorkerPool.h"
+
+namespace ClayEngine
+{
+	constexpr auto c_paste_brick_cache{ 8 }; // Decoded clipboard bricks kept per worker, a rotated tile usually reads from 4 to 8
+
+	/// <summary>
+	/// Affine transform as the top three rows of a 4x4 matrix, column 3 is the translation
+	/// </summary>
+	struct VoxelTransform
+	{
+		double M[3][4] = { { 1., 0., 0., 0. }, { 0., 1., 0., 0. }, { 0., 0., 1., 0. } };
+
+		static VoxelTransform Translation(double x, double y, double z);
+		static VoxelTransform Scale(double x, double y, double z);
+		/// <summary>
+		/// Rotation by a unit quaternion given as x, y, z, w
+		/// </summary>
+		static VoxelTransform Rotation(const double (&quaternion)[4]);
+
+		/// <summary>
+		/// Composition that applies rhs first, as with matrices
+		/// </summary>
+		VoxelTransform operator*(const VoxelTransform& rhs) const;
+		void Apply(const double (&point)[3], double (&result)[3]) const;
+		/// <summary>
+		/// False when the transform is singular, e.g. a zero scale
+		/// </summary>
+		bool Inverse(VoxelTransform& result) const;
+	};
+
+	enum class VoxelPasteFilter
+	{
+		Nearest,
+		Trilinear, // Weighted vote of the 8 nearest voxels, packed words can't be blended so the heaviest one wins
+	};
+
+	struct VoxelPasteSettings
+	{
+		VoxelTransform Transform = {}; // Clipboard space (0 based, continuous) to destination voxel space
+		VoxelPasteFilter Filter = VoxelPasteFilter::Nearest;
+		bool Air = true; // False leaves the destination where the selection is empty
+	};
+
+	struct VoxelPasteStats
+	{
+		size_t Tiles = 0; // Destination cells the paste overlaps
+		size_t Committed = 0; // Cells that received at least one voxel
+		size_t Voxels = 0; // Voxels written
+	};
+
+	/// <summary>
+	/// Receives one finished tile, box lies inside a single destination cell, voxels and covered are
+	/// dense x-fastest arrays of box.Volume() and voxels[i] is only meaningful where covered[i] is set.
+	/// Called from the worker threads, possibly at the same time.
+	/// </summary>
+	using VoxelPasteCommit = std::function<void(const VoxelBox& box, const uint32_t* voxels, const uint8_t* covered)>;
+
+	/// <summary>
+	/// Per-thread working memory, one tile of output, the coordinates of one row and the decoded brick cache
+	/// </summary>
+	struct VoxelPasteScratch
+	{
+		struct CachedBrick
+		{
+			int Index = -1;
+			uint64_t Used = 0;
+			std::unique_ptr<VoxelChunk> Chunk = nullptr;
+		};
+
+		VoxelChunkDecoderPtr Decoder = nullptr;
+		CachedBrick Bricks[c_paste_brick_cache] = {};
+		uint64_t Clock = 0;
+
+		std::vector<uint32_t> Voxels = {};
+		std::vector<uint8_t> Covered = {};
+
+		alignas(32) float X[c_voxel_chunk_size] = {};
+		alignas(32) float Y[c_voxel_chunk_size] = {};
+		alignas(32) float Z[c_voxel_chunk_size] = {};
+		alignas(32) int32_t IX[c_voxel_chunk_size] = {};
+		alignas(32) int32_t IY[c_voxel_chunk_size] = {};
+		alignas(32) int32_t IZ[c_voxel_chunk_size] = {};
+
+		VoxelPasteScratch();
+
+		/// <summary>
+		/// Decoded brick bx,by,bz of clipboard, nullptr if it doesn't exist or is corrupt
+		/// </summary>
+		const VoxelChunk* GetBrick(const VoxelClipboard& clipboard, int bx, int by, int bz);
+		/// <summary>
+		/// Forgets the cached bricks, they belong to the previous clipboard
+		/// </summary>
+		void Reset();
+	};
+	using VoxelPasteScratchPtr = std::unique_ptr<VoxelPasteScratch>;
+
+	/// <summary>
+	/// Pastes a clipboard through an arbitrary affine transform. The destination bounds are split into
+	/// tiles along the cell grid and every tile is filled on its own worker by inverse transforming its
+	/// voxel centres into the clipboard (8 at a time with AVX2) and sampling the compressed bricks
+	/// through a small per-worker cache of decoded ones. With AVX2, nearest sampling gathers 8 voxels
+	/// at once wherever they share a brick; the trilinear vote stays scalar. Each finished tile is
+	/// committed in one go, and since a tile is exactly one cell the workers commit to their cells side by side.
+	/// </summary>
+	class VoxelPaster
+	{
+		WorkerPoolRaw m_pool = nullptr;
+		VoxelCodecKernel m_kernel = VoxelCodecKernel::Scalar;
+		std::vector<VoxelPasteScratchPtr> m_scratch = {};
+		MUTEX m_mutex = {};
+
+		bool pasteTile(const VoxelClipboard& clipboard, const VoxelPasteSettings& settings, const VoxelTransform& inverse, const VoxelBox& tile, VoxelPasteScratch& scratch) const;
+
+	public:
+		VoxelPaster(WorkerPoolRaw pool = nullptr);
+		VoxelPaster(WorkerPoolRaw pool, VoxelCodecKernel kernel);
+		~VoxelPaster() = default;
+
+		VoxelPaster(const VoxelPaster&) = delete;
+		VoxelPaster& operator=(const VoxelPaster&) = delete;
+
+		/// <summary>
+		/// Destination voxels the transformed selection can touch
+		/// </summary>
+		static VoxelBox GetBounds(const VoxelClipboard& clipboard, const VoxelTransform& transform);
+
+		/// <summary>
+		/// Pastes into grid, covered voxels are written straight into each tile's chunk. Only finding or
+		/// creating the chunk is locked, the grid must not be used elsewhere during the paste.
+		/// </summary>
+		VoxelPasteStats Paste(const VoxelClipboard& clipboard, const VoxelPasteSettings& settings, VoxelGrid& grid);
+		/// <summary>
+		/// Pastes through commit for destinations other than a VoxelGrid. Not reentrant, the scratch
+		/// space belongs to the paster.
+		/// </summary>
+		VoxelPasteStats Paste(const VoxelClipboard& clipboard, const VoxelPasteSettings& settings, const VoxelPasteCommit& commit);
+
+		VoxelCodecKernel GetKernel() const { return m_kernel; }
+	};
+	using VoxelPasterPtr = std::unique_ptr<VoxelPaster>;
+
+	struct VoxelPasteBenchmark
+	{
+		size_t VoxelCount = 0; // Destination voxels per paste
+		size_t ThreadCount = 0;
+		double ScalarVoxelsPerSecond = 0.; // One thread, scalar kernel
+		double BatchVoxelsPerSecond = 0.; // Pool threads, detected kernel
+		double TrilinearVoxelsPerSecond = 0.;
+		VoxelCodecKernel Kernel = VoxelCodecKernel::Scalar;
+	};
+
+	/// <summary>
+	/// Pastes a size^3 prefab rotated 30 degrees about two axes and scaled by 1.5 on one thread with the
+	/// scalar kernel and on pool's threads with the detected kernel, and writes the voxels per second to
+	/// the console
+	/// </summary>
+	VoxelPasteBenchmark RunVoxelPasteBenchmark(WorkerPoolRaw pool, int size = 96);
+}
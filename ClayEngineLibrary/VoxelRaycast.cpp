@@ -0,0 +1,348 @@
+#include "pch.h"
+#include "VoxelRaycast.h"
+#include "VoxelOctree.h"
+#include "Strings.h"
+#include "Benchmark.h"
+
+#include <random>
+
+using namespace ClayEngine;
+
+namespace
+{
+	constexpr int c_level_shift[3] = { c_voxel_chunk_bits, c_ray_brick_bits, 0 }; // Chunks, bricks, voxels
+	constexpr auto c_brick_words{ 1 << (3 * c_ray_brick_bits) };
+	constexpr auto c_infinity{ std::numeric_limits<double>::infinity() };
+
+	bool normalise(const double (&direction)[3], double (&result)[3])
+	{
+		auto length = std::sqrt(direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2]);
+		if (length <= 0.) return false;
+		for (auto i = 0; i < 3; ++i) result[i] = direction[i] / length;
+		return true;
+	}
+
+	int brickBit(int bx, int by, int bz)
+	{
+		// Bricks are the top six bits of the Morton index, the same order they sit in memory
+		return static_cast<int>(MortonIndex(bx << c_ray_brick_bits, by << c_ray_brick_bits, bz << c_ray_brick_bits) >> (3 * c_ray_brick_bits));
+	}
+
+	/// <summary>
+	/// Single level DDA through GetVoxel, the straightforward version the benchmark compares against
+	/// </summary>
+	bool castNaive(const VoxelGrid& grid, const VoxelRay& ray, VoxelRayHit& hit)
+	{
+		hit = {};
+		double d[3] = {};
+		if (!normalise(ray.Direction, d)) return false;
+
+		int cell[3], step[3];
+		double tMax[3], tDelta[3];
+		for (auto i = 0; i < 3; ++i)
+		{
+			cell[i] = static_cast<int>(std::floor(ray.Origin[i]));
+			step[i] = d[i] > 0. ? 1 : (d[i] < 0. ? -1 : 0);
+			tMax[i] = step[i] > 0 ? (cell[i] + 1 - ray.Origin[i]) / d[i] : (step[i] < 0 ? (cell[i] - ray.Origin[i]) / d[i] : c_infinity);
+			tDelta[i] = step[i] ? 1. / std::abs(d[i]) : c_infinity;
+		}
+
+		auto t = 0.;
+		auto axis = -1;
+		while (t <= ray.MaxDistance)
+		{
+			auto value = grid.GetVoxel(cell[0], cell[1], cell[2]);
+			if (!IsVoxelEmpty(value))
+			{
+				hit.Hit = true;
+				hit.Position = { cell[0], cell[1], cell[2] };
+				hit.Distance = t;
+				hit.Value = value;
+				if (axis >= 0) hit.Normal[axis] = -step[axis];
+				return true;
+			}
+
+			axis = tMax[0] < tMax[1] ? (tMax[0] < tMax[2] ? 0 : 2) : (tMax[1] < tMax[2] ? 1 : 2);
+			t = tMax[axis];
+			cell[axis] += step[axis];
+			tMax[axis] += tDelta[axis];
+		}
+		return false;
+	}
+}
+
+#pragma region Voxel Raycaster Implementation
+ClayEngine::VoxelRaycaster::VoxelRaycaster(const VoxelGrid& grid, WorkerPoolRaw pool)
+	: m_grid(&grid)
+	, m_pool(pool)
+{
+	Rebuild();
+}
+
+uint64_t ClayEngine::VoxelRaycaster::summarise(const VoxelChunk& chunk)
+{
+	uint64_t bricks = 0;
+	for (auto b = 0; b < c_voxel_chunk_volume / c_brick_words; ++b)
+	{
+		auto words = chunk.Voxels + b * c_brick_words;
+		for (auto i = 0; i < c_brick_words; ++i)
+		{
+			if (!IsVoxelEmpty(words[i]))
+			{
+				bricks |= 1ull << b;
+				break;
+			}
+		}
+	}
+	return bricks;
+}
+
+void ClayEngine::VoxelRaycaster::updateBounds()
+{
+	m_bounds = {};
+	auto first = true;
+	for (auto& element : m_cells)
+	{
+		auto c = VoxelGrid::GetChunkCoord(element.first);
+		if (first)
+		{
+			m_bounds = { c, { c.X + 1, c.Y + 1, c.Z + 1 } };
+			first = false;
+			continue;
+		}
+		m_bounds.Min = { std::min(m_bounds.Min.X, c.X), std::min(m_bounds.Min.Y, c.Y), std::min(m_bounds.Min.Z, c.Z) };
+		m_bounds.Max = { std::max(m_bounds.Max.X, c.X + 1), std::max(m_bounds.Max.Y, c.Y + 1), std::max(m_bounds.Max.Z, c.Z + 1) };
+	}
+}
+
+void ClayEngine::VoxelRaycaster::Rebuild()
+{
+	m_cells.clear();
+	for (auto& element : m_grid->GetChunks())
+	{
+		auto bricks = summarise(*element.second);
+		if (bricks) m_cells[element.first] = { bricks, element.second };
+	}
+	updateBounds();
+}
+
+void ClayEngine::VoxelRaycaster::Update(const std::vector<VoxelCoord>& cells)
+{
+	for (auto& c : cells)
+	{
+		auto key = VoxelGrid::MakeChunkKey(c.X, c.Y, c.Z);
+		auto chunk = m_grid->GetChunk(c.X, c.Y, c.Z);
+		auto bricks = chunk ? summarise(*chunk) : 0;
+
+		if (bricks) m_cells[key] = { bricks, chunk };
+		else m_cells.erase(key);
+	}
+	updateBounds();
+}
+
+bool ClayEngine::VoxelRaycaster::castLevel(const VoxelRay& ray, const double (&direction)[3], int level, const int (&low)[3], const int (&high)[3], double t0, double t1, int entryAxis, const CellSummary* cell, VoxelRayHit& hit) const
+{
+	const auto shift = c_level_shift[level];
+	const auto size = static_cast<double>(1 << shift);
+
+	// Start in the cell holding the entry point, clamped into the parent so boundary rounding can't escape it
+	int c[3], step[3];
+	double tMax[3], tDelta[3];
+	for (auto i = 0; i < 3; ++i)
+	{
+		auto p = ray.Origin[i] + direction[i] * t0;
+		c[i] = std::min(std::max(static_cast<int>(std::floor(p / size)), low[i]), high[i]);
+		step[i] = direction[i] > 0. ? 1 : (direction[i] < 0. ? -1 : 0);
+		tMax[i] = step[i] > 0 ? ((c[i] + 1) * size - ray.Origin[i]) / direction[i] : (step[i] < 0 ? (c[i] * size - ray.Origin[i]) / direction[i] : c_infinity);
+		tDelta[i] = step[i] ? size / std::abs(direction[i]) : c_infinity;
+	}
+
+	auto t = t0;
+	for (;;)
+	{
+		auto exit = std::min(std::min(tMax[0], tMax[1]), tMax[2]);
+
+		switch (level)
+		{
+		case 0:
+		{
+			auto it = m_cells.find(VoxelGrid::MakeChunkKey(c[0], c[1], c[2]));
+			if (it == m_cells.end()) break;
+
+			const int childLow[3] = { c[0] << (shift - c_ray_brick_bits), c[1] << (shift - c_ray_brick_bits), c[2] << (shift - c_ray_brick_bits) };
+			const int childHigh[3] = { childLow[0] + (1 << (shift - c_ray_brick_bits)) - 1, childLow[1] + (1 << (shift - c_ray_brick_bits)) - 1, childLow[2] + (1 << (shift - c_ray_brick_bits)) - 1 };
+			if (castLevel(ray, direction, 1, childLow, childHigh, t, std::min(exit, t1), entryAxis, &it->second, hit)) return true;
+			break;
+		}
+		case 1:
+		{
+			if (!(cell->Bricks & (1ull << brickBit(c[0], c[1], c[2])))) break;
+
+			const int childLow[3] = { c[0] << shift, c[1] << shift, c[2] << shift };
+			const int childHigh[3] = { childLow[0] + (1 << shift) - 1, childLow[1] + (1 << shift) - 1, childLow[2] + (1 << shift) - 1 };
+			if (castLevel(ray, direction, 2, childLow, childHigh, t, std::min(exit, t1), entryAxis, cell, hit)) return true;
+			break;
+		}
+		default:
+		{
+			auto value = cell->Chunk->Get(c[0], c[1], c[2]);
+			if (IsVoxelEmpty(value)) break;
+
+			hit.Hit = true;
+			hit.Position = { c[0], c[1], c[2] };
+			hit.Cell = { c[0] >> c_voxel_chunk_bits, c[1] >> c_voxel_chunk_bits, c[2] >> c_voxel_chunk_bits };
+			hit.Voxel = { c[0] & c_voxel_chunk_mask, c[1] & c_voxel_chunk_mask, c[2] & c_voxel_chunk_mask };
+			if (entryAxis >= 0) hit.Normal[entryAxis] = direction[entryAxis] > 0. ? -1 : 1;
+			hit.Distance = t;
+			hit.Value = value;
+			return true;
+		}
+		}
+
+		auto axis = tMax[0] < tMax[1] ? (tMax[0] < tMax[2] ? 0 : 2) : (tMax[1] < tMax[2] ? 1 : 2);
+		if (tMax[axis] > t1) return false;
+
+		t = tMax[axis];
+		c[axis] += step[axis];
+		if (c[axis] < low[axis] || c[axis] > high[axis]) return false;
+		tMax[axis] += tDelta[axis];
+		entryAxis = axis;
+	}
+}
+
+bool ClayEngine::VoxelRaycaster::Cast(const VoxelRay& ray, VoxelRayHit& hit) const
+{
+	hit = {};
+	if (m_cells.empty()) return false;
+
+	double direction[3] = {};
+	if (!normalise(ray.Direction, direction)) return false;
+
+	// Clip the ray to the summarised cells so empty space past the edge of the world costs nothing
+	const double low[3] = { static_cast<double>(m_bounds.Min.X) * c_voxel_chunk_size, static_cast<double>(m_bounds.Min.Y) * c_voxel_chunk_size, static_cast<double>(m_bounds.Min.Z) * c_voxel_chunk_size };
+	const double high[3] = { static_cast<double>(m_bounds.Max.X) * c_voxel_chunk_size, static_cast<double>(m_bounds.Max.Y) * c_voxel_chunk_size, static_cast<double>(m_bounds.Max.Z) * c_voxel_chunk_size };
+
+	auto t0 = 0.;
+	auto t1 = ray.MaxDistance;
+	auto entryAxis = -1;
+	for (auto i = 0; i < 3; ++i)
+	{
+		if (direction[i] == 0.)
+		{
+			if (ray.Origin[i] < low[i] || ray.Origin[i] >= high[i]) return false;
+			continue;
+		}
+
+		auto a = (low[i] - ray.Origin[i]) / direction[i];
+		auto b = (high[i] - ray.Origin[i]) / direction[i];
+		if (a > b) std::swap(a, b);
+		if (a > t0)
+		{
+			t0 = a;
+			entryAxis = i;
+		}
+		t1 = std::min(t1, b);
+	}
+	if (t0 > t1) return false;
+
+	const int cellLow[3] = { m_bounds.Min.X, m_bounds.Min.Y, m_bounds.Min.Z };
+	const int cellHigh[3] = { m_bounds.Max.X - 1, m_bounds.Max.Y - 1, m_bounds.Max.Z - 1 };
+	return castLevel(ray, direction, 0, cellLow, cellHigh, t0, t1, entryAxis, nullptr, hit);
+}
+
+void ClayEngine::VoxelRaycaster::Cast(const VoxelRay* rays, size_t count, VoxelRayHit* hits) const
+{
+	auto jobs = (count + c_ray_batch_size - 1) / c_ray_batch_size;
+	auto job = [&](size_t index, size_t) {
+		auto end = std::min(count, (index + 1) * c_ray_batch_size);
+		for (auto i = index * c_ray_batch_size; i < end; ++i) Cast(rays[i], hits[i]);
+	};
+
+	if (m_pool) m_pool->ParallelFor(jobs, job);
+	else for (size_t i = 0; i < jobs; ++i) job(i, 0);
+}
+
+bool ClayEngine::VoxelRaycaster::HasLineOfSight(const double (&from)[3], const double (&to)[3]) const
+{
+	VoxelRay ray = {};
+	for (auto i = 0; i < 3; ++i)
+	{
+		ray.Origin[i] = from[i];
+		ray.Direction[i] = to[i] - from[i];
+	}
+	ray.MaxDistance = std::sqrt(ray.Direction[0] * ray.Direction[0] + ray.Direction[1] * ray.Direction[1] + ray.Direction[2] * ray.Direction[2]);
+	if (ray.MaxDistance <= 0.) return true;
+
+	VoxelRayHit hit = {};
+	if (!Cast(ray, hit)) return true;
+
+	// The target standing in (or being) a solid voxel doesn't block the view of itself
+	return hit.Position.X == static_cast<int>(std::floor(to[0])) && hit.Position.Y == static_cast<int>(std::floor(to[1])) && hit.Position.Z == static_cast<int>(std::floor(to[2]));
+}
+#pragma endregion
+
+ClayEngine::VoxelRaycastBenchmark ClayEngine::RunVoxelRaycastBenchmark(WorkerPoolRaw pool, size_t rayCount)
+{
+	VoxelRaycastBenchmark result = {};
+	result.RayCount = rayCount;
+	result.ThreadCount = pool ? pool->GetThreadCount() : 1;
+
+	// Rolling heightmap, mostly air above and solid below like a real map
+	VoxelGrid terrain;
+	for (auto z = 0; z < 256; ++z)
+		for (auto x = 0; x < 256; ++x)
+		{
+			auto h = static_cast<int>(24. + 10. * std::sin(x * .05) * std::cos(z * .04));
+			terrain.Fill({ { x, 0, z }, { x + 1, h, z + 1 } }, 1);
+		}
+
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<double> across(0., 256.);
+	std::uniform_real_distribution<double> spread(-1., 1.);
+
+	std::vector<VoxelRay> rays(rayCount);
+	for (auto& ray : rays)
+	{
+		ray.Origin[0] = across(rng);
+		ray.Origin[1] = 60.;
+		ray.Origin[2] = across(rng);
+		ray.Direction[0] = spread(rng);
+		ray.Direction[1] = -.25 - .75 * std::abs(spread(rng));
+		ray.Direction[2] = spread(rng);
+		ray.MaxDistance = 400.;
+	}
+
+	std::vector<VoxelRayHit> naive(rayCount), single(rayCount), batch(rayCount);
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < rayCount; ++i) castNaive(terrain, rays[i], naive[i]);
+	result.NaiveRaysPerSecond = PerSecond(rayCount, std::chrono::steady_clock::now() - start);
+
+	VoxelRaycaster caster(terrain, pool);
+
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < rayCount; ++i) caster.Cast(rays[i], single[i]);
+	result.SingleRaysPerSecond = PerSecond(rayCount, std::chrono::steady_clock::now() - start);
+
+	start = std::chrono::steady_clock::now();
+	caster.Cast(rays.data(), rayCount, batch.data());
+	result.BatchRaysPerSecond = PerSecond(rayCount, std::chrono::steady_clock::now() - start);
+
+	for (size_t i = 0; i < rayCount; ++i)
+	{
+		auto& a = naive[i];
+		auto& b = batch[i];
+		if (a.Hit != b.Hit || (a.Hit && (a.Position.X != b.Position.X || a.Position.Y != b.Position.Y || a.Position.Z != b.Position.Z))) ++result.Mismatches;
+	}
+
+	std::wstringstream wss;
+	wss << std::fixed << std::setprecision(2)
+		<< L"VoxelRaycast " << result.RayCount << L" rays"
+		<< L" | Naive " << result.NaiveRaysPerSecond / 1e6 << L" Mrays/sec"
+		<< L" | Hierarchical " << result.SingleRaysPerSecond / 1e6 << L" Mrays/sec"
+		<< L" | Batched " << result.ThreadCount << L" threads " << result.BatchRaysPerSecond / 1e6 << L" Mrays/sec"
+		<< L" | Mismatches " << result.Mismatches;
+	WriteLine(wss.str());
+
+	return result;
+}
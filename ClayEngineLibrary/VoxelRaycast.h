@@ -0,0 +1,120 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* Hierarchical 3D DDA ray traversal for picking and line of sight            */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "VoxelGrid.h"
+#include "WorkerPool.h"
+
+namespace ClayEngine
+{
+	constexpr auto c_ray_brick_bits{ 3 }; // 8^3 bricks, 64 per chunk, one bit each in the occupancy mask
+	constexpr auto c_ray_batch_size{ 64 }; // Rays per job in a batched cast
+
+	/// <summary>
+	/// Ray in voxel coordinates, Direction does not need to be normalised
+	/// </summary>
+	struct VoxelRay
+	{
+		double Origin[3] = {};
+		double Direction[3] = { 0., 0., 1. };
+		double MaxDistance = 1e9;
+	};
+
+	/// <summary>
+	/// What a ray struck, the engine's equivalent of VoxelFarm's VoxelHitInfo
+	/// </summary>
+	struct VoxelRayHit
+	{
+		bool Hit = false;
+		VoxelCoord Cell = {}; // Chunk coordinates of the cell that was hit
+		VoxelCoord Voxel = {}; // Voxel inside that cell, 0 to c_voxel_chunk_size - 1
+		VoxelCoord Position = {}; // Grid coordinates of the same voxel
+		int Normal[3] = {}; // Face the ray entered through, all zero when the ray started inside a solid voxel
+		double Distance = 0.; // Along the normalised direction from the origin to the entry point
+		uint32_t Value = c_voxel_empty;
+	};
+
+	/// <summary>
+	/// Casts rays against a VoxelGrid with an Amanatides-Woo DDA at three scales. Whole chunks are
+	/// stepped over when the grid has nothing there, 8^3 bricks are stepped over when their bit in the
+	/// chunk's occupancy mask is clear, and only bricks with something solid in them are walked a voxel
+	/// at a time. The masks are a summary of the grid, call Update with the cells an edit touched (or
+	/// Rebuild) before casting again. Casting is const and may run on many threads at once as long as
+	/// the grid isn't being edited.
+	/// </summary>
+	class VoxelRaycaster
+	{
+		struct CellSummary
+		{
+			uint64_t Bricks = 0; // Bit b set when brick b (Morton order, so words b * 512 to b * 512 + 511) has a solid voxel
+			VoxelChunkRaw Chunk = nullptr;
+		};
+
+		const VoxelGrid* m_grid = nullptr;
+		WorkerPoolRaw m_pool = nullptr;
+		std::unordered_map<VoxelGrid::ChunkKey, CellSummary> m_cells = {};
+		VoxelBox m_bounds = {}; // Chunk coordinates covering every summarised cell
+
+		static uint64_t summarise(const VoxelChunk& chunk);
+		void updateBounds();
+		bool castLevel(const VoxelRay& ray, const double (&direction)[3], int level, const int (&low)[3], const int (&high)[3], double t0, double t1, int entryAxis, const CellSummary* cell, VoxelRayHit& hit) const;
+
+	public:
+		VoxelRaycaster(const VoxelGrid& grid, WorkerPoolRaw pool = nullptr);
+		~VoxelRaycaster() = default;
+
+		VoxelRaycaster(const VoxelRaycaster&) = delete;
+		VoxelRaycaster& operator=(const VoxelRaycaster&) = delete;
+
+		/// <summary>
+		/// Summarises every chunk of the grid
+		/// </summary>
+		void Rebuild();
+		/// <summary>
+		/// Summarises only the given cells, e.g. the dirty cells of an edit
+		/// </summary>
+		void Update(const std::vector<VoxelCoord>& cells);
+
+		/// <summary>
+		/// Nearest solid voxel along ray within MaxDistance, returns hit.Hit
+		/// </summary>
+		bool Cast(const VoxelRay& ray, VoxelRayHit& hit) const;
+		/// <summary>
+		/// Casts count rays across the worker pool, hits[i] answers rays[i]
+		/// </summary>
+		void Cast(const VoxelRay* rays, size_t count, VoxelRayHit* hits) const;
+		/// <summary>
+		/// True when nothing solid lies between from and to, the voxel containing to is not tested
+		/// </summary>
+		bool HasLineOfSight(const double (&from)[3], const double (&to)[3]) const;
+
+		size_t GetCellCount() const { return m_cells.size(); }
+	};
+	using VoxelRaycasterPtr = std::unique_ptr<VoxelRaycaster>;
+
+	struct VoxelRaycastBenchmark
+	{
+		size_t RayCount = 0;
+		size_t ThreadCount = 0;
+		double NaiveRaysPerSecond = 0.; // Voxel by voxel DDA through VoxelGrid::GetVoxel
+		double SingleRaysPerSecond = 0.; // Hierarchical, one ray at a time on the calling thread
+		double BatchRaysPerSecond = 0.; // Hierarchical, batched across pool
+		size_t Mismatches = 0; // Rays where the naive and hierarchical hits differ, should be 0
+	};
+
+	/// <summary>
+	/// Casts rayCount random rays over a 256 x 64 x 256 heightmap from above the terrain and writes the
+	/// rays per second for each method to the console
+	/// </summary>
+	VoxelRaycastBenchmark RunVoxelRaycastBenchmark(WorkerPoolRaw pool, size_t rayCount = 1u << 16);
+}
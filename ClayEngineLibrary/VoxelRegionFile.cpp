@@ -0,0 +1,581 @@
+#include "pch.h"
+#include "VoxelRegionFile.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace ClayEngine;
+
+namespace
+{
+	constexpr uint32_t sectorsFor(size_t length)
+	{
+		return static_cast<uint32_t>((length + c_region_sector_size - 1) / c_region_sector_size);
+	}
+
+	constexpr uint64_t sectorOffset(uint32_t sector)
+	{
+		return static_cast<uint64_t>(sector) * c_region_sector_size;
+	}
+
+	/// <summary>
+	/// Parses "r.level.x.y.z.generation.cer" into its five fields
+	/// </summary>
+	bool parseRegionName(const std::string& name, int (&fields)[5])
+	{
+		if (name.compare(0, 2, "r.") != 0) return false;
+
+		auto cursor = name.c_str() + 2;
+		for (auto& field : fields)
+		{
+			char* end = nullptr;
+			auto value = strtol(cursor, &end, 10);
+			if (end == cursor || *end != '.') return false;
+
+			field = static_cast<int>(value);
+			cursor = end + 1;
+		}
+		return strcmp(cursor - 1, c_region_extension) == 0;
+	}
+}
+
+#pragma region Platform File Implementation
+/// <summary>
+/// Read/write handle on one region file. A retired file is deleted when the last reference to it
+/// goes away, which is after the last mapping (and so the last cell view) into it is released.
+/// </summary>
+struct ClayEngine::VoxelRegionFile::FileHandle
+{
+#if defined(_WIN32)
+	HANDLE Handle = INVALID_HANDLE_VALUE;
+#else
+	int Handle = -1;
+#endif
+	std::filesystem::path Path = {};
+	std::atomic<bool> Remove = false;
+
+	FileHandle(std::filesystem::path path) : Path(std::move(path))
+	{
+#if defined(_WIN32)
+		Handle = CreateFileW(Path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (Handle == INVALID_HANDLE_VALUE) throw std::runtime_error("ClayEngine::VoxelRegionFile CreateFileW() FAILED");
+#else
+		Handle = ::open(Path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		if (Handle < 0) throw std::runtime_error("ClayEngine::VoxelRegionFile open() FAILED");
+#endif
+	}
+
+	~FileHandle()
+	{
+#if defined(_WIN32)
+		CloseHandle(Handle);
+#else
+		::close(Handle);
+#endif
+		if (Remove)
+		{
+			std::error_code ec;
+			std::filesystem::remove(Path, ec);
+		}
+	}
+
+	uint64_t GetSize() const
+	{
+#if defined(_WIN32)
+		LARGE_INTEGER size = {};
+		if (!GetFileSizeEx(Handle, &size)) throw std::runtime_error("ClayEngine::VoxelRegionFile GetFileSizeEx() FAILED");
+		return static_cast<uint64_t>(size.QuadPart);
+#else
+		struct stat st = {};
+		if (fstat(Handle, &st) != 0) throw std::runtime_error("ClayEngine::VoxelRegionFile fstat() FAILED");
+		return static_cast<uint64_t>(st.st_size);
+#endif
+	}
+
+	void SetSize(uint64_t size)
+	{
+#if defined(_WIN32)
+		LARGE_INTEGER position = {};
+		position.QuadPart = static_cast<LONGLONG>(size);
+		if (!SetFilePointerEx(Handle, position, nullptr, FILE_BEGIN) || !SetEndOfFile(Handle)) throw std::runtime_error("ClayEngine::VoxelRegionFile SetEndOfFile() FAILED");
+#else
+		if (ftruncate(Handle, static_cast<off_t>(size)) != 0) throw std::runtime_error("ClayEngine::VoxelRegionFile ftruncate() FAILED");
+#endif
+	}
+
+	void WriteAt(uint64_t offset, const void* data, size_t size)
+	{
+		auto cursor = static_cast<const uint8_t*>(data);
+		while (size > 0)
+		{
+#if defined(_WIN32)
+			OVERLAPPED ov = {};
+			ov.Offset = static_cast<DWORD>(offset);
+			ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+			DWORD written = 0;
+			auto request = static_cast<DWORD>(std::min<size_t>(size, 0x40000000));
+			if (!WriteFile(Handle, cursor, request, &written, &ov) || written == 0) throw std::runtime_error("ClayEngine::VoxelRegionFile WriteFile() FAILED");
+#else
+			auto written = ::pwrite(Handle, cursor, size, static_cast<off_t>(offset));
+			if (written <= 0) throw std::runtime_error("ClayEngine::VoxelRegionFile pwrite() FAILED");
+#endif
+			cursor += written;
+			offset += static_cast<uint64_t>(written);
+			size -= static_cast<size_t>(written);
+		}
+	}
+
+	void Flush()
+	{
+#if defined(_WIN32)
+		FlushFileBuffers(Handle);
+#else
+		fsync(Handle);
+#endif
+	}
+};
+
+/// <summary>
+/// Read-only view of the whole file. Appends go through the file handle, both platforms keep the
+/// page cache coherent so a view sees data written after it was created as long as it is in range.
+/// </summary>
+struct ClayEngine::VoxelRegionFile::Mapping
+{
+	std::shared_ptr<FileHandle> File = nullptr;
+#if defined(_WIN32)
+	HANDLE Handle = nullptr;
+#endif
+	const uint8_t* Data = nullptr;
+	size_t Size = 0;
+
+	Mapping(std::shared_ptr<FileHandle> file, size_t size) : File(std::move(file)), Size(size)
+	{
+#if defined(_WIN32)
+		Handle = CreateFileMappingW(File->Handle, nullptr, PAGE_READONLY, static_cast<DWORD>(static_cast<uint64_t>(size) >> 32), static_cast<DWORD>(size), nullptr);
+		if (!Handle) throw std::runtime_error("ClayEngine::VoxelRegionFile CreateFileMappingW() FAILED");
+
+		Data = static_cast<const uint8_t*>(MapViewOfFile(Handle, FILE_MAP_READ, 0, 0, size));
+		if (!Data)
+		{
+			CloseHandle(Handle);
+			throw std::runtime_error("ClayEngine::VoxelRegionFile MapViewOfFile() FAILED");
+		}
+#else
+		auto p = mmap(nullptr, size, PROT_READ, MAP_SHARED, File->Handle, 0);
+		if (p == MAP_FAILED) throw std::runtime_error("ClayEngine::VoxelRegionFile mmap() FAILED");
+		Data = static_cast<const uint8_t*>(p);
+#endif
+	}
+
+	~Mapping()
+	{
+#if defined(_WIN32)
+		UnmapViewOfFile(Data);
+		CloseHandle(Handle);
+#else
+		munmap(const_cast<uint8_t*>(Data), Size);
+#endif
+	}
+};
+#pragma endregion
+
+#pragma region Voxel Region File Implementation
+ClayEngine::VoxelRegionFile::VoxelRegionFile(std::filesystem::path path, int level, int rx, int ry, int rz)
+	: m_path(std::move(path))
+{
+	m_file = std::make_shared<FileHandle>(m_path);
+
+	auto size = m_file->GetSize();
+	if (size == 0)
+	{
+		m_header.Level = level;
+		m_header.RegionX = rx;
+		m_header.RegionY = ry;
+		m_header.RegionZ = rz;
+
+		resize(c_region_grow_sectors);
+		m_file->WriteAt(0, &m_header, sizeof(m_header));
+		remap();
+		return;
+	}
+
+	if (size % c_region_sector_size || size < sectorOffset(c_region_first_data_sector)) throw std::runtime_error("ClayEngine::VoxelRegionFile file size is not sector aligned");
+
+	m_capacity = static_cast<uint32_t>(size / c_region_sector_size);
+	remap();
+
+	memcpy(&m_header, m_mapping->Data, sizeof(m_header));
+	if (m_header.Magic != c_region_magic || m_header.Version != c_region_version) throw std::runtime_error("ClayEngine::VoxelRegionFile header is not a region file");
+	if (m_header.Level != level || m_header.RegionX != rx || m_header.RegionY != ry || m_header.RegionZ != rz) throw std::runtime_error("ClayEngine::VoxelRegionFile header names a different region");
+	if (m_header.SectorCount < c_region_first_data_sector || m_header.SectorCount > m_capacity) throw std::runtime_error("ClayEngine::VoxelRegionFile sector count is corrupt");
+
+	memcpy(m_toc.data(), m_mapping->Data + c_region_sector_size, sizeof(m_toc));
+	for (const auto& entry : m_toc)
+	{
+		if (!entry.Sector) continue;
+		if (entry.Sector < c_region_first_data_sector || entry.Sector + sectorsFor(entry.Length) > m_header.SectorCount) throw std::runtime_error("ClayEngine::VoxelRegionFile TOC entry is corrupt");
+		m_live_sectors += sectorsFor(entry.Length);
+	}
+}
+
+ClayEngine::VoxelRegionFile::~VoxelRegionFile()
+{
+	m_mapping.reset();
+	m_file.reset();
+}
+
+void ClayEngine::VoxelRegionFile::writeAt(uint64_t offset, const void* data, size_t size)
+{
+	m_file->WriteAt(offset, data, size);
+}
+
+void ClayEngine::VoxelRegionFile::resize(uint32_t sectors)
+{
+	// Never shrinks, a live mapping may still cover the tail
+	if (sectors <= m_capacity) return;
+
+	m_file->SetSize(sectorOffset(sectors));
+	m_capacity = sectors;
+}
+
+void ClayEngine::VoxelRegionFile::remap()
+{
+	if (m_mapping && m_mapping->Size == sectorOffset(m_capacity)) return;
+
+	m_mapping = std::make_shared<Mapping>(m_file, static_cast<size_t>(sectorOffset(m_capacity)));
+}
+
+uint32_t ClayEngine::VoxelRegionFile::GetSlot(int x, int y, int z)
+{
+	constexpr auto mask = c_region_axis_cells - 1;
+	return static_cast<uint32_t>((x & mask) | ((y & mask) << c_region_axis_bits) | ((z & mask) << (c_region_axis_bits * 2)));
+}
+
+void ClayEngine::VoxelRegionFile::Write(uint32_t slot, const uint8_t* data, size_t size)
+{
+	if (slot >= c_region_cell_count) throw std::runtime_error("ClayEngine::VoxelRegionFile slot out of range");
+	if (!data || size == 0 || size > UINT32_MAX) throw std::runtime_error("ClayEngine::VoxelRegionFile cell data size is invalid");
+
+	LockGuard lock(m_write_mutex);
+
+	// The TOC entry waits for Flush to sync the data first, the disk may reorder unsynced writes, so a
+	// crash leaves stranded sectors rather than an entry pointing at missing data
+	auto sectors = sectorsFor(size);
+	auto first = m_header.SectorCount;
+	resize(((first + sectors + c_region_grow_sectors - 1) / c_region_grow_sectors) * c_region_grow_sectors);
+
+	writeAt(sectorOffset(first), data, size);
+
+	auto header = m_header;
+	header.SectorCount = first + sectors;
+	writeAt(0, &header, sizeof(header));
+
+	VoxelRegionTocEntry entry = { first, static_cast<uint32_t>(size) };
+
+	std::unique_lock<std::shared_mutex> toc(m_toc_mutex);
+	remap();
+	m_header = header;
+	m_live_sectors += sectors - sectorsFor(m_toc[slot].Length);
+	m_toc[slot] = entry;
+	m_dirty.set(slot);
+}
+
+bool ClayEngine::VoxelRegionFile::Erase(uint32_t slot)
+{
+	if (slot >= c_region_cell_count) throw std::runtime_error("ClayEngine::VoxelRegionFile slot out of range");
+
+	LockGuard lock(m_write_mutex);
+	if (!m_toc[slot].Sector) return false;
+
+	std::unique_lock<std::shared_mutex> toc(m_toc_mutex);
+	m_live_sectors -= sectorsFor(m_toc[slot].Length);
+	m_toc[slot] = {};
+	m_dirty.set(slot);
+	return true;
+}
+
+ClayEngine::VoxelRegionCellView ClayEngine::VoxelRegionFile::Read(uint32_t slot)
+{
+	if (slot >= c_region_cell_count) return {};
+
+	std::shared_lock<std::shared_mutex> lock(m_toc_mutex);
+	const auto& entry = m_toc[slot];
+	if (!entry.Sector) return {};
+
+	return { m_mapping, m_mapping->Data + sectorOffset(entry.Sector), entry.Length };
+}
+
+bool ClayEngine::VoxelRegionFile::Contains(uint32_t slot)
+{
+	if (slot >= c_region_cell_count) return false;
+
+	std::shared_lock<std::shared_mutex> lock(m_toc_mutex);
+	return m_toc[slot].Sector != 0;
+}
+
+void ClayEngine::VoxelRegionFile::Compact(std::filesystem::path path)
+{
+	LockGuard lock(m_write_mutex);
+
+	// Built under a temporary name and renamed once durable, a crash mid-compaction leaves the old generation intact
+	auto staging = path;
+	staging += ".tmp";
+
+	auto file = std::make_shared<FileHandle>(staging);
+	file->Remove = true;
+
+	VoxelRegionHeader header = m_header;
+	header.SectorCount = c_region_first_data_sector + m_live_sectors;
+	auto capacity = ((header.SectorCount + c_region_grow_sectors - 1) / c_region_grow_sectors) * c_region_grow_sectors;
+	file->SetSize(sectorOffset(capacity));
+
+	// Live cells are packed in slot order, readers keep using the old mapping meanwhile
+	std::array<VoxelRegionTocEntry, c_region_cell_count> toc = {};
+	auto next = c_region_first_data_sector;
+	for (uint32_t slot = 0; slot < c_region_cell_count; ++slot)
+	{
+		const auto& entry = m_toc[slot];
+		if (!entry.Sector) continue;
+
+		file->WriteAt(sectorOffset(next), m_mapping->Data + sectorOffset(entry.Sector), entry.Length);
+		toc[slot] = { next, entry.Length };
+		next += sectorsFor(entry.Length);
+	}
+
+	file->WriteAt(c_region_sector_size, toc.data(), sizeof(toc));
+	file->WriteAt(0, &header, sizeof(header));
+	file->Flush();
+
+	std::filesystem::rename(staging, path);
+	file->Path = path;
+	file->Remove = false;
+
+	auto mapping = std::make_shared<Mapping>(file, static_cast<size_t>(sectorOffset(capacity)));
+
+	std::unique_lock<std::shared_mutex> exclusive(m_toc_mutex);
+	m_file->Remove = true;
+	m_file = std::move(file);
+	m_mapping = std::move(mapping);
+	m_path = std::move(path);
+	m_header = header;
+	m_toc = toc;
+	m_capacity = capacity;
+	m_dirty.reset(); // The new file was written with the whole TOC and synced
+}
+
+double ClayEngine::VoxelRegionFile::GetDeadRatio()
+{
+	std::shared_lock<std::shared_mutex> lock(m_toc_mutex);
+
+	auto used = m_header.SectorCount - c_region_first_data_sector;
+	if (used == 0) return 0.0;
+	return static_cast<double>(used - m_live_sectors) / used;
+}
+
+void ClayEngine::VoxelRegionFile::Flush()
+{
+	LockGuard lock(m_write_mutex);
+	m_file->Flush();
+	if (m_dirty.none()) return;
+
+	// Entries go out in runs of adjacent dirty slots, cells written together usually sit together
+	for (uint32_t slot = 0; slot < c_region_cell_count;)
+	{
+		if (!m_dirty.test(slot))
+		{
+			++slot;
+			continue;
+		}
+
+		auto end = slot;
+		while (end < c_region_cell_count && m_dirty.test(end)) ++end;
+		writeAt(c_region_sector_size + slot * sizeof(VoxelRegionTocEntry), &m_toc[slot], (end - slot) * sizeof(VoxelRegionTocEntry));
+		slot = end;
+	}
+
+	m_file->Flush();
+	m_dirty.reset();
+}
+#pragma endregion
+
+#pragma region Voxel Region Store Implementation
+void ClayEngine::VoxelRegionCompactionFunctor::operator()(FUTURE future, VoxelRegionStore* store)
+{
+	while (future.wait_for(c_region_compaction_interval) == std::future_status::timeout)
+	{
+		store->Flush();
+		store->CompactRegions();
+	}
+}
+
+ClayEngine::VoxelRegionStore::VoxelRegionStore(std::filesystem::path directory, bool backgroundCompaction)
+	: m_directory(std::move(directory))
+{
+	std::filesystem::create_directories(m_directory);
+
+	// Keep the newest generation of each region, older generations and staging files are leftovers of an interrupted compaction
+	for (const auto& item : std::filesystem::directory_iterator(m_directory))
+	{
+		if (!item.is_regular_file()) continue;
+
+		auto name = item.path().filename().string();
+		if (item.path().extension() == ".tmp")
+		{
+			std::filesystem::remove(item.path());
+			continue;
+		}
+
+		int fields[5] = {};
+		if (!parseRegionName(name, fields) || fields[4] < 0) continue;
+
+		auto key = PackVoxelCellId(fields[0], fields[1], fields[2], fields[3]);
+		auto generation = static_cast<uint32_t>(fields[4]);
+		auto it = m_generations.find(key);
+		if (it == m_generations.end())
+		{
+			m_generations.emplace(key, generation);
+		}
+		else if (it->second < generation)
+		{
+			std::filesystem::remove(makePath(key, it->second));
+			it->second = generation;
+		}
+		else
+		{
+			std::filesystem::remove(item.path());
+		}
+	}
+
+	if (backgroundCompaction)
+	{
+		m_compaction_thread = THREAD{ VoxelRegionCompactionFunctor(), std::move(m_compaction_promise.get_future()), this };
+	}
+}
+
+ClayEngine::VoxelRegionStore::~VoxelRegionStore()
+{
+	if (m_compaction_thread.joinable())
+	{
+		m_compaction_promise.set_value();
+		m_compaction_thread.join();
+	}
+
+	Flush();
+}
+
+std::filesystem::path ClayEngine::VoxelRegionStore::makePath(RegionKey key, uint32_t generation) const
+{
+	int level = 0, rx = 0, ry = 0, rz = 0;
+	UnpackVoxelCellId(key, level, rx, ry, rz);
+
+	char name[96] = {};
+	snprintf(name, sizeof(name), "r.%d.%d.%d.%d.%u%s", level, rx, ry, rz, generation, c_region_extension);
+	return m_directory / name;
+}
+
+ClayEngine::VoxelRegionFilePtr ClayEngine::VoxelRegionStore::getRegion(VoxelCellId cell, bool create, uint32_t& slot)
+{
+	int level = 0, x = 0, y = 0, z = 0;
+	UnpackVoxelCellId(cell, level, x, y, z);
+
+	slot = VoxelRegionFile::GetSlot(x, y, z);
+	auto rx = x >> c_region_axis_bits;
+	auto ry = y >> c_region_axis_bits;
+	auto rz = z >> c_region_axis_bits;
+	auto key = PackVoxelCellId(level, rx, ry, rz);
+
+	LockGuard lock(m_regions_mutex);
+
+	auto it = m_regions.find(key);
+	if (it != m_regions.end()) return it->second;
+
+	auto generation = m_generations.find(key);
+	if (generation == m_generations.end())
+	{
+		if (!create) return nullptr;
+		generation = m_generations.emplace(key, 0).first;
+	}
+
+	auto region = std::make_shared<VoxelRegionFile>(makePath(key, generation->second), level, rx, ry, rz);
+	m_regions.emplace(key, region);
+	return region;
+}
+
+void ClayEngine::VoxelRegionStore::Write(VoxelCellId cell, const uint8_t* data, size_t size)
+{
+	uint32_t slot = 0;
+	getRegion(cell, true, slot)->Write(slot, data, size);
+}
+
+bool ClayEngine::VoxelRegionStore::Erase(VoxelCellId cell)
+{
+	uint32_t slot = 0;
+	auto region = getRegion(cell, false, slot);
+	return region ? region->Erase(slot) : false;
+}
+
+ClayEngine::VoxelRegionCellView ClayEngine::VoxelRegionStore::Read(VoxelCellId cell)
+{
+	uint32_t slot = 0;
+	auto region = getRegion(cell, false, slot);
+	return region ? region->Read(slot) : VoxelRegionCellView{};
+}
+
+bool ClayEngine::VoxelRegionStore::Contains(VoxelCellId cell)
+{
+	uint32_t slot = 0;
+	auto region = getRegion(cell, false, slot);
+	return region ? region->Contains(slot) : false;
+}
+
+size_t ClayEngine::VoxelRegionStore::CompactRegions(double threshold)
+{
+	std::vector<std::pair<RegionKey, VoxelRegionFilePtr>> candidates = {};
+	{
+		LockGuard lock(m_regions_mutex);
+		for (const auto& [key, region] : m_regions)
+		{
+			if (region->GetDeadRatio() >= threshold) candidates.emplace_back(key, region);
+		}
+	}
+
+	LockGuard compaction(m_compaction_mutex);
+	for (auto& [key, region] : candidates)
+	{
+		uint32_t generation = 0;
+		{
+			LockGuard lock(m_regions_mutex);
+			generation = m_generations[key] + 1;
+		}
+
+		// The new generation only counts once its file is in place, a failed Compact leaves the old one current
+		region->Compact(makePath(key, generation));
+
+		LockGuard lock(m_regions_mutex);
+		m_generations[key] = generation;
+	}
+
+	return candidates.size();
+}
+
+void ClayEngine::VoxelRegionStore::Flush()
+{
+	// Synced outside the map lock, so cells in other regions can still be looked up meanwhile
+	std::vector<VoxelRegionFilePtr> regions = {};
+	{
+		LockGuard lock(m_regions_mutex);
+		regions.reserve(m_regions.size());
+		for (const auto& [key, region] : m_regions) regions.push_back(region);
+	}
+
+	for (const auto& region : regions) region->Flush();
+}
+#pragma endregion
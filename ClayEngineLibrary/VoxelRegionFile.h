@@ -0,0 +1,210 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* Memory mapped region files for persistent voxel cells                      */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <array>
+#include <bitset>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <vector>
+
+#include "Services.h"
+
+namespace ClayEngine
+{
+	/// <summary>
+	/// Cell identifier in the same spirit as VoxelFarm's packCellId: 4 bits of level and 20 signed bits per axis
+	/// </summary>
+	using VoxelCellId = uint64_t;
+
+	constexpr VoxelCellId PackVoxelCellId(int level, int x, int y, int z)
+	{
+		return (static_cast<VoxelCellId>(level & 0xF) << 60)
+			| (static_cast<VoxelCellId>(x & 0xFFFFF) << 40)
+			| (static_cast<VoxelCellId>(y & 0xFFFFF) << 20)
+			| static_cast<VoxelCellId>(z & 0xFFFFF);
+	}
+
+	inline void UnpackVoxelCellId(VoxelCellId cell, int& level, int& x, int& y, int& z)
+	{
+		auto extend = [](VoxelCellId v) { return static_cast<int>(static_cast<int64_t>(v << 44) >> 44); };
+		level = static_cast<int>(cell >> 60);
+		x = extend(cell >> 40);
+		y = extend(cell >> 20);
+		z = extend(cell);
+	}
+
+	constexpr uint32_t c_region_magic{ 0x46524543 }; // "CERF"
+	constexpr uint32_t c_region_version{ 1 };
+	constexpr auto c_region_sector_size{ 4096u };
+	constexpr auto c_region_axis_bits{ 4 };
+	constexpr auto c_region_axis_cells{ 1 << c_region_axis_bits }; // 16 cells per axis per region
+	constexpr auto c_region_cell_count{ c_region_axis_cells * c_region_axis_cells * c_region_axis_cells };
+	constexpr auto c_region_toc_sectors{ (c_region_cell_count * 8u) / c_region_sector_size }; // 32KiB of TOC
+	constexpr auto c_region_first_data_sector{ 1u + c_region_toc_sectors };
+	constexpr auto c_region_grow_sectors{ 256u }; // Files grow 1MiB at a time so the mapping isn't rebuilt on every append
+	constexpr auto c_region_compaction_ratio{ 0.5 }; // Compact once half the data sectors are dead
+	constexpr auto c_region_compaction_interval{ std::chrono::seconds(30) }; // Also how often the background thread flushes
+	constexpr auto c_region_extension = ".cer";
+
+	struct VoxelRegionHeader
+	{
+		uint32_t Magic = c_region_magic;
+		uint32_t Version = c_region_version;
+		int32_t Level = 0;
+		int32_t RegionX = 0;
+		int32_t RegionY = 0;
+		int32_t RegionZ = 0;
+		uint32_t SectorCount = c_region_first_data_sector; // Sectors in use, header and TOC included
+		uint32_t Reserved = 0;
+	};
+
+	struct VoxelRegionTocEntry
+	{
+		uint32_t Sector = 0; // 0 means the cell isn't stored
+		uint32_t Length = 0; // Bytes, the cell occupies ceil(Length / sector size) sectors
+	};
+	static_assert(sizeof(VoxelRegionTocEntry) == 8, "The TOC is written to disk as-is");
+
+	class VoxelRegionFile;
+	using VoxelRegionFilePtr = std::shared_ptr<VoxelRegionFile>;
+
+	/// <summary>
+	/// Zero-copy view of a stored cell. The view keeps the mapping it points into alive, so it stays
+	/// valid across later appends, remaps and compaction of the region.
+	/// </summary>
+	struct VoxelRegionCellView
+	{
+		std::shared_ptr<const void> Mapping = nullptr;
+		const uint8_t* Data = nullptr;
+		size_t Size = 0;
+
+		explicit operator bool() const { return Data != nullptr; }
+	};
+
+	/// <summary>
+	/// One file holding 16^3 cells of a single level. Sector 0 is the header and the next eight
+	/// sectors are the TOC; cell data is appended on 4KiB boundaries and never rewritten in place.
+	/// Rewriting a cell strands its old sectors, Compact() copies the live cells into a fresh file.
+	/// Writes and erases are visible to Read at once but only reach the on-disk TOC in Flush, which
+	/// syncs the appended data first, so a crash loses the cells since the last Flush and nothing else.
+	/// </summary>
+	class VoxelRegionFile
+	{
+	public:
+		struct FileHandle;
+		struct Mapping;
+
+	private:
+		std::filesystem::path m_path = {};
+		VoxelRegionHeader m_header = {};
+		std::array<VoxelRegionTocEntry, c_region_cell_count> m_toc = {};
+
+		std::shared_ptr<FileHandle> m_file = nullptr;
+		std::shared_ptr<Mapping> m_mapping = nullptr;
+		uint32_t m_capacity = 0; // Sectors the file is currently sized to
+		uint32_t m_live_sectors = 0;
+		std::bitset<c_region_cell_count> m_dirty = {}; // Slots whose TOC entry hasn't been written to disk
+
+		MUTEX m_write_mutex = {}; // Serialises appends and compaction
+		std::shared_mutex m_toc_mutex = {}; // Readers share, TOC and mapping updates are exclusive
+
+		void writeAt(uint64_t offset, const void* data, size_t size);
+		void resize(uint32_t sectors);
+		void remap();
+
+	public:
+		/// <summary>
+		/// Opens the file at path, creating it for the given region if it doesn't exist
+		/// </summary>
+		VoxelRegionFile(std::filesystem::path path, int level, int rx, int ry, int rz);
+		~VoxelRegionFile();
+
+		VoxelRegionFile(const VoxelRegionFile&) = delete;
+		VoxelRegionFile& operator=(const VoxelRegionFile&) = delete;
+
+		static uint32_t GetSlot(int x, int y, int z);
+
+		/// <summary>
+		/// Appends the cell's data on a fresh sector run and points the in-memory TOC at it, any previous
+		/// data for the slot becomes dead space until the next compaction. Durable after the next Flush.
+		/// </summary>
+		void Write(uint32_t slot, const uint8_t* data, size_t size);
+		bool Erase(uint32_t slot);
+		VoxelRegionCellView Read(uint32_t slot);
+		bool Contains(uint32_t slot);
+
+		/// <summary>
+		/// Writes the live cells into a new file at path and switches over to it, the old file is deleted
+		/// once the last outstanding view into it is released
+		/// </summary>
+		void Compact(std::filesystem::path path);
+
+		/// <summary>
+		/// Fraction of data sectors that no longer belong to any cell
+		/// </summary>
+		double GetDeadRatio();
+		const std::filesystem::path& GetPath() const { return m_path; }
+		/// <summary>
+		/// Syncs the appended data, then writes the TOC entries changed since the last Flush and syncs again
+		/// </summary>
+		void Flush();
+	};
+
+	struct VoxelRegionCompactionFunctor
+	{
+		void operator()(FUTURE future, class VoxelRegionStore* store);
+	};
+
+	/// <summary>
+	/// Directory of region files keyed by (level, x, y, z) cells. Regions are opened on first use and a
+	/// background thread flushes them and compacts any region whose dead sector ratio passes
+	/// c_region_compaction_ratio. VoxelFarmThread loads cells from it before generating them and saves
+	/// what it generates.
+	/// </summary>
+	class VoxelRegionStore
+	{
+		using RegionKey = VoxelCellId; // PackVoxelCellId of the region coordinate
+		using RegionMap = std::map<RegionKey, VoxelRegionFilePtr>;
+		using GenerationMap = std::map<RegionKey, uint32_t>;
+
+		std::filesystem::path m_directory = {};
+
+		MUTEX m_regions_mutex = {};
+		RegionMap m_regions = {};
+		GenerationMap m_generations = {};
+		MUTEX m_compaction_mutex = {}; // One compaction pass at a time, a pass claims a generation only after Compact succeeds
+
+		THREAD m_compaction_thread;
+		PROMISE m_compaction_promise = {};
+
+		std::filesystem::path makePath(RegionKey key, uint32_t generation) const;
+		VoxelRegionFilePtr getRegion(VoxelCellId cell, bool create, uint32_t& slot);
+
+	public:
+		VoxelRegionStore(std::filesystem::path directory, bool backgroundCompaction = true);
+		~VoxelRegionStore();
+
+		void Write(VoxelCellId cell, const uint8_t* data, size_t size);
+		void Write(VoxelCellId cell, const std::vector<uint8_t>& data) { Write(cell, data.data(), data.size()); }
+		bool Erase(VoxelCellId cell);
+		VoxelRegionCellView Read(VoxelCellId cell);
+		bool Contains(VoxelCellId cell);
+
+		/// <summary>
+		/// Compacts every open region whose dead ratio is at least threshold, returns how many were rewritten
+		/// </summary>
+		size_t CompactRegions(double threshold = c_region_compaction_ratio);
+		void Flush();
+	};
+	using VoxelRegionStorePtr = std::unique_ptr<VoxelRegionStore>;
+}
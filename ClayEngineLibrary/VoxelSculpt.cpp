@@ -0,0 +1,350 @@
+#include "pch.h"
+#include "VoxelSculpt.h"
+#include "VoxelOctree.h"
+#include "Strings.h"
+#include "Benchmark.h"
+
+#include <immintrin.h>
+
+using namespace ClayEngine;
+
+namespace
+{
+	constexpr auto c_p = c_sculpt_tile;
+	constexpr auto c_pad = c_sculpt_pad;
+	constexpr auto c_iso = .5f;
+
+	size_t tileIndex(int x, int y, int z)
+	{
+		return (static_cast<size_t>(z) * c_p + y) * c_p + x;
+	}
+
+	/// <summary>
+	/// dst[i] = sum of weights[k] * src[i + (k - radius) * stride] over [begin, end). The tile is one
+	/// flat array, so stride 1, c_p and c_p^2 blur along x, y and z with the same loop; entries near
+	/// the padding pick up neighbouring rows but only the interior is ever read back.
+	/// </summary>
+	void convolveScalar(const float* src, float* dst, size_t begin, size_t end, ptrdiff_t stride, const float* weights, int radius)
+	{
+		for (auto i = begin; i < end; ++i)
+		{
+			auto acc = 0.f;
+			for (auto k = -radius; k <= radius; ++k) acc += weights[k + radius] * src[static_cast<ptrdiff_t>(i) + k * stride];
+			dst[i] = acc;
+		}
+	}
+
+	CLAY_TARGET_AVX2 void convolveAVX2(const float* src, float* dst, size_t begin, size_t end, ptrdiff_t stride, const float* weights, int radius)
+	{
+		auto i = begin;
+		for (; i + 8 <= end; i += 8)
+		{
+			// Same multiply then add order as the scalar loop, no FMA, so both kernels agree exactly
+			auto acc = _mm256_setzero_ps();
+			for (auto k = -radius; k <= radius; ++k)
+			{
+				auto w = _mm256_set1_ps(weights[k + radius]);
+				acc = _mm256_add_ps(acc, _mm256_mul_ps(w, _mm256_loadu_ps(src + static_cast<ptrdiff_t>(i) + k * stride)));
+			}
+			_mm256_storeu_ps(dst + i, acc);
+		}
+		convolveScalar(src, dst, i, end, stride, weights, radius);
+	}
+
+	/// <summary>
+	/// One row of the raise filter, dst[x] is src linearly sampled at (x, y - offsets[x], z)
+	/// </summary>
+	void raiseRowScalar(const float* src, float* dst, const float* offsets, int y, int z)
+	{
+		for (auto x = 0; x < c_p; ++x)
+		{
+			auto sy = static_cast<float>(y) - offsets[x];
+			auto fy = std::floor(sy);
+			auto t = sy - fy;
+			auto iy = std::min(std::max(static_cast<int>(fy), 0), c_p - 2);
+
+			auto a = src[tileIndex(x, iy, z)];
+			auto b = src[tileIndex(x, iy + 1, z)];
+			dst[tileIndex(x, y, z)] = a + (b - a) * t;
+		}
+	}
+
+	CLAY_TARGET_AVX2 void raiseRowAVX2(const float* src, float* dst, const float* offsets, int y, int z)
+	{
+		const auto lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		const auto low = _mm256_setzero_si256();
+		const auto high = _mm256_set1_epi32(c_p - 2);
+		const auto py = _mm256_set1_ps(static_cast<float>(y));
+		const auto plane = _mm256_set1_epi32(z * c_p);
+		const auto row = _mm256_set1_epi32(c_p);
+
+		auto x = 0;
+		for (; x + 8 <= c_p; x += 8)
+		{
+			auto sy = _mm256_sub_ps(py, _mm256_loadu_ps(offsets + x));
+			auto fy = _mm256_floor_ps(sy);
+			auto t = _mm256_sub_ps(sy, fy);
+			auto iy = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvttps_epi32(fy), low), high);
+
+			// Index of (x, iy, z) and the voxel above it, then gather both
+			auto index = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_add_epi32(plane, iy), row), _mm256_add_epi32(_mm256_set1_epi32(x), lanes));
+			auto a = _mm256_i32gather_ps(src, index, 4);
+			auto b = _mm256_i32gather_ps(src, _mm256_add_epi32(index, row), 4);
+			_mm256_storeu_ps(dst + tileIndex(x, y, z), _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), t)));
+		}
+
+		for (; x < c_p; ++x)
+		{
+			auto sy = static_cast<float>(y) - offsets[x];
+			auto fy = std::floor(sy);
+			auto t = sy - fy;
+			auto iy = std::min(std::max(static_cast<int>(fy), 0), c_p - 2);
+
+			auto a = src[tileIndex(x, iy, z)];
+			auto b = src[tileIndex(x, iy + 1, z)];
+			dst[tileIndex(x, y, z)] = a + (b - a) * t;
+		}
+	}
+}
+
+ClayEngine::VoxelSculptScratch::VoxelSculptScratch()
+{
+	Words.resize(c_sculpt_tile_volume);
+	Field.resize(c_sculpt_tile_volume);
+	Temp.resize(c_sculpt_tile_volume);
+	Offsets.resize(static_cast<size_t>(c_p) * c_p);
+}
+
+#pragma region Voxel Sculptor Implementation
+ClayEngine::VoxelSculptor::VoxelSculptor(WorkerPoolRaw pool)
+	: VoxelSculptor(pool, VoxelBatchCodec::DetectKernel())
+{
+
+}
+
+ClayEngine::VoxelSculptor::VoxelSculptor(WorkerPoolRaw pool, VoxelCodecKernel kernel)
+	: m_pool(pool)
+	, m_kernel(VoxelBatchCodec::ClampKernel(kernel))
+{
+	auto threads = m_pool ? m_pool->GetThreadCount() : 1;
+	for (size_t i = 0; i < threads; ++i) m_scratch.push_back(std::make_unique<VoxelSculptScratch>());
+}
+
+void ClayEngine::VoxelSculptor::loadTile(const VoxelGrid& grid, const VoxelBox& tile, VoxelSculptScratch& scratch) const
+{
+	// The full padded cube is read even for partial tiles, keeping one fixed layout for the kernels
+	VoxelCoord min = { tile.Min.X - c_pad, tile.Min.Y - c_pad, tile.Min.Z - c_pad };
+	grid.CopyTo({ min, { min.X + c_p, min.Y + c_p, min.Z + c_p } }, scratch.Words.data());
+
+	for (size_t i = 0; i < scratch.Words.size(); ++i) scratch.Field[i] = IsVoxelEmpty(scratch.Words[i]) ? 0.f : 1.f;
+}
+
+void ClayEngine::VoxelSculptor::storeTile(const VoxelSculptScratch& scratch, uint32_t material, bool shifted, Tile& tile) const
+{
+	const auto& words = scratch.Words;
+	const auto& field = scratch.Temp;
+
+	auto& box = tile.Box;
+	tile.Voxels.resize(box.Volume());
+
+	size_t i = 0;
+	for (auto z = 0; z < box.SizeZ(); ++z)
+		for (auto y = 0; y < box.SizeY(); ++y)
+			for (auto x = 0; x < box.SizeX(); ++x, ++i)
+			{
+				auto t = tileIndex(x + c_pad, y + c_pad, z + c_pad);
+				auto word = words[t];
+
+				// A raise carries the material along with the surface, the voxel comes from where it was sampled
+				auto source = word;
+				if (shifted)
+				{
+					auto offset = scratch.Offsets[static_cast<size_t>(z + c_pad) * c_p + (x + c_pad)];
+					auto sy = std::min(std::max(y + c_pad - static_cast<int>(std::lround(offset)), 0), c_p - 1);
+					source = words[tileIndex(x + c_pad, sy, z + c_pad)];
+				}
+
+				uint32_t value = c_voxel_empty;
+				if (field[t] > c_iso)
+				{
+					value = !IsVoxelEmpty(source) ? source : word;
+					if (IsVoxelEmpty(value))
+					{
+						// Newly solid, copy a face neighbour, the one below first so surfaces grow their top layer
+						const ptrdiff_t neighbours[6] = { -c_p, c_p, -1, 1, -c_p * c_p, c_p * c_p };
+						value = material;
+						for (auto n : neighbours)
+						{
+							auto candidate = words[static_cast<ptrdiff_t>(t) + n];
+							if (!IsVoxelEmpty(candidate))
+							{
+								value = candidate;
+								break;
+							}
+						}
+					}
+				}
+
+				tile.Voxels[i] = value;
+				if (value != word) ++tile.Changed;
+			}
+
+	if (!tile.Changed)
+	{
+		tile.Voxels.clear();
+		tile.Voxels.shrink_to_fit();
+	}
+}
+
+template<typename Filter>
+ClayEngine::VoxelSculptStats ClayEngine::VoxelSculptor::run(VoxelGrid& grid, const VoxelBox& box, Filter filter)
+{
+	VoxelSculptStats stats = {};
+	if (box.IsEmpty()) return stats;
+
+	// One tile per cell the box overlaps
+	std::vector<Tile> tiles = {};
+	for (auto cz = box.Min.Z >> c_voxel_chunk_bits; cz <= (box.Max.Z - 1) >> c_voxel_chunk_bits; ++cz)
+		for (auto cy = box.Min.Y >> c_voxel_chunk_bits; cy <= (box.Max.Y - 1) >> c_voxel_chunk_bits; ++cy)
+			for (auto cx = box.Min.X >> c_voxel_chunk_bits; cx <= (box.Max.X - 1) >> c_voxel_chunk_bits; ++cx)
+			{
+				VoxelCoord min = { cx * c_voxel_chunk_size, cy * c_voxel_chunk_size, cz * c_voxel_chunk_size };
+				Tile tile = {};
+				tile.Box = {
+					{ std::max(box.Min.X, min.X), std::max(box.Min.Y, min.Y), std::max(box.Min.Z, min.Z) },
+					{ std::min(box.Max.X, min.X + c_voxel_chunk_size), std::min(box.Max.Y, min.Y + c_voxel_chunk_size), std::min(box.Max.Z, min.Z + c_voxel_chunk_size) }
+				};
+				tiles.push_back(std::move(tile));
+			}
+	stats.Tiles = tiles.size();
+
+	auto job = [&](size_t index, size_t worker) {
+		auto& scratch = *m_scratch[worker];
+		loadTile(grid, tiles[index].Box, scratch);
+		filter(tiles[index], scratch);
+	};
+
+	if (m_pool) m_pool->ParallelFor(tiles.size(), job);
+	else for (size_t i = 0; i < tiles.size(); ++i) job(i, 0);
+
+	// Every tile has finished reading, so writing now can't leak one tile's result into another's input
+	for (auto& tile : tiles)
+	{
+		if (!tile.Changed) continue;
+
+		grid.CopyFrom(tile.Box, tile.Voxels.data());
+		stats.Voxels += tile.Changed;
+		stats.Cells.push_back({ tile.Box.Min.X >> c_voxel_chunk_bits, tile.Box.Min.Y >> c_voxel_chunk_bits, tile.Box.Min.Z >> c_voxel_chunk_bits });
+	}
+
+	return stats;
+}
+
+ClayEngine::VoxelSculptStats ClayEngine::VoxelSculptor::Smooth(VoxelGrid& grid, const VoxelBox& box, const VoxelSmoothSettings& settings)
+{
+	auto radius = std::min(std::max(settings.Radius, 0), c_sculpt_max_radius);
+
+	float weights[2 * c_sculpt_max_radius + 1] = {};
+	auto sum = 0.f;
+	for (auto k = -radius; k <= radius; ++k)
+	{
+		auto w = settings.Sigma > 0.f ? std::exp(-static_cast<float>(k * k) / (2.f * settings.Sigma * settings.Sigma)) : 1.f;
+		weights[k + radius] = w;
+		sum += w;
+	}
+	for (auto k = 0; k <= 2 * radius; ++k) weights[k] /= sum;
+
+	auto convolve = m_kernel == VoxelCodecKernel::AVX2 ? convolveAVX2 : convolveScalar;
+
+	return run(grid, box, [&](Tile& tile, VoxelSculptScratch& scratch) {
+		// x into Temp, y back into Field, z into Temp where storeTile reads it
+		const ptrdiff_t strides[3] = { 1, c_p, static_cast<ptrdiff_t>(c_p) * c_p };
+		float* buffers[2] = { scratch.Field.data(), scratch.Temp.data() };
+		for (auto axis = 0; axis < 3; ++axis)
+		{
+			auto margin = static_cast<size_t>(radius * strides[axis]);
+			convolve(buffers[axis & 1], buffers[(axis + 1) & 1], margin, c_sculpt_tile_volume - margin, strides[axis], weights, radius);
+		}
+
+		storeTile(scratch, settings.Material, false, tile);
+	});
+}
+
+ClayEngine::VoxelSculptStats ClayEngine::VoxelSculptor::Raise(VoxelGrid& grid, const VoxelBox& box, const VoxelRaiseSettings& settings)
+{
+	if (box.IsEmpty()) return {};
+
+	auto height = std::min(std::max(settings.Height, -c_sculpt_max_raise), c_sculpt_max_raise);
+	auto falloff = std::min(std::max(settings.Falloff, 1e-3f), 1.f);
+
+	const auto centreX = (box.Min.X + box.Max.X) * .5f;
+	const auto centreZ = (box.Min.Z + box.Max.Z) * .5f;
+	const auto halfX = box.SizeX() * .5f;
+	const auto halfZ = box.SizeZ() * .5f;
+
+	auto raiseRow = m_kernel == VoxelCodecKernel::AVX2 ? raiseRowAVX2 : raiseRowScalar;
+
+	return run(grid, box, [&](Tile& tile, VoxelSculptScratch& scratch) {
+		// Offset per column, full height in the middle easing to 0 over the outer Falloff of the box
+		for (auto pz = 0; pz < c_p; ++pz)
+			for (auto px = 0; px < c_p; ++px)
+			{
+				auto dx = std::abs(tile.Box.Min.X - c_pad + px + .5f - centreX) / halfX;
+				auto dz = std::abs(tile.Box.Min.Z - c_pad + pz + .5f - centreZ) / halfZ;
+				auto t = std::min(std::max((1.f - std::max(dx, dz)) / falloff, 0.f), 1.f);
+				scratch.Offsets[static_cast<size_t>(pz) * c_p + px] = height * t * t * (3.f - 2.f * t);
+			}
+
+		for (auto z = c_pad; z < c_pad + tile.Box.SizeZ(); ++z)
+			for (auto y = c_pad; y < c_pad + tile.Box.SizeY(); ++y)
+				raiseRow(scratch.Field.data(), scratch.Temp.data(), scratch.Offsets.data() + static_cast<size_t>(z) * c_p, y, z);
+
+		storeTile(scratch, settings.Material, true, tile);
+	});
+}
+#pragma endregion
+
+ClayEngine::VoxelSculptBenchmark ClayEngine::RunVoxelSculptBenchmark(WorkerPoolRaw pool, int size)
+{
+	VoxelSculptBenchmark result = {};
+
+	// Rolling terrain through the middle of the box so both tools have a surface to work on
+	VoxelGrid terrain;
+	VoxelBox box = { { 0, 0, 0 }, { size, size, size } };
+	for (auto z = 0; z < size; ++z)
+		for (auto x = 0; x < size; ++x)
+		{
+			auto h = static_cast<int>(size * (.5 + .15 * std::sin(x * .11) * std::cos(z * .07)));
+			terrain.Fill({ { x, 0, z }, { x + 1, h, z + 1 } }, h % 3 + 1u);
+		}
+	result.VoxelCount = box.Volume();
+
+	auto time = [&](VoxelSculptor& sculptor, bool raise) {
+		VoxelGrid grid;
+		grid.CopyRegion(terrain, box, box.Min);
+		auto start = std::chrono::steady_clock::now();
+		if (raise) sculptor.Raise(grid, box, { 4.f, .5f, 1 });
+		else sculptor.Smooth(grid, box, { 3, 1.5f, 1 });
+		return PerSecond(result.VoxelCount, std::chrono::steady_clock::now() - start);
+	};
+
+	VoxelSculptor scalar(nullptr, VoxelCodecKernel::Scalar);
+	result.ScalarSmoothVoxelsPerSecond = time(scalar, false);
+	result.ScalarRaiseVoxelsPerSecond = time(scalar, true);
+
+	VoxelSculptor batch(pool);
+	result.Kernel = batch.GetKernel();
+	result.ThreadCount = pool ? pool->GetThreadCount() : 1;
+	result.BatchSmoothVoxelsPerSecond = time(batch, false);
+	result.BatchRaiseVoxelsPerSecond = time(batch, true);
+
+	std::wstringstream wss;
+	wss << std::fixed << std::setprecision(2)
+		<< L"VoxelSculpt " << result.VoxelCount << L" voxels"
+		<< L" | Scalar 1 thread smooth " << result.ScalarSmoothVoxelsPerSecond / 1e6 << L" raise " << result.ScalarRaiseVoxelsPerSecond / 1e6 << L" Mvox/sec"
+		<< L" | " << VoxelBatchCodec::GetKernelName(result.Kernel) << L" " << result.ThreadCount << L" threads smooth " << result.BatchSmoothVoxelsPerSecond / 1e6
+		<< L" raise " << result.BatchRaiseVoxelsPerSecond / 1e6 << L" Mvox/sec";
+	WriteLine(wss.str());
+
+	return result;
+}
@@ -0,0 +1,125 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* Vectorised smoothing and raise filters for area sculpting tools            */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "VoxelBatchCodec.h"
+#include "VoxelGrid.h"
+#include "WorkerPool.h"
+
+namespace ClayEngine
+{
+	constexpr auto c_sculpt_max_radius{ 8 }; // Widest blur, also the padding read around every tile
+	constexpr auto c_sculpt_pad{ c_sculpt_max_radius + 1 };
+	constexpr auto c_sculpt_tile{ c_voxel_chunk_size + 2 * c_sculpt_pad }; // Padded tile edge
+	constexpr auto c_sculpt_tile_volume{ c_sculpt_tile * c_sculpt_tile * c_sculpt_tile };
+	constexpr auto c_sculpt_max_raise{ static_cast<float>(c_sculpt_pad - 1) }; // Largest offset one Raise can apply
+
+	struct VoxelSmoothSettings
+	{
+		int Radius = 2; // Clamped to c_sculpt_max_radius
+		float Sigma = 1.f; // Gaussian width in voxels, 0 or less for a box blur
+		uint32_t Material = 1; // For voxels that turn solid with no solid neighbour to copy
+	};
+
+	struct VoxelRaiseSettings
+	{
+		float Height = 1.f; // Voxels at the centre of the box move up by this much, negative lowers
+		float Falloff = 1.f; // Share of the half extent over which the offset fades to 0 at the box edge
+		uint32_t Material = 1;
+	};
+
+	struct VoxelSculptStats
+	{
+		size_t Tiles = 0;
+		size_t Voxels = 0; // Voxels whose value changed
+		std::vector<VoxelCoord> Cells = {}; // Cells that changed, for remeshing
+	};
+
+	/// <summary>
+	/// Per-thread working memory, one padded tile of the grid and two float fields over it
+	/// </summary>
+	struct VoxelSculptScratch
+	{
+		std::vector<uint32_t> Words = {};
+		std::vector<float> Field = {};
+		std::vector<float> Temp = {};
+		std::vector<float> Offsets = {}; // Raise, one per column of the tile
+
+		VoxelSculptScratch();
+	};
+	using VoxelSculptScratchPtr = std::unique_ptr<VoxelSculptScratch>;
+
+	/// <summary>
+	/// Area tools that filter the solid/air field of a box in a single pass. The field is 1 for solid
+	/// and 0 for air, so after filtering its distance from .5 approximates the signed distance to the
+	/// surface, the same iso the mesher extracts. The box is cut into tiles along the cell grid, each
+	/// tile is copied with c_sculpt_pad voxels of padding and filtered on its own worker with AVX2
+	/// kernels, then every changed cell is written back once. Tiles only read the grid while they
+	/// filter, so the result does not depend on the order they run in.
+	/// </summary>
+	class VoxelSculptor
+	{
+		WorkerPoolRaw m_pool = nullptr;
+		VoxelCodecKernel m_kernel = VoxelCodecKernel::Scalar;
+		std::vector<VoxelSculptScratchPtr> m_scratch = {};
+
+		struct Tile
+		{
+			VoxelBox Box = {};
+			std::vector<uint32_t> Voxels = {}; // Filtered result, empty when nothing changed
+			size_t Changed = 0;
+		};
+
+		template<typename Filter>
+		VoxelSculptStats run(VoxelGrid& grid, const VoxelBox& box, Filter filter);
+		void loadTile(const VoxelGrid& grid, const VoxelBox& tile, VoxelSculptScratch& scratch) const;
+		void storeTile(const VoxelSculptScratch& scratch, uint32_t material, bool shifted, Tile& tile) const;
+
+	public:
+		VoxelSculptor(WorkerPoolRaw pool = nullptr);
+		VoxelSculptor(WorkerPoolRaw pool, VoxelCodecKernel kernel);
+		~VoxelSculptor() = default;
+
+		VoxelSculptor(const VoxelSculptor&) = delete;
+		VoxelSculptor& operator=(const VoxelSculptor&) = delete;
+
+		/// <summary>
+		/// Separable Gaussian (or box) blur of the field inside box, rounding off edges and filling pits
+		/// </summary>
+		VoxelSculptStats Smooth(VoxelGrid& grid, const VoxelBox& box, const VoxelSmoothSettings& settings = {});
+		/// <summary>
+		/// Moves the field inside box up by an offset that is Height at the centre and fades out towards
+		/// the sides, sampling each column at y - offset
+		/// </summary>
+		VoxelSculptStats Raise(VoxelGrid& grid, const VoxelBox& box, const VoxelRaiseSettings& settings = {});
+
+		VoxelCodecKernel GetKernel() const { return m_kernel; }
+	};
+	using VoxelSculptorPtr = std::unique_ptr<VoxelSculptor>;
+
+	struct VoxelSculptBenchmark
+	{
+		size_t VoxelCount = 0;
+		size_t ThreadCount = 0;
+		double ScalarSmoothVoxelsPerSecond = 0.; // One thread, scalar kernels
+		double BatchSmoothVoxelsPerSecond = 0.; // Pool threads, detected kernels
+		double ScalarRaiseVoxelsPerSecond = 0.;
+		double BatchRaiseVoxelsPerSecond = 0.;
+		VoxelCodecKernel Kernel = VoxelCodecKernel::Scalar;
+	};
+
+	/// <summary>
+	/// Smooths and raises a size^3 box of rolling terrain with the scalar kernels on one thread and with
+	/// the detected kernels on pool's threads, and writes the voxels per second to the console
+	/// </summary>
+	VoxelSculptBenchmark RunVoxelSculptBenchmark(WorkerPoolRaw pool, int size = 128);
+}
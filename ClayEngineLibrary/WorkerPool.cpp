@@ -0,0 +1,113 @@
+#include "pch.h"
+#include "WorkerPool.h"
+
+using namespace ClayEngine;
+
+void ClayEngine::WorkerPoolFunctor::operator()(FUTURE future, WorkerPool* pool, size_t worker)
+{
+	uint64_t seen = 0;
+
+	while (future.wait_for(std::chrono::milliseconds(0)) == std::future_status::timeout)
+	{
+		if (!pool->waitForBatch(seen)) break;
+		pool->runBatch(worker);
+	}
+}
+
+ClayEngine::WorkerPool::WorkerPool(size_t threads)
+{
+	if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+	m_workers.resize(threads - 1);
+	for (size_t i = 0; i < m_workers.size(); ++i)
+	{
+		auto& element = m_workers[i];
+		element.Thread = THREAD{ WorkerPoolFunctor(), std::move(element.Promise.get_future()), this, i + 1 };
+	}
+}
+
+ClayEngine::WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<MUTEX> lock(m_mutex);
+		m_stopping = true;
+	}
+
+	for (auto& element : m_workers)
+	{
+		element.Promise.set_value();
+	}
+	m_wake.notify_all();
+
+	for (auto& element : m_workers)
+	{
+		if (element.Thread.joinable()) element.Thread.join();
+	}
+}
+
+bool ClayEngine::WorkerPool::waitForBatch(uint64_t& seen)
+{
+	std::unique_lock<MUTEX> lock(m_mutex);
+	m_wake.wait(lock, [&] { return m_stopping || m_batch != seen; });
+	if (m_stopping) return false;
+
+	seen = m_batch;
+	return true;
+}
+
+void ClayEngine::WorkerPool::runBatch(size_t worker)
+{
+	for (auto i = m_next.fetch_add(1); i < m_count; i = m_next.fetch_add(1))
+	{
+		try
+		{
+			(*m_job)(i, worker);
+		}
+		catch (...)
+		{
+			std::lock_guard<MUTEX> lock(m_mutex);
+			if (!m_error) m_error = std::current_exception();
+			m_next = m_count; // Abandon the rest of the batch
+		}
+	}
+
+	std::lock_guard<MUTEX> lock(m_mutex);
+	if (--m_running == 0) m_done.notify_all();
+}
+
+void ClayEngine::WorkerPool::ParallelFor(size_t count, const WorkerJob& job)
+{
+	if (count == 0) return;
+
+	LockGuard submit(m_submit_mutex);
+
+	// Small batches and single threaded pools aren't worth waking anyone for
+	if (m_workers.empty() || count == 1)
+	{
+		for (size_t i = 0; i < count; ++i) job(i, 0);
+		return;
+	}
+
+	{
+		std::lock_guard<MUTEX> lock(m_mutex);
+		m_job = &job;
+		m_count = count;
+		m_next = 0;
+		m_running = GetThreadCount();
+		m_error = nullptr;
+		++m_batch;
+	}
+	m_wake.notify_all();
+
+	runBatch(0);
+
+	std::exception_ptr error = nullptr;
+	{
+		std::unique_lock<MUTEX> lock(m_mutex);
+		m_done.wait(lock, [&] { return m_running == 0; });
+		m_job = nullptr;
+		error = m_error;
+	}
+
+	if (error) std::rethrow_exception(error);
+}
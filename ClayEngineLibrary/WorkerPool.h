@@ -0,0 +1,92 @@
+#pragma once
+/******************************************************************************/
+/*                                                                            */
+/* ClayEngineOSS (C) 2024 Elideus                                             */
+/* Fixed pool of worker threads for data parallel simulation passes          */
+/* https://github.com/elide-us                                                */
+/*                                                                            */
+/******************************************************************************/
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "Services.h"
+
+namespace ClayEngine
+{
+	/// <summary>
+	/// Job body, index is the item being processed and worker identifies the thread running it in the
+	/// range [0, GetThreadCount()), 0 being the thread that called ParallelFor. Use worker to pick
+	/// per-thread scratch space.
+	/// </summary>
+	using WorkerJob = std::function<void(size_t index, size_t worker)>;
+
+	class WorkerPool;
+
+	/// <summary>
+	/// This functor serves as the entry point for each pool thread
+	/// </summary>
+	struct WorkerPoolFunctor
+	{
+		void operator()(FUTURE future, WorkerPool* pool, size_t worker);
+	};
+
+	/// <summary>
+	/// Runs batches of independent jobs across a fixed set of threads, the calling thread joins in
+	/// and ParallelFor returns once every index has been processed, so a batch doubles as a barrier
+	/// between simulation phases.
+	/// </summary>
+	class WorkerPool
+	{
+		friend struct WorkerPoolFunctor;
+
+		struct WorkerThread
+		{
+			THREAD Thread;
+			PROMISE Promise = {};
+		};
+		using WorkerThreads = std::vector<WorkerThread>;
+
+		WorkerThreads m_workers = {};
+
+		MUTEX m_submit_mutex = {}; // One batch at a time
+		MUTEX m_mutex = {};
+		std::condition_variable m_wake = {};
+		std::condition_variable m_done = {};
+
+		const WorkerJob* m_job = nullptr;
+		size_t m_count = 0;
+		std::atomic<size_t> m_next = 0;
+		uint64_t m_batch = 0;
+		size_t m_running = 0;
+		bool m_stopping = false;
+		std::exception_ptr m_error = nullptr;
+
+		bool waitForBatch(uint64_t& seen);
+		void runBatch(size_t worker);
+
+	public:
+		/// <summary>
+		/// threads is the total including the caller, 0 uses one per hardware thread
+		/// </summary>
+		WorkerPool(size_t threads = 0);
+		~WorkerPool();
+
+		WorkerPool(const WorkerPool&) = delete;
+		WorkerPool& operator=(const WorkerPool&) = delete;
+
+		/// <summary>
+		/// Calls job(index, worker) for every index in [0, count) and blocks until all have returned. The
+		/// first exception thrown by a job is rethrown here. Not reentrant, jobs must not call ParallelFor.
+		/// </summary>
+		void ParallelFor(size_t count, const WorkerJob& job);
+
+		size_t GetThreadCount() const { return m_workers.size() + 1; }
+	};
+	using WorkerPoolPtr = std::unique_ptr<WorkerPool>;
+	using WorkerPoolRaw = WorkerPool*;
+}